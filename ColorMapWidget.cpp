@@ -68,11 +68,30 @@ ColorMapWidget::ColorMapWidget(const struct model_error *model1_error,
   histogram = NULL;
   scaleState = LIN_SCALE;
   colorState = HSV;
-  dmax = me->max_error;
-  dmin = me->min_error;
+  errorRange(me,&dmin,&dmax);
   cmap_len = -1;
 }
 
+void ColorMapWidget::errorRange(const struct model_error *me, double *emin,
+                                double *emax) {
+  if (me->is_signed) {
+    *emax = (-me->min_error > me->max_error) ? -me->min_error : me->max_error;
+    *emin = -*emax;
+  } else {
+    *emin = me->min_error;
+    *emax = me->max_error;
+  }
+}
+
+float** ColorMapWidget::newColorMap(colorSpace cs, bool is_signed, int len) {
+  if (cs == HSV)
+    return is_signed ? colormap_signed(len) : colormap_hsv(len);
+  else if (cs == GRAYSCALE)
+    return colormap_gs(len);
+  fprintf(stderr, "Invalid color space specified\n");
+  return NULL;
+}
+
 QSize ColorMapWidget::sizeHint() const {
   return QSize(75,512);
 }
@@ -100,8 +119,8 @@ void ColorMapWidget::doHistogram(int scaleType) {
   memset(histogram, 0, sizeof(*histogram)*len);
 
   n = me->n_samples;
-  drange = me->max_error - me->min_error;
-  off = me->min_error;
+  drange = dmax - dmin;
+  off = dmin;
   serror = me->fe[0].serror;
   for (i=0; i<n; i++) {
     bin_idx = (int) ((serror[i]-off)/drange*len);
@@ -136,13 +155,7 @@ void ColorMapWidget::setColorMap(int newSpace) {
   if (colorState != newSpace) {
     colorState = (colorSpace)newSpace;
     free_colormap(colormap);
-
-    if (colorState == HSV)
-      colormap = colormap_hsv(cmap_len);
-    else if (colorState == GRAYSCALE)
-      colormap = colormap_gs(cmap_len);
-    else 
-      fprintf(stderr, "Invalid color space specified\n");
+    colormap = newColorMap(colorState,me->is_signed != 0,cmap_len);
     doHistogram(scaleState);
   }
 }
@@ -177,13 +190,7 @@ void ColorMapWidget::paintEvent(QPaintEvent *) {
   if (cmap_len != h) {
     free_colormap(colormap);
     cmap_len = h;
-    if (colorState == HSV)
-      colormap = colormap_hsv(cmap_len);
-    else if (colorState == GRAYSCALE)
-      colormap = colormap_gs(cmap_len);
-    else 
-      fprintf(stderr, "Invalid color space specified\n");
-
+    colormap = newColorMap(colorState,me->is_signed != 0,cmap_len);
     doHistogram(scaleState);
   }
   p.drawText(40, yoff+ysub, tmpDisplayedText.sprintf( "%.3f",dmax/scale));
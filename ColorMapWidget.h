@@ -76,6 +76,13 @@ public:
  QSize minimumSizeHint() const;
  enum scaleMode {LIN_SCALE=0, LOG_SCALE=1};
  enum colorSpace {GRAYSCALE, HSV};
+ // Range of the errors of me mapped to the colormap, centered on zero if
+ // the errors are signed
+ static void errorRange(const struct model_error *me, double *emin,
+                        double *emax);
+ // New colormap of len entries for the color space cs, the two-sided one
+ // replacing HSV for signed errors
+ static float **newColorMap(colorSpace cs, bool is_signed, int len);
 
 public slots:
   void doHistogram(int scaleType);
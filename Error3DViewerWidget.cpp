@@ -57,14 +57,17 @@ Error3DViewerWidget::Error3DViewerWidget(struct model_error *model_err,
 					 const char *name)
   : Basic3DViewerWidget(model_err->mesh, parent, name), no_err_value(0.25)
 {
+  model = model_err;
+  ColorMapWidget::errorRange(model,&emin,&emax);
+
   // Build the colormap used to display the mean error onto the surface of
   // the model
   csp = ColorMapWidget::HSV;
-  colormap = colormap_hsv(CMAP_LENGTH);
+  colormap = ColorMapWidget::newColorMap(csp,model->is_signed != 0,
+                                         CMAP_LENGTH);
 
   error_mode = VERTEX_ERROR;
 
-  model = model_err;
   texture_enabled = tex_enabled;
 
   // Initialize the state
@@ -131,12 +134,8 @@ void Error3DViewerWidget::setColorMap(int newSpace)
   if (newSpace != csp) {
     csp = (ColorMapWidget::colorSpace)newSpace;
     free(colormap);
-    if (csp == ColorMapWidget::HSV)
-      colormap = colormap_hsv(CMAP_LENGTH);
-    else if (csp == ColorMapWidget::GRAYSCALE)
-      colormap = colormap_gs(CMAP_LENGTH);
-    else
-      fprintf(stderr, "Invalid color space specified\n");
+    colormap = ColorMapWidget::newColorMap(csp,model->is_signed != 0,
+                                           CMAP_LENGTH);
     if (error_mode != SAMPLE_ERROR) {
       makeCurrent();
       // display wait cursor while rebuilding list (useful for n=1 only)
@@ -303,7 +302,7 @@ int Error3DViewerWidget::fillTexture(const struct face_error *fe,
     return 1;
   } else {
     sz = 1<<ceilLog2(n);
-    drange = model->max_error - model->min_error;
+    drange = emax - emin;
     if (drange < FLT_MIN*100) drange = 1;
     for (i2=-1, k=0; i2<=sz; i2++) {
       i = (i2 >= 0) ? ((i2 < sz) ? i2 : sz-1) : 0;
@@ -311,7 +310,7 @@ int Error3DViewerWidget::fillTexture(const struct face_error *fe,
         j = (j2 >= 0) ? ((j2 < sz) ? j2 : sz-1) : 0;
         if (i<n && j<(n-i)) { /* sample point */
           cidx = (int) (CMAP_LENGTH*(fe->serror[j+i*(2*n-i+1)/2]-
-                                     model->min_error)/drange);
+                                     emin)/drange);
           if (cidx >= CMAP_LENGTH) cidx = CMAP_LENGTH-1;
           r = (GLubyte) (255*colormap[cidx][0]);
           g = (GLubyte) (255*colormap[cidx][1]);
@@ -321,7 +320,7 @@ int Error3DViewerWidget::fillTexture(const struct face_error *fe,
           e1 = (i>0 && j>0) ? fe->serror[(j-1)+(i-1)*(2*n-(i-1)+1)/2] : 0;
           e2 = (j>0) ? fe->serror[(j-1)+i*(2*n-i+1)/2] : 0;
           e3 = (i>0) ? fe->serror[j+(i-1)*(2*n-(i-1)+1)/2] : 0;
-          cidx = (int) (CMAP_LENGTH*(e2+e3-e1-model->min_error)/drange);
+          cidx = (int) (CMAP_LENGTH*(e2+e3-e1-emin)/drange);
           if (cidx < 0) {
             cidx = 0;
           } else if (cidx >= CMAP_LENGTH) {
@@ -360,9 +359,9 @@ void Error3DViewerWidget::setGLColorForError(float error) const
   int cidx;
   float mine,drange;
 
-  mine = model->min_error;
+  mine = (float)emin;
   if (error >= mine) {
-    drange = model->max_error-model->min_error;
+    drange = (float)(emax-emin);
     cidx = (int) (CMAP_LENGTH*(error-mine)/drange);
     if (cidx >= CMAP_LENGTH) cidx = CMAP_LENGTH-1;
     glColor3fv(colormap[cidx]);
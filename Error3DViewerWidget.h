@@ -94,6 +94,7 @@ private:
   float **colormap;
   ColorMapWidget::colorSpace csp;
   struct model_error *model;
+  double emin, emax; // range of the errors mapped to the colormap
   GLuint *etex_id; // texture IDs for per triangle sample error
   int *etex_sz;    // texture size for each of etex_id textures
   const GLfloat no_err_value; // gray value for when there is no error for
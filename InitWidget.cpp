@@ -284,14 +284,23 @@ void InitWidget::meshSetUp() {
 
 // Should only be called after meshSetUp
 void InitWidget::meshRun() {
-  QProgressDialog qProg("Calculating distance",0,100);
+  QProgressDialog qProg("Calculating distance","Cancel",100);
   struct prog_reporter pr;
   
   qProg.setIcon(*qpxMeshIcon);
   qProg.setMinimumDuration(1500);
+  memset(&pr,0,sizeof(pr));
   pr.prog = QT_prog;
   pr.cb_out = &qProg;
-  mesh_run(&pargs,model1,model2, log, &pr);
+  if (mesh_run(&pargs,model1,model2, log, &pr) != 0) {
+    // Cancelled or failed, the models are already freed. Let the user start
+    // again.
+    outbuf_flush(log);
+    outbuf_delete(log);
+    log = NULL;
+    show();
+    return;
+  }
   outbuf_flush(log);
   c = new ScreenWidget(model1, model2, &pargs);
   c->setIcon(*qpxMeshIcon);
@@ -301,10 +310,11 @@ void InitWidget::meshRun() {
   c->show();
 }
 
-void QT_prog(void *out, int p) {
+int QT_prog(void *out, int p) {
   QProgressDialog *qpd;
   qpd = (QProgressDialog*)out;
   qpd->setProgress(p<0 ? qpd->totalSteps() : p );
   qApp->processEvents();
+  return qpd->wasCancelled();
 }
 
@@ -90,7 +90,7 @@ private:
 };
 
 extern "C" {
-  void QT_prog(void *out, int p);
+  int QT_prog(void *out, int p);
 }
 
 #endif
@@ -114,6 +114,10 @@ SOURCE=.\compute_error.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\lib3d\src\edge_table.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\Error3DViewerWidget.cpp
 # End Source File
 # Begin Source File
@@ -134,6 +138,14 @@ SOURCE=.\mesh.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\mesh_batch.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\mesh_output.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\mesh_run.c
 # End Source File
 # Begin Source File
@@ -202,6 +214,14 @@ SOURCE=.\TextWidget.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\lib3d\src\thread_pool.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\timing.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\xalloc.c
 # End Source File
 # End Group
@@ -292,6 +312,10 @@ SOURCE=.\compute_error.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\lib3d\include\edge_table.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\Error3DViewerWidget.h
 
 !IF  "$(CFG)" == "Mesh - Win32 Release"
@@ -399,6 +423,14 @@ SOURCE=.\mesh.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\mesh_batch.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\mesh_output.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\mesh_run.h
 # End Source File
 # Begin Source File
@@ -456,6 +488,14 @@ SOURCE=.\TextWidget.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\lib3d\include\thread_pool.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\timing.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\xalloc.h
 # End Source File
 # End Group
@@ -0,0 +1,807 @@
+/* $Id$ */
+
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+
+
+
+
+
+/*
+ * mesh_bench: benchmark of the model readers and of the stages of the
+ * distance calculation, on synthetic models of controlled size and
+ * density. The timings can be compared to those of a baseline file, so
+ * that slowdowns are flagged.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <3dmodel.h>
+#include <xalloc.h>
+#include <geomutils.h>
+#include <model_analysis.h>
+#include <compute_error.h>
+#include <mesh_run.h>
+#include <timing.h>
+
+/* Maximum number of timings */
+#define BENCH_MAX_RESULTS 128
+
+/* Maximum length of a timing name */
+#define BENCH_KEY_MAX 64
+
+/* Timing differences below this (in seconds) are never flagged, as they
+ * are mostly noise. */
+#define BENCH_MIN_DIFF 0.01
+
+/* Number of doubles in the array of the calibration loop (8 MB, so that
+ * it does not fit in the cache, like the models) */
+#define BENCH_CALIB_SIZE (1<<20)
+
+/* Name of the calibration loop timing */
+#define BENCH_CALIB_KEY "all.calibration"
+
+/* The result of the calibration loop, so that it is not optimized away */
+static volatile double calib_sink;
+
+/* --------------------------------------------------------------------------*
+ *                       Local data types                                    *
+ * --------------------------------------------------------------------------*/
+
+/* A set of named timings */
+struct bench_results {
+  char key[BENCH_MAX_RESULTS][BENCH_KEY_MAX]; /* The timing names */
+  double t[BENCH_MAX_RESULTS];                /* The timings, in seconds */
+  int n;                                      /* The number of timings */
+};
+
+/* Lattice of vertices on the surface of a box, to generate models */
+struct box_lattice {
+  int n[3];       /* The number of quads along the X, Y and Z axis */
+  int *vidx;      /* The model vertex index of each lattice point, -1 if
+                   * not yet created */
+  dvertex_t c;    /* The center of the box */
+  dvertex_t h;    /* The half size of the box along each axis */
+  int on_sphere;  /* If non-zero the points are projected on the sphere of
+                   * radius h.x */
+};
+
+/* A synthetic data set: a pair of models */
+struct bench_data {
+  const char *name;   /* The name of the data set */
+  struct model *m1;   /* Model 1 (coarser and perturbed) */
+  struct model *m2;   /* Model 2 */
+};
+
+/* --------------------------------------------------------------------------*
+ *                       Model generators                                    *
+ * --------------------------------------------------------------------------*/
+
+/* Appends the vertices and faces of m2 to m */
+static void append_model(struct model *m, const struct model *m2)
+{
+  int i;
+
+  m->vertices = xa_realloc(m->vertices,
+                           (m->num_vert+m2->num_vert)*sizeof(*(m->vertices)));
+  m->faces = xa_realloc(m->faces,
+                        (m->num_faces+m2->num_faces)*sizeof(*(m->faces)));
+  memcpy(m->vertices+m->num_vert,m2->vertices,
+         m2->num_vert*sizeof(*(m->vertices)));
+  for (i=0; i<m2->num_faces; i++) {
+    m->faces[m->num_faces+i].f0 = m2->faces[i].f0+m->num_vert;
+    m->faces[m->num_faces+i].f1 = m2->faces[i].f1+m->num_vert;
+    m->faces[m->num_faces+i].f2 = m2->faces[i].f2+m->num_vert;
+  }
+  m->num_vert += m2->num_vert;
+  m->num_faces += m2->num_faces;
+}
+
+/* Returns a new empty model */
+static struct model *new_model(void)
+{
+  return xa_calloc(1,sizeof(struct model));
+}
+
+/* Computes the bounding box of m */
+static void set_bbox(struct model *m)
+{
+  int i;
+  vertex_t *v;
+
+  m->bBox[0].x = m->bBox[0].y = m->bBox[0].z = FLT_MAX;
+  m->bBox[1].x = m->bBox[1].y = m->bBox[1].z = -FLT_MAX;
+  for (i=0; i<m->num_vert; i++) {
+    v = &(m->vertices[i]);
+    if (v->x < m->bBox[0].x) m->bBox[0].x = v->x;
+    if (v->y < m->bBox[0].y) m->bBox[0].y = v->y;
+    if (v->z < m->bBox[0].z) m->bBox[0].z = v->z;
+    if (v->x > m->bBox[1].x) m->bBox[1].x = v->x;
+    if (v->y > m->bBox[1].y) m->bBox[1].y = v->y;
+    if (v->z > m->bBox[1].z) m->bBox[1].z = v->z;
+  }
+}
+
+/* Returns the index in m of the vertex at lattice point l of bl, creating
+ * it if necessary. */
+static int lattice_vertex(struct model *m, struct box_lattice *bl,
+                          const int *l)
+{
+  int lin,k;
+  double t[3],len;
+
+  lin = l[0]+(bl->n[0]+1)*(l[1]+(bl->n[1]+1)*l[2]);
+  if (bl->vidx[lin] >= 0) return bl->vidx[lin];
+  for (k=0; k<3; k++) {
+    t[k] = 2.0*l[k]/bl->n[k]-1;
+  }
+  if (bl->on_sphere) { /* equiangular cube to sphere projection */
+    for (k=0; k<3; k++) t[k] = tan(t[k]*M_PI_4);
+    len = sqrt(t[0]*t[0]+t[1]*t[1]+t[2]*t[2]);
+    for (k=0; k<3; k++) t[k] /= len;
+    m->vertices[m->num_vert].x = (float)(bl->c.x+bl->h.x*t[0]);
+    m->vertices[m->num_vert].y = (float)(bl->c.y+bl->h.x*t[1]);
+    m->vertices[m->num_vert].z = (float)(bl->c.z+bl->h.x*t[2]);
+  } else {
+    m->vertices[m->num_vert].x = (float)(bl->c.x+bl->h.x*t[0]);
+    m->vertices[m->num_vert].y = (float)(bl->c.y+bl->h.y*t[1]);
+    m->vertices[m->num_vert].z = (float)(bl->c.z+bl->h.z*t[2]);
+  }
+  bl->vidx[lin] = m->num_vert++;
+  return bl->vidx[lin];
+}
+
+/* Returns a new closed model of the surface of the box centered at c, with
+ * half sizes h, divided in nx, ny and nz quads along each axis (each split
+ * in two triangles). If on_sphere is non-zero, the vertices are projected
+ * on the sphere centered at c and of radius h->x, which gives an almost
+ * uniform sphere triangulation for equal nx, ny and nz. */
+static struct model *gen_box(const dvertex_t *c, const dvertex_t *h,
+                             int nx, int ny, int nz, int on_sphere)
+{
+  struct model *m;
+  struct box_lattice bl;
+  int a,b,d,side,p,q,n_lat,i;
+  int l[3],v00,v10,v11,v01;
+
+  m = new_model();
+  bl.n[0] = nx;
+  bl.n[1] = ny;
+  bl.n[2] = nz;
+  bl.c = *c;
+  bl.h = *h;
+  bl.on_sphere = on_sphere;
+  n_lat = (nx+1)*(ny+1)*(nz+1);
+  bl.vidx = xa_malloc(n_lat*sizeof(*(bl.vidx)));
+  for (i=0; i<n_lat; i++) bl.vidx[i] = -1;
+  m->vertices = xa_malloc((n_lat-(nx-1)*(ny-1)*(nz-1))*
+                          sizeof(*(m->vertices)));
+  m->faces = xa_malloc(4*(nx*ny+ny*nz+nz*nx)*sizeof(*(m->faces)));
+  for (a=0; a<3; a++) {
+    b = (a+1)%3;
+    d = (a+2)%3;
+    for (side=0; side<=bl.n[a]; side+=bl.n[a]) {
+      l[a] = side;
+      for (p=0; p<bl.n[b]; p++) {
+        for (q=0; q<bl.n[d]; q++) {
+          l[b] = p; l[d] = q;
+          v00 = lattice_vertex(m,&bl,l);
+          l[b] = p+1;
+          v10 = lattice_vertex(m,&bl,l);
+          l[d] = q+1;
+          v11 = lattice_vertex(m,&bl,l);
+          l[b] = p;
+          v01 = lattice_vertex(m,&bl,l);
+          /* e_b x e_d is e_a, so reverse on the negative side */
+          if (side != 0) {
+            m->faces[m->num_faces].f0 = v00;
+            m->faces[m->num_faces].f1 = v10;
+            m->faces[m->num_faces++].f2 = v11;
+            m->faces[m->num_faces].f0 = v00;
+            m->faces[m->num_faces].f1 = v11;
+            m->faces[m->num_faces++].f2 = v01;
+          } else {
+            m->faces[m->num_faces].f0 = v00;
+            m->faces[m->num_faces].f1 = v11;
+            m->faces[m->num_faces++].f2 = v10;
+            m->faces[m->num_faces].f0 = v00;
+            m->faces[m->num_faces].f1 = v01;
+            m->faces[m->num_faces++].f2 = v11;
+          }
+        }
+      }
+    }
+  }
+  free(bl.vidx);
+  set_bbox(m);
+  return m;
+}
+
+/* Returns a new sphere model centered at c, of radius r, with about
+ * 12*n*n triangles of almost uniform size. */
+static struct model *gen_sphere(const dvertex_t *c, double r, int n)
+{
+  dvertex_t h;
+
+  h.x = h.y = h.z = r;
+  return gen_box(c,&h,n,n,n,1);
+}
+
+/* Returns a new torus model centered at the origin, around the Z axis, with
+ * major radius r_maj and minor radius r_min, using nu and nv quads along the
+ * major and minor circles, respectively. */
+static struct model *gen_torus(double r_maj, double r_min, int nu, int nv)
+{
+  struct model *m;
+  int i,j,i1,j1;
+  double th,ph;
+
+  m = new_model();
+  m->num_vert = nu*nv;
+  m->vertices = xa_malloc(m->num_vert*sizeof(*(m->vertices)));
+  m->faces = xa_malloc(2*nu*nv*sizeof(*(m->faces)));
+  for (i=0; i<nu; i++) {
+    th = 2*M_PI*i/nu;
+    for (j=0; j<nv; j++) {
+      ph = 2*M_PI*j/nv;
+      m->vertices[i*nv+j].x = (float)((r_maj+r_min*cos(ph))*cos(th));
+      m->vertices[i*nv+j].y = (float)((r_maj+r_min*cos(ph))*sin(th));
+      m->vertices[i*nv+j].z = (float)(r_min*sin(ph));
+    }
+  }
+  for (i=0; i<nu; i++) {
+    i1 = (i+1)%nu;
+    for (j=0; j<nv; j++) {
+      j1 = (j+1)%nv;
+      m->faces[m->num_faces].f0 = i*nv+j;
+      m->faces[m->num_faces].f1 = i1*nv+j;
+      m->faces[m->num_faces++].f2 = i1*nv+j1;
+      m->faces[m->num_faces].f0 = i*nv+j;
+      m->faces[m->num_faces].f1 = i1*nv+j1;
+      m->faces[m->num_faces++].f2 = i*nv+j1;
+    }
+  }
+  set_bbox(m);
+  return m;
+}
+
+/* Returns a new model of four thin parallel slabs, whose triangles are very
+ * elongated (aspect ratio about 32). The size is controlled by n, giving
+ * about 8*n*n triangles. */
+static struct model *gen_slabs(int n)
+{
+  struct model *m,*slab;
+  dvertex_t c,h;
+  int k;
+
+  m = new_model();
+  h.x = 2;
+  h.y = 0.5;
+  h.z = 0.02;
+  c.x = c.y = 0;
+  for (k=0; k<4; k++) {
+    c.z = -0.3+0.2*k;
+    slab = gen_box(&c,&h,(n+3)/4,2*n,1,0);
+    append_model(m,slab);
+    __free_raw_model(slab);
+  }
+  set_bbox(m);
+  return m;
+}
+
+/* Returns a new model simulating a scan with a dense cluster: a coarse
+ * sphere (about 12*n*n/16 triangles) with eight small and finely
+ * triangulated spheres (about 12*n*n/9 triangles each) grouped near its
+ * surface. */
+static struct model *gen_cluster(int n)
+{
+  struct model *m,*s;
+  dvertex_t c;
+  int k;
+
+  c.x = c.y = c.z = 0;
+  m = gen_sphere(&c,2,(n+3)/4);
+  for (k=0; k<8; k++) {
+    c.x = 2.1+0.25*(k&1);
+    c.y = 0.25*((k>>1)&1);
+    c.z = 0.25*((k>>2)&1);
+    s = gen_sphere(&c,0.1,(n+2)/3);
+    append_model(m,s);
+    __free_raw_model(s);
+  }
+  set_bbox(m);
+  return m;
+}
+
+/* Displaces each vertex of m by a deterministic pseudo-random offset of at
+ * most amp in each direction. */
+static void perturb_model(struct model *m, double amp)
+{
+  unsigned long state;
+  int i;
+  double d[3];
+  int k;
+
+  state = 12345;
+  for (i=0; i<m->num_vert; i++) {
+    for (k=0; k<3; k++) {
+      state = (state*1103515245UL+12345UL)&0xffffffffUL;
+      d[k] = amp*(2.0*((state>>8)&0xffff)/65535.0-1);
+    }
+    m->vertices[i].x += (float)d[0];
+    m->vertices[i].y += (float)d[1];
+    m->vertices[i].z += (float)d[2];
+  }
+  set_bbox(m);
+}
+
+/* Generates the data set number idx at size n (model 2 has about 12*n*n
+ * triangles for the sphere, and similar numbers for the others). Returns
+ * zero if there is no such data set. */
+static int gen_data(struct bench_data *bd, int idx, int n)
+{
+  dvertex_t c;
+  int n1;
+
+  n1 = (int)(0.7*n+0.5); /* model 1 is coarser */
+  c.x = c.y = c.z = 0;
+  switch (idx) {
+  case 0:
+    bd->name = "sphere";
+    bd->m1 = gen_sphere(&c,1,n1);
+    bd->m2 = gen_sphere(&c,1,n);
+    break;
+  case 1:
+    bd->name = "torus";
+    bd->m1 = gen_torus(1,0.3,4*n1,n1);
+    bd->m2 = gen_torus(1,0.3,4*n,n);
+    break;
+  case 2:
+    bd->name = "slabs";
+    bd->m1 = gen_slabs(n1);
+    bd->m2 = gen_slabs(n);
+    break;
+  case 3:
+    bd->name = "cluster";
+    bd->m1 = gen_cluster(n1);
+    bd->m2 = gen_cluster(n);
+    break;
+  default:
+    return 0;
+  }
+  perturb_model(bd->m1,0.002*dist_v(&(bd->m2->bBox[0]),&(bd->m2->bBox[1])));
+  return 1;
+}
+
+/* --------------------------------------------------------------------------*
+ *                       Model writers                                       *
+ * --------------------------------------------------------------------------*/
+
+/* Writes model m to file fname in the format ext (one of "off", "raw", "smf"
+ * and "ply", all ascii). Exits on error. */
+static void write_model(const struct model *m, const char *fname,
+                        const char *ext)
+{
+  FILE *f;
+  int i,base;
+
+  f = fopen(fname,"w");
+  if (f == NULL) {
+    fprintf(stderr,"ERROR: could not create %s\n",fname);
+    exit(1);
+  }
+  base = 0;
+  if (strcmp(ext,"off") == 0) {
+    fprintf(f,"OFF\n%d %d 0\n",m->num_vert,m->num_faces);
+  } else if (strcmp(ext,"raw") == 0) {
+    fprintf(f,"%d %d\n",m->num_vert,m->num_faces);
+  } else if (strcmp(ext,"ply") == 0) {
+    fprintf(f,"ply\nformat ascii 1.0\nelement vertex %d\n"
+            "property float x\nproperty float y\nproperty float z\n"
+            "element face %d\nproperty list uchar int vertex_indices\n"
+            "end_header\n",m->num_vert,m->num_faces);
+  } else { /* smf */
+    base = 1;
+  }
+  for (i=0; i<m->num_vert; i++) {
+    fprintf(f,"%s%.7g %.7g %.7g\n",(base != 0) ? "v " : "",
+            m->vertices[i].x,m->vertices[i].y,m->vertices[i].z);
+  }
+  for (i=0; i<m->num_faces; i++) {
+    fprintf(f,"%s%d %d %d\n",(base != 0) ? "f " :
+            ((strcmp(ext,"raw") == 0) ? "" : "3 "),
+            m->faces[i].f0+base,m->faces[i].f1+base,m->faces[i].f2+base);
+  }
+  if (fclose(f) != 0) {
+    fprintf(stderr,"ERROR: could not write %s\n",fname);
+    exit(1);
+  }
+}
+
+/* --------------------------------------------------------------------------*
+ *                       Timing and results                                  *
+ * --------------------------------------------------------------------------*/
+
+/* Sets the timing of key in res to t, if smaller than the current one (so
+ * that the minimum over repetitions is kept). */
+static void set_result(struct bench_results *res, const char *key, double t)
+{
+  int i;
+
+  for (i=0; i<res->n; i++) {
+    if (strcmp(res->key[i],key) == 0) {
+      if (t < res->t[i]) res->t[i] = t;
+      return;
+    }
+  }
+  if (res->n == BENCH_MAX_RESULTS) {
+    fprintf(stderr,"ERROR: too many benchmark results\n");
+    exit(1);
+  }
+  strncpy(res->key[res->n],key,BENCH_KEY_MAX-1);
+  res->key[res->n][BENCH_KEY_MAX-1] = '\0';
+  res->t[res->n++] = t;
+}
+
+/* Same as set_result() for the key prefix.name */
+static void set_stage_result(struct bench_results *res, const char *prefix,
+                             const char *name, double t)
+{
+  char key[BENCH_KEY_MAX];
+
+  sprintf(key,"%.20s.%.40s",prefix,name);
+  set_result(res,key,t);
+}
+
+/* Returns the timing of key in res, or a negative value if not present */
+static double get_result(const struct bench_results *res, const char *key)
+{
+  int i;
+
+  for (i=0; i<res->n; i++) {
+    if (strcmp(res->key[i],key) == 0) return res->t[i];
+  }
+  return -1;
+}
+
+/* Runs a fixed loop of floating point operations and memory accesses in
+ * an irregular pattern, similar to the distance calculation, and returns
+ * its time. The timings are divided by it when compared to the baseline,
+ * so that a machine that is slower or busier than when the baseline was
+ * recorded does not flag every timing. */
+static double calibration_loop(void)
+{
+  struct stage_time t;
+  double *a,s;
+  unsigned long r;
+  int i,j;
+
+  a = xa_malloc(BENCH_CALIB_SIZE*sizeof(*a));
+  for (i=0; i<BENCH_CALIB_SIZE; i++) a[i] = i%97;
+  memset(&t,0,sizeof(t));
+  stage_begin(&t);
+  s = 0;
+  r = 1;
+  for (j=0; j<8; j++) {
+    for (i=0; i<BENCH_CALIB_SIZE; i++) {
+      r = (r*1103515245UL+12345UL) & 0x7fffffffUL;
+      s += sqrt(a[r%BENCH_CALIB_SIZE]*a[i]+1);
+      a[i] = s*1e-6-floor(s*1e-6)+i%97;
+    }
+  }
+  stage_end(&t);
+  calib_sink = s;
+  free(a);
+  return t.wall;
+}
+
+/* Times the readers on model m, written in each supported format in
+ * directory dir, storing the timings in res under name. */
+static void bench_readers(struct bench_results *res, const char *name,
+                          const struct model *m, const char *dir, int reps)
+{
+  static const char *exts[] = {"off","raw","smf","ply"};
+  char fname[1024];
+  char key[BENCH_KEY_MAX];
+  const char *errstr;
+  struct model *mr;
+  struct stage_time t;
+  int i,r;
+
+  for (i=0; i<(int)(sizeof(exts)/sizeof(*exts)); i++) {
+    sprintf(fname,"%.900s/mesh_bench_%.20s.%s",dir,name,exts[i]);
+    write_model(m,fname,exts[i]);
+    for (r=0; r<reps; r++) {
+      memset(&t,0,sizeof(t));
+      stage_begin(&t);
+      mr = read_model_file(fname,0,&errstr);
+      stage_end(&t);
+      if (mr == NULL) {
+        fprintf(stderr,"ERROR: %s: %s\n",fname,errstr);
+        exit(1);
+      }
+      __free_raw_model(mr);
+      sprintf(key,"read_%s",exts[i]);
+      set_stage_result(res,name,key,t.wall);
+    }
+    remove(fname);
+  }
+}
+
+/* Times the analysis and the stages of the distance calculation of the
+ * data set bd, storing the timings in res. */
+static void bench_distance(struct bench_results *res,
+                           const struct bench_data *bd, int reps)
+{
+  struct model_info info;
+  struct model_error me1;
+  struct dist_surf_surf_stats stats;
+  struct stage_time t;
+  double step,dens;
+  int r,rcode;
+
+  step = 0.002*dist_v(&(bd->m2->bBox[0]),&(bd->m2->bBox[1]));
+  dens = 1/(step*step);
+  for (r=0; r<reps; r++) {
+    memset(&t,0,sizeof(t));
+    stage_begin(&t);
+    if (analyze_model(bd->m2,&info,0,1,0,NULL,NULL) != 0) {
+      fprintf(stderr,"ERROR: %s: not enough memory\n",bd->name);
+      exit(1);
+    }
+    stage_end(&t);
+    set_stage_result(res,bd->name,"analyze",t.wall);
+
+    memset(&me1,0,sizeof(me1));
+    me1.mesh = bd->m1;
+    memset(&t,0,sizeof(t));
+    stage_begin(&t);
+    if ((rcode = dist_surf_surf(&me1,bd->m2,dens,0,&stats,0,1,NULL)) != 0) {
+      fprintf(stderr,"ERROR: %s: %s\n",bd->name,dist_error_str(rcode));
+      exit(1);
+    }
+    stage_end(&t);
+    free_face_error(me1.fe);
+    set_stage_result(res,bd->name,"triangle_list",stats.t_tlist.wall);
+    set_stage_result(res,bd->name,"grid",stats.t_grid.wall);
+    set_stage_result(res,bd->name,"sampling",stats.t_sampling.wall);
+    set_stage_result(res,bd->name,"stats",stats.t_stats.wall);
+    set_stage_result(res,bd->name,"dist_total",t.wall);
+  }
+  printf("%-8s model 1: %7d triangles, model 2: %7d triangles, "
+         "%8d samples\n",bd->name,bd->m1->num_faces,bd->m2->num_faces,
+         stats.m1_samples);
+}
+
+/* Writes the timings in res to file fname as a JSON object */
+static void write_results(const struct bench_results *res, const char *fname)
+{
+  FILE *f;
+  int i;
+
+  f = fopen(fname,"w");
+  if (f == NULL) {
+    fprintf(stderr,"ERROR: could not create %s\n",fname);
+    exit(1);
+  }
+  fprintf(f,"{\n");
+  for (i=0; i<res->n; i++) {
+    fprintf(f,"  \"%s\": %.6f%s\n",res->key[i],res->t[i],
+            (i+1 < res->n) ? "," : "");
+  }
+  fprintf(f,"}\n");
+  if (fclose(f) != 0) {
+    fprintf(stderr,"ERROR: could not write %s\n",fname);
+    exit(1);
+  }
+}
+
+/* Reads the timings in the JSON file fname, as written by write_results(),
+ * into res. Only objects with numeric values are supported. Exits on
+ * error. */
+static void read_results(struct bench_results *res, const char *fname)
+{
+  FILE *f;
+  int c,n;
+  char key[BENCH_KEY_MAX];
+  double t;
+
+  memset(res,0,sizeof(*res));
+  f = fopen(fname,"r");
+  if (f == NULL) {
+    fprintf(stderr,"ERROR: could not open %s\n",fname);
+    exit(1);
+  }
+  while ((c = getc(f)) != EOF) {
+    if (c != '"') continue;
+    for (n=0; (c = getc(f)) != EOF && c != '"'; ) {
+      if (n < BENCH_KEY_MAX-1) key[n++] = (char)c;
+    }
+    key[n] = '\0';
+    if (fscanf(f," : %lf",&t) != 1) {
+      fprintf(stderr,"ERROR: %s: invalid value for \"%s\"\n",fname,key);
+      exit(1);
+    }
+    set_result(res,key,t);
+  }
+  fclose(f);
+}
+
+/* Prints the timings in res and compares them to those in base (if not
+ * NULL). The baseline timings are first scaled by the ratio of the
+ * calibration loop timings, if both have it (the "all." results are not
+ * scaled). Returns the number of timings slower than the scaled baseline
+ * by more than the relative tolerance tol. */
+static int compare_results(const struct bench_results *res,
+                           const struct bench_results *base, double tol)
+{
+  int i,n_slow;
+  double tb,dt,tc_res,tc_base,scale;
+  const char *flag;
+
+  n_slow = 0;
+  scale = 1;
+  if (base != NULL) {
+    tc_res = get_result(res,BENCH_CALIB_KEY);
+    tc_base = get_result(base,BENCH_CALIB_KEY);
+    if (tc_res > 0 && tc_base > 0) {
+      scale = tc_res/tc_base;
+      printf("\nBaseline timings scaled by %.3f (calibration loop)\n",
+             scale);
+    } else {
+      printf("\nNo calibration loop timing, baseline timings not scaled\n");
+    }
+  }
+  printf("\n%-24s\t  Baseline\t   Current\t  Change\n","Measure (secs)");
+  for (i=0; i<res->n; i++) {
+    tb = (base != NULL) ? get_result(base,res->key[i]) : -1;
+    if (tb < 0) {
+      printf("%-24s\t%10s\t%10.4f\n",res->key[i],"-",res->t[i]);
+      continue;
+    }
+    if (strncmp(res->key[i],"all.",4) != 0) tb *= scale;
+    dt = res->t[i]-tb;
+    flag = "";
+    if (dt > tol*tb && dt > BENCH_MIN_DIFF) {
+      flag = "\tSLOWER";
+      n_slow++;
+    } else if (-dt > tol*tb && -dt > BENCH_MIN_DIFF) {
+      flag = "\tfaster";
+    }
+    printf("%-24s\t%10.4f\t%10.4f\t%+7.1f%%%s\n",res->key[i],tb,res->t[i],
+           (tb > 0) ? 100*dt/tb : 0.0,flag);
+  }
+  return n_slow;
+}
+
+/* Prints the usage information to out */
+static void print_usage(FILE *out)
+{
+  fprintf(out,"mesh_bench [-s scale] [-r reps] [-d dir] [-b baseline] "
+          "[-w results] [-t tol]\n\n");
+  fprintf(out,"Times the model readers and the stages of the distance\n");
+  fprintf(out,"calculation on synthetic models (uniform sphere, torus,\n");
+  fprintf(out,"anisotropic slabs and dense cluster plus sparse scan).\n");
+  fprintf(out,"The baseline timings are scaled by the ratio of the times\n");
+  fprintf(out,"of a fixed calibration loop before comparing.\n\n");
+  fprintf(out,"  -s scale\tScale the number of triangles (default 1).\n");
+  fprintf(out,"  -r reps\tRepeat each timing reps times and keep the\n");
+  fprintf(out,"         \tminimum (default 5).\n");
+  fprintf(out,"  -d dir\tDirectory for temporary model files (default .)\n");
+  fprintf(out,"  -b file\tCompare to the baseline timings in file, and\n");
+  fprintf(out,"         \texit with status 2 if any is slower.\n");
+  fprintf(out,"  -w file\tWrite the timings to file (JSON).\n");
+  fprintf(out,"  -t tol\tRelative slowdown tolerance (default 0.25).\n");
+}
+
+/* --------------------------------------------------------------------------*
+ *                       Main                                                *
+ * --------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+  struct bench_results res,base;
+  struct bench_data bd;
+  const char *dir,*base_fname,*out_fname;
+  double scale,tol;
+  int i,reps,n,n_slow;
+
+  scale = 1;
+  reps = 5;
+  tol = 0.25;
+  dir = ".";
+  base_fname = NULL;
+  out_fname = NULL;
+  for (i=1; i<argc; i++) {
+    if (strcmp(argv[i],"-h") == 0) {
+      print_usage(stdout);
+      return 0;
+    } else if (i+1 >= argc || argv[i][0] != '-' || argv[i][2] != '\0') {
+      print_usage(stderr);
+      return 1;
+    }
+    switch (argv[i++][1]) {
+    case 's': scale = atof(argv[i]); break;
+    case 'r': reps = atoi(argv[i]); break;
+    case 'd': dir = argv[i]; break;
+    case 'b': base_fname = argv[i]; break;
+    case 'w': out_fname = argv[i]; break;
+    case 't': tol = atof(argv[i]); break;
+    default:
+      print_usage(stderr);
+      return 1;
+    }
+  }
+  if (scale <= 0 || reps <= 0 || tol < 0) {
+    fprintf(stderr,"ERROR: invalid argument value\n");
+    return 1;
+  }
+
+  memset(&res,0,sizeof(res));
+  n = (int)(100*sqrt(scale)+0.5);
+  for (i=0; i<reps; i++) {
+    set_result(&res,BENCH_CALIB_KEY,calibration_loop());
+  }
+  for (i=0; gen_data(&bd,i,n); i++) {
+    bench_readers(&res,bd.name,bd.m2,dir,reps);
+    bench_distance(&res,&bd,reps);
+    __free_raw_model(bd.m1);
+    __free_raw_model(bd.m2);
+  }
+  /* Again at the end, as the load of the machine may have changed */
+  for (i=0; i<reps; i++) {
+    set_result(&res,BENCH_CALIB_KEY,calibration_loop());
+  }
+  set_stage_result(&res,"all","peak_rss_mb",peak_rss_kb()/1024.0);
+
+  if (base_fname != NULL) read_results(&base,base_fname);
+  n_slow = compare_results(&res,(base_fname != NULL) ? &base : NULL,tol);
+  if (out_fname != NULL) write_results(&res,out_fname);
+  if (n_slow > 0) {
+    printf("\nWARNING: %d timings are slower than the baseline by more "
+           "than %g%%\n",n_slow,tol*100);
+    return 2;
+  }
+  return 0;
+}
@@ -151,6 +151,36 @@ float** colormap_gs(int len)
   return cmap;
 }
 
+/* see colormap.h */
+float** colormap_signed(int len)
+{
+  float **cmap,t;
+  int i;
+
+  if (len <= 1) return NULL;
+
+  cmap = xa_malloc(len*sizeof(*cmap));
+  *cmap = xa_malloc(3*len*sizeof(**cmap));
+  for (i=1; i<len; i++) {
+    cmap[i] = cmap[i-1]+3;
+  }
+
+  for (i=0; i<len ; i++) {
+    t = 2*i/(float)(len-1)-1; /* from -1 to 1 */
+    if (t < 0) { /* blue to white */
+      cmap[i][0] = 1+t;
+      cmap[i][1] = 1+t;
+      cmap[i][2] = 1;
+    } else { /* white to red */
+      cmap[i][0] = 1;
+      cmap[i][1] = 1-t;
+      cmap[i][2] = 1-t;
+    }
+  }
+  
+  return cmap;
+}
+
 /* see colormap.h */
 void free_colormap(float **cmap)
 {
@@ -75,6 +75,13 @@ float** colormap_hsv(int len);
  * paper costs 1000$ :-) */
 float** colormap_gs(int len);
 
+/* Returns a two-sided colormap for signed values, with len entries, in the
+ * same format as colormap_hsv(). It goes from blue (first entry) to white
+ * (middle) and then to red (last entry), so that negative and positive
+ * values of a range centered on zero are told apart by the hue, and their
+ * magnitude by the saturation. len should be no less than 2. */
+float** colormap_signed(int len);
+
 /* Frees a colormap */
 void free_colormap(float **cmap);
 
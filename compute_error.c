@@ -50,7 +50,8 @@
 #include <compute_error.h>
 
 #include <geomutils.h>
-#include <xalloc.h>
+#include <model_in.h>
+#include <thread_pool.h>
 #include <math.h>
 #include <assert.h>
 
@@ -65,8 +66,24 @@
  * side length and the side length of an average equilateral triangle. */
 #define CELL_TRIAG_RATIO 0.707
 
-/* If defined statistics for the dist_pt_surf() function are computed */
-/* #define DO_DIST_PT_SURF_STATS */
+/* The candidate values of the cell ratio (see CELL_TRIAG_RATIO) tried when
+ * auto-tuning the grid, in increasing order. */
+static const double tune_cell_ratios[] = {0.35, 0.5, 0.707, 1.0, 1.41, 2.0};
+
+/* Number of elements of tune_cell_ratios */
+#define N_TUNE_CELL_RATIOS \
+  ((int)(sizeof(tune_cell_ratios)/sizeof(tune_cell_ratios[0])))
+
+/* Number of sample points used by the probe queries for auto-tuning the
+ * grid. The grid is not tuned if the model to sample has less than
+ * TUNE_MIN_FACTOR times this number of samples. */
+#define TUNE_N_PROBES 4096
+#define TUNE_MIN_FACTOR 8
+
+/* Number of runs of consecutive faces from which the probe samples are
+ * taken. Consecutive faces are sampled as in the real calculation, so that
+ * the probe queries benefit of the same locality. */
+#define TUNE_N_RUNS 32
 
 /* Margin factor from DBL_MIN to consider a triangle side length too small and
  * mark it as degenerate. */
@@ -75,9 +92,40 @@
 /* Maximum number of cells in the grid. */
 #define GRID_CELLS_MAX 512000
 
+/* Number of consecutive vertices handed out at once to a thread by
+ * dist_verts_idx(). Consecutive vertices are usually close, which the warm
+ * start of the distance queries exploits. */
+#define VERT_CHUNK 512
+
+/* Number of consecutive faces of model 1 handed out at once to a thread by
+ * dist_surf_idx(). Those not yet handed out are skipped when the
+ * computation is cancelled. */
+#define FACE_BLOCK 64
+
+/* Number of bits per coordinate of the Morton codes used to sort the
+ * vertices spatially in dist_verts_idx() (at most 10) */
+#define MORTON_BITS 10
+
 /* The value of 1/sqrt(3) */
 #define SQRT_1_3 0.5773502691896258
 
+/* The closest feature of a triangle to a point, as returned by
+ * closest_pt_triag(). The values for vertices and edges are also the index
+ * of their pseudo-normal among those of the triangle (see struct
+ * triangle_list). */
+#define CPF_VTX_A   0 /* The A vertex */
+#define CPF_VTX_B   1 /* The B vertex */
+#define CPF_VTX_C   2 /* The C vertex */
+#define CPF_EDGE_AB 3 /* The interior of the AB edge */
+#define CPF_EDGE_BC 4 /* The interior of the BC edge */
+#define CPF_EDGE_CA 5 /* The interior of the CA edge */
+#define CPF_FACE    6 /* The interior of the triangle */
+
+/* Special values of the vertex error, smaller than any error (see
+ * calc_vertex_error()) */
+#define VERR_UNSET      (-FLT_MAX)      /* vertex not yet visited */
+#define VERR_NO_SAMPLES (-0.5f*FLT_MAX) /* vertex without samples */
+
 /* Define inlining directive for C99 or as compiler specific C89 extension */
 #if defined(_MSC_VER) /* Visual C++ */
 # define INLINE __inline
@@ -113,6 +161,9 @@
   /* Macro to set the bit corresponding to element i in the bitmap bm. */
 # define EC_BITMAP_SET_BIT(bm,i) \
    ((bm)[(i)/EC_BITMAP_T_BITS] |= 1 << ((i)&EC_BITMAP_T_MASK))
+  /* Macro to clear the bit corresponding to element i in the bitmap bm. */
+# define EC_BITMAP_CLEAR_BIT(bm,i) \
+   ((bm)[(i)/EC_BITMAP_T_BITS] &= ~(1 << ((i)&EC_BITMAP_T_MASK)))
 #else /* Fake bitmap macros to access simple type */
   /* Type for marking empty cells. Small type uses less memory, but access to
    * aligned type can be faster (but more memory can cause more cache misses) */
@@ -128,12 +179,17 @@
 # define EC_BITMAP_TEST_BIT(bm,i) (bm)[i]
   /* Macro to set the element i in the map bm. */
 # define EC_BITMAP_SET_BIT(bm,i) ((bm)[i] = 1)
+  /* Macro to clear the element i in the map bm. */
+# define EC_BITMAP_CLEAR_BIT(bm,i) ((bm)[i] = 0)
 #endif
 
 /* Temporary struct to hold extra statistics */
 struct misc_stats {
   double *dist_smpl;/* The distance at each sample of model 1 */
-  int dist_smpl_sz; /* Size (in elements) of the buffer for dist_smpl */
+  struct sample_closest_point *scp; /* The closest point of model 2 to each
+                                     * sample of model 1, NULL if not
+                                     * requested */
+  int n_smpl;       /* The number of samples in dist_smpl */
 };
 
 /* List of triangles intersecting each cell */
@@ -172,81 +228,149 @@ struct dist_cell_lists {
   int n_dists;            /* The number of elements in list */
 };
 
-/* Storage for triangle sample errors. */
-struct triag_sample_error {
-  double **err;      /* Error array with 2D addressing. Sample (i,j) has the
-                      * error stored at err[i][j], where i varies betwen 0 and
-                      * n_samples-1 inclusive and j varies between 0 and
-                      * n_samples-i-1 inclusive. */
-  int n_samples;     /* The number of samples in each triangle direction */
-  double *err_lin;   /* Error array with 1D adressing, which varies from 0 to
-                      * n_samples_tot-1 inclusive. It refers to the same
-                      * location as err, thus any change to err is reflected
-                      * in err_lin and vice-versa. The order in the 1D array
-                      * is all errors for i equal 0 and j from 0 to
-                      * n_samples-1, followed by errors for i equal 1 and j
-                      * from 0 to n_samples-2, and so on. */
-  int n_samples_tot; /* The total number of samples in the triangle */
-  int buf_sz;        /* The allocated err_lin buffer size (number of elements)*/
-};
-
 /* A list of triangles with their associated information */
 struct triangle_list {
-  struct triangle_info *triangles; /* The triangles */
+  struct triangle_info *triangles; /* The triangles, with the information
+                                    * used by the distance calculation */
+  double *s_area;                  /* The surface area of each triangle. It
+                                    * is not needed by the distance
+                                    * calculation, so it is kept out of
+                                    * triangles to make them smaller. */
+  unsigned char *a_vert;           /* Which vertex of each face is the A
+                                    * vertex of the triangle (0, 1 or 2 for
+                                    * f0, f1 or f2). B and C follow in the
+                                    * same circular order, since the
+                                    * orientation is not changed. */
+  dvertex_t *pnormal;              /* The (unnormalized) angle weighted
+                                    * pseudo-normals of the vertices and
+                                    * edges of each triangle, used to get the
+                                    * sign of the distance. Triangle i has
+                                    * them at pnormal[6*i+f], where f is the
+                                    * CPF_VTX_... or CPF_EDGE_... feature
+                                    * value. NULL if not calculated. */
   int n_triangles;                 /* The number of triangles */
   double area;                     /* The total triangle area */
 };
 
-/* A triangle and useful associated information. AB is always the longest side
- * of the triangle. That way the projection of C on AB is always inside AB. */
+/* A triangle and the information used to calculate the distance from a point
+ * to it. AB is always the longest side of the triangle. That way the
+ * projection of C on AB is always inside AB. Only the A vertex is stored,
+ * the distance is calculated from the vector from A (or C) to the point. The
+ * fields are ordered by the branch of dist_sqr_pt_triag() that uses them
+ * first, and nothing that can be derived cheaply is stored, to reduce the
+ * cache misses when scanning the triangles. */
 struct triangle_info {
   dvertex_t a;         /* The A vertex of the triangle */
-  dvertex_t b;         /* The B vertex of the triangle */
-  dvertex_t c;         /* The C vertex of the triangle. The projection of C
-                        * on AB is always inside the AB segment. */
+  dvertex_t nhsab;     /* (unnormalized) normal of the plane trough AB,
+                        * perpendicular to ABC and pointing outside of ABC */
   dvertex_t ab;        /* The AB vector */
+  double ab_len_sqr;   /* The square of the length of AB */
+  double ab_1_len_sqr; /* One over the square of the length of AB */
   dvertex_t ca;        /* The CA vector */
+  dvertex_t nhsbc;     /* (unnormalized) normal of the plane trough BC,
+                        * perpendicular to ABC and pointing outside of ABC */
   dvertex_t cb;        /* The CB vector */
-  double ab_len_sqr;   /* The square of the length of AB */
-  double ca_len_sqr;   /* The square of the length of CA */
   double cb_len_sqr;   /* The square of the length of CB */
-  double ab_1_len_sqr; /* One over the square of the length of AB */
-  double ca_1_len_sqr; /* One over the square of the length of CA */
   double cb_1_len_sqr; /* One over the square of the length of CB */
+  dvertex_t nhsca;     /* (unnormalized) normal of the plane trough CA,
+                        * perpendicular to ABC and pointing outside of ABC */
+  double ca_len_sqr;   /* The square of the length of CA */
+  double ca_1_len_sqr; /* One over the square of the length of CA */
   dvertex_t normal;    /* The (unit length) normal of the ABC triangle
                         * (orinted with the right hand rule turning from AB to
                         * AC). If the triangle is degenerate it is (0,0,0). */
-  dvertex_t nhsab;     /* (unnormalized) normal of the plane trough AB,
-                        * perpendicular to ABC and pointing outside of ABC */
-  dvertex_t nhsbc;     /* (unnormalized) normal of the plane trough BC,
-                        * perpendicular to ABC and pointing outside of ABC */
-  dvertex_t nhsca;     /* (unnormalized) normal of the plane trough CA,
-                        * perpendicular to ABC and pointing outside of ABC */
-  double chsab;        /* constant of the plane equation: <p|npab>=cpab */
-  double chsbc;        /* constant of the plane equation: <p|npbc>=cpbc */
-  double chsca;        /* constant of the plane equation: <p|npca>=cpca */
-  double a_n;          /* scalar product of A with the unit length normal */
-  double s_area;       /* The surface area of the triangle */
   int obtuse_at_c;     /* Flag indicating if the angle at C is larger than 90
                         * degrees (i.e. obtuse) */
 };
 
-/* Statistics of dist_pt_surf() function */
-struct dist_pt_surf_stats {
-  int n_cell_scans;       /* Number of cells that are scanned (i.e. distance
-                           * point to cell is calculated) */
-  int n_cell_t_scans;     /* Number of cells that for which their triangles are
-                           * scanned */
-  int n_triag_scans;      /* Number of triangles that are scanned */
-  int sum_kmax;           /* the sum of athe max k for each sample point */
+/* A spatial index on the surface of a model, to speed up the point to
+ * surface distance calculation. It is read-only once built, so it can be
+ * shared by several threads. */
+struct surf_index {
+  struct triangle_list *tl;   /* The triangle list of the model */
+  struct t_in_cell_list *fic; /* The list of triangles intersecting each
+                               * cell */
+  dvertex_t bbox_min;         /* The minimum coordinates of the bounding box
+                               * on which the cell grid is placed (i.e. the
+                               * origin of cell (0,0,0)). */
+  double cell_sz;             /* The side length of the cubic cells */
+  struct size3d grid_sz;      /* The number of cells in the X, Y and Z
+                               * directions */
+  double cell_ratio;          /* The cell size relative to the average
+                               * triangle side (see CELL_TRIAG_RATIO) */
+  double probe_cost;          /* The time per query measured by the probe
+                               * queries, zero if not auto-tuned */
+  struct stage_time t_tlist;  /* Time used to build tl */
+  struct stage_time t_tune;   /* Time used to auto-tune cell_sz */
+  struct stage_time t_grid;   /* Time used to build the grid (fic) */
+};
+
+/* The state of a sequence of point to surface distance queries on a
+ * surf_index. Each thread needs its own. */
+struct surf_query {
+  const struct surf_index *si; /* The index being queried */
+  struct dist_cell_lists *dcl; /* Cache for the list of non-empty cells at
+                                * each distance, for each cell. */
+  int *dcl_buf;                /* Temporary buffer to construct dcl lists */
+  int dcl_buf_sz;              /* Size of dcl_buf */
+  dvertex_t prev_p;            /* The previous query point */
+  double prev_d;               /* The distance of the previous query point */
+  struct dist_query_stats *qs; /* The query statistics to update, NULL if
+                                * not collected */
+  int last_triag;              /* The index of the triangle closest to the
+                                * last query point */
+  int error;                   /* Zero, or the error code (MESH_NO_MEM or
+                                * MESH_MODEL_ERR) of the first failed
+                                * query. The queries are then meaningless. */
+};
+
+/* The data shared by the threads calculating the distance from the vertices
+ * of a model (see vert_dist_work()) */
+struct vert_dist_data {
+  const struct model *m;       /* The model whose vertices are queried */
+  int *order;                  /* The indices of the vertices in the order
+                                * in which they are queried */
+  struct surf_query *sq;       /* The query state of each thread */
+  int is_signed;               /* Calculate the signed distance */
+  double *dist;                /* The distance at each vertex */
+};
+
+/* The data shared by the threads calculating the error at the samples of
+ * the faces of a model (see face_dist_work()) */
+struct face_dist_data {
+  struct face_sampler *fs;     /* The face sampler of each thread */
+  struct face_error *fe;       /* The per face errors, with the sampling
+                                * frequencies and sample locations set */
+};
+
+/* The state to sample the faces of a model and calculate the error at the
+ * samples (see sample_face_error()) */
+struct face_sampler {
+  const struct model *m;       /* The model whose faces are sampled */
+  double sampling_density;     /* The number of samples per unit surface */
+  int min_sample_freq;         /* The minimum sampling frequency */
+  int is_signed;               /* Calculate the signed distance */
+  int do_scp;                  /* Get the closest point of each sample */
+  struct surf_query sq;        /* The distance query state */
+  struct sample_list ts;       /* The samples of the current face */
+  int error;                   /* Zero, or the error code of the first face
+                                * that could not be sampled */
+};
+
+/* A vertex index with its Morton code, for sorting */
+struct morton_key {
+  unsigned int code; /* The Morton code of the vertex position */
+  int idx;           /* The vertex index */
 };
 
 /* --------------------------------------------------------------------------*
  *                    Local utility functions                                *
  * --------------------------------------------------------------------------*/
 
-/* Finalizes the members of the me->fe array. The m_stats->dist_smpl array
- * will now be referenced by me->fe->serror. */
+/* Points the serror and scp members of the me->fe array to the location of
+ * the samples of each face in the m_stats->dist_smpl and m_stats->scp
+ * arrays, given the sampling frequencies already set in me->fe. The faces
+ * are stored consecutively, in face order. */
 static void finalize_face_error(struct model_error *me,
                                 struct misc_stats *m_stats)
 {
@@ -256,65 +380,36 @@ static void finalize_face_error(struct model_error *me,
   n_faces = me->mesh->num_faces;
   fe = me->fe;
   fe[0].serror = m_stats->dist_smpl;
+  fe[0].scp = m_stats->scp;
   for (i=1; i<n_faces; i++) {
     n = fe[i-1].sample_freq;
     fe[i].serror = fe[i-1].serror+n*(n+1)/2;
+    fe[i].scp = (fe[i-1].scp != NULL) ? fe[i-1].scp+n*(n+1)/2 : NULL;
   }
 }
 
-/* Reallocates the buffers of tse to store the sample errors for a triangle
- * sampling with n samples in each direction. If tse->err and tse->err_lin is
- * NULL new buffers are allocated. The allocation never fails (if out of
- * memory the program is stopped, as with xa_realloc()) */
-static void realloc_triag_sample_error(struct triag_sample_error *tse, int n)
-{
-  int i;
-
-  if (tse->n_samples == n) return;
-  tse->n_samples = n;
-  tse->n_samples_tot = n*(n+1)/2;
-  if (tse->n_samples_tot >  tse->buf_sz) {
-    tse->err = xa_realloc(tse->err,n*sizeof(*(tse->err)));
-    tse->err_lin = xa_realloc(tse->err_lin,
-                              tse->n_samples_tot*sizeof(**(tse->err)));
-    tse->buf_sz = tse->n_samples_tot;
-  }
-  if (n != 0) {
-    tse->err[0] = tse->err_lin;
-    for (i=1; i<n; i++) {
-      tse->err[i] = tse->err[i-1]+(n-(i-1));
-    }
-  }
-}
-
-/* Frees the buffers in tse (allocated with realloc_triag_sample_error()). */
-static void free_triag_sample_error(struct triag_sample_error *tse)
-{
-  if (tse == NULL) return;
-  free(tse->err);
-  free(tse->err_lin);
-  tse->err = NULL;
-  tse->err_lin = NULL;
-}
-
 /* Computes the normalized vertex normals assuming an oriented model. The
  * triangle information already present in tl are used to speed up the
  * calculation. If the model is not oriented, the resulting normals will be
  * incorrect. Vertices that belong to no triangles or to degenerate ones only
- * have a (0,0,0) normal vector set. */
-static void calc_normals_as_oriented_model(struct model *m,
-                                           const struct triangle_list *tl)
+ * have a (0,0,0) normal vector set. Returns zero on success and MESH_NO_MEM
+ * if out of memory, in which case m is not modified. */
+static int calc_normals_as_oriented_model(struct model *m,
+                                          const struct triangle_list *tl)
 {
   int k,kmax;
   vertex_t n;
+  vertex_t *normals;
 
   /* initialize all normals to zero */
-  m->normals = xa_realloc(m->normals,m->num_vert*sizeof(*(m->normals)));
+  normals = realloc(m->normals,max(m->num_vert,1)*sizeof(*normals));
+  if (normals == NULL) return MESH_NO_MEM;
+  m->normals = normals;
   memset(m->normals,0,m->num_vert*sizeof(*(m->normals)));
   /* add face normals to vertices, weighted by face area */
   for (k=0, kmax=m->num_faces; k < kmax; k++) {
     vertex_d2f_v(&(tl->triangles[k].normal),&n); /* convert double to float */
-    __prod_v(tl->triangles[k].s_area,n,n);
+    __prod_v(tl->s_area[k],n,n);
     __add_v(n,m->normals[m->faces[k].f0],m->normals[m->faces[k].f0]);
     __add_v(n,m->normals[m->faces[k].f1],m->normals[m->faces[k].f1]);
     __add_v(n,m->normals[m->faces[k].f2],m->normals[m->faces[k].f2]);
@@ -326,16 +421,19 @@ static void calc_normals_as_oriented_model(struct model *m,
       __normalize_v(m->normals[k]);
     }
   }
+  return 0;
 }
 
 /* Returns the integer sample frequency for a triangle of area t_area, so that
  * the sample density (number of samples per unit area) is s_density
  * (statistically speaking). The returned sample frequency is the number of
- * samples to take on each side. A random variable is used so that the
- * resulting sampling density is s_density in average. */
-static int get_sampling_freq(double t_area, double s_density)
+ * samples to take on each side. A random variable, derived from the face
+ * index k, is used so that the resulting sampling density is s_density in
+ * average. */
+static int get_sampling_freq(double t_area, double s_density, int k)
 {
   double rv,p,n_samples;
+  unsigned long h;
   int n;
 
   /* NOTE: we use a random variable so that the expected (i.e. statistical
@@ -344,8 +442,15 @@ static int get_sampling_freq(double t_area, double s_density)
    * number of samples n_samples we obtain the maximum sampling freq. n that
    * gives no more than n_samples. The we choose n with probability p, or n+1
    * with probability 1-p, so that p*n*(n+1)/2+(1-p)*(n+1)*(n+2)/2=n_samples,
-   * that is the expected value is n_samples. */
-  rv = rand()/(RAND_MAX+1.0); /* rand var. in [0,1) interval */
+   * that is the expected value is n_samples. The random variable is a hash
+   * of the face index k, and not rand(), so that the sampling does not
+   * depend on the order in which the faces are processed and can be
+   * planned before sampling. */
+  h = ((unsigned long)k*2654435761UL+12345UL)&0xffffffffUL;
+  h ^= h >> 16;
+  h = (h*0x45d9f3bUL)&0xffffffffUL;
+  h ^= h >> 16;
+  rv = h/4294967296.0; /* rand var. in [0,1) interval */
   n_samples = t_area*s_density;
   n = (int)floor(sqrt(0.25+2*n_samples)-0.5);
   p = (n+2)*0.5-n_samples/(n+1);
@@ -355,9 +460,11 @@ static int get_sampling_freq(double t_area, double s_density)
 /* Given a the triangle list tl of a model, and the minimum and maximum
  * coordinates of the bounding box on which the cell grid is to be made,
  * bbox_min and bbox_max, calculates the grid cell size as well as the grid
- * size. The cubic cell side length is returned and the grid size is stored in
- * *grid_sz. */
-static double get_cell_size(const struct triangle_list *tl,
+ * size, for the cell ratio cell_ratio (see CELL_TRIAG_RATIO). The cubic cell
+ * side length is returned and the grid size is stored in *grid_sz. If the
+ * cell size overflows or is not a number (i.e. the coordinates are too
+ * large or not finite) a negative value is returned instead. */
+static double get_cell_size(const struct triangle_list *tl, double cell_ratio,
                             const dvertex_t *bbox_min,
                             const dvertex_t *bbox_max, struct size3d *grid_sz)
 {
@@ -366,16 +473,15 @@ static double get_cell_size(const struct triangle_list *tl,
 
   /* Derive the grid size. For that we derive the average triangle side length
    * as the side of an equilateral triangle which's surface equals the average
-   * triangle surface of m2. The cubic cell side is then CELL_TRIAG_RATIO
-   * times that. */
-  cell_sz = CELL_TRIAG_RATIO*sqrt(tl->area/tl->n_triangles*4/sqrt(3));
+   * triangle surface of m2. The cubic cell side is then cell_ratio times
+   * that. */
+  cell_sz = cell_ratio*sqrt(tl->area/tl->n_triangles*4/sqrt(3));
 
   /* Avoid values that can overflow or underflow */
   if (cell_sz < DBL_MIN*DMARGIN) { /* Avoid division by zero with cell_sz */
     cell_sz = DBL_MIN*DMARGIN;
-  } else if (cell_sz >= DBL_MAX/DMARGIN) {
-    fprintf(stderr,"ERROR: coordinate overflow. Are models OK?\n");
-    exit(1);
+  } else if (!(cell_sz < DBL_MAX/DMARGIN)) { /* also true for NaNs */
+    return -1;
   }
 
   /* Limit to maximum number of cells */
@@ -412,8 +518,9 @@ static double get_cell_size(const struct triangle_list *tl,
  * included in the list. The temporary buffer used to construct the list is
  * given by *buf (can be NULL) and its size (in elements) by *buf_sz. If a
  * larger buffer is required it is realloc'ed and the new address and size are
- * returned in *buf and *buf_sz. */
-static void get_cells_at_distance(struct dist_cell_lists *dlists,
+ * returned in *buf and *buf_sz. Returns zero on success and MESH_NO_MEM if
+ * out of memory, in which case dlists->list[k] is an empty list. */
+static int get_cells_at_distance(struct dist_cell_lists *dlists,
                                   struct size3d cell_gr_coord,
                                   struct size3d grid_sz, int k,
                                   const struct t_in_cell_list *fic,
@@ -431,6 +538,8 @@ static void get_cells_at_distance(struct dist_cell_lists *dlists,
   int min_m,max_m,min_n,max_n,min_o,max_o;
   int d;
   int tmp;
+  struct cell_list *list;
+  int *new_buf;
 
   assert(k == 0 || dlists->n_dists <= k);
 
@@ -439,7 +548,9 @@ static void get_cells_at_distance(struct dist_cell_lists *dlists,
   fic_empty_cell = fic->empty_cell;
 
   /* Expand storage for distance cell list */
-  dlists->list = xa_realloc(dlists->list,(k+1)*sizeof(*(dlists->list)));
+  list = realloc(dlists->list,(k+1)*sizeof(*list));
+  if (list == NULL) return MESH_NO_MEM;
+  dlists->list = list;
   if (k > dlists->n_dists){
     /* set to NULL new elements that will not be filled */
     memset(dlists->list+dlists->n_dists,0,
@@ -452,8 +563,14 @@ static void get_cells_at_distance(struct dist_cell_lists *dlists,
   max_n_cells = 6*(2*k+1)*(2*k+1)+12*(2*k+1)+8;
   if (k == 0) max_n_cells += 1; /* add center cell */
   if (*buf == NULL || *buf_sz < max_n_cells) {
+    new_buf = realloc(*buf,max_n_cells*sizeof(**buf));
+    if (new_buf == NULL) {
+      list[k].cell = NULL;
+      list[k].n_cells = 0;
+      return MESH_NO_MEM;
+    }
+    *buf = new_buf;
     *buf_sz = max_n_cells;
-    *buf = xa_realloc(*buf,(*buf_sz)*sizeof(**buf));
   }
   cur_cell = *buf;
   if (k == 0) { /* add center cell */
@@ -594,14 +711,15 @@ static void get_cells_at_distance(struct dist_cell_lists *dlists,
   }
   /* Store resulting cell list */
   cll = cur_cell-*buf;
+  list[k].cell = NULL;
+  list[k].n_cells = 0;
   if (cll != 0) {
-    dlists->list[k].cell = xa_malloc(cll*sizeof(*cur_cell));
-    memcpy(dlists->list[k].cell,*buf,cll*sizeof(*cur_cell));
-    dlists->list[k].n_cells = cll;
-  } else {
-    dlists->list[k].cell = NULL;
-    dlists->list[k].n_cells = 0;
+    list[k].cell = malloc(cll*sizeof(*cur_cell));
+    if (list[k].cell == NULL) return MESH_NO_MEM;
+    memcpy(list[k].cell,*buf,cll*sizeof(*cur_cell));
+    list[k].n_cells = cll;
   }
+  return 0;
 }
 
 
@@ -610,14 +728,18 @@ static void get_cells_at_distance(struct dist_cell_lists *dlists,
  * --------------------------------------------------------------------------*/
 
 /* Initializes the triangle '*t' using the '*a' '*b' and '*c' vertices and
- * calculates all the relative fields of the struct. */
-static void init_triangle(const vertex_t *a, const vertex_t *b, 
-                          const vertex_t *c, struct triangle_info *t)
+ * calculates all the relative fields of the struct. The surface area of the
+ * triangle is returned, and which of '*a' '*b' and '*c' (0, 1 or 2) is the A
+ * vertex of '*t' in '*a_vert'. */
+static double init_triangle(const vertex_t *a, const vertex_t *b,
+                            const vertex_t *c, struct triangle_info *t,
+                            unsigned char *a_vert)
 {
   dvertex_t dv_a,dv_b,dv_c;
   dvertex_t ab,ac,bc;
   double ab_len_sqr,ac_len_sqr,bc_len_sqr;
   double n_len;
+  double s_area;
 
   /* Convert float vertices to double */
   vertex_f2d_dv(a,&dv_a);
@@ -633,9 +755,8 @@ static void init_triangle(const vertex_t *a, const vertex_t *b,
   bc_len_sqr = __norm2_v(bc);
   if (ab_len_sqr <= ac_len_sqr) {
     if (ac_len_sqr <= bc_len_sqr) { /* BC longest side => A to C */
-      t->c = dv_a;
+      *a_vert = 1;
       t->a = dv_b;
-      t->b = dv_c;
       t->ab = bc;
       t->ca = ab;
       t->cb = ac;
@@ -643,8 +764,7 @@ static void init_triangle(const vertex_t *a, const vertex_t *b,
       t->ca_len_sqr = ab_len_sqr;
       t->cb_len_sqr = ac_len_sqr;
     } else { /* AC longest side => B to C */
-      t->b = dv_a;
-      t->c = dv_b;
+      *a_vert = 2;
       t->a = dv_c;
       __neg_v(ac,t->ab);
       t->ca = bc;
@@ -655,9 +775,8 @@ static void init_triangle(const vertex_t *a, const vertex_t *b,
     }
   } else {
     if (ab_len_sqr <= bc_len_sqr) { /* BC longest side => A to C */
-      t->c = dv_a;
+      *a_vert = 1;
       t->a = dv_b;
-      t->b = dv_c;
       t->ab = bc;
       t->ca = ab;
       t->cb = ac;
@@ -665,9 +784,8 @@ static void init_triangle(const vertex_t *a, const vertex_t *b,
       t->ca_len_sqr = ab_len_sqr;
       t->cb_len_sqr = ac_len_sqr;
     } else { /* AB longest side => C remains C */
+      *a_vert = 0;
       t->a = dv_a;
-      t->b = dv_b;
-      t->c = dv_c;
       t->ab = ab;
       __neg_v(ac,t->ca);
       __neg_v(bc,t->cb);
@@ -697,22 +815,18 @@ static void init_triangle(const vertex_t *a, const vertex_t *b,
     t->normal.x = 0;
     t->normal.y = 0;
     t->normal.z = 0;
-    t->s_area = 0;
+    s_area = 0;
   } else {
     __prod_dv(1/n_len,t->normal,t->normal);
-    t->s_area = n_len*0.5;
+    s_area = n_len*0.5;
   }
   /* Get planes trough sides */
   __crossprod_dv(t->ab,t->normal,t->nhsab);
   __crossprod_dv(t->normal,t->cb,t->nhsbc);
   __crossprod_dv(t->ca,t->normal,t->nhsca);
-  /* Get constants for plane equations */
-  t->chsab = __scalprod_v(t->a,t->nhsab);
-  t->chsca = __scalprod_v(t->a,t->nhsca);
-  t->chsbc = __scalprod_v(t->b,t->nhsbc);
   /* Miscellaneous fields */
   t->obtuse_at_c = (t->ab_len_sqr > t->ca_len_sqr+t->cb_len_sqr);
-  t->a_n = __scalprod_v(t->a,t->normal);
+  return s_area;
 }
 
 /* Compute the square of the distance between point 'p' and triangle 't' in 3D
@@ -723,7 +837,7 @@ static double dist_sqr_pt_triag(const struct triangle_info *t,
 {
   double dpp;             /* (signed) distance point to ABC plane */
   double ap_ab,cp_cb,cp_ca; /* scalar products */
-  dvertex_t ap,cp;        /* Point to point vectors */
+  dvertex_t ap,bp,cp;     /* Point to point vectors */
   double dmin_sqr;        /* minimum distance squared */
 
   /* NOTE: If the triangle has a obtuse angle (i.e. angle larger than 90
@@ -740,16 +854,18 @@ static double dist_sqr_pt_triag(const struct triangle_info *t,
    * minimum of the distance to the BC and CA segments (only BC is the angle
    * at C is not obtuse). Otherwise P is towards the triangle exterior from the
    * plane hsac and the distance from P to ABC is the distance to the CA
-   * segment. */
+   * segment. The side of each plane is given by the sign of the scalar
+   * product of its normal with the vector from A or C (which lie on the
+   * planes) to P. */
 
-  /* NOTE: if the triangle is degenerate t->npab and t->cpab are identically
-   * (0,0,0), so first 'if' test is true (other 'if's never get degenerated
+  /* NOTE: if the triangle is degenerate t->nhsab is identically (0,0,0), so
+   * first 'if' test is true (other 'if's never get degenerated
    * triangles). Furthermore, if the AB side is degenerate (that is the
    * triangle degenerates to a point since AB is longest side) t->ab is
    * identically (0,0,0) also and the distance to A is calculated. */
-  if (scalprod_dv(p,&(t->nhsab)) >= t->chsab) {
+  substract_dv(p,&(t->a),&ap);
+  if (__scalprod_v(ap,t->nhsab) >= 0) {
     /* P in the exterior side of hsab plane => closest to AB */
-    substract_dv(p,&(t->a),&ap);
     ap_ab = __scalprod_v(ap,t->ab);
     if(ap_ab > 0) {
       if (ap_ab < t->ab_len_sqr) { /* projection of P on AB is in AB */
@@ -757,14 +873,16 @@ static double dist_sqr_pt_triag(const struct triangle_info *t,
         if (dmin_sqr < 0) dmin_sqr = 0; /* correct rounding problems */
         return dmin_sqr;
       } else { /* B is closer */
-        return dist2_dv(p,&(t->b));
+        __substract_v(ap,t->ab,bp);
+        return __norm2_v(bp);
       }
     } else { /* A is closer */
       return __norm2_v(ap);
     }
-  } else if (scalprod_dv(p,&(t->nhsbc)) >= t->chsbc) {
+  }
+  __add_v(ap,t->ca,cp); /* CP = AP+CA */
+  if (__scalprod_v(cp,t->nhsbc) >= 0) {
     /* P in the exterior side of hsbc plane => closest to BC or AC */
-    substract_dv(p,&(t->c),&cp);
     cp_cb = __scalprod_v(cp,t->cb);
     if(cp_cb > 0) {
       if (cp_cb < t->cb_len_sqr) { /* projection of P on BC is in BC */
@@ -772,7 +890,8 @@ static double dist_sqr_pt_triag(const struct triangle_info *t,
         if (dmin_sqr < 0) dmin_sqr = 0; /* correct rounding problems */
         return dmin_sqr;
       } else { /* B is closer */
-        return dist2_dv(p,&(t->b));
+        __substract_v(cp,t->cb,bp);
+        return __norm2_v(bp);
       }
     } else if (!t->obtuse_at_c) { /* C is closer */
       return __norm2_v(cp);
@@ -784,15 +903,14 @@ static double dist_sqr_pt_triag(const struct triangle_info *t,
           if (dmin_sqr < 0) dmin_sqr = 0; /* correct rounding problems */
           return dmin_sqr;
         } else { /* A is closer */
-          return dist2_dv(p,&(t->a));
+          return __norm2_v(ap);
         }
       } else { /* C is closer */
         return __norm2_v(cp);
       }
     }
-  } else if (scalprod_dv(p,&(t->nhsca)) >= t->chsca) {
+  } else if (__scalprod_v(cp,t->nhsca) >= 0) {
     /* P in the exterior side of hsca plane => closest to AC */
-    substract_dv(p,&(t->c),&cp);
     cp_ca = __scalprod_v(cp,t->ca);
     if(cp_ca > 0) {
       if (cp_ca < t->ca_len_sqr) { /* projection of P on AC is in AC */
@@ -800,17 +918,81 @@ static double dist_sqr_pt_triag(const struct triangle_info *t,
         if (dmin_sqr < 0) dmin_sqr = 0; /* correct rounding problems */
         return dmin_sqr;
       } else { /* A is closer */
-        return dist2_dv(p,&(t->a));
+        return __norm2_v(ap);
       }
     } else { /* C is closer */
       return __norm2_v(cp);
     }
   } else { /* P projects into triangle */
-    dpp = scalprod_dv(p,&(t->normal))-t->a_n;
+    dpp = __scalprod_v(ap,t->normal);
     return dpp*dpp;
   }
 }
 
+/* Gets the closest point of triangle 't' to point 'p', as its barycentric
+ * coordinates relative to the B and C vertices, returned in '*wb' and '*wc'
+ * (the one relative to A is 1-*wb-*wc). The closest feature of 't' (one of
+ * the CPF_... values) is returned. The closest point is found as in
+ * dist_sqr_pt_triag(), see the comments there. This is only called for the
+ * closest triangle, so it is kept out of the faster dist_sqr_pt_triag(). */
+static int closest_pt_triag(const struct triangle_info *t,
+                            const dvertex_t *p, double *wb, double *wc)
+{
+  double ap_ab,cp_cb,cp_ca; /* scalar products */
+  double d00,d01,d11,d20,d21,den; /* for the interior barycentric coords */
+  dvertex_t ap,cp;        /* Point to point vectors */
+
+  *wb = 0;
+  *wc = 0;
+  substract_dv(p,&(t->a),&ap);
+  if (__scalprod_v(ap,t->nhsab) >= 0) { /* closest to AB */
+    ap_ab = __scalprod_v(ap,t->ab);
+    if (ap_ab <= 0) return CPF_VTX_A;
+    if (ap_ab >= t->ab_len_sqr) {
+      *wb = 1;
+      return CPF_VTX_B;
+    }
+    *wb = ap_ab*t->ab_1_len_sqr;
+    return CPF_EDGE_AB;
+  }
+  __add_v(ap,t->ca,cp); /* CP = AP+CA */
+  if (__scalprod_v(cp,t->nhsbc) >= 0) { /* closest to BC or AC */
+    cp_cb = __scalprod_v(cp,t->cb);
+    if (cp_cb > 0) {
+      if (cp_cb >= t->cb_len_sqr) {
+        *wb = 1;
+        return CPF_VTX_B;
+      }
+      *wb = cp_cb*t->cb_1_len_sqr;
+      *wc = 1-*wb;
+      return CPF_EDGE_BC;
+    } else if (!t->obtuse_at_c) { /* C is closer */
+      *wc = 1;
+      return CPF_VTX_C;
+    }
+  } else if (__scalprod_v(cp,t->nhsca) < 0) { /* projects into triangle */
+    /* Solve AP = wb*AB+wc*AC in the ABC plane, with AC = -CA */
+    d00 = t->ab_len_sqr;
+    d01 = -__scalprod_v(t->ab,t->ca);
+    d11 = t->ca_len_sqr;
+    d20 = __scalprod_v(ap,t->ab);
+    d21 = -__scalprod_v(ap,t->ca);
+    den = d00*d11-d01*d01;
+    *wb = (d11*d20-d01*d21)/den;
+    *wc = (d00*d21-d01*d20)/den;
+    return CPF_FACE;
+  }
+  /* closest to AC */
+  cp_ca = __scalprod_v(cp,t->ca);
+  if (cp_ca <= 0) { /* C is closer */
+    *wc = 1;
+    return CPF_VTX_C;
+  }
+  if (cp_ca >= t->ca_len_sqr) return CPF_VTX_A;
+  *wc = 1-cp_ca*t->ca_1_len_sqr;
+  return CPF_EDGE_CA;
+}
+
 /* Calculates the square of the distance between a point p in cell
  * (gr_x,gr_y,gr_z) and cell cell_idx (linear index). The coordinates of p are
  * relative to the minimum X,Y,Z coordinates of the bounding box from where
@@ -847,9 +1029,23 @@ static INLINE double dist_sqr_pt_cell(const dvertex_t *p, int gr_x, int gr_y,
   return d2;
 }
 
+/* Frees the triangle list tl, as returned by model_to_triangle_list(). If
+ * tl is NULL nothing is done. */
+static void free_triangle_list(struct triangle_list *tl)
+{
+  if (tl == NULL) return;
+  free(tl->triangles);
+  free(tl->s_area);
+  free(tl->a_vert);
+  free(tl->pnormal);
+  free(tl);
+}
+
 /* Convert the triangular model m to a triangle list (without connectivity
  * information) with the associated information. All the information about the
- * triangles (i.e. fields of struct triangle_info) is computed. */
+ * triangles (i.e. fields of struct triangle_info and their area) is
+ * computed, except the pseudo-normals (see calc_pseudo_normals()). Returns
+ * NULL if out of memory. */
 static struct triangle_list* model_to_triangle_list(const struct model *m)
 {
   int i,n;
@@ -859,117 +1055,238 @@ static struct triangle_list* model_to_triangle_list(const struct model *m)
 
   /* Initialize and allocate storage */
   n = m->num_faces;
-  tl = xa_malloc(sizeof(*tl));
+  tl = calloc(1,sizeof(*tl));
+  if (tl == NULL) return NULL;
   tl->n_triangles = n;
-  triags = xa_malloc(sizeof(*tl->triangles)*n);
+  triags = malloc(sizeof(*tl->triangles)*max(n,1));
   tl->triangles = triags;
-  tl->area = 0;
+  tl->s_area = malloc(sizeof(*tl->s_area)*max(n,1));
+  tl->a_vert = malloc(sizeof(*tl->a_vert)*max(n,1));
+  if (triags == NULL || tl->s_area == NULL || tl->a_vert == NULL) {
+    free_triangle_list(tl);
+    return NULL;
+  }
 
   /* Convert triangles and update global data */
   for (i=0; i<n; i++) {
     face_i = &(m->faces[i]);
-    init_triangle(&(m->vertices[face_i->f0]),&(m->vertices[face_i->f1]),
-                  &(m->vertices[face_i->f2]),&(triags[i]));
-    tl->area += triags[i].s_area;
+    tl->s_area[i] = init_triangle(&(m->vertices[face_i->f0]),
+                                  &(m->vertices[face_i->f1]),
+                                  &(m->vertices[face_i->f2]),&(triags[i]),
+                                  &(tl->a_vert[i]));
+    tl->area += tl->s_area[i];
   }
 
   return tl;
 }
 
-/* Calculates the statistics of the error samples in tse. For each triangle
- * formed by neighboring samples the error at the vertices is averaged to
- * obtain a single error for the sample triangle. The overall mean error is
- * obtained by calculating the mean of the errors of the sample triangles. The
- * other statistics are obtained analogously. Note that all sample triangles
- * have exactly the same area, and thus the calculation is independent of the
- * triangle shape. The overall statistics in dss_stats and m_stats are updated
+/* Stores in *pn the sum of the normals of the triangles of tl that share the
+ * edge between the vertices v0 and v1 of model m (the triangles of tl being
+ * the faces of m). The list of faces incident on each vertex is flist. Each
+ * triangle has an angle of pi at the edge, so this is the angle weighted
+ * pseudo-normal of the edge. */
+static void edge_pseudo_normal(const struct model *m,
+                               const struct triangle_list *tl,
+                               const struct face_lists *flist, int v0, int v1,
+                               dvertex_t *pn)
+{
+  const face_t *face;
+  int i,k;
+
+  pn->x = 0;
+  pn->y = 0;
+  pn->z = 0;
+  for (i=flist->start[v0]; i<flist->start[v0+1]; i++) {
+    k = flist->face[i];
+    face = &(m->faces[k]);
+    if (face->f0 == v1 || face->f1 == v1 || face->f2 == v1) {
+      __add_v(*pn,tl->triangles[k].normal,*pn);
+    }
+  }
+}
+
+/* Calculates the angle weighted pseudo-normals of the vertices and edges of
+ * the triangles of tl, which are the faces of model m, and stores them in
+ * tl->pnormal. The pseudo-normal of a vertex is the sum of the normals of
+ * its incident faces, each weighted by the face angle at the vertex. The
+ * sign of the scalar product of the pseudo-normal of the closest feature
+ * with the vector from the closest point to a point is the side of the
+ * surface where the point is, even at the edges and vertices. Returns zero
+ * on success and MESH_NO_MEM if out of memory, in which case tl->pnormal is
+ * NULL. */
+static int calc_pseudo_normals(struct triangle_list *tl,
+                               const struct model *m)
+{
+  dvertex_t *v_pn;          /* the pseudo-normal of each vertex of m */
+  struct face_lists *flist; /* the faces incident on each vertex */
+  dvertex_t v[3];           /* the face vertices */
+  dvertex_t e1,e2,n;        /* sides from a vertex and their crossproduct */
+  dvertex_t *pn;            /* the pseudo-normals of the current triangle */
+  int vidx[3];              /* the face vertex indices */
+  int i,j,k,n_degenerate;
+  double angle;
+
+  tl->pnormal = NULL;
+  v_pn = calloc(max(m->num_vert,1),sizeof(*v_pn));
+  if (v_pn == NULL) return MESH_NO_MEM;
+  for (k=0; k<tl->n_triangles; k++) {
+    if (tl->s_area[k] == 0) continue; /* degenerate, no normal */
+    vertex_f2d_dv(&(m->vertices[m->faces[k].f0]),&(v[0]));
+    vertex_f2d_dv(&(m->vertices[m->faces[k].f1]),&(v[1]));
+    vertex_f2d_dv(&(m->vertices[m->faces[k].f2]),&(v[2]));
+    vidx[0] = m->faces[k].f0;
+    vidx[1] = m->faces[k].f1;
+    vidx[2] = m->faces[k].f2;
+    for (j=0; j<3; j++) {
+      __substract_v(v[(j+1)%3],v[j],e1);
+      __substract_v(v[(j+2)%3],v[j],e2);
+      __crossprod_dv(e1,e2,n);
+      angle = atan2(sqrt(__norm2_v(n)),__scalprod_v(e1,e2));
+      __prod_dv(angle,tl->triangles[k].normal,n);
+      __add_v(v_pn[vidx[j]],n,v_pn[vidx[j]]);
+    }
+  }
+  flist = faces_of_vertex(m,1,&n_degenerate);
+  tl->pnormal = malloc(6*max(tl->n_triangles,1)*sizeof(*(tl->pnormal)));
+  if (flist == NULL || tl->pnormal == NULL) {
+    free_face_lists(flist);
+    free(tl->pnormal);
+    tl->pnormal = NULL;
+    free(v_pn);
+    return MESH_NO_MEM;
+  }
+  for (k=0; k<tl->n_triangles; k++) {
+    vidx[0] = m->faces[k].f0;
+    vidx[1] = m->faces[k].f1;
+    vidx[2] = m->faces[k].f2;
+    i = tl->a_vert[k];
+    pn = tl->pnormal+6*k;
+    pn[CPF_VTX_A] = v_pn[vidx[i]];
+    pn[CPF_VTX_B] = v_pn[vidx[(i+1)%3]];
+    pn[CPF_VTX_C] = v_pn[vidx[(i+2)%3]];
+    edge_pseudo_normal(m,tl,flist,vidx[i],vidx[(i+1)%3],&(pn[CPF_EDGE_AB]));
+    edge_pseudo_normal(m,tl,flist,vidx[(i+1)%3],vidx[(i+2)%3],
+                       &(pn[CPF_EDGE_BC]));
+    edge_pseudo_normal(m,tl,flist,vidx[(i+2)%3],vidx[i],&(pn[CPF_EDGE_CA]));
+  }
+  free_face_lists(flist);
+  free(v_pn);
+  return 0;
+}
+
+/* Calculates the statistics of the error samples of a triangle with n
+ * samples in each direction, which are given in s_err in the order of the
+ * samples of sample_triangle(), the one of the serror field of struct
+ * face_error. For each triangle formed by neighboring samples the error at
+ * the vertices is averaged to obtain a single error for the sample
+ * triangle. The overall mean error is obtained by calculating the mean of
+ * the errors of the sample triangles. The other statistics are obtained
+ * analogously. Note that all sample triangles have exactly the same area,
+ * and thus the calculation is independent of the triangle shape. The
+ * overall statistics in dss_stats are updated
  * (dss_stats->mean_dist is cumulated with the total error and
  * dss_stats->rms_dist is cumulated with the total squared error, instead of
- * being really updated).  */
-static void error_stat_triag(const struct triag_sample_error *tse,
+ * being really updated). If dss_stats->is_signed is set the errors are
+ * signed, the statistics in fe are of the signed errors and those in
+ * dss_stats of their absolute value, except for the signed ones
+ * (dss_stats->mean_sdist is cumulated as dss_stats->mean_dist). */
+static void error_stat_triag(const double *s_err, int n,
                              struct face_error *fe,
-                             struct dist_surf_surf_stats *dss_stats,
-                             struct misc_stats *m_stats)
+                             struct dist_surf_surf_stats *dss_stats)
 {
-  int n,n_tot,i,j,imax,jmax;
-  double err_local;
-  double err_a,err_b,err_c;
+  int i,j,m;
+  double err_a,err_b,err_c,err_d;     /* errors at the sample triangles */
+  double abs_a,abs_b,abs_c,abs_d;     /* their absolute values */
   double err_min, err_max, err_tot, err_sqr_tot;
-  double **s_err;
+  double abs_min, abs_max, abs_tot; /* same for the absolute errors */
+  const double *row_i,*row_i1; /* two consecutive sample rows in s_err */
 
-  n = tse->n_samples;
   fe->sample_freq = n;
   dss_stats->m1_area += fe->face_area;
   if (n == 0) { /* no samples in this triangle */
     return;
   }
-  n_tot = tse->n_samples_tot;
   dss_stats->st_m1_area += fe->face_area;
-  if (m_stats->dist_smpl_sz < n_tot+dss_stats->m1_samples) {
-    m_stats->dist_smpl_sz += (m_stats->dist_smpl_sz+3)/4; /* 25% increase */
-    if (m_stats->dist_smpl_sz < n_tot+dss_stats->m1_samples) {
-      m_stats->dist_smpl_sz = n_tot+dss_stats->m1_samples;
-    }
-    m_stats->dist_smpl = xa_realloc(m_stats->dist_smpl,
-                                    sizeof(*(m_stats->dist_smpl))*
-                                    m_stats->dist_smpl_sz);
-  }
-  memcpy(m_stats->dist_smpl+dss_stats->m1_samples,
-         tse->err_lin,sizeof(*(m_stats->dist_smpl))*n_tot);
-  dss_stats->m1_samples += n_tot;
   /* NOTE: In a triangle with values at the vertex e1, e2 and e3 and using
    * linear interpolation to obtain the values within the triangle, the mean
    * value (i.e. integral of the value divided by the surface) is
    * (e1+e2+e3)/3; and the squared mean value (i.e. integral of the squared
    * value divided by the surface) is (e1^2+e2^2+e3^2+e1*e2+e2*e3+e1*e3)/6. */
   err_min = DBL_MAX;
-  err_max = 0;
+  err_max = -DBL_MAX;
   err_tot = 0;
   err_sqr_tot = 0;
-  s_err = tse->err;
-  /* Do sample triangles for which the point (i,j) is closer to the point
-   * (0,0) than the side of the sample triangle opposite (i,j). There are
-   * (n-1)*n/2 of these. */
-  for (i=0, imax=n-1; i<imax; i++) {
-    for (j=0, jmax=imax-i; j<jmax; j++) {
-      err_a = s_err[i][j];
-      err_b = s_err[i][j+1];
-      err_c = s_err[i+1][j];
-      err_tot += err_a+err_b+err_c;
-      err_sqr_tot += err_a*(err_a+err_b+err_c)+err_b*(err_b+err_c)+err_c*err_c;
-    }
-  }
-  /* Do the other triangles. There are (n-2)*(n-1)/2 of these. */
-  for (i=1; i<n; i++) {
-    for (j=1, jmax=n-i; j<jmax; j++) {
-      err_a = s_err[i-1][j];
-      err_b = s_err[i][j-1];
-      err_c = s_err[i][j];
-      err_tot += err_a+err_b+err_c;
-      err_sqr_tot += err_a*(err_a+err_b+err_c)+err_b*(err_b+err_c)+err_c*err_c;
-    }
-  }
-  /* Get min max */
-  for (i=0; i<tse->n_samples_tot; i++) {
-    err_local = tse->err_lin[i];
-    if (err_min > err_local) err_min = err_local;
-    if (err_max < err_local) err_max = err_local;
+  abs_min = DBL_MAX;
+  abs_max = 0;
+  abs_tot = 0;
+#define EST_MINMAX(e,ae)                              \
+  do {                                                \
+    if (err_min > (e)) err_min = (e);                 \
+    if (err_max < (e)) err_max = (e);                 \
+    if (abs_min > (ae)) abs_min = (ae);               \
+    if (abs_max < (ae)) abs_max = (ae);               \
+  } while (0)
+  /* Single pass over the rows. Row i has m+1 = n-i samples and row i+1 has
+   * m samples. Between them lie the m sample triangles (i,j), (i,j+1),
+   * (i+1,j) with j from 0 to m-1 and the m-1 sample triangles (i,j),
+   * (i+1,j-1), (i+1,j) with j from 1 to m-1. They are done in the same
+   * loop over j, along with the min and max of row i, carrying the errors
+   * at (i,j+1) and (i+1,j) over to the next j so that each sample is
+   * loaded once per row pair. */
+  for (i=0, row_i=s_err; i<n; i++, row_i=row_i1) {
+    m = n-i-1;
+    row_i1 = row_i+(m+1);
+    err_a = row_i[0];
+    abs_a = fabs(err_a);
+    EST_MINMAX(err_a,abs_a);
+    if (m == 0) continue; /* last row, with a single sample */
+    err_b = row_i[1];
+    abs_b = fabs(err_b);
+    err_d = row_i1[0];
+    abs_d = fabs(err_d);
+    err_tot += err_a+err_b+err_d;
+    err_sqr_tot += err_a*(err_a+err_b+err_d)+err_b*(err_b+err_d)+err_d*err_d;
+    abs_tot += abs_a+abs_b+abs_d;
+    for (j=1; j<m; j++) {
+      err_a = err_b;
+      abs_a = abs_b;
+      err_c = err_d;
+      abs_c = abs_d;
+      err_b = row_i[j+1];
+      abs_b = fabs(err_b);
+      err_d = row_i1[j];
+      abs_d = fabs(err_d);
+      EST_MINMAX(err_a,abs_a);
+      err_tot += (err_a+err_d)*2+err_b+err_c;
+      err_sqr_tot += err_a*(2*(err_a+err_d)+err_b+err_c)+
+        err_d*(2*err_d+err_b+err_c)+err_b*err_b+err_c*err_c;
+      abs_tot += (abs_a+abs_d)*2+abs_b+abs_c;
+    }
+    EST_MINMAX(err_b,abs_b);
   }
+#undef EST_MINMAX
   /* Finalize error measures */
   fe->min_error = err_min;
   fe->max_error = err_max;
   if (n != 1) { /* normal case, (n-1)*n/2+(n-2)*(n-1)/2 = (n-1)*(n-1) */
     fe->mean_error = err_tot/((n-1)*(n-1)*3);
     fe->mean_sqr_error = err_sqr_tot/((n-1)*(n-1)*6);
+    abs_tot /= (n-1)*(n-1)*3;
   } else { /* special case */
-    fe->mean_error = tse->err_lin[0];
-    fe->mean_sqr_error = tse->err_lin[0]*tse->err_lin[0];
+    fe->mean_error = s_err[0];
+    fe->mean_sqr_error = s_err[0]*s_err[0];
+    abs_tot = fabs(s_err[0]);
   }
   /* Update overall statistics */
-  if (err_min < dss_stats->min_dist) dss_stats->min_dist = err_min;
-  if (err_max > dss_stats->max_dist) dss_stats->max_dist = err_max;
-  dss_stats->mean_dist += fe->mean_error*fe->face_area;
+  if (abs_min < dss_stats->min_dist) dss_stats->min_dist = abs_min;
+  if (abs_max > dss_stats->max_dist) dss_stats->max_dist = abs_max;
+  dss_stats->mean_dist += abs_tot*fe->face_area;
   dss_stats->rms_dist += fe->mean_sqr_error*fe->face_area;
+  if (dss_stats->is_signed) {
+    if (err_min < dss_stats->min_sdist) dss_stats->min_sdist = err_min;
+    if (err_max > dss_stats->max_sdist) dss_stats->max_sdist = err_max;
+    dss_stats->mean_sdist += fe->mean_error*fe->face_area;
+  }
 }
 
 /* Samples a triangle (a,b,c) using n samples in each direction. The sample
@@ -980,19 +1297,26 @@ static void error_stat_triag(const struct triag_sample_error *tse,
  * followed by all samples for i equal 1 and j from 0 to n-2, and so on, where
  * i and j are the sampling indices along the ab and ac sides,
  * respectively. As a special case, if n equals 1, the triangle middle point
- * is used as the sample. */
-static void sample_triangle(const dvertex_t *a, const dvertex_t *b, 
-			    const dvertex_t *c, int n, struct sample_list* s)
+ * is used as the sample. Returns zero on success and MESH_NO_MEM if out of
+ * memory, in which case s has no samples. */
+static int sample_triangle(const dvertex_t *a, const dvertex_t *b, 
+                           const dvertex_t *c, int n, struct sample_list* s)
 {
   dvertex_t u,v;     /* basis parametrization vectors */
   dvertex_t a_cache; /* local (on stack) copy of a for faster access */
   int i,j,maxj,k;    /* counters and limits */
+  dvertex_t *sample;
 
   /* initialize */
   s->n_samples = n*(n+1)/2;
-  if (n == 0) return;
+  if (n == 0) return 0;
   if (s->buf_sz < s->n_samples) {
-    s->sample = xa_realloc(s->sample,sizeof(*(s->sample))*s->n_samples);
+    sample = realloc(s->sample,sizeof(*sample)*s->n_samples);
+    if (sample == NULL) {
+      s->n_samples = 0;
+      return MESH_NO_MEM;
+    }
+    s->sample = sample;
     s->buf_sz = s->n_samples;
   }
   if (n != 1) { /* normal case */
@@ -1015,13 +1339,149 @@ static void sample_triangle(const dvertex_t *a, const dvertex_t *b,
     s->sample[0].y = 1/3.0*(a->y+b->y+c->y);
     s->sample[0].z = 1/3.0*(a->z+b->z+c->z);
   }
+  return 0;
+}
+
+/* Gets the cells of the grid that triangle t intersects. The size of the
+ * grid is given by grid_sz, the side length of the cubic cells by cell_sz
+ * and the minimum coordinates of the bounding box (i.e. origin) of the grid
+ * by bbox_min. The linear indices of the cells are stored in *c_buf, which
+ * is realloc'ed as necessary (its size in elements is *c_buf_sz), and their
+ * number is returned. Consecutive indices are different, but a cell can
+ * appear more than once. The sample list sl is used as temporary storage. If
+ * out of memory MESH_NO_MEM is returned. */
+static int triangle_cells(const struct triangle_info *t,
+                          struct size3d grid_sz, double cell_sz,
+                          dvertex_t bbox_min, struct sample_list *sl,
+                          int **c_buf, int *c_buf_sz)
+{
+  int cell_idx,cell_idx_prev; /* linear (1D) cell indices */
+  int cell_stride_z;          /* spacement for Z index in 3D addressing of
+                               * cell list */
+  int j,h;                    /* counters */
+  int m_a,n_a,o_a,m_b,n_b,o_b,m_c,n_c,o_c; /* 3D cell indices for vertices */
+  int tmpi,max_cell_dist;     /* maximum cell distance along any axis */
+  int n_samples;              /* number of samples to use for triangles */
+  int m,n,o;                  /* 3D cell indices for samples */
+  dvertex_t a,b,c;            /* the triangle vertices */
+  int *new_buf;
+
+  /* Get the cells in which the triangle vertices are. For non-negative
+   * values, cast to int is equivalent to floor and probably faster (here
+   * negative values can not happen since bounding box is obtained from the
+   * vertices in tl). Only A is stored, B and C are derived from it (the
+   * float vertices converted to double are recovered exactly). */
+  cell_stride_z = grid_sz.x*grid_sz.y;
+  a = t->a;
+  __add_v(a,t->ab,b);
+  __substract_v(a,t->ca,c);
+  m_a = (int)((a.x-bbox_min.x)/cell_sz);
+  n_a = (int)((a.y-bbox_min.y)/cell_sz);
+  o_a = (int)((a.z-bbox_min.z)/cell_sz);
+  m_b = (int)((b.x-bbox_min.x)/cell_sz);
+  n_b = (int)((b.y-bbox_min.y)/cell_sz);
+  o_b = (int)((b.z-bbox_min.z)/cell_sz);
+  m_c = (int)((c.x-bbox_min.x)/cell_sz);
+  n_c = (int)((c.y-bbox_min.y)/cell_sz);
+  o_c = (int)((c.z-bbox_min.z)/cell_sz);
+
+  if (*c_buf_sz < 1) {
+    if ((new_buf = realloc(*c_buf,sizeof(**c_buf))) == NULL) {
+      return MESH_NO_MEM;
+    }
+    *c_buf = new_buf;
+    *c_buf_sz = 1;
+  }
+  if (m_a == m_b && m_a == m_c && n_a == n_b && n_a == n_c &&
+      o_a == o_b && o_a == o_c) {
+    /* The ABC triangle fits entirely into one cell => fast case */
+    cell_idx = m_a+n_a*grid_sz.x+o_a*cell_stride_z;
+    assert(cell_idx >= 0 && cell_idx < grid_sz.x*grid_sz.y*grid_sz.z);
+    (*c_buf)[0] = cell_idx;
+    return 1;
+  }
+
+  /* Triangle does not fit in one cell, how many cells does the triangle
+   * span ? */
+  max_cell_dist = abs(m_a-m_b);
+  if ((tmpi = abs(m_a-m_c)) > max_cell_dist) max_cell_dist = tmpi;
+  if ((tmpi = abs(m_b-m_c)) > max_cell_dist) max_cell_dist = tmpi;
+  if ((tmpi = abs(n_a-n_b)) > max_cell_dist) max_cell_dist = tmpi;
+  if ((tmpi = abs(n_a-n_c)) > max_cell_dist) max_cell_dist = tmpi;
+  if ((tmpi = abs(n_b-n_c)) > max_cell_dist) max_cell_dist = tmpi;
+  if ((tmpi = abs(o_a-o_b)) > max_cell_dist) max_cell_dist = tmpi;
+  if ((tmpi = abs(o_a-o_c)) > max_cell_dist) max_cell_dist = tmpi;
+  if ((tmpi = abs(o_b-o_c)) > max_cell_dist) max_cell_dist = tmpi;
+  /* Sample the triangle so as to have twice the samples in any direction
+   * than the number of cells spanned in that direction. */
+  n_samples = 2*(max_cell_dist+1);
+  if (sample_triangle(&a,&b,&c,n_samples,sl) != 0) return MESH_NO_MEM;
+  /* Get the intersecting cells from the samples */
+  cell_idx_prev = -1;
+  h = 0;
+  for(j=0;j<sl->n_samples;j++){
+    /* Get cell in which the sample is. Due to rounding in the triangle
+     * sampling process we check the indices to be within bounds. As above,
+     * we can use cast to int instead of floor (probably faster) */
+    m=(int)((sl->sample[j].x-bbox_min.x)/cell_sz);
+    if(m >= grid_sz.x) {
+      m = grid_sz.x - 1;
+    } else if (m < 0) {
+      m = 0;
+    }
+    n=(int)((sl->sample[j].y-bbox_min.y)/cell_sz);
+    if (n >= grid_sz.y) {
+      n = grid_sz.y - 1;
+    } else if (n < 0) {
+      n = 0;
+    }
+    o=(int)((sl->sample[j].z-bbox_min.z)/cell_sz);
+    if (o >= grid_sz.z) {
+      o = grid_sz.z - 1;
+    } else if (o < 0) {
+      o = 0;
+    }
+
+    /* Include cell index in list only if not the same as previous one
+     * (avoid too many duplicates). */
+    cell_idx = m + n*grid_sz.x + o*cell_stride_z;
+    assert(cell_idx >= 0 && cell_idx < grid_sz.x*grid_sz.y*grid_sz.z);
+    if (cell_idx != cell_idx_prev) {
+      if (*c_buf_sz <= h) {
+        if ((new_buf = realloc(*c_buf,(h+1)*sizeof(**c_buf))) == NULL) {
+          return MESH_NO_MEM;
+        }
+        *c_buf = new_buf;
+        (*c_buf_sz)++;
+      }
+      (*c_buf)[h++] = cell_idx;
+      cell_idx_prev = cell_idx;
+    }
+  }
+  return h;
+}
+
+/* Frees the list of triangles in each cell fic, as returned by
+ * triangles_in_cells(). If fic is NULL nothing is done. */
+static void free_t_in_cell_list(struct t_in_cell_list *fic)
+{
+  int k,kmax;
+
+  if (fic == NULL) return;
+  for (k=0, kmax=fic->n_cells; k<kmax; k++) {
+    free(fic->triag_idx[k]);
+  }
+  free(fic->triag_idx);
+  free(fic->empty_cell);
+  free(fic);
 }
 
 /* Given a triangle list tl, returns the list of triangle indices that
  * intersect a cell, for each cell in the grid. The size of the grid is given
  * by grid_sz, the side length of the cubic cells by cell_sz and the minimum
  * coordinates of the bounding box (i.e. origin) of the grid by bbox_min. The
- * returned struct, its arrays and subarrays are malloc'ed independently. */
+ * returned struct, its arrays and subarrays are malloc'ed independently, see
+ * free_t_in_cell_list(). Returns NULL if out of memory. */
 static struct t_in_cell_list* 
 triangles_in_cells(const struct triangle_list *tl,
                    struct size3d grid_sz,
@@ -1035,120 +1495,40 @@ triangles_in_cells(const struct triangle_list *tl,
   int *nt;                    /* Array with the number of intersecting
                                * triangles found so far for each cell */
   ec_bitmap_t *ecb;           /* The empty cell bitmap */
-  int cell_idx,cell_idx_prev; /* linear (1D) cell indices */
-  int cell_stride_z;          /* spacement for Z index in 3D addressing of
-                               * cell list */
-  int i,j,h,imax;             /* counters and loop limits */
-  int m_a,n_a,o_a,m_b,n_b,o_b,m_c,n_c,o_c; /* 3D cell indices for vertices */
-  int tmpi,max_cell_dist;     /* maximum cell distance along any axis */
-  int n_samples;              /* number of samples to use for triangles */
-  int m,n,o;                  /* 3D cell indices for samples */
+  int cell_idx;               /* linear (1D) cell index */
+  int i,j,h,n_c,imax;         /* counters and loop limits */
   int *c_buf;                 /* temp storage for cell list */
   int c_buf_sz;               /* the size of c_buf */
+  int *cell_tl;               /* the new list of a cell */
 
   /* Initialize */
-  cell_stride_z = grid_sz.x*grid_sz.y;
   c_buf = NULL;
   c_buf_sz = 0;
   memset(&(sl.sample),0,sizeof(sl));
-  lst = xa_malloc(sizeof(*lst));
-  nt = xa_calloc(grid_sz.x*grid_sz.y*grid_sz.z,sizeof(*nt));
-  tab = xa_calloc(grid_sz.x*grid_sz.y*grid_sz.z,sizeof(*tab));
-  ecb = xa_calloc((grid_sz.x*grid_sz.y*grid_sz.z+EC_BITMAP_T_BITS-1)/
-                  EC_BITMAP_T_BITS,EC_BITMAP_T_SZ);
+  nt = calloc(grid_sz.x*grid_sz.y*grid_sz.z,sizeof(*nt));
+  lst = calloc(1,sizeof(*lst));
+  if (lst == NULL) goto no_mem;
+  tab = calloc(grid_sz.x*grid_sz.y*grid_sz.z,sizeof(*tab));
+  if (tab == NULL) goto no_mem;
   lst->triag_idx = tab;
   lst->n_cells = grid_sz.x*grid_sz.y*grid_sz.z;
+  ecb = calloc((grid_sz.x*grid_sz.y*grid_sz.z+EC_BITMAP_T_BITS-1)/
+               EC_BITMAP_T_BITS,EC_BITMAP_T_SZ);
   lst->empty_cell = ecb;
+  if (nt == NULL || ecb == NULL) goto no_mem;
 
-  /* Get intersecting cells for each triangle */
+  /* Get intersecting cells for each triangle and include the triangle in
+   * their lists, without duplicate. */
   for (i=0, imax=tl->n_triangles; i<imax;i++) {
-    /* Get the cells in which the triangle vertices are. For non-negative
-     * values, cast to int is equivalent to floor and probably faster (here
-     * negative values can not happen since bounding box is obtained from the
-     * vertices in tl). */
-    m_a = (int)((tl->triangles[i].a.x-bbox_min.x)/cell_sz);
-    n_a = (int)((tl->triangles[i].a.y-bbox_min.y)/cell_sz);
-    o_a = (int)((tl->triangles[i].a.z-bbox_min.z)/cell_sz);
-    m_b = (int)((tl->triangles[i].b.x-bbox_min.x)/cell_sz);
-    n_b = (int)((tl->triangles[i].b.y-bbox_min.y)/cell_sz);
-    o_b = (int)((tl->triangles[i].b.z-bbox_min.z)/cell_sz);
-    m_c = (int)((tl->triangles[i].c.x-bbox_min.x)/cell_sz);
-    n_c = (int)((tl->triangles[i].c.y-bbox_min.y)/cell_sz);
-    o_c = (int)((tl->triangles[i].c.z-bbox_min.z)/cell_sz);
-
-    if (m_a == m_b && m_a == m_c && n_a == n_b && n_a == n_c &&
-        o_a == o_b && o_a == o_c) {
-      /* The ABC triangle fits entirely into one cell => fast case */
-      cell_idx = m_a+n_a*grid_sz.x+o_a*cell_stride_z;
-      assert(cell_idx >= 0 && cell_idx < grid_sz.x*grid_sz.y*grid_sz.z);
-      tab[cell_idx] = xa_realloc(tab[cell_idx],(nt[cell_idx]+2)*sizeof(**tab));
-      tab[cell_idx][nt[cell_idx]++] = i;
-      continue;
-    }
-
-    /* Triangle does not fit in one cell, how many cells does the triangle
-     * span ? */
-    max_cell_dist = abs(m_a-m_b);
-    if ((tmpi = abs(m_a-m_c)) > max_cell_dist) max_cell_dist = tmpi;
-    if ((tmpi = abs(m_b-m_c)) > max_cell_dist) max_cell_dist = tmpi;
-    if ((tmpi = abs(n_a-n_b)) > max_cell_dist) max_cell_dist = tmpi;
-    if ((tmpi = abs(n_a-n_c)) > max_cell_dist) max_cell_dist = tmpi;
-    if ((tmpi = abs(n_b-n_c)) > max_cell_dist) max_cell_dist = tmpi;
-    if ((tmpi = abs(o_a-o_b)) > max_cell_dist) max_cell_dist = tmpi;
-    if ((tmpi = abs(o_a-o_c)) > max_cell_dist) max_cell_dist = tmpi;
-    if ((tmpi = abs(o_b-o_c)) > max_cell_dist) max_cell_dist = tmpi;
-    /* Sample the triangle so as to have twice the samples in any direction
-     * than the number of cells spanned in that direction. */
-    n_samples = 2*(max_cell_dist+1);
-    sample_triangle(&(tl->triangles[i].a),&(tl->triangles[i].b),
-                    &(tl->triangles[i].c),n_samples,&sl);
-    /* Get the intersecting cells from the samples */
-    cell_idx_prev = -1;
-    h = 0;
-    for(j=0;j<sl.n_samples;j++){
-      /* Get cell in which the sample is. Due to rounding in the triangle
-       * sampling process we check the indices to be within bounds. As above,
-       * we can use cast to int instead of floor (probably faster) */
-      m=(int)((sl.sample[j].x-bbox_min.x)/cell_sz);
-      if(m >= grid_sz.x) {
-        m = grid_sz.x - 1;
-      } else if (m < 0) {
-        m = 0;
-      }
-      n=(int)((sl.sample[j].y-bbox_min.y)/cell_sz);
-      if (n >= grid_sz.y) {
-        n = grid_sz.y - 1;
-      } else if (n < 0) {
-        n = 0;
-      }
-      o=(int)((sl.sample[j].z-bbox_min.z)/cell_sz);
-      if (o >= grid_sz.z) {
-        o = grid_sz.z - 1;
-      } else if (o < 0) {
-        o = 0;
-      }
-
-      /* Include cell index in list only if not the same as previous one
-       * (avoid too many duplicates). */
-      cell_idx = m + n*grid_sz.x + o*cell_stride_z;
-      assert(cell_idx >= 0 && cell_idx < grid_sz.x*grid_sz.y*grid_sz.z);
-      if (cell_idx != cell_idx_prev) {
-        if (c_buf_sz <= h) {
-          c_buf = xa_realloc(c_buf, (h+1)*sizeof(*c_buf));
-          c_buf_sz++;
-        }
-        c_buf[h++] = cell_idx;
-        cell_idx_prev = cell_idx;
-      }
-    }
-
-    /* Include triangle in intersecting cell lists, without duplicate. */
-    for (j=0; j<h; j++) {
+    n_c = triangle_cells(&(tl->triangles[i]),grid_sz,cell_sz,bbox_min,&sl,
+                         &c_buf,&c_buf_sz);
+    if (n_c < 0) goto no_mem;
+    for (j=0; j<n_c; j++) {
       cell_idx = c_buf[j];
-      assert(cell_idx >= 0 && cell_idx < grid_sz.x*grid_sz.y*grid_sz.z);
       if (nt[cell_idx] == 0 || tab[cell_idx][nt[cell_idx]-1] != i) {
-        tab[cell_idx] = xa_realloc(tab[cell_idx],
-                                   (nt[cell_idx]+2)*sizeof(**tab));
+        cell_tl = realloc(tab[cell_idx],(nt[cell_idx]+2)*sizeof(**tab));
+        if (cell_tl == NULL) goto no_mem;
+        tab[cell_idx] = cell_tl;
         tab[cell_idx][nt[cell_idx]++] = i;
       }
     }
@@ -1166,45 +1546,231 @@ triangles_in_cells(const struct triangle_list *tl,
   }
 
   lst->n_ne_cells = j;
-  lst->n_t_per_ne_cell = (double)h/j;
+  lst->n_t_per_ne_cell = (j > 0) ? (double)h/j : 0;
   free(nt);
   free(sl.sample);
   free(c_buf);
   return lst;
+
+ no_mem:
+  free(nt);
+  free(sl.sample);
+  free(c_buf);
+  free_t_in_cell_list(lst);
+  return NULL;
+}
+
+/* Inserts triangle t in the list of cell cell_idx of fic, keeping it sorted
+ * and without duplicates. Returns one if it has been inserted, zero if it
+ * was already there and MESH_NO_MEM if out of memory. */
+static int cell_insert_triag(struct t_in_cell_list *fic, int cell_idx, int t)
+{
+  int *lst;
+  int i,n;
+
+  lst = fic->triag_idx[cell_idx];
+  if (lst == NULL) {
+    if ((lst = malloc(2*sizeof(*lst))) == NULL) return MESH_NO_MEM;
+    lst[0] = t;
+    lst[1] = -1;
+    fic->triag_idx[cell_idx] = lst;
+    EC_BITMAP_CLEAR_BIT(fic->empty_cell,cell_idx);
+    fic->n_ne_cells++;
+    return 1;
+  }
+  for (n=0; lst[n] >= 0; n++) {
+    if (lst[n] == t) return 0;
+  }
+  if ((lst = realloc(lst,(n+2)*sizeof(*lst))) == NULL) return MESH_NO_MEM;
+  for (i=n; i>0 && lst[i-1] > t; i--) {
+    lst[i] = lst[i-1];
+  }
+  lst[i] = t;
+  lst[n+1] = -1;
+  fic->triag_idx[cell_idx] = lst;
+  return 1;
+}
+
+/* Removes triangle t from the list of cell cell_idx of fic. Returns one if
+ * it has been removed and zero if it was not there. */
+static int cell_remove_triag(struct t_in_cell_list *fic, int cell_idx, int t)
+{
+  int *lst;
+  int i;
+
+  lst = fic->triag_idx[cell_idx];
+  if (lst == NULL) return 0;
+  for (i=0; lst[i] >= 0 && lst[i] != t; i++);
+  if (lst[i] < 0) return 0;
+  for (; lst[i] >= 0; i++) {
+    lst[i] = lst[i+1];
+  }
+  if (lst[0] < 0) { /* now empty */
+    free(lst);
+    fic->triag_idx[cell_idx] = NULL;
+    EC_BITMAP_SET_BIT(fic->empty_cell,cell_idx);
+    fic->n_ne_cells--;
+  }
+  return 1;
+}
+
+/* Returns non-zero if the point p falls in the cell grid of si. */
+static int pt_in_grid(const struct surf_index *si, const vertex_t *p)
+{
+  dvertex_t q;
+
+  vertex_f2d_dv(p,&q);
+  return q.x >= si->bbox_min.x && q.y >= si->bbox_min.y &&
+    q.z >= si->bbox_min.z &&
+    (int)((q.x-si->bbox_min.x)/si->cell_sz) < si->grid_sz.x &&
+    (int)((q.y-si->bbox_min.y)/si->cell_sz) < si->grid_sz.y &&
+    (int)((q.z-si->bbox_min.z)/si->cell_sz) < si->grid_sz.z;
+}
+
+/* Extends the box (bmin,bmax) to include the triangle t. */
+static void box_add_triag(const struct triangle_info *t, dvertex_t *bmin,
+                          dvertex_t *bmax)
+{
+  dvertex_t v[3];
+  int i;
+
+  v[0] = t->a;
+  __add_v(t->a,t->ab,v[1]);
+  __substract_v(t->a,t->ca,v[2]);
+  for (i=0; i<3; i++) {
+    bmin->x = min(bmin->x,v[i].x);
+    bmin->y = min(bmin->y,v[i].y);
+    bmin->z = min(bmin->z,v[i].z);
+    bmax->x = max(bmax->x,v[i].x);
+    bmax->y = max(bmax->y,v[i].y);
+    bmax->z = max(bmax->z,v[i].z);
+  }
+}
+
+/* Returns the squared distance from the point p to the box (bmin,bmax),
+ * which is zero if p is inside. */
+static double dist_sqr_pt_box(const dvertex_t *p, const dvertex_t *bmin,
+                              const dvertex_t *bmax)
+{
+  double d2,tmp;
+
+  d2 = 0;
+  if (p->x < bmin->x) {
+    tmp = bmin->x-p->x;
+    d2 += tmp*tmp;
+  } else if (p->x > bmax->x) {
+    tmp = p->x-bmax->x;
+    d2 += tmp*tmp;
+  }
+  if (p->y < bmin->y) {
+    tmp = bmin->y-p->y;
+    d2 += tmp*tmp;
+  } else if (p->y > bmax->y) {
+    tmp = p->y-bmax->y;
+    d2 += tmp*tmp;
+  }
+  if (p->z < bmin->z) {
+    tmp = bmin->z-p->z;
+    d2 += tmp*tmp;
+  } else if (p->z > bmax->z) {
+    tmp = p->z-bmax->z;
+    d2 += tmp*tmp;
+  }
+  return d2;
+}
+
+/* Returns the logarithmic histogram bin of v, as defined for struct
+ * dist_query_stats. */
+static int log_hist_bin(int v)
+{
+  int bin;
+
+  for (bin=0; v>0 && bin<DQS_HIST_BINS-1; bin++) {
+    v >>= 1;
+  }
+  return bin;
+}
+
+/* Adds the statistics of a distance query, which tested n_triag_scans
+ * triangles and scanned the cell rings from k_start to k_last, to qs. */
+static void update_query_stats(struct dist_query_stats *qs, int n_cell_scans,
+                               int n_cell_t_scans, int n_triag_scans,
+                               int k_start, int k_last)
+{
+  qs->n_queries++;
+  qs->n_cell_scans += n_cell_scans;
+  qs->n_cell_t_scans += n_cell_t_scans;
+  qs->n_triag_scans += n_triag_scans;
+  qs->sum_kmax += k_last;
+  qs->sum_kstart += k_start;
+  if (k_start > 0) qs->n_warm_starts++;
+  qs->hist_triags[log_hist_bin(n_triag_scans)]++;
+  qs->hist_kmax[min(k_last,DQS_HIST_BINS-1)]++;
+}
+
+/* Initializes the query state sq for distance queries on the surface index
+ * si. The state should be freed with free_surf_query(). Returns zero on
+ * success and MESH_NO_MEM if out of memory, in which case sq need not be
+ * freed. */
+static int init_surf_query(struct surf_query *sq, const struct surf_index *si)
+{
+  sq->si = si;
+  sq->dcl = calloc(si->grid_sz.x*si->grid_sz.y*si->grid_sz.z,
+                   sizeof(*(sq->dcl)));
+  sq->dcl_buf = NULL;
+  sq->dcl_buf_sz = 0;
+  sq->prev_p.x = 0;
+  sq->prev_p.y = 0;
+  sq->prev_p.z = 0;
+  sq->prev_d = 0;
+  sq->qs = NULL;
+  sq->last_triag = -1;
+  sq->error = 0;
+  return (sq->dcl != NULL) ? 0 : MESH_NO_MEM;
+}
+
+/* Frees the storage allocated by init_surf_query() for sq */
+static void free_surf_query(struct surf_query *sq)
+{
+  int i,k,kmax;
+  struct size3d grid_sz;
+
+  grid_sz = sq->si->grid_sz;
+  if (sq->dcl == NULL) return;
+  for (k=0, kmax=grid_sz.x*grid_sz.y*grid_sz.z; k<kmax; k++) {
+    if (sq->dcl[k].list != NULL) {
+      for (i=0; i<sq->dcl[k].n_dists; i++) {
+        free(sq->dcl[k].list[i].cell);
+      }
+      free(sq->dcl[k].list);
+    }
+  }
+  free(sq->dcl);
+  free(sq->dcl_buf);
+  sq->dcl = NULL;
+  sq->dcl_buf = NULL;
 }
 
-/* Returns the distance from point p to the surface defined by the triangle
- * list tl. The distance from a point to a surface is defined as the distance
- * from a point to the closest point on the surface. To speed up the search
- * for the closest triangle in the surface the bounding box of the model is
+/* Returns the distance from point p to the surface indexed by sq->si. The
+ * distance from a point to a surface is defined as the distance from a point
+ * to the closest point on the surface. To speed up the search for the
+ * closest triangle in the surface the bounding box of the index is
  * subdivided in cubic cells. The list of triangles that intersect each cell
- * is given by fic, as returned by the triangles_in_cells() function. The side
- * of the cubic cells is of length cell_sz, and there are
- * (grid_sz.x,grid_sz.y,grid_sz.z) cells in teh X,Y,Z directions. Cell (0,0,0)
- * starts at bbox_min, which is the minimum coordinates of the (axis aligned)
- * bounding box on which the grid is placed. If DO_DIST_T_SURF_STATS is
- * defined at compile time, the statistics stats are updated (no reset to zero
- * occurs, the counters are increased). The list of cells distant of k cells
- * in the X, Y or Z direction, for each cell, is cached in dcl, which must be
- * an array of length grid_sz.x*grid_sz.y*grid_sz.z and must be initialized to
- * all zero on the first call to this function. The distance obtained from a
- * previous point *prev_p is prev_d (it is used to minimize the work). For the
- * first call set prev_d as zero. The temporary buffer used to construct each
- * list in dcl is given by *dcl_buf (can be NULL) and its size (in elements)
- * by *dcl_buf_sz. If a larger buffer is required it is realloc'ed and the new
- * address and size are returned in *dcl_buf and *dcl_buf_sz. */
-static double dist_pt_surf(dvertex_t p, const struct triangle_list *tl,
-                           const struct t_in_cell_list *fic,
-#ifdef DO_DIST_PT_SURF_STATS
-                           struct dist_pt_surf_stats *stats,
-#endif
-                           struct size3d grid_sz, double cell_sz,
-                           dvertex_t bbox_min, struct dist_cell_lists *dcl,
-                           const dvertex_t *prev_p, double prev_d,
-                           int **dcl_buf, int *dcl_buf_sz)
+ * is given by sq->si->fic, as returned by the triangles_in_cells()
+ * function. The point p can be outside the bounding box of the grid. If
+ * sq->qs is not NULL the query statistics in it are updated. The list of
+ * cells distant of k cells in the X, Y or Z direction, for each cell, is
+ * cached in sq->dcl. The distance obtained from the previous point
+ * sq->prev_p is sq->prev_d (it is used to minimize the work), both are
+ * updated on return, as well as the index of the closest triangle
+ * sq->last_triag. If the query fails (out of memory, or no finite distance
+ * found) zero is returned and the error code is stored in sq->error. */
+static double dist_pt_surf(dvertex_t p, struct surf_query *sq)
 {
   dvertex_t p_rel;      /* coordinates of p relative to bbox_min */
   struct size3d grid_coord; /* coordinates of cell in which p is */
+  struct size3d grid_sz;/* number of cells in the X, Y and Z directions */
+  double cell_sz;       /* side length of the cubic cells */
   int k;                /* cell index distance of current scan */
   int kmax;             /* maximum limit for k (avoid infinite loops) */
   int cell_idx;         /* linear cell index */
@@ -1212,6 +1778,7 @@ static double dist_pt_surf(dvertex_t p, const struct triangle_list *tl,
   double dist_sqr;      /* current distance squared */
   double cell_sz_sqr;   /* cubic cell side length squared */
   int t_idx;            /* triangle index in triangle list */
+  int t_min_idx;        /* index of the closest triangle found so far */
   int cell_stride_z;    /* spacement for Z index in 3D addressing of cell
                          * list */
   int *cur_cell_tl;     /* list of triangles intersecting the current cell */
@@ -1219,63 +1786,93 @@ static double dist_pt_surf(dvertex_t p, const struct triangle_list *tl,
   int *cur_cell;        /* current cell in the list of cells to scan for the
                          * current k */
   int *end_cell;        /* one past the last cell in the current cell list */
-  ec_bitmap_t *fic_empty_cell; /* stack copy of fic->empty_cell (faster) */
   int **fic_triag_idx;  /* stack copy of fic->triag_idx (faster) */
+  struct dist_cell_lists *dcl; /* stack copy of sq->dcl */
   double dmin;          /* minimum possible distance to any triangle */
+  double d_out_sqr;     /* squared distance from p to the grid, if outside */
+  double tmp;
+  int k_start;          /* first value of k */
+  int n_cell_scans;     /* number of cells scanned, for statistics */
+  int n_cell_t_scans;   /* number of cells with triangles scanned, idem */
+  int n_triag_scans;    /* number of triangles scanned, idem */
 
   /* NOTE: tests have shown it is faster to scan each triangle, even
    * repeteadly, than to track which triangles have been scanned (too much
    * time spent initializing tracking info to zero). */
 
   /* Initialize */
+  grid_sz = sq->si->grid_sz;
+  cell_sz = sq->si->cell_sz;
   cell_stride_z = grid_sz.y*grid_sz.x;
-  triags = tl->triangles;
-  fic_empty_cell = fic->empty_cell;
-  fic_triag_idx = fic->triag_idx;
+  triags = sq->si->tl->triangles;
+  fic_triag_idx = sq->si->fic->triag_idx;
+  dcl = sq->dcl;
 
   /* Get relative coordinates of point */
-  __substract_v(p,bbox_min,p_rel);
-  /* Get the cell coordinates of where point is. Since the bounding box bbox
-   * is that of the model 2, the grid coordinates can be out of bounds (in
-   * which case we limit them) */
+  __substract_v(p,sq->si->bbox_min,p_rel);
+  /* Get the cell coordinates of where point is. The point can be outside of
+   * the grid, in which case we limit them and keep track of the distance
+   * from the point to the grid. */
+  d_out_sqr = 0;
   grid_coord.x = (int) floor(p_rel.x/cell_sz);
   if (grid_coord.x < 0) {
     grid_coord.x = 0;
+    d_out_sqr += p_rel.x*p_rel.x;
   } else if (grid_coord.x >= grid_sz.x) {
     grid_coord.x = grid_sz.x-1;
+    tmp = p_rel.x-grid_sz.x*cell_sz;
+    if (tmp > 0) d_out_sqr += tmp*tmp;
   }
   grid_coord.y = (int) floor(p_rel.y/cell_sz);
   if (grid_coord.y < 0) {
     grid_coord.y = 0;
+    d_out_sqr += p_rel.y*p_rel.y;
   } else if (grid_coord.y >= grid_sz.y) {
     grid_coord.y = grid_sz.y-1;
+    tmp = p_rel.y-grid_sz.y*cell_sz;
+    if (tmp > 0) d_out_sqr += tmp*tmp;
   }
   grid_coord.z = (int) floor(p_rel.z/cell_sz);
   if (grid_coord.z < 0) {
     grid_coord.z = 0;
+    d_out_sqr += p_rel.z*p_rel.z;
   } else if (grid_coord.z >= grid_sz.z) {
     grid_coord.z = grid_sz.z-1;
+    tmp = p_rel.z-grid_sz.z*cell_sz;
+    if (tmp > 0) d_out_sqr += tmp*tmp;
   }
 
   /* Determine starting k, based on previous point (which is typically close
-   * to current point) and its distance to closest triangle */
-  dmin = prev_d-dist_dv(&p,prev_p);
+   * to current point) and its distance to closest triangle. If the point is
+   * outside the grid the cells are further away than seen from the border
+   * cell in which we start, so the bound is reduced accordingly. */
+  dmin = sq->prev_d-dist_dv(&p,&(sq->prev_p));
+  if (d_out_sqr > 0) dmin -= sqrt(d_out_sqr);
   k = (int) floor(dmin*SQRT_1_3/cell_sz)-2;
   if (k <0) k = 0;
 
   /* Scan cells, at sequentially increasing index distance k */
   kmax = max3(grid_sz.x,grid_sz.y,grid_sz.z);
   if (k >= kmax) k = kmax-1;
+  k_start = k;
+  n_cell_scans = 0;
+  n_cell_t_scans = 0;
+  n_triag_scans = 0;
   dmin_sqr = DBL_MAX;
+  t_min_idx = -1;
   cell_sz_sqr = cell_sz*cell_sz;
   do {
     /* Get the list of cells at distance k in X Y or Z direction, which has
      * not been previously tested. Only non-empty cells are included in the
      * list. */
     cell_idx = grid_coord.x+grid_coord.y*grid_sz.x+grid_coord.z*cell_stride_z;
-    if (dcl[cell_idx].n_dists <= k || dcl[cell_idx].list == NULL) {
-      get_cells_at_distance(&(dcl[cell_idx]),grid_coord,grid_sz,k,fic,
-                            dcl_buf,dcl_buf_sz);
+    if ((dcl[cell_idx].n_dists <= k || dcl[cell_idx].list == NULL) &&
+        get_cells_at_distance(&(dcl[cell_idx]),grid_coord,grid_sz,k,
+                              sq->si->fic,&(sq->dcl_buf),
+                              &(sq->dcl_buf_sz)) != 0) {
+      sq->error = MESH_NO_MEM;
+      sq->last_triag = -1;
+      return 0;
     }
 
     /* Scan each (non-empty) cell in the compiled list */
@@ -1285,27 +1882,22 @@ static double dist_pt_surf(dvertex_t p, const struct triangle_list *tl,
       cell_idx = *cur_cell;
       /* If minimum distance from point to cell is larger than already
        * found minimum distance we can skip all triangles in the cell */
-#ifdef DO_DIST_PT_SURF_STATS
-      stats->n_cell_scans++;
-#endif
+      n_cell_scans++;
       if (dmin_sqr < dist_sqr_pt_cell(&p_rel,grid_coord.x,grid_coord.y,
                                       grid_coord.z,cell_idx,grid_sz.x,
                                       cell_stride_z,cell_sz)) {
         continue;
       }
       /* Scan all triangles (i.e. faces) in the cell */
-#ifdef DO_DIST_PT_SURF_STATS
-      stats->n_cell_t_scans++;
-#endif
+      n_cell_t_scans++;
       cur_cell_tl = fic_triag_idx[cell_idx];
       t_idx = *(cur_cell_tl++);
       do { /* cell has always one triangle at least, so do loop is OK */
-#ifdef DO_DIST_PT_SURF_STATS
-        stats->n_triag_scans++;
-#endif
+        n_triag_scans++;
         dist_sqr = dist_sqr_pt_triag(&triags[t_idx],&p);
         if (dist_sqr < dmin_sqr) {
           dmin_sqr = dist_sqr;
+          t_min_idx = t_idx;
         }
       } while ((t_idx = *(cur_cell_tl++)) >= 0);
     }
@@ -1314,175 +1906,1391 @@ static double dist_pt_surf(dvertex_t p, const struct triangle_list *tl,
      * cells have been tested. */
     k++;
   } while (k < kmax && dmin_sqr >= k*k*cell_sz_sqr);
-#ifdef DO_DIST_PT_SURF_STATS
-  stats->sum_kmax += k-1;
-#endif
+  if (sq->qs != NULL) {
+    update_query_stats(sq->qs,n_cell_scans,n_cell_t_scans,n_triag_scans,
+                       k_start,k-1);
+  }
   if (dmin_sqr >= DBL_MAX || dmin_sqr != dmin_sqr || dmin_sqr < 0) {
-    /* Something is going wrong (probably NaNs, etc.). The x != x test is for
-     * NaNs (if supported, otherwise always true) */
-    fprintf(stderr,
-            "ERROR: entered infinite loop! NaN or infinte value in model ?\n"
-            "       (otherwise you have stumbled on a bug, please report)\n");
-    exit(1);
+    /* Something is going wrong (probably NaNs or infinite values in the
+     * models, otherwise a bug). The x != x test is for NaNs (if supported,
+     * otherwise always true) */
+    sq->error = MESH_MODEL_ERR;
+    sq->last_triag = -1;
+    return 0;
   }
 
-  return  sqrt(dmin_sqr);
+  sq->prev_p = p;
+  sq->prev_d = sqrt(dmin_sqr);
+  sq->last_triag = t_min_idx;
+  return sq->prev_d;
 }
 
-/* --------------------------------------------------------------------------*
- *                          External functions                               *
- * --------------------------------------------------------------------------*/
-
-/* See compute_error.h */
-void dist_surf_surf(struct model_error *me1, struct model *m2, 
-		    double sampling_density, int min_sample_freq,
-                    struct dist_surf_surf_stats *stats, int calc_normals,
-                    struct prog_reporter *prog)
+/* Stores in *scp the closest point to p of the surface indexed by sq->si,
+ * as found by the last call to dist_pt_surf(p,sq). */
+static void get_closest_point(dvertex_t p, const struct surf_query *sq,
+                              struct sample_closest_point *scp)
 {
-  struct model *m1;           /* The m1 model mesh */
-  dvertex_t bbox_min,bbox_max;/* min and max of bounding box of m1 and m2 */
-  struct triangle_list *tl2;  /* triangle list for m2 */
-  struct t_in_cell_list *fic; /* list of faces intersecting each cell */
-  struct sample_list ts;      /* list of sample from a triangle */
-  struct triag_sample_error tse; /* the errors at the triangle samples */
-  int n;                      /* sampling frequency for current triangle */
-  int i,k,kmax;               /* counters and loop limits */
-  double cell_sz;             /* side length of the cubic cells */
-  struct size3d grid_sz;      /* number of cells in the X, Y and Z directions */
-  int report_step;            /* The step to update the progress report */
-  struct dist_cell_lists *dcl;/* Cache for the list of non-empty cells at each
-                               * distance, for each cell. */
-  int *dcl_buf;               /* Temporary buffer to construct dcl lists */
-  int dcl_buf_sz;             /* Size of dcl_buf */
-  dvertex_t prev_p;           /* previous point */
-  double prev_d;              /* distance for previous point */
-  dvertex_t v1,v2,v3;         /* double version of triangle vertices */
-  struct misc_stats m_stats;  /* temporary structure for temp stats */
-#ifdef DO_DIST_PT_SURF_STATS
-  struct dist_pt_surf_stats dps_stats; /* Statistics */
-#endif
-
-  /* Initialize */
-  m1 = me1->mesh;
-  memset(&ts,0,sizeof(ts));
-  memset(&tse,0,sizeof(tse));
-  report_step = (int) (m1->num_faces/(100.0/2)); /* report every 2 % */
-  if (report_step <= 0) report_step = 1;
-  bbox_min.x = min(m1->bBox[0].x,m2->bBox[0].x);
-  bbox_min.y = min(m1->bBox[0].y,m2->bBox[0].y);
-  bbox_min.z = min(m1->bBox[0].z,m2->bBox[0].z);
-  bbox_max.x = max(m1->bBox[1].x,m2->bBox[1].x);
-  bbox_max.y = max(m1->bBox[1].y,m2->bBox[1].y);
-  bbox_max.z = max(m1->bBox[1].z,m2->bBox[1].z);
-  prev_p.x = 0;
-  prev_p.y = 0;
-  prev_p.z = 0;
-  prev_d = 0;
-
-  /* Get the triangle list from model 2 and determine the grid and cell size */
-  tl2 = model_to_triangle_list(m2);
-  cell_sz = get_cell_size(tl2,&bbox_min,&bbox_max,&grid_sz);
-  dcl = xa_calloc(grid_sz.x*grid_sz.y*grid_sz.z,sizeof(*dcl));
-  dcl_buf = NULL;
-  dcl_buf_sz = 0;
+  double w[3];          /* barycentric coordinates relative to f0, f1, f2 */
+  double wb,wc;         /* barycentric coordinates relative to B and C */
+  int k;
+
+  closest_pt_triag(&(sq->si->tl->triangles[sq->last_triag]),&p,&wb,&wc);
+  k = sq->si->tl->a_vert[sq->last_triag];
+  w[k] = 1-wb-wc;
+  w[(k+1)%3] = wb;
+  w[(k+2)%3] = wc;
+  scp->face = sq->last_triag;
+  scp->u = (float)w[1];
+  scp->v = (float)w[2];
+}
 
-  /* Get the list of triangles in each cell */
-  fic = triangles_in_cells(tl2,grid_sz,cell_sz,bbox_min);
+/* Returns the sign (1 or -1) of the distance from p to the surface indexed
+ * by sq->si, as found by the last call to dist_pt_surf(p,sq). It is the sign
+ * of the scalar product of the vector from the closest point to p with the
+ * normal of the closest triangle, or with the pseudo-normal of its closest
+ * edge or vertex if the closest point is on one. The pseudo-normals must be
+ * present. */
+static double dist_sign(dvertex_t p, const struct surf_query *sq)
+{
+  const struct triangle_info *t;
+  dvertex_t ap,qp;      /* vectors from A and from the closest point to p */
+  double wb,wc;         /* barycentric coordinates relative to B and C */
+  double sp;            /* scalar product giving the sign */
+  int f;
+
+  t = &(sq->si->tl->triangles[sq->last_triag]);
+  f = closest_pt_triag(t,&p,&wb,&wc);
+  __substract_v(p,t->a,ap);
+  if (f == CPF_FACE) {
+    sp = __scalprod_v(ap,t->normal);
+  } else { /* QP = AP-wb*AB+wc*CA */
+    qp.x = ap.x-wb*t->ab.x+wc*t->ca.x;
+    qp.y = ap.y-wb*t->ab.y+wc*t->ca.y;
+    qp.z = ap.z-wb*t->ab.z+wc*t->ca.z;
+    sp = __scalprod_v(qp,sq->si->tl->pnormal[6*sq->last_triag+f]);
+  }
+  return (sp < 0) ? -1 : 1;
+}
 
-  /* Allocate storage for errors */
-  me1->fe = xa_realloc(me1->fe,m1->num_faces*sizeof(*(me1->fe)));
+/* Initializes the overall statistics in stats for a distance calculation to
+ * the surface indexed by si, including the signed ones if is_signed is
+ * non-zero. If the DIST_QUERY_STATS bit is set in flags stats->has_qstats is
+ * set and the histogram of the triangles per cell is calculated. */
+static void init_dist_stats(struct dist_surf_surf_stats *stats,
+                            const struct surf_index *si, int is_signed,
+                            int flags)
+{
+  int i,k,kmax;
 
-  /* Initialize overall statistics */
   memset(stats,0,sizeof(*stats));
-  stats->m2_area = tl2->area;
+  stats->m2_area = si->tl->area;
   stats->min_dist = DBL_MAX;
-  stats->cell_sz = cell_sz;
-  stats->grid_sz = grid_sz;
-  stats->n_ne_cells = fic->n_ne_cells;
-  stats->n_t_p_nec = fic->n_t_per_ne_cell;
-  memset(&m_stats,0,sizeof(m_stats));
-  m_stats.dist_smpl_sz = (int)(1.1*tl2->area*sampling_density);
-  if (m_stats.dist_smpl_sz < 200) m_stats.dist_smpl_sz = 200;
-  m_stats.dist_smpl =
-    xa_malloc(sizeof(*(m_stats.dist_smpl))*m_stats.dist_smpl_sz);
-#ifdef DO_DIST_PT_SURF_STATS
-  memset(&dps_stats,0,sizeof(dps_stats));
-#endif
-
-  /* For each triangle in model 1, sample and calculate the error */
-  if (prog != NULL) prog_report(prog,0);
-  for (k=0, kmax=m1->num_faces; k<kmax; k++) {
-    if (prog != NULL && k!=0 && k%report_step==0) {
-      prog_report(prog,(100*k/(kmax-1)));
+  stats->cell_sz = si->cell_sz;
+  stats->cell_ratio = si->cell_ratio;
+  stats->probe_cost = si->probe_cost;
+  stats->grid_sz = si->grid_sz;
+  stats->n_ne_cells = si->fic->n_ne_cells;
+  stats->n_t_p_nec = si->fic->n_t_per_ne_cell;
+  stats->t_tlist = si->t_tlist;
+  stats->t_tune = si->t_tune;
+  stats->t_grid = si->t_grid;
+  if (is_signed) {
+    stats->is_signed = 1;
+    stats->min_sdist = DBL_MAX;
+    stats->max_sdist = -DBL_MAX;
+  }
+  if (flags & DIST_QUERY_STATS) {
+    stats->has_qstats = 1;
+    for (k=0, kmax=si->fic->n_cells; k<kmax; k++) {
+      if (si->fic->triag_idx[k] == NULL) continue;
+      i = 0;
+      while (si->fic->triag_idx[k][i] >= 0) i++;
+      stats->qstats.hist_cell_len[log_hist_bin(i)]++;
     }
-    vertex_f2d_dv(&(m1->vertices[m1->faces[k].f0]),&v1);
-    vertex_f2d_dv(&(m1->vertices[m1->faces[k].f1]),&v2);
-    vertex_f2d_dv(&(m1->vertices[m1->faces[k].f2]),&v3);
-    me1->fe[k].face_area = tri_area_dv(&v1,&v2,&v3);
-    if (me1->fe[k].face_area < DMARGIN*DBL_MIN) continue; /* degenerate */
-    n = get_sampling_freq(me1->fe[k].face_area,sampling_density);
-    if (n < min_sample_freq) n = min_sample_freq;
-    realloc_triag_sample_error(&tse,n);
-    sample_triangle(&v1,&v2,&v3,n,&ts);
-    for (i=0; i<tse.n_samples_tot; i++) {
-      tse.err_lin[i] = dist_pt_surf(ts.sample[i],tl2,fic,
-#ifdef DO_DIST_PT_SURF_STATS
-                                    &dps_stats,
-#endif
-                                    grid_sz,cell_sz,bbox_min,dcl,
-                                    &prev_p,prev_d,&dcl_buf,&dcl_buf_sz);
-      prev_p = ts.sample[i];
-      prev_d = tse.err_lin[i];
-    }
-    error_stat_triag(&tse,&(me1->fe[k]),stats,&m_stats);
-  }
-  if (prog != NULL) prog_report(prog,-1);
-#ifdef DO_DIST_PT_SURF_STATS
-  fprintf(stderr,"Average number of scanned non-empty cells per sample: %g\n",
-          ((double)dps_stats.n_cell_scans)/stats->m1_samples);
-  fprintf(stderr,"Average number of cells per sample for which triangles are "
-          "scanned: %g\n",
-          ((double)dps_stats.n_cell_t_scans)/stats->m1_samples);
-  fprintf(stderr,"Average number of triangles scanned per sample: %g\n",
-          ((double)dps_stats.n_triag_scans)/stats->m1_samples);
-  fprintf(stderr,"Average maximum cell to cell distance: %g\n",
-          ((double)dps_stats.sum_kmax)/stats->m1_samples);
-#endif
-  /* Finalize overall statistics */
-  stats->mean_dist /= stats->st_m1_area;
-  stats->rms_dist = sqrt(stats->rms_dist/stats->st_m1_area);
-  finalize_face_error(me1,&m_stats);
-  me1->min_error = stats->min_dist;
-  me1->max_error = stats->max_dist;
-  me1->mean_error = stats->mean_dist;
-  me1->n_samples = stats->m1_samples;
-
-  /* Do normals for model 2 if requested and not yet present */
-  if (calc_normals && m2->normals == NULL) {
-    calc_normals_as_oriented_model(m2,tl2);
   }
+}
 
-  /* free temporary storage */
-  free(tl2->triangles);
-  free(tl2);
-  for (k=0, kmax=fic->n_cells; k<kmax; k++) {
-    free(fic->triag_idx[k]);
+/* Adds incr to the bins of stats->sdist_hist of the n signed distances in
+ * e, for the current stats->sdist_range. */
+static void add_sdist_hist(struct dist_surf_surf_stats *stats,
+                           const double *e, int n, double incr)
+{
+  int i,k;
+
+  for (i=0; i<n; i++) {
+    if (stats->sdist_range > 0) {
+      k = (int)((e[i]/stats->sdist_range+1)*(SDIST_HIST_BINS/2));
+      if (k >= SDIST_HIST_BINS) k = SDIST_HIST_BINS-1;
+      if (k < 0) k = 0;
+    } else { /* all zero */
+      k = SDIST_HIST_BINS/2;
+    }
+    stats->sdist_hist[k] += incr;
   }
-  free(fic->triag_idx);
-  free(fic->empty_cell);
-  free(fic);
-  for (k=0, kmax=grid_sz.x*grid_sz.y*grid_sz.z; k<kmax; k++) {
-    if (dcl[k].list != NULL) {
-      for (i=0; i<dcl[k].n_dists; i++) {
-        free(dcl[k].list[i].cell);
+}
+
+/* Sets stats->sdist_range from stats->min_sdist and stats->max_sdist, and
+ * fills stats->sdist_hist with the n signed distances in e. */
+static void signed_dist_hist(struct dist_surf_surf_stats *stats,
+                             const double *e, int n)
+{
+  stats->sdist_range = max(-stats->min_sdist,stats->max_sdist);
+  add_sdist_hist(stats,e,n,1);
+}
+
+/* Adds the query counts and histograms of src to those of dst, except for
+ * the histogram of the triangles per cell, which is not per query. */
+static void add_query_stats(struct dist_query_stats *dst,
+                            const struct dist_query_stats *src)
+{
+  int i;
+
+  dst->n_queries += src->n_queries;
+  dst->n_cell_scans += src->n_cell_scans;
+  dst->n_cell_t_scans += src->n_cell_t_scans;
+  dst->n_triag_scans += src->n_triag_scans;
+  dst->sum_kmax += src->sum_kmax;
+  dst->n_warm_starts += src->n_warm_starts;
+  dst->sum_kstart += src->sum_kstart;
+  for (i=0; i<DQS_HIST_BINS; i++) {
+    dst->hist_triags[i] += src->hist_triags[i];
+    dst->hist_kmax[i] += src->hist_kmax[i];
+  }
+}
+
+/* Calculates the distance from the vertices data->order[start] to
+ * data->order[end-1] of data->m to the surface, using the query state of
+ * thread tid. The vertices are skipped once a query of the thread fails.
+ * The data argument is a struct vert_dist_data. Used with prog_par_for()
+ * by dist_verts_idx(). */
+static void vert_dist_work(void *data, int start, int end, int tid)
+{
+  struct vert_dist_data *vd;
+  struct surf_query *sq;
+  dvertex_t p;
+  int i,j;
+
+  vd = data;
+  sq = &(vd->sq[tid]);
+  for (i=start; i<end && sq->error == 0; i++) {
+    j = vd->order[i];
+    vertex_f2d_dv(&(vd->m->vertices[j]),&p);
+    vd->dist[j] = dist_pt_surf(p,sq);
+    if (sq->error != 0) return;
+    if (vd->is_signed) vd->dist[j] *= dist_sign(p,sq);
+  }
+}
+
+/* Returns v with its lowest MORTON_BITS bits spread out, with two zero bits
+ * between each. */
+static unsigned int morton_spread(unsigned int v)
+{
+  v &= (1 << MORTON_BITS)-1;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+/* Comparison function for qsort(), ordering struct morton_key by increasing
+ * code and then index. */
+static int cmp_morton_key(const void *a, const void *b)
+{
+  const struct morton_key *ka = a;
+  const struct morton_key *kb = b;
+
+  if (ka->code != kb->code) return (ka->code < kb->code) ? -1 : 1;
+  return (ka->idx < kb->idx) ? -1 : (ka->idx > kb->idx);
+}
+
+/* Returns a new array with the indices of the vertices of m sorted along
+ * the Morton (Z-order) curve over the bounding box of m, so that
+ * consecutive vertices are close in space, which is what the warm start of
+ * dist_pt_surf() needs. Returns NULL if out of memory. */
+static int *morton_order(const struct model *m)
+{
+  struct morton_key *keys;
+  int *order;
+  double scale[3];     /* from relative coordinates to code cells */
+  double ext;          /* bounding box extent along an axis */
+  unsigned int c[3];   /* code cell along each axis */
+  int i,j,n;
+
+  n = m->num_vert;
+  ext = m->bBox[1].x-m->bBox[0].x;
+  scale[0] = (ext > 0) ? ((1 << MORTON_BITS)-1)/ext : 0;
+  ext = m->bBox[1].y-m->bBox[0].y;
+  scale[1] = (ext > 0) ? ((1 << MORTON_BITS)-1)/ext : 0;
+  ext = m->bBox[1].z-m->bBox[0].z;
+  scale[2] = (ext > 0) ? ((1 << MORTON_BITS)-1)/ext : 0;
+  keys = malloc(sizeof(*keys)*max(n,1));
+  order = malloc(sizeof(*order)*max(n,1));
+  if (keys == NULL || order == NULL) {
+    free(keys);
+    free(order);
+    return NULL;
+  }
+  for (i=0; i<n; i++) {
+    c[0] = (unsigned int)((m->vertices[i].x-m->bBox[0].x)*scale[0]);
+    c[1] = (unsigned int)((m->vertices[i].y-m->bBox[0].y)*scale[1]);
+    c[2] = (unsigned int)((m->vertices[i].z-m->bBox[0].z)*scale[2]);
+    for (j=0; j<3; j++) {
+      if (c[j] >= (1 << MORTON_BITS)) c[j] = (1 << MORTON_BITS)-1;
+    }
+    keys[i].code = morton_spread(c[0]) | (morton_spread(c[1]) << 1) |
+      (morton_spread(c[2]) << 2);
+    keys[i].idx = i;
+  }
+  qsort(keys,n,sizeof(*keys),cmp_morton_key);
+  for (i=0; i<n; i++) order[i] = keys[i].idx;
+  free(keys);
+  return order;
+}
+
+/* Gets the samples of model m used by the probe queries to auto-tune the
+ * grid. The faces are sampled with the sampling density sampling_density as
+ * in dist_surf_idx(), but with the sampling frequency rounded instead of
+ * randomized, in TUNE_N_RUNS runs of consecutive faces starting at
+ * pseudo-random positions, until TUNE_N_PROBES samples are obtained. The
+ * samples are returned in the new array *probes and their number as the
+ * return value. The expected number of samples of the whole model is
+ * returned in *n_total. If it is too small for the tuning to pay off, zero
+ * is returned and *probes is NULL. If out of memory MESH_NO_MEM is returned
+ * and *probes is NULL. */
+static int get_probe_samples(const struct model *m, double sampling_density,
+                             dvertex_t **probes, double *n_total)
+{
+  struct sample_list ts;  /* samples of the current face */
+  dvertex_t v1,v2,v3;     /* double version of face vertices */
+  double area;            /* total area of m */
+  unsigned long seed;     /* state of the pseudo-random generator */
+  int n_probes;           /* number of probe samples obtained so far */
+  int run_end;            /* value of n_probes at which the run stops */
+  int r,i,j,k,n;
+
+  area = 0;
+  for (k=0; k<m->num_faces; k++) {
+    vertex_f2d_dv(&(m->vertices[m->faces[k].f0]),&v1);
+    vertex_f2d_dv(&(m->vertices[m->faces[k].f1]),&v2);
+    vertex_f2d_dv(&(m->vertices[m->faces[k].f2]),&v3);
+    area += tri_area_dv(&v1,&v2,&v3);
+  }
+  *n_total = area*sampling_density;
+  *probes = NULL;
+  if (*n_total < (double)TUNE_MIN_FACTOR*TUNE_N_PROBES) return 0;
+
+  /* NOTE: we do not use rand(), so that the samples of the real calculation
+   * do not depend on whether the grid is tuned or not. */
+  *probes = malloc(TUNE_N_PROBES*sizeof(**probes));
+  if (*probes == NULL) return MESH_NO_MEM;
+  memset(&ts,0,sizeof(ts));
+  seed = 1;
+  n_probes = 0;
+  for (r=0; r<TUNE_N_RUNS; r++) {
+    seed = (seed*1103515245UL+12345UL)&0xffffffffUL;
+    k = (int)(seed/4294967296.0*m->num_faces);
+    run_end = (int)((double)TUNE_N_PROBES*(r+1)/TUNE_N_RUNS);
+    for (i=0; i<m->num_faces && n_probes<run_end; i++) {
+      vertex_f2d_dv(&(m->vertices[m->faces[k].f0]),&v1);
+      vertex_f2d_dv(&(m->vertices[m->faces[k].f1]),&v2);
+      vertex_f2d_dv(&(m->vertices[m->faces[k].f2]),&v3);
+      n = (int)floor(sqrt(0.25+2*tri_area_dv(&v1,&v2,&v3)*sampling_density));
+      if (sample_triangle(&v1,&v2,&v3,n,&ts) != 0) {
+        free(ts.sample);
+        free(*probes);
+        *probes = NULL;
+        return MESH_NO_MEM;
+      }
+      for (j=0; j<ts.n_samples && n_probes<run_end; j++) {
+        (*probes)[n_probes++] = ts.sample[j];
+      }
+      if (++k == m->num_faces) k = 0;
+    }
+  }
+  free(ts.sample);
+  return n_probes;
+}
+
+/* Stores in *cost the average wall clock time of the distance queries from
+ * the n_probes points in probes to the surface indexed by si. Returns zero
+ * on success and the error code of the queries otherwise. */
+static int probe_query_time(const struct surf_index *si,
+                            const dvertex_t *probes, int n_probes,
+                            double *cost)
+{
+  struct surf_query sq;
+  double t;
+  int i,rcode;
+
+  if (init_surf_query(&sq,si) != 0) return MESH_NO_MEM;
+  t = wall_time();
+  for (i=0; i<n_probes && sq.error == 0; i++) {
+    dist_pt_surf(probes[i],&sq);
+  }
+  t = wall_time()-t;
+  rcode = sq.error;
+  free_surf_query(&sq);
+  *cost = t/n_probes;
+  return rcode;
+}
+
+/* Auto-tunes the cell size of the surface index si, for which only the
+ * triangle list and bbox_min are set, and builds its grid, placed on the
+ * bounding box from si->bbox_min to bbox_max. For each candidate cell ratio
+ * in tune_cell_ratios the grid is built and the distance queries from the
+ * n_probes samples in probes are timed. The grid with the smallest estimated
+ * time to build it and query n_total samples is kept, the others are
+ * freed. Returns zero on success and the error code otherwise (MESH_NO_MEM
+ * or MESH_MODEL_ERR), in which case no grid is kept. */
+static int tune_grid(struct surf_index *si, const dvertex_t *bbox_max,
+                     const dvertex_t *probes, int n_probes, double n_total)
+{
+  struct surf_index cand; /* the candidate index */
+  double cost;            /* estimated total time with cand */
+  double best_cost;       /* estimated total time with the best grid */
+  double prev_cell_sz;    /* cell size of the previous candidate */
+  int i,rcode;
+
+  si->fic = NULL;
+  rcode = 0;
+  best_cost = DBL_MAX;
+  prev_cell_sz = 0;
+  cand = *si;
+  for (i=0; i<N_TUNE_CELL_RATIOS; i++) {
+    cand.cell_ratio = tune_cell_ratios[i];
+    cand.cell_sz = get_cell_size(si->tl,cand.cell_ratio,&(si->bbox_min),
+                                 bbox_max,&(cand.grid_sz));
+    if (cand.cell_sz < 0) {
+      rcode = MESH_MODEL_ERR;
+      break;
+    }
+    /* Same grid as previous if limited by GRID_CELLS_MAX */
+    if (cand.cell_sz == prev_cell_sz) continue;
+    prev_cell_sz = cand.cell_sz;
+    memset(&(cand.t_grid),0,sizeof(cand.t_grid));
+    stage_begin(&(cand.t_grid));
+    cand.fic = triangles_in_cells(si->tl,cand.grid_sz,cand.cell_sz,
+                                  si->bbox_min);
+    stage_end(&(cand.t_grid));
+    if (cand.fic == NULL) {
+      rcode = MESH_NO_MEM;
+      break;
+    }
+    rcode = probe_query_time(&cand,probes,n_probes,&(cand.probe_cost));
+    if (rcode != 0) {
+      free_t_in_cell_list(cand.fic);
+      break;
+    }
+    cost = cand.t_grid.wall+cand.probe_cost*n_total;
+    if (cost < best_cost) {
+      best_cost = cost;
+      free_t_in_cell_list(si->fic);
+      si->fic = cand.fic;
+      si->cell_ratio = cand.cell_ratio;
+      si->cell_sz = cand.cell_sz;
+      si->grid_sz = cand.grid_sz;
+      si->probe_cost = cand.probe_cost;
+      si->t_grid = cand.t_grid;
+    } else {
+      free_t_in_cell_list(cand.fic);
+    }
+  }
+  if (rcode != 0) {
+    free_t_in_cell_list(si->fic);
+    si->fic = NULL;
+  }
+  return rcode;
+}
+
+/* --------------------------------------------------------------------------*
+ *                          External functions                               *
+ * --------------------------------------------------------------------------*/
+
+/* See compute_error.h */
+int build_surf_index(struct surf_index **si_ref, const struct model *m,
+                     const dvertex_t *bbox_min, const dvertex_t *bbox_max,
+                     const struct model *probe_m, double sampling_density,
+                     int flags)
+{
+  struct surf_index *si;
+  dvertex_t bmin,bmax;
+  dvertex_t *probes;          /* the samples for the probe queries */
+  int n_probes;               /* the number of samples in probes */
+  double n_total;             /* the expected number of samples of probe_m */
+  int rcode;
+
+  if (bbox_min != NULL && bbox_max != NULL) {
+    bmin = *bbox_min;
+    bmax = *bbox_max;
+  } else {
+    vertex_f2d_dv(&(m->bBox[0]),&bmin);
+    vertex_f2d_dv(&(m->bBox[1]),&bmax);
+  }
+  if ((si = calloc(1,sizeof(*si))) == NULL) return MESH_NO_MEM;
+  si->bbox_min = bmin;
+  /* Get the triangle list and determine the grid and cell size */
+  rcode = 0;
+  stage_begin(&(si->t_tlist));
+  si->tl = model_to_triangle_list(m);
+  if (si->tl == NULL) {
+    rcode = MESH_NO_MEM;
+  } else if (flags & DIST_SIGNED) {
+    rcode = calc_pseudo_normals(si->tl,m);
+  }
+  stage_end(&(si->t_tlist));
+  n_probes = 0;
+  if (rcode == 0 && probe_m != NULL) {
+    stage_begin(&(si->t_tune));
+    n_probes = get_probe_samples(probe_m,sampling_density,&probes,&n_total);
+    if (n_probes < 0) {
+      rcode = n_probes;
+    } else if (n_probes > 0) {
+      rcode = tune_grid(si,&bmax,probes,n_probes,n_total);
+    }
+    free(probes);
+    stage_end(&(si->t_tune));
+  }
+  if (rcode == 0 && n_probes == 0) { /* not tuned, use default cell size */
+    stage_begin(&(si->t_grid));
+    si->cell_ratio = CELL_TRIAG_RATIO;
+    si->cell_sz = get_cell_size(si->tl,si->cell_ratio,&bmin,&bmax,
+                                &(si->grid_sz));
+    if (si->cell_sz < 0) {
+      rcode = MESH_MODEL_ERR;
+    } else { /* Get the list of triangles in each cell */
+      si->fic = triangles_in_cells(si->tl,si->grid_sz,si->cell_sz,bmin);
+      if (si->fic == NULL) rcode = MESH_NO_MEM;
+    }
+    stage_end(&(si->t_grid));
+  }
+  if (rcode != 0) {
+    free_surf_index(si);
+    return rcode;
+  }
+  *si_ref = si;
+  return 0;
+}
+
+/* See compute_error.h */
+void free_surf_index(struct surf_index *si)
+{
+  if (si == NULL) return;
+  free_triangle_list(si->tl);
+  free_t_in_cell_list(si->fic);
+  free(si);
+}
+
+/* See compute_error.h */
+int update_surf_index(struct surf_index *si, const struct model *m,
+                      int old_num_faces, const int *changed, int n_changed,
+                      dvertex_t *ebox_min, dvertex_t *ebox_max)
+{
+  struct triangle_list *tl;   /* The triangle list of the index */
+  char *redo;                 /* Non-zero for the triangles to replace */
+  struct sample_list sl;      /* Temporary storage for triangle_cells() */
+  int *c_buf;                 /* The cells of a triangle */
+  int c_buf_sz;               /* The size of c_buf */
+  double n_cell_t;            /* The total number of triangles in the cells */
+  void *buf;                  /* A reallocated array of tl */
+  int n_faces,i,k,n,n_c,rcode;
+  const face_t *face;
+
+  n_faces = m->num_faces;
+  if (n_faces == 0) return 1; /* no triangle left for the queries */
+  tl = si->tl;
+  redo = calloc(max(n_faces,old_num_faces),sizeof(*redo));
+  if (redo == NULL) return MESH_NO_MEM;
+  for (i=0; i<n_changed; i++) {
+    if (changed[i] >= 0 && changed[i] < n_faces) redo[changed[i]] = 1;
+  }
+  for (k=old_num_faces; k<n_faces; k++) redo[k] = 1;
+  for (k=0; k<n_faces; k++) {
+    if (!redo[k]) continue;
+    face = &(m->faces[k]);
+    if (!pt_in_grid(si,&(m->vertices[face->f0])) ||
+        !pt_in_grid(si,&(m->vertices[face->f1])) ||
+        !pt_in_grid(si,&(m->vertices[face->f2]))) {
+      free(redo);
+      return 1;
+    }
+  }
+  /* Grow the triangle list beforehand, the old triangles are still needed
+   * to remove them from the cells */
+  if (n_faces > tl->n_triangles) {
+    if ((buf = realloc(tl->triangles,sizeof(*(tl->triangles))*n_faces)) ==
+        NULL) {
+      free(redo);
+      return MESH_NO_MEM;
+    }
+    tl->triangles = buf;
+    if ((buf = realloc(tl->s_area,sizeof(*(tl->s_area))*n_faces)) == NULL) {
+      free(redo);
+      return MESH_NO_MEM;
+    }
+    tl->s_area = buf;
+    if ((buf = realloc(tl->a_vert,sizeof(*(tl->a_vert))*n_faces)) == NULL) {
+      free(redo);
+      return MESH_NO_MEM;
+    }
+    tl->a_vert = buf;
+  }
+
+  ebox_min->x = ebox_min->y = ebox_min->z = DBL_MAX;
+  ebox_max->x = ebox_max->y = ebox_max->z = -DBL_MAX;
+  memset(&sl,0,sizeof(sl));
+  c_buf = NULL;
+  c_buf_sz = 0;
+  n_cell_t = si->fic->n_t_per_ne_cell*si->fic->n_ne_cells;
+  rcode = MESH_NO_MEM; /* until all is done */
+
+  /* Remove the old triangles from their cells */
+  for (k=0; k<old_num_faces; k++) {
+    if (k < n_faces && !redo[k]) continue;
+    box_add_triag(&(tl->triangles[k]),ebox_min,ebox_max);
+    tl->area -= tl->s_area[k];
+    n_c = triangle_cells(&(tl->triangles[k]),si->grid_sz,si->cell_sz,
+                         si->bbox_min,&sl,&c_buf,&c_buf_sz);
+    if (n_c < 0) goto end;
+    for (i=0; i<n_c; i++) {
+      n_cell_t -= cell_remove_triag(si->fic,c_buf[i],k);
+    }
+  }
+
+  /* Insert the new triangles. Shrinking the triangle list can not fail
+   * (if realloc() does the larger one is kept). */
+  if (n_faces < tl->n_triangles) {
+    if ((buf = realloc(tl->triangles,sizeof(*(tl->triangles))*n_faces)) !=
+        NULL) {
+      tl->triangles = buf;
+    }
+    if ((buf = realloc(tl->s_area,sizeof(*(tl->s_area))*n_faces)) != NULL) {
+      tl->s_area = buf;
+    }
+    if ((buf = realloc(tl->a_vert,sizeof(*(tl->a_vert))*n_faces)) != NULL) {
+      tl->a_vert = buf;
+    }
+  }
+  tl->n_triangles = n_faces;
+  for (k=0; k<n_faces; k++) {
+    if (!redo[k]) continue;
+    face = &(m->faces[k]);
+    tl->s_area[k] = init_triangle(&(m->vertices[face->f0]),
+                                  &(m->vertices[face->f1]),
+                                  &(m->vertices[face->f2]),
+                                  &(tl->triangles[k]),&(tl->a_vert[k]));
+    tl->area += tl->s_area[k];
+    box_add_triag(&(tl->triangles[k]),ebox_min,ebox_max);
+    n_c = triangle_cells(&(tl->triangles[k]),si->grid_sz,si->cell_sz,
+                         si->bbox_min,&sl,&c_buf,&c_buf_sz);
+    if (n_c < 0) goto end;
+    for (i=0; i<n_c; i++) {
+      if ((n = cell_insert_triag(si->fic,c_buf[i],k)) < 0) goto end;
+      n_cell_t += n;
+    }
+  }
+  /* all the cells can have been emptied */
+  si->fic->n_t_per_ne_cell = (si->fic->n_ne_cells > 0) ?
+    n_cell_t/si->fic->n_ne_cells : 0;
+
+  /* The pseudo-normals of the neighbors change too, do them all */
+  if (tl->pnormal != NULL) {
+    free(tl->pnormal);
+    if (calc_pseudo_normals(tl,m) != 0) goto end;
+  }
+  rcode = 0;
+
+ end:
+  free(redo);
+  free(sl.sample);
+  free(c_buf);
+  return rcode;
+}
+
+/* Initializes the face sampler fs to calculate the error of the faces of
+ * model m, for the given sampling parameters, to the surface indexed by
+ * si. The signed distance is calculated if is_signed is non-zero and the
+ * closest points are recorded if do_scp is non-zero. Returns zero on success
+ * and MESH_NO_MEM if out of memory, in which case fs need not be freed. */
+static int init_face_sampler(struct face_sampler *fs, const struct model *m,
+                              const struct surf_index *si,
+                              double sampling_density, int min_sample_freq,
+                              int is_signed, int do_scp)
+{
+  memset(fs,0,sizeof(*fs));
+  fs->m = m;
+  fs->sampling_density = sampling_density;
+  fs->min_sample_freq = min_sample_freq;
+  fs->is_signed = is_signed;
+  fs->do_scp = do_scp;
+  return init_surf_query(&(fs->sq),si);
+}
+
+/* Frees the storage of the face sampler fs, but not fs itself. */
+static void free_face_sampler(struct face_sampler *fs)
+{
+  free_surf_query(&(fs->sq));
+  free(fs->ts.sample);
+}
+
+/* Sets the area and sampling frequency of face k of fs->m in fe, the
+ * frequency being zero if the face is degenerate. Returns the number of
+ * samples of the face. */
+static int plan_face_samples(const struct face_sampler *fs, int k,
+                             struct face_error *fe)
+{
+  const face_t *face;
+  dvertex_t v1,v2,v3;         /* double version of triangle vertices */
+  int n;
+
+  face = &(fs->m->faces[k]);
+  vertex_f2d_dv(&(fs->m->vertices[face->f0]),&v1);
+  vertex_f2d_dv(&(fs->m->vertices[face->f1]),&v2);
+  vertex_f2d_dv(&(fs->m->vertices[face->f2]),&v3);
+  fe->face_area = tri_area_dv(&v1,&v2,&v3);
+  if (fe->face_area < DMARGIN*DBL_MIN) { /* degenerate */
+    fe->sample_freq = 0;
+    return 0;
+  }
+  n = get_sampling_freq(fe->face_area,fs->sampling_density,k);
+  if (n < fs->min_sample_freq) n = fs->min_sample_freq;
+  fe->sample_freq = n;
+  return n*(n+1)/2;
+}
+
+/* Samples face k of fs->m, with the sampling frequency set in fe by
+ * plan_face_samples(), and calculates the error at the samples, which is
+ * stored in fe->serror, and the closest points, which are stored in fe->scp
+ * if requested. Returns zero on success and the error code otherwise. */
+static int sample_face_error(struct face_sampler *fs, int k,
+                              struct face_error *fe)
+{
+  const face_t *face;
+  dvertex_t v1,v2,v3;         /* double version of triangle vertices */
+  int i,n_tot;
+  double *err;                /* the errors of the face samples */
+  struct sample_closest_point *scp; /* the closest points of the samples */
+
+  if (fe->sample_freq == 0) return 0;
+  face = &(fs->m->faces[k]);
+  vertex_f2d_dv(&(fs->m->vertices[face->f0]),&v1);
+  vertex_f2d_dv(&(fs->m->vertices[face->f1]),&v2);
+  vertex_f2d_dv(&(fs->m->vertices[face->f2]),&v3);
+  if (sample_triangle(&v1,&v2,&v3,fe->sample_freq,&(fs->ts)) != 0) {
+    return MESH_NO_MEM;
+  }
+  n_tot = fs->ts.n_samples;
+  err = fe->serror;
+  if (!fs->do_scp && !fs->is_signed) {
+    for (i=0; i<n_tot; i++) {
+      err[i] = dist_pt_surf(fs->ts.sample[i],&(fs->sq));
+    }
+  } else {
+    scp = fs->do_scp ? fe->scp : NULL;
+    for (i=0; i<n_tot; i++) {
+      err[i] = dist_pt_surf(fs->ts.sample[i],&(fs->sq));
+      if (fs->sq.error != 0) break;
+      if (scp != NULL) {
+        get_closest_point(fs->ts.sample[i],&(fs->sq),&(scp[i]));
+      }
+      if (fs->is_signed) {
+        err[i] *= dist_sign(fs->ts.sample[i],&(fs->sq));
+      }
+    }
+  }
+  return fs->sq.error;
+}
+
+/* Calculates the error at the samples of the faces start to end-1, using
+ * the face sampler of thread tid. The faces are skipped once a face of the
+ * thread fails (see face_sampler.error). The data argument is a struct
+ * face_dist_data. Used with prog_par_for() by dist_surf_idx(). */
+static void face_dist_work(void *data, int start, int end, int tid)
+{
+  struct face_dist_data *fd;
+  struct face_sampler *fs;
+  int k;
+
+  fd = data;
+  fs = &(fd->fs[tid]);
+  for (k=start; k<end && fs->error == 0; k++) {
+    fs->error = sample_face_error(fs,k,&(fd->fe[k]));
+  }
+}
+
+/* Sets the overall error values of me1 from the statistics in stats. */
+static void set_model_error(struct model_error *me1,
+                            const struct dist_surf_surf_stats *stats)
+{
+  if (stats->is_signed) {
+    me1->min_error = stats->min_sdist;
+    me1->max_error = stats->max_sdist;
+    me1->mean_error = stats->mean_sdist;
+  } else {
+    me1->min_error = stats->min_dist;
+    me1->max_error = stats->max_dist;
+    me1->mean_error = stats->mean_dist;
+  }
+  me1->is_signed = stats->is_signed;
+  me1->n_samples = stats->m1_samples;
+}
+
+/* See compute_error.h */
+int dist_surf_idx(struct model_error *me1, const struct surf_index *si,
+                  double sampling_density, int min_sample_freq,
+                  struct dist_surf_surf_stats *stats, int flags,
+                  int n_threads, struct prog_reporter *prog)
+{
+  struct model *m1;           /* The m1 model mesh */
+  struct face_sampler *fs;    /* The face sampler of each thread */
+  struct face_dist_data fd;   /* The data for the worker threads */
+  struct dist_query_stats *qs;/* The query statistics of each thread */
+  int i,k,kmax;               /* counters and loop limits */
+  int n_fs;                   /* The number of initialized samplers */
+  struct misc_stats m_stats;  /* temporary structure for temp stats */
+  int is_signed;              /* calculate the signed distance */
+  int rcode;                  /* The return code */
+
+  /* Initialize */
+  m1 = me1->mesh;
+  if (n_threads <= 0) n_threads = tp_num_cpus();
+  is_signed = (flags & DIST_SIGNED) && si->tl->pnormal != NULL;
+  init_dist_stats(stats,si,is_signed,flags);
+  memset(&m_stats,0,sizeof(m_stats));
+  rcode = MESH_NO_MEM; /* until the sampling is done */
+  n_fs = 0;
+  qs = NULL;
+  fs = malloc(sizeof(*fs)*n_threads);
+  if (fs == NULL) goto end;
+  if (stats->has_qstats && (qs = calloc(n_threads,sizeof(*qs))) == NULL) {
+    goto end;
+  }
+  for (; n_fs<n_threads; n_fs++) {
+    if (init_face_sampler(&(fs[n_fs]),m1,si,sampling_density,min_sample_freq,
+                          is_signed,flags & DIST_CLOSEST_POINTS) != 0) {
+      goto end;
+    }
+    if (qs != NULL) fs[n_fs].sq.qs = &(qs[n_fs]);
+  }
+
+  /* Get the sampling frequency of each face beforehand, so that the
+   * samples can be stored in a single exactly sized array, each face
+   * having a fixed place in it. */
+  stage_begin(&(stats->t_sampling));
+  free_face_error(me1->fe);
+  me1->fe = malloc(max(m1->num_faces,1)*sizeof(*(me1->fe)));
+  if (me1->fe == NULL) goto end;
+  for (k=0, kmax=m1->num_faces; k<kmax; k++) {
+    m_stats.n_smpl += plan_face_samples(&(fs[0]),k,&(me1->fe[k]));
+  }
+  m_stats.dist_smpl =
+    malloc(sizeof(*(m_stats.dist_smpl))*max(m_stats.n_smpl,1));
+  if (m_stats.dist_smpl == NULL) goto end;
+  if (flags & DIST_CLOSEST_POINTS) {
+    m_stats.scp = malloc(sizeof(*(m_stats.scp))*max(m_stats.n_smpl,1));
+    if (m_stats.scp == NULL) goto end;
+  }
+  finalize_face_error(me1,&m_stats);
+
+  /* For each triangle in model 1, sample and calculate the error. The
+   * threads take blocks of consecutive faces, which keeps the warm start of
+   * the queries effective. */
+  fd.fs = fs;
+  fd.fe = me1->fe;
+  prog_par_for(prog,n_threads,m1->num_faces,FACE_BLOCK,face_dist_work,&fd);
+  stage_end(&(stats->t_sampling));
+  for (rcode=0, i=0; i<n_threads && rcode == 0; i++) rcode = fs[i].error;
+  if (rcode != 0 || prog_cancelled(prog)) goto end;
+
+  /* Get the error statistics of each triangle from the stored samples, in
+   * face order so that they do not depend on the number of threads */
+  stage_begin(&(stats->t_stats));
+  stats->m1_samples = m_stats.n_smpl;
+  for (k=0, kmax=m1->num_faces; k<kmax; k++) {
+    if (me1->fe[k].face_area < DMARGIN*DBL_MIN) continue; /* degenerate */
+    error_stat_triag(me1->fe[k].serror,me1->fe[k].sample_freq,
+                     &(me1->fe[k]),stats);
+  }
+  /* Finalize overall statistics */
+  stats->mean_dist /= stats->st_m1_area;
+  stats->rms_dist = sqrt(stats->rms_dist/stats->st_m1_area);
+  if (is_signed) {
+    stats->mean_sdist /= stats->st_m1_area;
+    signed_dist_hist(stats,m_stats.dist_smpl,stats->m1_samples);
+  }
+  set_model_error(me1,stats);
+  if (qs != NULL) {
+    for (i=0; i<n_threads; i++) add_query_stats(&(stats->qstats),&(qs[i]));
+  }
+  stage_end(&(stats->t_stats));
+  m_stats.dist_smpl = NULL; /* now owned by me1->fe */
+  m_stats.scp = NULL;
+
+ end:
+  if (rcode != 0 || m_stats.dist_smpl != NULL) { /* drop partial results */
+    free(m_stats.dist_smpl);
+    free(m_stats.scp);
+    free(me1->fe);
+    me1->fe = NULL;
+    me1->n_samples = 0;
+  }
+  for (i=0; i<n_fs; i++) free_face_sampler(&(fs[i]));
+  free(fs);
+  free(qs);
+  return rcode;
+}
+
+/* Sets the extremes in stats (min_dist and max_dist, and min_sdist and
+ * max_sdist if signed) from the per face errors of the n_faces faces in
+ * fe. The samples of a face are only scanned if its signed errors cross
+ * zero. */
+static void face_error_extremes(struct dist_surf_surf_stats *stats,
+                                const struct face_error *fe, int n_faces)
+{
+  double a_min,a_max;         /* Min and max absolute error of a face */
+  int i,k,n,n_tot;
+
+  stats->min_dist = DBL_MAX;
+  stats->max_dist = 0;
+  if (stats->is_signed) {
+    stats->min_sdist = DBL_MAX;
+    stats->max_sdist = -DBL_MAX;
+  }
+  for (k=0; k<n_faces; k++) {
+    n = fe[k].sample_freq;
+    if (n == 0 || fe[k].face_area < DMARGIN*DBL_MIN) continue;
+    if (fe[k].min_error >= 0) {
+      a_min = fe[k].min_error;
+      a_max = fe[k].max_error;
+    } else if (fe[k].max_error <= 0) {
+      a_min = -fe[k].max_error;
+      a_max = -fe[k].min_error;
+    } else { /* crosses zero, need the samples */
+      a_max = max(-fe[k].min_error,fe[k].max_error);
+      a_min = DBL_MAX;
+      for (i=0, n_tot=n*(n+1)/2; i<n_tot; i++) {
+        if (fabs(fe[k].serror[i]) < a_min) a_min = fabs(fe[k].serror[i]);
+      }
+    }
+    if (a_min < stats->min_dist) stats->min_dist = a_min;
+    if (a_max > stats->max_dist) stats->max_dist = a_max;
+    if (stats->is_signed) {
+      if (fe[k].min_error < stats->min_sdist) {
+        stats->min_sdist = fe[k].min_error;
+      }
+      if (fe[k].max_error > stats->max_sdist) {
+        stats->max_sdist = fe[k].max_error;
+      }
+    }
+  }
+}
+
+/* Initializes the statistics s to accumulate the contributions of faces
+ * with error_stat_triag(), including the extremes. */
+static void init_stats_delta(struct dist_surf_surf_stats *s, int is_signed)
+{
+  memset(s,0,sizeof(*s));
+  s->is_signed = is_signed;
+  s->min_dist = DBL_MAX;
+  s->min_sdist = DBL_MAX;
+  s->max_sdist = -DBL_MAX;
+}
+
+/* See compute_error.h */
+int dist_surf_idx_update(struct model_error *me1,
+                         const struct surf_index *si,
+                         double sampling_density, int min_sample_freq,
+                         int old_num_faces, const int *changed,
+                         int n_changed, struct dist_surf_surf_stats *stats,
+                         int flags)
+{
+  struct model *m1;           /* The m1 model mesh */
+  struct face_error *fe;      /* The new per face errors, of all the faces
+                               * or, if in place, of those in redo_list */
+  struct model_error fe_new;  /* Holds fe, to place its samples */
+  struct face_error fe_tmp;   /* Copy of an old face error, not to modify it */
+  struct face_sampler fs;     /* The face sampling and query state */
+  struct dist_surf_surf_stats sub; /* The contributions to remove */
+  struct dist_surf_surf_stats add; /* The contributions to add */
+  struct misc_stats m_stats;  /* temporary structure for temp stats */
+  char *redo;                 /* Non-zero for the faces to sample again */
+  int *redo_list;             /* The changed faces, each listed once */
+  int n_redo;                 /* The number of faces in redo_list */
+  int in_place;               /* Non-zero if the new samples replace the old
+                               * ones in the existing sample array */
+  double *smpl;               /* The sample array, once updated */
+  double st_area;             /* The old sampled area */
+  double mean_tot,sqr_tot,smean_tot; /* Area weighted error sums */
+  double old_range;           /* The old signed distance histogram range */
+  int n_faces;                /* The current number of faces of m1 */
+  int n,n_tot,i,j,k;
+  int rcode;                  /* The return code */
+
+  m1 = me1->mesh;
+  n_faces = m1->num_faces;
+  if (init_face_sampler(&fs,m1,si,sampling_density,min_sample_freq,
+                        stats->is_signed,flags & DIST_CLOSEST_POINTS) != 0) {
+    return MESH_NO_MEM;
+  }
+  rcode = MESH_NO_MEM; /* until all is allocated */
+  fe = NULL;
+  redo_list = NULL;
+  in_place = 0;
+  memset(&m_stats,0,sizeof(m_stats));
+  if (stats->has_qstats) fs.sq.qs = &(stats->qstats);
+  memset(&(stats->t_sampling),0,sizeof(stats->t_sampling));
+  memset(&(stats->t_stats),0,sizeof(stats->t_stats));
+  stats->m2_area = si->tl->area;
+  stats->n_ne_cells = si->fic->n_ne_cells;
+  stats->n_t_p_nec = si->fic->n_t_per_ne_cell;
+
+  /* Mark the faces to sample again */
+  redo = calloc(max(n_faces,1),sizeof(*redo));
+  redo_list = malloc(max(n_changed,1)*sizeof(*redo_list));
+  if (redo == NULL || redo_list == NULL) goto end;
+  for (i=0, n_redo=0; i<n_changed; i++) {
+    k = changed[i];
+    if (k >= 0 && k < n_faces && !redo[k]) {
+      redo[k] = 1;
+      redo_list[n_redo++] = k;
+    }
+  }
+  for (k=old_num_faces; k<n_faces; k++) redo[k] = 1;
+  /* If no face has been added or removed, the samples of the changed faces
+   * can replace the old ones in place, as long as their number does not
+   * change (checked below) */
+  in_place = (n_faces == old_num_faces);
+  /* The closest points were not recorded by the previous calculation, so
+   * they can not be copied: sample all the faces again */
+  if (fs.do_scp && old_num_faces > 0 && me1->fe[0].scp == NULL) {
+    memset(redo,1,n_faces);
+    in_place = 0;
+  }
+
+  /* Get the contributions of the changed and removed faces */
+  init_stats_delta(&sub,stats->is_signed);
+  for (k=0; k<old_num_faces; k++) {
+    if (k < n_faces && !redo[k]) continue;
+    if (me1->fe[k].face_area < DMARGIN*DBL_MIN) continue; /* degenerate */
+    fe_tmp = me1->fe[k];
+    error_stat_triag(fe_tmp.serror,fe_tmp.sample_freq,&fe_tmp,&sub);
+  }
+
+  stage_begin(&(stats->t_sampling));
+  if (in_place) {
+    fe = malloc(max(n_redo,1)*sizeof(*fe));
+    if (fe == NULL) goto end;
+    for (j=0; j<n_redo && in_place; j++) {
+      m_stats.n_smpl += plan_face_samples(&fs,redo_list[j],&(fe[j]));
+      in_place = (fe[j].sample_freq == me1->fe[redo_list[j]].sample_freq);
+    }
+    if (!in_place) {
+      free(fe);
+      fe = NULL;
+      m_stats.n_smpl = 0;
+    }
+  }
+  if (in_place) {
+    /* Sample the changed faces in a separate array, so that me1 is not
+     * modified on error */
+    m_stats.dist_smpl =
+      malloc(sizeof(*(m_stats.dist_smpl))*max(m_stats.n_smpl,1));
+    if (m_stats.dist_smpl == NULL) goto end;
+    if (fs.do_scp) {
+      m_stats.scp = malloc(sizeof(*(m_stats.scp))*max(m_stats.n_smpl,1));
+      if (m_stats.scp == NULL) goto end;
+    }
+    for (j=0, n_tot=0; j<n_redo; j++) {
+      fe[j].serror = m_stats.dist_smpl+n_tot;
+      fe[j].scp = (m_stats.scp != NULL) ? m_stats.scp+n_tot : NULL;
+      n_tot += fe[j].sample_freq*(fe[j].sample_freq+1)/2;
+    }
+    rcode = 0;
+    for (j=0; j<n_redo; j++) {
+      if ((rcode = sample_face_error(&fs,redo_list[j],&(fe[j]))) != 0) {
+        goto end;
+      }
+    }
+  } else {
+    /* Build the new sample array, copying the samples of the unchanged
+     * faces */
+    fe_new.mesh = m1;
+    fe_new.fe = malloc(max(n_faces,1)*sizeof(*(fe_new.fe)));
+    fe = fe_new.fe;
+    if (fe == NULL) goto end;
+    for (k=0; k<n_faces; k++) {
+      if (redo[k]) {
+        m_stats.n_smpl += plan_face_samples(&fs,k,&(fe[k]));
+      } else {
+        fe[k] = me1->fe[k];
+        n = fe[k].sample_freq;
+        m_stats.n_smpl += n*(n+1)/2;
+      }
+    }
+    m_stats.dist_smpl =
+      malloc(sizeof(*(m_stats.dist_smpl))*max(m_stats.n_smpl,1));
+    if (m_stats.dist_smpl == NULL) goto end;
+    if (fs.do_scp) {
+      m_stats.scp = malloc(sizeof(*(m_stats.scp))*max(m_stats.n_smpl,1));
+      if (m_stats.scp == NULL) goto end;
+    }
+    finalize_face_error(&fe_new,&m_stats);
+    rcode = 0;
+    for (k=0; k<n_faces; k++) {
+      if (redo[k]) {
+        if ((rcode = sample_face_error(&fs,k,&(fe[k]))) != 0) goto end;
+      } else {
+        n_tot = fe[k].sample_freq*(fe[k].sample_freq+1)/2;
+        memcpy(fe[k].serror,me1->fe[k].serror,
+               sizeof(*(fe[k].serror))*n_tot);
+        if (fs.do_scp) {
+          memcpy(fe[k].scp,me1->fe[k].scp,sizeof(*(fe[k].scp))*n_tot);
+        }
+      }
+    }
+  }
+  stage_end(&(stats->t_sampling));
+
+  /* Get the statistics of the sampled faces and update the overall ones by
+   * removing the old contributions and adding the new ones */
+  stage_begin(&(stats->t_stats));
+  init_stats_delta(&add,stats->is_signed);
+  for (j=0, n=in_place ? n_redo : n_faces; j<n; j++) {
+    if (!in_place && !redo[j]) continue;
+    if (fe[j].face_area < DMARGIN*DBL_MIN) continue; /* degenerate */
+    error_stat_triag(fe[j].serror,fe[j].sample_freq,&(fe[j]),&add);
+  }
+  st_area = stats->st_m1_area;
+  mean_tot = stats->mean_dist*st_area-sub.mean_dist+add.mean_dist;
+  sqr_tot = stats->rms_dist*stats->rms_dist*st_area-sub.rms_dist+add.rms_dist;
+  smean_tot = stats->mean_sdist*st_area-sub.mean_sdist+add.mean_sdist;
+  stats->m1_area += add.m1_area-sub.m1_area;
+  stats->st_m1_area += add.st_m1_area-sub.st_m1_area;
+  if (!in_place) stats->m1_samples = m_stats.n_smpl;
+  stats->mean_dist = mean_tot/stats->st_m1_area;
+  stats->rms_dist = sqrt(max(sqr_tot,0)/stats->st_m1_area);
+  if (stats->is_signed) stats->mean_sdist = smean_tot/stats->st_m1_area;
+
+  /* Replace the errors and samples of the changed faces, removing the old
+   * samples from the histogram (valid only if its range does not change,
+   * see below), or the whole per face error array */
+  old_range = stats->sdist_range;
+  if (in_place) {
+    for (j=0; j<n_redo; j++) {
+      k = redo_list[j];
+      n_tot = fe[j].sample_freq*(fe[j].sample_freq+1)/2;
+      if (stats->is_signed) add_sdist_hist(stats,me1->fe[k].serror,n_tot,-1);
+      memcpy(me1->fe[k].serror,fe[j].serror,sizeof(*(fe[j].serror))*n_tot);
+      if (fs.do_scp) {
+        memcpy(me1->fe[k].scp,fe[j].scp,sizeof(*(fe[j].scp))*n_tot);
+      }
+      fe[j].serror = me1->fe[k].serror;
+      fe[j].scp = me1->fe[k].scp;
+      me1->fe[k] = fe[j];
+    }
+    smpl = me1->fe[0].serror;
+  } else {
+    if (old_num_faces > 0) {
+      free_face_error(me1->fe);
+    } else {
+      free(me1->fe);
+    }
+    me1->fe = fe;
+    smpl = m_stats.dist_smpl;
+  }
+
+  /* The extremes can not be removed: if a removed contribution held one of
+   * them get them again from all the faces, otherwise only the new
+   * contributions can extend them */
+  if (sub.min_dist <= stats->min_dist || sub.max_dist >= stats->max_dist ||
+      (stats->is_signed && (sub.min_sdist <= stats->min_sdist ||
+                            sub.max_sdist >= stats->max_sdist))) {
+    face_error_extremes(stats,me1->fe,n_faces);
+  } else {
+    if (add.min_dist < stats->min_dist) stats->min_dist = add.min_dist;
+    if (add.max_dist > stats->max_dist) stats->max_dist = add.max_dist;
+    if (stats->is_signed) {
+      if (add.min_sdist < stats->min_sdist) stats->min_sdist = add.min_sdist;
+      if (add.max_sdist > stats->max_sdist) stats->max_sdist = add.max_sdist;
+    }
+  }
+  if (stats->is_signed) {
+    if (in_place && max(-stats->min_sdist,stats->max_sdist) == old_range) {
+      for (j=0; j<n_redo; j++) {
+        n = fe[j].sample_freq;
+        add_sdist_hist(stats,fe[j].serror,n*(n+1)/2,1);
+      }
+    } else { /* the bins change, fill the histogram again */
+      memset(stats->sdist_hist,0,sizeof(stats->sdist_hist));
+      signed_dist_hist(stats,smpl,stats->m1_samples);
+    }
+  }
+  set_model_error(me1,stats);
+  stage_end(&(stats->t_stats));
+
+ end:
+  if (rcode != 0 || in_place) { /* me1 has not been modified, or the new
+                                 * samples have been copied into it */
+    free(m_stats.dist_smpl);
+    free(m_stats.scp);
+    free(fe);
+  }
+  free(redo);
+  free(redo_list);
+  free_face_sampler(&fs);
+  return rcode;
+}
+
+/* See compute_error.h */
+int *faces_near_edit(const struct model_error *me1,
+                     const dvertex_t *ebox_min, const dvertex_t *ebox_max,
+                     int *n_faces)
+{
+  const struct model *m1;     /* The m1 model mesh */
+  const struct face_error *fe;/* The error of the current face */
+  struct sample_list ts;      /* The samples of the current face */
+  dvertex_t v1,v2,v3;         /* double version of triangle vertices */
+  dvertex_t fmin,fmax;        /* The bounding box of the current face */
+  dvertex_t d;                /* The separation of the face and edit boxes */
+  double e_max;               /* The maximum absolute error of the face */
+  int *faces;
+  int i,k,n;
+
+  m1 = me1->mesh;
+  faces = malloc(sizeof(*faces)*max(m1->num_faces,1));
+  if (faces == NULL) return NULL;
+  *n_faces = 0;
+  if (ebox_min->x > ebox_max->x) return faces; /* nothing edited */
+  memset(&ts,0,sizeof(ts));
+  for (k=0; k<m1->num_faces; k++) {
+    fe = &(me1->fe[k]);
+    n = fe->sample_freq;
+    if (n == 0) continue;
+    /* Quick rejection with the bounding box of the face */
+    vertex_f2d_dv(&(m1->vertices[m1->faces[k].f0]),&v1);
+    vertex_f2d_dv(&(m1->vertices[m1->faces[k].f1]),&v2);
+    vertex_f2d_dv(&(m1->vertices[m1->faces[k].f2]),&v3);
+    e_max = max(fabs(fe->min_error),fabs(fe->max_error));
+    fmin.x = min(v1.x,min(v2.x,v3.x));
+    fmin.y = min(v1.y,min(v2.y,v3.y));
+    fmin.z = min(v1.z,min(v2.z,v3.z));
+    fmax.x = max(v1.x,max(v2.x,v3.x));
+    fmax.y = max(v1.y,max(v2.y,v3.y));
+    fmax.z = max(v1.z,max(v2.z,v3.z));
+    d.x = max(0,max(fmin.x-ebox_max->x,ebox_min->x-fmax.x));
+    d.y = max(0,max(fmin.y-ebox_max->y,ebox_min->y-fmax.y));
+    d.z = max(0,max(fmin.z-ebox_max->z,ebox_min->z-fmax.z));
+    if (e_max*e_max < __norm2_v(d)) continue;
+    /* Check each sample */
+    if (sample_triangle(&v1,&v2,&v3,n,&ts) != 0) {
+      free(ts.sample);
+      free(faces);
+      return NULL;
+    }
+    for (i=0; i<ts.n_samples; i++) {
+      if (fe->serror[i]*fe->serror[i] >=
+          dist_sqr_pt_box(&(ts.sample[i]),ebox_min,ebox_max)) {
+        faces[(*n_faces)++] = k;
+        break;
       }
-      free(dcl[k].list);
     }
   }
-  free(dcl);
-  free(dcl_buf);
-  free_triag_sample_error(&tse);
   free(ts.sample);
+  return faces;
+}
+
+/* See compute_error.h */
+int dist_surf_surf(struct model_error *me1, struct model *m2, 
+                   double sampling_density, int min_sample_freq,
+                   struct dist_surf_surf_stats *stats, int flags,
+                   int n_threads, struct prog_reporter *prog)
+{
+  struct model *m1;           /* The m1 model mesh */
+  dvertex_t bbox_min,bbox_max;/* min and max of bounding box of m1 and m2 */
+  struct surf_index *si;      /* The spatial index on m2 */
+  int rcode;
+
+  /* The grid is placed on the bounding box of both models, so that all
+   * samples of m1 fall in it. */
+  m1 = me1->mesh;
+  bbox_min.x = min(m1->bBox[0].x,m2->bBox[0].x);
+  bbox_min.y = min(m1->bBox[0].y,m2->bBox[0].y);
+  bbox_min.z = min(m1->bBox[0].z,m2->bBox[0].z);
+  bbox_max.x = max(m1->bBox[1].x,m2->bBox[1].x);
+  bbox_max.y = max(m1->bBox[1].y,m2->bBox[1].y);
+  bbox_max.z = max(m1->bBox[1].z,m2->bBox[1].z);
+
+  rcode = build_surf_index(&si,m2,&bbox_min,&bbox_max,
+                           ((flags & DIST_AUTO_GRID) ? m1 : NULL),
+                           sampling_density,flags);
+  if (rcode == 0) {
+    rcode = dist_surf_idx(me1,si,sampling_density,min_sample_freq,stats,
+                          flags,n_threads,prog);
+    /* Do normals for model 2 if requested and not yet present */
+    if (rcode == 0 && (flags & DIST_CALC_NORMALS) && m2->normals == NULL &&
+        !prog_cancelled(prog)) {
+      rcode = calc_normals_as_oriented_model(m2,si->tl);
+    }
+    free_surf_index(si);
+  }
+  if (rcode != 0) { /* drop the results, as when cancelled */
+    free_face_error(me1->fe);
+    me1->fe = NULL;
+    me1->n_samples = 0;
+  }
+  return rcode;
+}
+
+/* See compute_error.h */
+int dist_verts_idx(struct model_error *me1, const struct surf_index *si,
+                   struct dist_surf_surf_stats *stats, int flags,
+                   int n_threads, struct prog_reporter *prog)
+{
+  struct model *m1;           /* The m1 model mesh */
+  struct vert_dist_data vd;   /* The data for the worker threads */
+  struct dist_query_stats *qs;/* The query statistics of each thread */
+  int i,kmax;                 /* counters and loop limits */
+  int n_sq;                   /* The number of initialized query states */
+  double d,ad;                /* signed and absolute distance */
+  double sum_sqr;             /* sum of the squared distances */
+  float *verror;              /* The new per vertex errors */
+  int rcode;                  /* The return code */
+
+  /* Initialize */
+  m1 = me1->mesh;
+  if (n_threads <= 0) n_threads = tp_num_cpus();
+  vd.m = m1;
+  vd.is_signed = (flags & DIST_SIGNED) && si->tl->pnormal != NULL;
+  init_dist_stats(stats,si,vd.is_signed,flags);
+  stats->vertices_only = 1;
+  rcode = MESH_NO_MEM; /* until the queries are done */
+  n_sq = 0;
+  qs = NULL;
+  vd.order = NULL;
+  vd.dist = malloc(sizeof(*(vd.dist))*max(m1->num_vert,1));
+  vd.sq = malloc(sizeof(*(vd.sq))*n_threads);
+  if (vd.dist == NULL || vd.sq == NULL) goto end;
+  if (stats->has_qstats && (qs = calloc(n_threads,sizeof(*qs))) == NULL) {
+    goto end;
+  }
+  for (; n_sq<n_threads; n_sq++) {
+    if (init_surf_query(&(vd.sq[n_sq]),si) != 0) goto end;
+    if (qs != NULL) vd.sq[n_sq].qs = &(qs[n_sq]);
+  }
+
+  /* Query the vertices in spatial order */
+  stage_begin(&(stats->t_sampling));
+  if ((vd.order = morton_order(m1)) == NULL) goto end;
+  prog_par_for(prog,n_threads,m1->num_vert,VERT_CHUNK,vert_dist_work,&vd);
+  stage_end(&(stats->t_sampling));
+  for (rcode=0, i=0; i<n_threads && rcode == 0; i++) rcode = vd.sq[i].error;
+  if (rcode == 0 && !prog_cancelled(prog)) {
+    verror = realloc(me1->verror,sizeof(*verror)*max(m1->num_vert,1));
+    if (verror == NULL) {
+      rcode = MESH_NO_MEM;
+    } else {
+      me1->verror = verror;
+    }
+  }
+  if (rcode != 0 || prog_cancelled(prog)) goto end;
+
+  /* Get the statistics, in vertex order so that they do not depend on the
+   * number of threads */
+  stage_begin(&(stats->t_stats));
+  free_face_error(me1->fe);
+  me1->fe = NULL;
+  sum_sqr = 0;
+  for (i=0, kmax=m1->num_vert; i<kmax; i++) {
+    d = vd.dist[i];
+    ad = fabs(d);
+    if (ad < stats->min_dist) stats->min_dist = ad;
+    if (ad > stats->max_dist) stats->max_dist = ad;
+    stats->mean_dist += ad;
+    sum_sqr += d*d;
+    if (vd.is_signed) {
+      if (d < stats->min_sdist) stats->min_sdist = d;
+      if (d > stats->max_sdist) stats->max_sdist = d;
+      stats->mean_sdist += d;
+    }
+    me1->verror[i] = (float) d;
+  }
+  stats->m1_samples = m1->num_vert;
+  if (m1->num_vert > 0) {
+    stats->mean_dist /= m1->num_vert;
+    stats->rms_dist = sqrt(sum_sqr/m1->num_vert);
+    if (vd.is_signed) {
+      stats->mean_sdist /= m1->num_vert;
+      signed_dist_hist(stats,vd.dist,m1->num_vert);
+    }
+  }
+  if (vd.is_signed) {
+    me1->min_error = stats->min_sdist;
+    me1->max_error = stats->max_sdist;
+    me1->mean_error = stats->mean_sdist;
+  } else {
+    me1->min_error = stats->min_dist;
+    me1->max_error = stats->max_dist;
+    me1->mean_error = stats->mean_dist;
+  }
+  me1->is_signed = vd.is_signed;
+  me1->n_samples = m1->num_vert;
+  if (qs != NULL) {
+    for (i=0; i<n_threads; i++) add_query_stats(&(stats->qstats),&(qs[i]));
+  }
+  stage_end(&(stats->t_stats));
+
+ end:
+  if (rcode != 0 || prog_cancelled(prog)) { /* drop the partial results */
+    free_face_error(me1->fe);
+    me1->fe = NULL;
+    free(me1->verror);
+    me1->verror = NULL;
+    me1->n_samples = 0;
+  }
+  for (i=0; i<n_sq; i++) free_surf_query(&(vd.sq[i]));
+  free(vd.sq);
+  free(vd.dist);
+  free(vd.order);
+  free(qs);
+  return rcode;
+}
+
+/* See compute_error.h */
+int dist_verts_surf(struct model_error *me1, struct model *m2,
+                    struct dist_surf_surf_stats *stats, int flags,
+                    int n_threads, struct prog_reporter *prog)
+{
+  struct model *m1;           /* The m1 model mesh */
+  dvertex_t bbox_min,bbox_max;/* min and max of bounding box of m1 and m2 */
+  struct surf_index *si;      /* The spatial index on m2 */
+  int rcode;
+
+  m1 = me1->mesh;
+  bbox_min.x = min(m1->bBox[0].x,m2->bBox[0].x);
+  bbox_min.y = min(m1->bBox[0].y,m2->bBox[0].y);
+  bbox_min.z = min(m1->bBox[0].z,m2->bBox[0].z);
+  bbox_max.x = max(m1->bBox[1].x,m2->bBox[1].x);
+  bbox_max.y = max(m1->bBox[1].y,m2->bBox[1].y);
+  bbox_max.z = max(m1->bBox[1].z,m2->bBox[1].z);
+
+  rcode = build_surf_index(&si,m2,&bbox_min,&bbox_max,NULL,0,flags);
+  if (rcode == 0) {
+    rcode = dist_verts_idx(me1,si,stats,flags,n_threads,prog);
+    /* Do normals for model 2 if requested and not yet present */
+    if (rcode == 0 && (flags & DIST_CALC_NORMALS) && m2->normals == NULL &&
+        !prog_cancelled(prog)) {
+      rcode = calc_normals_as_oriented_model(m2,si->tl);
+    }
+    free_surf_index(si);
+  }
+  if (rcode != 0) { /* drop the results, as when cancelled */
+    free_face_error(me1->fe);
+    me1->fe = NULL;
+    free(me1->verror);
+    me1->verror = NULL;
+    me1->n_samples = 0;
+  }
+  return rcode;
 }
 
 /* See compute_error.h */
@@ -1490,19 +3298,23 @@ void free_face_error(struct face_error *fe)
 {
   if (fe != NULL) {
     free(fe->serror);
+    free(fe->scp);
     free(fe);
   }
 }
 
 /* See compute_error.h */
-void calc_vertex_error(struct model_error *me, int *nv_empty, int *nf_empty)
+int calc_vertex_error(struct model_error *me, int *nv_empty, int *nf_empty)
 {
   int i,n;
+  float *verror;
 
   /* Initialize */
-  me->verror = xa_realloc(me->verror,me->mesh->num_vert*sizeof(*(me->verror)));
+  verror = realloc(me->verror,max(me->mesh->num_vert,1)*sizeof(*verror));
+  if (verror == NULL) return MESH_NO_MEM;
+  me->verror = verror;
   for (i=0; i<me->mesh->num_vert; i++) {
-    me->verror[i] = -1; /* special flag value */
+    me->verror[i] = VERR_UNSET;
   }
 
   /* Get the error values at the vertices of each face */
@@ -1511,14 +3323,14 @@ void calc_vertex_error(struct model_error *me, int *nv_empty, int *nf_empty)
     n = me->fe[i].sample_freq;
     if (n <= 1) { /* no samples at face vertices */
       if (n == 0) (*nf_empty)++; /* no samples for this face */
-      if (me->verror[me->mesh->faces[i].f0] == -1) {
-        me->verror[me->mesh->faces[i].f0] = -2; /* special flag value */
+      if (me->verror[me->mesh->faces[i].f0] == VERR_UNSET) {
+        me->verror[me->mesh->faces[i].f0] = VERR_NO_SAMPLES;
       }
-      if (me->verror[me->mesh->faces[i].f1] == -1) {
-        me->verror[me->mesh->faces[i].f1] = -2; /* special flag value */
+      if (me->verror[me->mesh->faces[i].f1] == VERR_UNSET) {
+        me->verror[me->mesh->faces[i].f1] = VERR_NO_SAMPLES;
       }
-      if (me->verror[me->mesh->faces[i].f2] == -1) {
-        me->verror[me->mesh->faces[i].f2] = -2; /* special flag value */
+      if (me->verror[me->mesh->faces[i].f2] == VERR_UNSET) {
+        me->verror[me->mesh->faces[i].f2] = VERR_NO_SAMPLES;
       }
     } else {
       me->verror[me->mesh->faces[i].f0] = (float)me->fe[i].serror[0];
@@ -1529,9 +3341,24 @@ void calc_vertex_error(struct model_error *me, int *nv_empty, int *nf_empty)
 
   *nv_empty = 0;
   for (i=0; i<me->mesh->num_vert; i++) {
-    if (me->verror[i] == -2) { /* no samples at this vertex */
+    if (me->verror[i] == VERR_NO_SAMPLES) { /* no samples at this vertex */
       (*nv_empty)++;
     }
   }
+  return 0;
+}
 
+/* See compute_error.h */
+const char *dist_error_str(int rcode)
+{
+  switch (rcode) {
+  case 0:
+    return "no error";
+  case MESH_NO_MEM:
+    return "not enough memory";
+  case MESH_MODEL_ERR:
+    return "coordinate overflow, NaN or infinite value in the models";
+  default:
+    return "unknown error";
+  }
 }
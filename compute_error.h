@@ -59,6 +59,7 @@
 
 #include <model_analysis.h>
 #include <reporting.h>
+#include <timing.h>
 
 #ifdef __cplusplus
 #define BEGIN_DECL extern "C" {
@@ -82,9 +83,21 @@ struct size3d {
   int z; /* Number of elements in the Z direction */
 };
 
+/* The closest point of model 2 to a sample of model 1 */
+struct sample_closest_point {
+  int face;  /* The index of the model 2 face on which the closest point
+              * lies */
+  float u;   /* The barycentric coordinate of the closest point relative to
+              * the f1 vertex of the face */
+  float v;   /* The barycentric coordinate of the closest point relative to
+              * the f2 vertex of the face. The one relative to the f0 vertex
+              * is 1-u-v. */
+};
+
 /* Per face error metrics */
 struct face_error {
-  double face_area;      /* Area of the face, for error weighting in averages */
+  double face_area;      /* Area of the face, for error weighting in
+                          * averages */
   double min_error;      /* The minimum error for the face */
   double max_error;      /* The maximum error for the face */
   double mean_error;     /* The mean error for the face */
@@ -100,7 +113,14 @@ struct face_error {
                           * direction. If sample_freq is larger than 1, the
                           * error at v0 is serror[0], at v1 is
                           * serror[sample_freq*(sample_freq+1)/2-1] and at v2
-                          * is serror[sample_freq-1]. */
+                          * is serror[sample_freq-1]. If the signed distance
+                          * is calculated (see DIST_SIGNED) the errors are
+                          * signed, and so are min_error, max_error and
+                          * mean_error. */
+  struct sample_closest_point *scp; /* The closest point of model 2 to each
+                                     * sample of the face, in the same order
+                                     * as serror. NULL if not requested with
+                                     * DIST_CLOSEST_POINTS. */
   int sample_freq;       /* The sampling frequency for this triangle. If zero,
                           * no error was calculated. The number of samples is
                           * sample_freq*(sample_freq+1)/2. */
@@ -116,12 +136,64 @@ struct model_error {
   struct face_error *fe;  /* The per-face error metrics. NULL if not
                            * present. The fe[i].serror arrays are all parts of
                            * one array, starting at fe[0].serror and can thus
-                           * be accessed linearly. */
+                           * be accessed linearly. Likewise for the
+                           * fe[i].scp arrays. */
   float *verror;          /* The per vertex error array. NULL if not
                            * present. */
+  int is_signed;          /* Non-zero if the errors are signed distances
+                           * (see DIST_SIGNED) */
   struct model_info *info;/* The model information. NULL if not present. */
 };
 
+/* Flags for the dist_surf_surf(), dist_surf_idx() and build_surf_index()
+ * functions */
+#define DIST_CALC_NORMALS 0x01 /* Calculate the normals of model 2 */
+#define DIST_QUERY_STATS  0x02 /* Collect the statistics of the point to
+                                * surface distance queries */
+#define DIST_AUTO_GRID    0x04 /* Auto-tune the partitioning grid cell size
+                                * with probe queries */
+#define DIST_CLOSEST_POINTS 0x08 /* Record the closest point of model 2 to
+                                  * each sample of model 1 */
+#define DIST_SIGNED       0x10 /* Calculate the signed distance, positive on
+                                * the side of model 2 its normals point to */
+
+/* Number of bins in the histograms of struct dist_query_stats */
+#define DQS_HIST_BINS 16
+
+/* Statistics of the point to surface distance queries, useful to tune the
+ * partitioning grid. The counts are stored as double, since they can
+ * overflow an int. The histograms with logarithmic bins count in bin 0 the
+ * zero values and in bin i the values in [2^(i-1),2^i). In all histograms
+ * the last bin also counts all larger values. */
+struct dist_query_stats {
+  double n_queries;      /* Number of queries (i.e. samples) */
+  double n_cell_scans;   /* Number of cells for which the distance from the
+                          * point to the cell is calculated */
+  double n_cell_t_scans; /* Number of cells for which their triangles are
+                          * scanned */
+  double n_triag_scans;  /* Number of triangles for which the distance to
+                          * the point is calculated */
+  double sum_kmax;       /* Sum of the last cell ring scanned (as cell index
+                          * distance k) by each query */
+  double n_warm_starts;  /* Number of queries for which the distance found by
+                          * the previous query allowed to skip the first
+                          * cell rings */
+  double sum_kstart;     /* Sum of the first cell ring scanned by each
+                          * query */
+  double hist_triags[DQS_HIST_BINS]; /* Histogram of the number of triangles
+                                      * scanned per query (log bins) */
+  double hist_kmax[DQS_HIST_BINS];   /* Histogram of the last cell ring
+                                      * scanned per query (bin k is ring
+                                      * k) */
+  double hist_cell_len[DQS_HIST_BINS]; /* Histogram of the number of
+                                        * triangles in each non-empty cell
+                                        * of the grid (log bins) */
+};
+
+/* Number of bins in the signed distance histogram of struct
+ * dist_surf_surf_stats */
+#define SDIST_HIST_BINS 20
+
 /* Statistics from the dist_surf_surf function */
 struct dist_surf_surf_stats {
   double st_m1_area;/* Total area of sampled triangles of model 1 */
@@ -132,17 +204,63 @@ struct dist_surf_surf_stats {
   double mean_dist; /* Mean distance from model 1 to model 2 */
   double rms_dist;  /* Root mean squared distance from model 1 to model 2 */
   double cell_sz;   /* The partitioning cubic cell side length */
+  double cell_ratio;/* The ratio between cell_sz and the side length of an
+                     * average equilateral triangle of model 2 */
+  double probe_cost;/* The time per distance query (secs, wall clock) measured
+                     * with the chosen cell size when the grid has been
+                     * auto-tuned, zero otherwise */
   double n_t_p_nec; /* Average number of triangles per non-empty cell */
   int m1_samples;   /* Total number of samples taken on model 1 */
   struct size3d grid_sz; /* The number of cells in the partitioning grid in
                           * each direction X,Y,Z */
   int n_ne_cells;   /* Number of non-empty cells */
+  struct stage_time t_tlist;    /* Time to build the triangle list of
+                                 * model 2 */
+  struct stage_time t_tune;     /* Time to auto-tune the grid cell size,
+                                 * including the probe grids */
+  struct stage_time t_grid;     /* Time to build the partitioning grid */
+  struct stage_time t_sampling; /* Time to sample model 1 and calculate the
+                                 * distance at each sample */
+  struct stage_time t_stats;    /* Time to calculate the error statistics
+                                 * from the sample distances */
+  int vertices_only;/* Non-zero if the distance has been calculated only at
+                     * the vertices of model 1 (see dist_verts_idx()), in
+                     * which case the statistics are not weighted by area
+                     * and the area fields and times of model 1 are
+                     * zero */
+  int has_qstats;   /* Non-zero if qstats has been collected */
+  struct dist_query_stats qstats; /* The distance query statistics, only if
+                                   * requested with DIST_QUERY_STATS */
+  int is_signed;    /* Non-zero if the signed distance has been calculated,
+                     * in which case the following fields are set. The
+                     * fields above are always of the unsigned distance. */
+  double min_sdist; /* Minimum signed distance from model 1 to model 2 */
+  double max_sdist; /* Maximum signed distance from model 1 to model 2 */
+  double mean_sdist;/* Mean signed distance from model 1 to model 2 */
+  double sdist_range; /* The largest absolute signed distance, the limit of
+                       * the histogram bins */
+  double sdist_hist[SDIST_HIST_BINS]; /* Two-sided histogram of the signed
+                                       * distance at the samples, with
+                                       * SDIST_HIST_BINS bins of equal width
+                                       * spanning [-sdist_range,
+                                       * sdist_range] (the last bin also
+                                       * counts sdist_range) */
 };
 
+/* Spatial index on the surface of a model, to speed up the distance
+ * calculations. It is opaque, see build_surf_index(). */
+struct surf_index;
+
 /* --------------------------------------------------------------------------*
  *                       Exported functions                                  *
  * --------------------------------------------------------------------------*/
 
+/* The distance calculation functions below that return an int return zero
+ * on success (also if cancelled), or a negative error code of model_in.h:
+ * MESH_NO_MEM if out of memory, or MESH_MODEL_ERR if a coordinate overflows
+ * or a distance is NaN or infinite (e.g., if a model has NaN or infinite
+ * vertices). See dist_error_str(). */
+
 /* Calculates the distance from model me1->mesh (m1) to model m2. The
  * triangles of m1 are sampled so that the sampling density (number of samples
  * per unit surface) is sampling_density. If min_sample_freq is non-zero, all
@@ -150,31 +268,191 @@ struct dist_surf_surf_stats {
  * even if the specified sampling density is too low for that. The per face
  * (of m1) error metrics are returned in a new array (of length m1->num_faces)
  * allocated at me1->fe. The overall distance metrics and other statistics are
- * returned in stats. Optionally, if calc_normals is non-zero and m2 has no
- * normals or face normals, the normals will be calculated and added to m2
+ * returned in stats. Optionally, if the DIST_CALC_NORMALS bit is set in
+ * flags and m2 has no normals, the normals will be calculated and added to m2
  * (only normals, not face normals). The normals are calculated assuming that
  * the model m2 is oriented, if it is not the case the resulting normals can
  * be incorrect. Information already used to calculate the distance is reused
- * to compute the normals, so it is very fast. If prog in not NULL it is used
- * for reporting progress. The memory allocated at me1->fe should be freed by
- * calling free_face_error(me1->fe). Note that non-zero values for
- * min_sample_freq distort the uniform distribution of error samples. */
-void dist_surf_surf(struct model_error *me1, struct model *m2, 
+ * to compute the normals, so it is very fast. If the DIST_QUERY_STATS bit is
+ * set in flags the statistics of the distance queries are also collected in
+ * stats->qstats, at a small cost. If the DIST_AUTO_GRID bit is set in flags
+ * the grid cell size is auto-tuned with samples of m1 (see
+ * build_surf_index()). If the DIST_CLOSEST_POINTS bit is set in flags the
+ * closest point of m2 to each sample is stored in the me1->fe[i].scp
+ * arrays, otherwise they are NULL. If the DIST_SIGNED bit is set in flags
+ * the signed distance is calculated: the errors in me1 are signed and the
+ * signed statistics are set in stats (see build_surf_index()). The sign is
+ * only meaningful if m2 is oriented. The triangles are sampled using
+ * n_threads threads (if zero or negative, as many as processors), the
+ * results not depending on it. The sampling frequency of each triangle is
+ * drawn from a deterministic sequence, so that repeated calculations give
+ * the same samples. If prog is not NULL it is used for reporting progress. If
+ * the cancellation is requested through prog (see struct prog_reporter) the
+ * calculation stops after the current block of faces, me1->fe is freed and set
+ * to NULL and stats is not valid. The same happens on error. The memory
+ * allocated at me1->fe should be freed by calling free_face_error(me1->fe).
+ * Note that non-zero values for min_sample_freq distort the uniform
+ * distribution of error samples. */
+int dist_surf_surf(struct model_error *me1, struct model *m2, 
 		    double sampling_density, int min_sample_freq,
-                    struct dist_surf_surf_stats *stats, int calc_normals,
-                    struct prog_reporter *prog);
+                    struct dist_surf_surf_stats *stats, int flags,
+                    int n_threads, struct prog_reporter *prog);
 
 
+/* Builds the spatial index on the surface of model m, used to calculate the
+ * distance from a model to m with dist_surf_idx(). The index is a grid of
+ * cubic cells placed on the bounding box given by bbox_min and bbox_max, or
+ * on the bounding box of m if either is NULL. If probe_m is NULL the cell
+ * size is derived from the average triangle size of m with a fixed
+ * ratio. Otherwise it is auto-tuned: the model probe_m is sampled with
+ * sampling_density as in dist_surf_idx(), and the distance from a subset of
+ * those samples to m is timed with several candidate cell sizes. The one
+ * minimizing the estimated time for building the grid and querying all the
+ * samples is kept. If the DIST_SIGNED bit is set in flags the angle
+ * weighted pseudo-normals of the vertices and edges of m are also stored,
+ * so that the sign of the distance can be obtained from the normal of the
+ * closest feature (face, edge or vertex) of m. The sign is positive on the
+ * side towards which the normals of m point. The other flags are
+ * ignored. The index only refers to m during the call, so m can be freed
+ * afterwards. The index is not modified by the distance calculations, and can
+ * thus be used by several of them at the same time (e.g., from different
+ * threads). The index is returned in *si_ref, and should be freed by
+ * free_surf_index(). On error *si_ref is NULL. */
+int build_surf_index(struct surf_index **si_ref, const struct model *m,
+                     const dvertex_t *bbox_min, const dvertex_t *bbox_max,
+                     const struct model *probe_m, double sampling_density,
+                     int flags);
+
+/* Frees the spatial index si, returned by build_surf_index(). */
+void free_surf_index(struct surf_index *si);
+
+/* Updates the spatial index si, built by build_surf_index() on model m,
+ * after a local edit of m, replacing only the triangles of the edited faces
+ * in the cells of the grid. The edit is described as for
+ * dist_surf_idx_update(): old_num_faces is the number of faces of m when si
+ * was built or last updated, and the n_changed indices in changed are the
+ * faces whose vertices have moved or been replaced. The bounding box of
+ * the edited region, covering the old and the new triangles of the edited
+ * faces, is returned in ebox_min and ebox_max (with ebox_min larger than
+ * ebox_max if nothing was edited), see faces_near_edit(). The grid is not
+ * moved nor resized, so all the vertices of the edited faces must fall in
+ * it, and m must have at least one face left. Otherwise 1 is returned,
+ * si is not modified and it should be built again. Zero is returned on
+ * success, and MESH_NO_MEM if out of memory, in which case si can only be
+ * freed. The pseudo-normals for the signed distance, if any, are all
+ * calculated again. No distance calculation can use si during the update. */
+int update_surf_index(struct surf_index *si, const struct model *m,
+                      int old_num_faces, const int *changed, int n_changed,
+                      dvertex_t *ebox_min, dvertex_t *ebox_max);
+
+/* Same as dist_surf_surf(), but the distance is calculated to the surface
+ * indexed by si (as returned by build_surf_index()), and no normals can be
+ * calculated nor the grid tuned (i.e. DIST_CALC_NORMALS and DIST_AUTO_GRID
+ * are ignored). DIST_SIGNED is ignored if si was not built with it. The
+ * samples of me1->mesh can fall outside of the bounding box of si, although
+ * the calculation is faster if they do not. This is used to measure the
+ * distance of several models to the same one, building its index only once.
+ * The triangle list, tuning and grid build times in stats are those of
+ * build_surf_index() for si. */
+int dist_surf_idx(struct model_error *me1, const struct surf_index *si,
+                   double sampling_density, int min_sample_freq,
+                   struct dist_surf_surf_stats *stats, int flags,
+                   int n_threads, struct prog_reporter *prog);
+
+/* Updates the distance calculated by dist_surf_idx() (or a previous call to
+ * this function) after a local edit of model me1->mesh (m1), sampling again
+ * only the edited faces. The surface index si (possibly updated in the
+ * meantime by update_surf_index()), sampling_density, min_sample_freq and
+ * flags must be the same as in the previous call, and stats must hold the
+ * statistics it returned. If DIST_CLOSEST_POINTS is set but was not in the
+ * previous call, all the faces are sampled again. The number of faces of m1 in
+ * the previous call is old_num_faces, the faces from old_num_faces to
+ * m1->num_faces-1 are new and, if m1->num_faces is smaller, the last ones have
+ * been removed. A face elsewhere is removed by moving the last face into its
+ * place and dropping the last one. The n_changed indices in changed are the
+ * faces whose vertices have moved or been replaced (which includes the
+ * destinations of such moves); indices of new or removed faces are ignored.
+ * The per face errors of unchanged faces are kept, and the overall statistics
+ * in stats are updated by removing the area weighted contributions of the old
+ * faces and adding those of the new ones. If no face was added or removed and
+ * the changed faces keep their number of samples (e.g., after an edit of model
+ * 2, see faces_near_edit()), their samples are replaced in place and only
+ * those are read. Otherwise the sample array is rebuilt, copying the samples
+ * of all the unchanged faces. The extremes are obtained again from the per
+ * face errors (reading the samples of the faces whose signed error crosses
+ * zero) only if a removed contribution held one of them, and the signed
+ * distance histogram from all the samples only if its range changes or the
+ * array is rebuilt. No distance query is needed for any of them. The query
+ * statistics accumulate over the calls, while the sampling and statistics
+ * times are those of this call. The per vertex errors in me1->verror are not
+ * updated, see calc_vertex_error(). On error me1 is not modified, but stats is
+ * no longer valid. */
+int dist_surf_idx_update(struct model_error *me1,
+                         const struct surf_index *si,
+                         double sampling_density, int min_sample_freq,
+                         int old_num_faces, const int *changed,
+                         int n_changed, struct dist_surf_surf_stats *stats,
+                         int flags);
+
+/* Returns the faces of model me1->mesh whose distance, as calculated by
+ * dist_surf_idx() or dist_surf_idx_update(), can change after the edit of
+ * model 2 in the box (ebox_min,ebox_max) returned by update_surf_index().
+ * Those are the faces with a sample whose distance is not smaller than its
+ * distance to the box, since the closest point of the others is outside of
+ * it and nothing closer can have appeared. The number of faces is returned
+ * in *n_faces, and the indices in a new array, which should be freed by the
+ * caller (NULL if out of memory). Passing them as the changed faces of
+ * dist_surf_idx_update(), with no new faces, recalculates the distance of
+ * model 1 to the edited model 2. The model me1->mesh must not have been
+ * modified since the distance calculation. */
+int *faces_near_edit(const struct model_error *me1,
+                     const dvertex_t *ebox_min, const dvertex_t *ebox_max,
+                     int *n_faces);
+
+/* Calculates the distance from each vertex of model me1->mesh (m1) to the
+ * surface indexed by si, instead of from samples of its triangles. Each
+ * vertex is queried exactly once, using n_threads threads (if zero or
+ * negative, as many as processors). The distances are stored in
+ * me1->verror (realloc'ed to m1->num_vert elements), any me1->fe array is
+ * freed and set to NULL, and me1->n_samples is the number of vertices. The
+ * statistics in stats are those of the vertex distances, all vertices with
+ * the same weight, and m1_samples is the number of vertices. The flags are
+ * as for dist_surf_idx(), but DIST_CLOSEST_POINTS is also ignored. If prog
+ * is not NULL it is used for reporting progress and cancellation, as for
+ * dist_surf_surf() (me1->verror is then also freed and set to NULL, as on
+ * error). The
+ * per triangle sampling is skipped, so it is much faster, but the distance
+ * between the vertices is not measured. The faces of m1 are not used, so it
+ * can also be a point cloud. The vertices are queried in Morton (Z-order)
+ * order, so that consecutive queries are close in space whatever the vertex
+ * order. */
+int dist_verts_idx(struct model_error *me1, const struct surf_index *si,
+                   struct dist_surf_surf_stats *stats, int flags,
+                   int n_threads, struct prog_reporter *prog);
+
+/* Same as dist_verts_idx(), but the distance is to model m2, indexed as in
+ * dist_surf_surf(). DIST_CALC_NORMALS is honored, DIST_AUTO_GRID and
+ * DIST_CLOSEST_POINTS are ignored. */
+int dist_verts_surf(struct model_error *me1, struct model *m2,
+                    struct dist_surf_surf_stats *stats, int flags,
+                    int n_threads, struct prog_reporter *prog);
+
 /* Frees the memory allocated by dist_surf_surf() for the per face error
  * metrics. */
 void free_face_error(struct face_error *fe);
 
 /* Stores the error values at each vertex in the me->verror array (realloc'ed
  * to the correct size), given the per face error metrics in me->fe. A
- * negative error (special flag) is assigned to vertices for which there are
- * no sample points. The number of vertices and faces without error samples is
- * returned in *nv_empty and *nf_empty, respectively. */
-void calc_vertex_error(struct model_error *me, int *nv_empty, int *nf_empty);
+ * special flag value, smaller than any error (even signed), is assigned to
+ * vertices for which there are no sample points. The number of vertices and
+ * faces without error samples is returned in *nv_empty and *nf_empty,
+ * respectively. Zero is returned on success, and MESH_NO_MEM if out of
+ * memory, in which case me->verror is not modified. */
+int calc_vertex_error(struct model_error *me, int *nv_empty, int *nf_empty);
+
+/* Returns a message describing the error code rcode returned by the above
+ * functions. */
+const char *dist_error_str(int rcode);
 
 END_DECL
 #undef END_DECL
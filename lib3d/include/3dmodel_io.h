@@ -12,6 +12,9 @@ extern "C" {
 #endif
   struct model* read_raw_model(const char*);
   void write_raw_model(const struct model*, char*, const int);
+  FILE* write_raw_header(char*, int, int, int, const int);
+  void write_raw_vertices(FILE*, const vertex_t*, int, const int);
+  void write_raw_faces(FILE*, const face_t*, int, const int);
 #ifdef __cplusplus
 }
 #endif
@@ -24,6 +24,17 @@ extern "C" {
                                    struct vertex_curvature*,
                                    const struct ring_info*);
   int compute_curvature(const struct model*, struct vertex_curvature*);
+  /* Principal curvatures and directions by least squares fitting of a
+   * quadric in the tangent plane of each vertex, to its 1-ring (or 2-ring
+   * if use_2ring is non-zero) neighbours, using up to n_threads
+   * threads. The vertex normals of the model must have been computed. Sets
+   * c, k1, k2, t1, t2, gauss_curv and mean_curv of each vertex. Returns
+   * the number of vertices that could not be fitted (e.g. with less than
+   * 3 neighbours), whose curvatures are set to zero, or -1 if out of
+   * memory. */
+  int compute_curvature_lsq(const struct model*, const struct ring_info*,
+                            struct vertex_curvature*, int use_2ring,
+                            int n_threads);
 
 #ifdef __cplusplus
 }
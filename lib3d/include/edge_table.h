@@ -0,0 +1,130 @@
+/* $Id$ */
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+
+/* Compact edge adjacency of a triangle mesh. Each face k has three
+ * half-edges, numbered 3*k, 3*k+1 and 3*k+2, going from f0 to f1, f1 to f2
+ * and f2 to f0 respectively. The half-edges lying on the same (undirected)
+ * edge are linked in a circular list, so that the faces sharing an edge,
+ * and the faces around a vertex, can be found without any search. The table
+ * is built in linear time by bucketing the half-edges on their edge key and
+ * is shared by the model analysis, the ring builder and the normal
+ * orientation code. Degenerate faces (i.e. with repeated vertices) have no
+ * edges and do not appear anywhere in the table. */
+
+#ifndef EDGE_TABLE_PROTO
+#define EDGE_TABLE_PROTO
+
+#include <3dmodel.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif 
+
+/* --------------------------------------------------------------------------
+   DATA TYPES
+   -------------------------------------------------------------------------- */
+
+/* The edge table. All arrays are malloc'ed. */
+struct edge_table {
+  int n_faces;      /* number of faces of the model */
+  int n_vert;       /* number of vertices of the model */
+  int n_edges;      /* number of distinct edges */
+  int *he_edge;     /* edge of each half-edge (3*n_faces), -1 for the
+                     * half-edges of degenerate faces */
+  int *he_radial;   /* the next half-edge on the same edge (3*n_faces), in
+                     * increasing order and wrapping around to the first
+                     * one. It is the half-edge itself for boundary edges
+                     * and -1 for degenerate faces. */
+  int *edge_he;     /* the first (smallest) half-edge of each edge
+                     * (n_edges) */
+  int *vtx_he;      /* the first (smallest) half-edge starting at each
+                     * vertex (n_vert), -1 if the vertex has no faces */
+  int *vtx_n_faces; /* the number of faces incident on each vertex
+                     * (n_vert) */
+};
+
+/* --------------------------------------------------------------------------
+   MACROS
+   -------------------------------------------------------------------------- */
+
+/* The face of half-edge h */
+#define ET_HE_FACE(h) ((h)/3)
+/* The next half-edge in the same face as h */
+#define ET_HE_NEXT(h) (((h)%3 == 2) ? (h)-2 : (h)+1)
+/* The previous half-edge in the same face as h */
+#define ET_HE_PREV(h) (((h)%3 == 0) ? (h)+2 : (h)-1)
+/* The starting vertex of half-edge h, where faces is the face array of the
+ * model */
+#define ET_HE_ORG(faces,h)                                               \
+  (((h)%3 == 0) ? (faces)[(h)/3].f0 :                                    \
+   (((h)%3 == 1) ? (faces)[(h)/3].f1 : (faces)[(h)/3].f2))
+/* The ending vertex of half-edge h, where faces is the face array of the
+ * model */
+#define ET_HE_DST(faces,h)                                               \
+  (((h)%3 == 0) ? (faces)[(h)/3].f1 :                                    \
+   (((h)%3 == 1) ? (faces)[(h)/3].f2 : (faces)[(h)/3].f0))
+/* The other half-edge on the same edge as h in table et, if the edge is
+ * manifold. If h is on a boundary edge (or a degenerate face) it is -1 and
+ * if more than two half-edges share the edge (non-manifold edge) it is
+ * -2. */
+#define ET_HE_TWIN(et,h)                                                 \
+  (((et)->he_radial[h] < 0 || (et)->he_radial[h] == (h)) ? -1 :          \
+   (((et)->he_radial[(et)->he_radial[h]] == (h)) ? (et)->he_radial[h] : -2))
+
+/* --------------------------------------------------------------------------
+   EXPORTED FUNCTIONS
+   -------------------------------------------------------------------------- */
+
+/* Builds and returns the edge table of model m, using up to n_threads
+ * threads. Returns NULL if there is not enough memory. The returned table
+ * should be freed with free_edge_table(). */
+struct edge_table *build_edge_table(const struct model *m, int n_threads);
+
+/* Frees the edge table et and all its arrays. Does nothing if et is NULL. */
+void free_edge_table(struct edge_table *et);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
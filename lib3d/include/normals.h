@@ -1,6 +1,7 @@
 /* $Id$ */
 #include <3dmodel.h>
 #include <ring.h>
+#include <edge_table.h>
 
 #ifndef _NORMALS_PROTO
 #define _NORMALS_PROTO
@@ -30,8 +31,7 @@ struct dual_graph_info {
 };
 
 struct dual_graph_index {
-  int ring[6]; /* each tr. has 3 dual edges, and we can hit them no
-                  more than twice (othewise non-manifold face) */ 
+  int ring[3]; /* each tr. has at most 3 dual edges, one per edge */ 
   int face_info; /* number of neighb. faces */
 };
 
@@ -46,8 +46,9 @@ struct edge_list {
 extern "C" {
 #endif
   struct face_tree** bfs_build_spanning_tree(const struct model*, 
-					     struct ring_info*);
-  vertex_t* compute_face_normals(const struct model*, struct ring_info*);
+					     const struct edge_table*);
+  vertex_t* compute_face_normals(const struct model*, 
+                                 const struct edge_table*);
   void compute_vertex_normal(struct model*, const struct ring_info*, 
                              const vertex_t*);
 #ifdef __cplusplus
@@ -25,6 +25,7 @@
 
 
 #include <3dmodel.h>
+#include <edge_table.h>
 
 #ifndef _RING_PROTO
 #define _RING_PROTO
@@ -41,14 +42,30 @@ struct edge_v {
   int v0; 
   int v1; 
   int face;
-  struct edge_v *prev, *next;
 }; 
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-  void build_star_global(const struct model*, struct ring_info*);
+  /* The rings are returned in a single block, to be freed with
+   * free_rings(). build_rings() returns NULL if out of memory. */
+  struct ring_info* build_rings(const struct model*, const struct edge_table*,
+                                int n_threads);
+  struct ring_info* build_star_global(const struct model*);
+  /* alloc_rings() allocates the block of build_rings() without building
+   * the rings, which are then built one by one with build_vertex_ring() or
+   * otherwise filled (e.g. from a coarser level of subdivision) */
+  struct ring_info* alloc_rings(const struct model*, const struct edge_table*);
+  void build_vertex_ring(const struct model*, const struct edge_table*, 
+                         int, struct ring_info*);
+  /* Rotates a closed (type 0) ring to its usual start, the same for all
+   * the ring builders */
+  void order_closed_ring(struct ring_info*);
+  void free_rings(struct ring_info*);
+  /* build_star() builds the same ring as build_rings() for a single
+   * vertex. Its vertex and face lists are malloc'ed and are to be freed by
+   * the caller. */
   void build_star(const struct model*, int, struct ring_info*);
 
 #ifdef __cplusplus
@@ -0,0 +1,136 @@
+/* $Id$ */
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+/* Laplacian smoothing of a triangle mesh. The Laplacian is assembled once,
+ * from the edge table, as a sparse matrix in compressed row (CSR) format,
+ * with either uniform (umbrella) or cotangent edge weights. The matrix can
+ * then be applied any number of times, as explicit smoothing steps, as
+ * Taubin lambda/mu steps (which do not shrink the model), or as an
+ * implicit step solved with a conjugate gradient. The coordinates are
+ * processed in double precision, stored as separate x, y and z arrays, and
+ * all the loops are run in parallel on the thread pool.
+ *
+ * With w_ij the weight of edge (i,j) and d_i the sum of the weights of the
+ * edges of vertex i, an explicit step with factor l moves vertex i to
+ *   p_i + l*(sum_j w_ij*p_j/d_i - p_i)
+ * and an implicit step with factor l solves the symmetric system
+ *   ((1+l)*D - l*W) p' = D p
+ * where D is the diagonal of the d_i and W the matrix of the w_ij. */
+
+#ifndef SMOOTHING_PROTO
+#define SMOOTHING_PROTO
+
+#include <3dmodel.h>
+#include <edge_table.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif 
+
+/* --------------------------------------------------------------------------
+   DATA TYPES
+   -------------------------------------------------------------------------- */
+
+/* Edge weights of the Laplacian */
+#define LAPL_UNIFORM   0 /* all weights are 1 */
+#define LAPL_COTANGENT 1 /* (cot(a)+cot(b))/2, a and b being the angles
+                          * opposite to the edge, or 0 if negative (i.e.
+                          * for obtuse angles summing to more than pi) */
+
+/* The Laplacian of a model, as a symmetric sparse matrix. The neighbours of
+ * vertex i are col[row_start[i]] to col[row_start[i+1]-1], in increasing
+ * order, and w holds the corresponding edge weights. All arrays are
+ * malloc'ed. */
+struct lapl_matrix {
+  int n_rows;     /* number of rows (i.e. vertices of the model) */
+  int *row_start; /* start of each row in col and w (n_rows+1) */
+  int *col;       /* column (i.e. neighbour vertex) of each entry (twice
+                   * the number of edges) */
+  double *w;      /* weight of each entry */
+  double *diag;   /* sum of the weights of each row (n_rows). Vertices
+                   * for which it is not positive (i.e. without edges or
+                   * with a degenerate cotangent star) are not moved. */
+};
+
+/* --------------------------------------------------------------------------
+   EXPORTED FUNCTIONS
+   -------------------------------------------------------------------------- */
+
+/* Builds the Laplacian of model m, with edge table et, using the edge
+ * weights given by type (LAPL_UNIFORM or LAPL_COTANGENT) and up to
+ * n_threads threads. The cotangent weights are computed from the current
+ * vertex positions. Returns NULL if there is not enough memory. The
+ * returned matrix should be freed with free_lapl_matrix(). */
+struct lapl_matrix *build_lapl_matrix(const struct model *m,
+                                      const struct edge_table *et,
+                                      int type, int n_threads);
+
+/* Frees the matrix lm and all its arrays. Does nothing if lm is NULL. */
+void free_lapl_matrix(struct lapl_matrix *lm);
+
+/* Applies n_iter explicit smoothing steps with factor lambda to the
+ * vertices of m, using the Laplacian lm of m and up to n_threads threads.
+ * If mu is not zero each step is followed by a second one with factor mu
+ * (Taubin smoothing, mu should then be negative and a bit larger in
+ * magnitude than lambda, e.g. lambda=0.5 and mu=-0.53). Returns zero on
+ * success and -1 if there is not enough memory (m is then unchanged). */
+int lapl_smooth(const struct lapl_matrix *lm, struct model *m, int n_iter,
+                double lambda, double mu, int n_threads);
+
+/* Applies one implicit smoothing step with factor lambda to the vertices
+ * of m, using the Laplacian lm of m and up to n_threads threads. The
+ * system is solved by a Jacobi preconditioned conjugate gradient, for
+ * each coordinate, until the residual is below tol times the norm of the
+ * right hand side. The weights being non-negative the system is positive
+ * definite for any positive lambda. Returns the number of iterations
+ * done, -1 if there is not enough memory (m is then unchanged) or -2 if
+ * the gradient did not converge in max_iter iterations or broke down (m
+ * then holds the last iterate). */
+int lapl_smooth_implicit(const struct lapl_matrix *lm, struct model *m,
+                         double lambda, int max_iter, double tol,
+                         int n_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,13 +9,6 @@
 #define _SUBDIV_H_PROTO_
 
 
-struct midpoint_info {
-  int size;
-  int *midpoint_idx; /* stores the midpoint idx for each edge of the
-                      * 1-ring */
-  bitmap_t *edge_subdiv_done;
-};
-
 struct subdiv_functions {
   int id;
   void (*midpoint_func)(const struct ring_info*, 
@@ -84,6 +77,21 @@ extern "C" {
 
   struct model* subdiv(struct model*, const struct subdiv_functions*);
 
+  /* Performs n_lev levels of 1-to-4 subdivision of raw_model with the
+   * functions sf, using n_threads threads (all the processors if zero or
+   * negative). The edge table and rings of each level are derived from the
+   * ones of the previous level instead of being rebuilt. The intermediate
+   * levels are freed, raw_model is not. subdiv_levels() returns the last
+   * level, subdiv_levels_write() writes it to the raw file filename while
+   * it is computed, without ever storing it. */
+  struct model* subdiv_levels(struct model *raw_model, 
+                              const struct subdiv_functions *sf, 
+                              int n_lev, int n_threads);
+  void subdiv_levels_write(struct model *raw_model, 
+                           const struct subdiv_functions *sf, 
+                           int n_lev, int n_threads, char *filename,
+                           int use_binary);
+
 
   struct model* subdiv_sqrt3(struct model*,  
                              const struct subdiv_sqrt3_functions*);
@@ -0,0 +1,118 @@
+/* $Id$ */
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+/* Minimal portable worker pool used to run loops in parallel. The work is
+ * split in chunks of consecutive indices which are handed out dynamically to
+ * a fixed number of worker threads, so that loops with an irregular cost per
+ * index are balanced. POSIX threads and Win32 threads are supported. If
+ * MESH_NO_THREADS is defined at compile time everything runs serially in the
+ * calling thread. */
+
+#ifndef THREAD_POOL_PROTO
+#define THREAD_POOL_PROTO
+
+#ifdef __cplusplus
+extern "C" {
+#endif 
+
+/* --------------------------------------------------------------------------
+   DATA TYPES
+   -------------------------------------------------------------------------- */
+
+/* The function called by the workers. It should process the indices from
+ * 'start' to 'end-1' (inclusive). The 'data' argument is the one given to
+ * tp_par_for() and 'tid' is the index of the worker thread calling the
+ * function, between 0 and n_threads-1. It is intended to index per thread
+ * private storage (buffers, counters, etc.). A given 'tid' is never used by
+ * two threads at the same time. */
+typedef void tp_work_func_t(void *data, int start, int end, int tid);
+
+/* The function called by tp_par_for_poll() while the loop runs. The 'data'
+ * argument is the 'poll_data' one given to tp_par_for_poll(), 'done' the
+ * number of indices processed so far and 'n' the total number of indices.
+ * If it returns non-zero no more chunks are handed out. */
+typedef int tp_poll_func_t(void *data, int done, int n);
+
+/* --------------------------------------------------------------------------
+   EXPORTED FUNCTIONS
+   -------------------------------------------------------------------------- */
+
+/* Returns the number of processors available on the system (at least 1) */
+int tp_num_cpus(void);
+
+/* Calls 'work' over the index range 0 to 'n-1', using at most 'n_threads'
+ * threads (the calling thread is one of them). The range is split in chunks
+ * of 'chunk' consecutive indices (if 'chunk' is zero or negative a default
+ * value is derived from 'n' and 'n_threads') and each thread repeatedly
+ * takes the next unprocessed chunk until none is left. The function returns
+ * when all indices have been processed. If threads can not be created the
+ * remaining work is done by the threads already running (in the worst case
+ * only the calling one), so the call never fails. The function returns the
+ * number of threads actually used. */
+int tp_par_for(int n_threads, int n, int chunk, tp_work_func_t *work, 
+               void *data);
+
+/* As tp_par_for(), but the calling thread calls 'poll' every 'interval'
+ * seconds while the loop runs, so that it can report the progress at a
+ * fixed rate. When more than one thread is used the calling thread does
+ * not process indices: it waits for the n_threads workers between the
+ * calls. Otherwise it calls 'poll' between chunks, once 'interval' seconds
+ * have passed. If 'poll' returns non-zero the chunks not yet handed out
+ * are skipped and the function returns once those being processed are
+ * done. */
+int tp_par_for_poll(int n_threads, int n, int chunk, tp_work_func_t *work, 
+                    void *data, tp_poll_func_t *poll, void *poll_data,
+                    double interval);
+
+/* Returns the CPU time used so far by the calling thread and by the workers
+ * it started in tp_par_for() (and by those the workers started), in
+ * seconds. The difference between two calls is thus the CPU time used by
+ * the work done by the calling thread in between, parallel loops included,
+ * regardless of what other threads do. Returns a negative value if the CPU
+ * time of the threads is not available. */
+double tp_cpu_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
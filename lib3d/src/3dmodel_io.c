@@ -153,13 +153,80 @@ struct model* read_raw_model(const char *filename) {
 }
 
 
-void write_raw_model(const struct model *raw_model, char *filename,
-                     const int use_binary) {
+/* Creates the raw file 'filename' and writes its header (and the magic
+ * number in binary mode), for a model of num_vert vertices and num_faces
+ * faces. If has_normals is not zero the vertex and face normals are to be
+ * written after the faces. */
+FILE* write_raw_header(char *filename, int num_vert, int num_faces,
+                       int has_normals, const int use_binary) {
   FILE *pf;
   int i;
-  /*temp storage for vtcs coords/idx in case of bin output */
+  float f;
+
+  pf = fopen(filename,"w");
+  if (pf == NULL) {
+    printf("Unable to open %s\n",filename);
+    exit(-1);
+  }
+
+  /* Output header */
+  fprintf(pf,"%d %d ",num_vert,num_faces);
+  if (has_normals) 
+    fprintf(pf, "%d %d ", num_vert, num_faces);
+  if (use_binary)
+    fprintf(pf, "0 0 bin");
+  fprintf(pf, "\n");
+
+  if (use_binary) {
+    /* Now output magic number, used to test endianness */
+    i = (('\n'<<24)|('\r'<<16)|('\n'<<8)|0x87);
+    fwrite(&i,sizeof(i),1,pf);
+    f = FLT_MIN;
+    fwrite(&f,sizeof(f),1,pf);
+  }
+  return pf;
+}
+
+/* Writes the n vertices (or normals) v to the raw file pf */
+void write_raw_vertices(FILE *pf, const vertex_t *v, int n, 
+                        const int use_binary) {
   float vtcs[3]; 
+  int i;
+
+  if (use_binary) {
+    for (i=0; i<n; i++) {
+      vtcs[0] = v[i].x;
+      vtcs[1] = v[i].y;
+      vtcs[2] = v[i].z;
+      fwrite(vtcs, sizeof(*vtcs), 3, pf);
+    }
+  } else {
+    for (i=0; i<n; i++)
+      fprintf(pf, "%f %f %f\n", v[i].x, v[i].y, v[i].z);
+  }
+}
+
+/* Writes the n faces f to the raw file pf */
+void write_raw_faces(FILE *pf, const face_t *f, int n, const int use_binary) {
   int vidx[3];
+  int i;
+
+  if (use_binary) {
+    for (i=0; i<n; i++) {
+      vidx[0] = f[i].f0;
+      vidx[1] = f[i].f1;
+      vidx[2] = f[i].f2;
+      fwrite(vidx, sizeof(*vidx), 3, pf);
+    }
+  } else {
+    for (i=0; i<n; i++)
+      fprintf(pf, "%d %d %d\n", f[i].f0, f[i].f1, f[i].f2);
+  }
+}
+
+void write_raw_model(const struct model *raw_model, char *filename,
+                     const int use_binary) {
+  FILE *pf;
   char *rootname;
   char *finalname;
   char *tmp;
@@ -187,78 +254,17 @@ void write_raw_model(const struct model *raw_model, char *filename,
     finalname = filename;
 
 
-  pf = fopen(finalname,"w");
-  if (pf == NULL) {
-    printf("Unable to open %s\n",finalname);
-    exit(-1);
-  }
-
-  /* Output header */
-  fprintf(pf,"%d %d ",raw_model->num_vert,raw_model->num_faces);
-  if (raw_model->normals != NULL) 
-    fprintf(pf, "%d %d ", raw_model->num_vert, raw_model->num_faces);
-  if (use_binary)
-    fprintf(pf, "0 0 bin");
-  fprintf(pf, "\n");
-  
-
-
-
-  if (use_binary) {
-    /* Now output magic number, used to test endianness */
-    i = (('\n'<<24)|('\r'<<16)|('\n'<<8)|0x87);
-    fwrite(&i,sizeof(i),1,pf);
-    vtcs[0] = FLT_MIN;
-    fwrite(vtcs,sizeof(*vtcs),1,pf);
-
-    /* Write vtcs coords and idxs */
-    for (i=0; i<raw_model->num_vert; i++) {
-      vtcs[0] = raw_model->vertices[i].x;
-      vtcs[1] = raw_model->vertices[i].y;
-      vtcs[2] = raw_model->vertices[i].z;
-      fwrite(vtcs, sizeof(*vtcs), 3, pf);
-    }
-    for (i=0; i<raw_model->num_faces; i++) {
-      vidx[0] = raw_model->faces[i].f0;
-      vidx[1] = raw_model->faces[i].f1;
-      vidx[2] = raw_model->faces[i].f2;
-      fwrite(vidx, sizeof(*vidx), 3, pf);
-    }
-    /* write normals if needed */
-    if (raw_model->normals != NULL) {
-      for (i=0; i<raw_model->num_vert; i++) {
-        vtcs[0] = raw_model->normals[i].x;
-        vtcs[1] = raw_model->normals[i].y;
-        vtcs[2] = raw_model->normals[i].z;
-        fwrite(vtcs, sizeof(*vtcs), 3, pf);
-      }
-      for (i=0; i<raw_model->num_faces; i++) {
-        vtcs[0] = raw_model->face_normals[i].x;
-        vtcs[1] = raw_model->face_normals[i].y;
-        vtcs[2] = raw_model->face_normals[i].z;
-        fwrite(vtcs, sizeof(*vtcs), 3, pf);
-      }
-      
-    }
-
-  } else { /* ASCII output */
-
-    for (i=0; i<raw_model->num_vert; i++)
-      fprintf(pf, "%f %f %f\n",raw_model->vertices[i].x,
-              raw_model->vertices[i].y, raw_model->vertices[i].z);
-    
-    for (i=0; i<raw_model->num_faces; i++)
-      fprintf(pf, "%d %d %d\n",raw_model->faces[i].f0,
-              raw_model->faces[i].f1,raw_model->faces[i].f2);
-    if (raw_model->normals != NULL) {
-      for (i=0; i<raw_model->num_vert; i++)
-        fprintf(pf, "%f %f %f\n", raw_model->normals[i].x, 
-                raw_model->normals[i].y, raw_model->normals[i].z);
-      
-      for (i=0; i<raw_model->num_faces; i++)
-        fprintf(pf, "%f %f %f\n", raw_model->face_normals[i].x,
-                raw_model->face_normals[i].y, raw_model->face_normals[i].z);
-    }
+  pf = write_raw_header(finalname, raw_model->num_vert, raw_model->num_faces,
+                        raw_model->normals != NULL, use_binary);
+  write_raw_vertices(pf, raw_model->vertices, raw_model->num_vert, 
+                     use_binary);
+  write_raw_faces(pf, raw_model->faces, raw_model->num_faces, use_binary);
+  /* write normals if needed */
+  if (raw_model->normals != NULL) {
+    write_raw_vertices(pf, raw_model->normals, raw_model->num_vert, 
+                       use_binary);
+    write_raw_vertices(pf, raw_model->face_normals, raw_model->num_faces, 
+                       use_binary);
   }
 
   fclose(pf);
@@ -0,0 +1,121 @@
+/* $Id$ */
+#include <3dutils.h>
+#include <ring.h>
+
+
+/* Size of the grids of the torus models of the check */
+#define CHECK_NU 12
+#define CHECK_NV 9
+
+
+/* Returns a pseudo-random number from the state *s, so that the models of
+ * the check are the same on all platforms */
+static unsigned int check_rand(unsigned long *s) {
+  *s = (*s*1103515245UL + 12345UL) & 0x7fffffffUL;
+  return (unsigned int)(*s >> 16);
+}
+
+/* Returns the torus connectivity with nu x nv quads, cut in two triangles
+ * each. The faces are shuffled and their vertices rotated (keeping the
+ * orientation), so that the ring starts do not follow the grid. If
+ * 'holes' is non-zero a band of quads is removed, leaving two boundaries,
+ * and so is one face in 14 of the remaining ones. */
+static struct model* torus_model(int nu, int nv, int holes) {
+  struct model *raw_model;
+  face_t tmp;
+  unsigned long s = 1;
+  int i, j, k, a, b, c, d;
+
+  raw_model = (struct model*)calloc(1, sizeof(struct model));
+  raw_model->num_vert = nu*nv;
+  raw_model->vertices = (vertex_t*)calloc(nu*nv, sizeof(vertex_t));
+  raw_model->faces = (face_t*)malloc(2*nu*nv*sizeof(face_t));
+  for (k=0, i=0; i<nu; i++) {
+    if (holes && i == nu/2)
+      continue;
+    for (j=0; j<nv; j++) {
+      a = i*nv + j;
+      b = ((i+1)%nu)*nv + j;
+      c = i*nv + (j+1)%nv;
+      d = ((i+1)%nu)*nv + (j+1)%nv;
+      raw_model->faces[k].f0 = a;
+      raw_model->faces[k].f1 = b;
+      raw_model->faces[k++].f2 = c;
+      raw_model->faces[k].f0 = c;
+      raw_model->faces[k].f1 = b;
+      raw_model->faces[k++].f2 = d;
+      if (holes && (i*nv+j)%7 == 3) /* drop the second face */
+        k--;
+    }
+  }
+  raw_model->num_faces = k;
+
+  for (k=raw_model->num_faces-1; k>0; k--) {
+    i = check_rand(&s)%(k+1);
+    tmp = raw_model->faces[k];
+    raw_model->faces[k] = raw_model->faces[i];
+    raw_model->faces[i] = tmp;
+  }
+  for (k=0; k<raw_model->num_faces; k++) {
+    tmp = raw_model->faces[k];
+    switch (check_rand(&s)%3) {
+    case 1:
+      raw_model->faces[k].f0 = tmp.f1;
+      raw_model->faces[k].f1 = tmp.f2;
+      raw_model->faces[k].f2 = tmp.f0;
+      break;
+    case 2:
+      raw_model->faces[k].f0 = tmp.f2;
+      raw_model->faces[k].f1 = tmp.f0;
+      raw_model->faces[k].f2 = tmp.f1;
+      break;
+    }
+  }
+  return raw_model;
+}
+
+/* Checks that build_star() gives the same ring as build_star_global() for
+ * each vertex of the model. Returns non-zero if the check fails. */
+static int check_model(const struct model *raw_model, const char *name) {
+  struct ring_info *rings;
+  struct ring_info r;
+  int v, n_diff, n_type[4];
+
+  rings = build_star_global(raw_model);
+  n_diff = 0;
+  memset(n_type, 0, sizeof(n_type));
+  for (v=0; v<raw_model->num_vert; v++) {
+    build_star(raw_model, v, &r);
+    if (r.type != rings[v].type)
+      n_diff++;
+    else if ((r.type == 0 || r.type == 1) &&
+             (r.size != rings[v].size || r.n_faces != rings[v].n_faces ||
+              memcmp(r.ord_vert, rings[v].ord_vert, r.size*sizeof(int)) ||
+              memcmp(r.ord_face, rings[v].ord_face, 
+                     r.n_faces*sizeof(int))))
+      n_diff++;
+    if (r.type >= -1 && r.type <= 2)
+      n_type[r.type+1]++;
+    free(r.ord_vert);
+    free(r.ord_face);
+  }
+  free_rings(rings);
+  printf("%s : %d regular %d boundary %d non-manifold vertices, "
+         "%d rings differ %s\n", name, n_type[1], n_type[2], n_type[3],
+         n_diff, (n_diff != 0) ? "FAILED" : "ok");
+  return n_diff != 0;
+}
+
+
+int main(void) {
+  struct model *raw_model;
+  int err=0;
+
+  raw_model = torus_model(CHECK_NU, CHECK_NV, 0);
+  err |= check_model(raw_model, "closed torus");
+  __free_raw_model(raw_model);
+  raw_model = torus_model(CHECK_NU, CHECK_NV, 1);
+  err |= check_model(raw_model, "torus with holes");
+  __free_raw_model(raw_model);
+  return err;
+}
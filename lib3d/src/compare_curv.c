@@ -8,6 +8,7 @@ int main(int argc, char **argv) {
   struct model *raw_model1, *raw_model2;
   struct vertex_curvature *info1, *info2;
   struct ring_info *ring1, *ring2;
+  struct edge_table *et;
   int i;
   char *filename1, *filename2;
   double *deltak1, *deltak2, *deltakg;
@@ -36,17 +37,25 @@ int main(int argc, char **argv) {
   printf("Computing face normals...\n");
   info1 = (struct vertex_curvature*)
     malloc(raw_model1->num_vert*sizeof(struct vertex_curvature));
-  ring1 = (struct ring_info*)
-    malloc(raw_model1->num_vert*sizeof(struct ring_info));
-  build_star_global(raw_model1, ring1);
-  raw_model1->face_normals = compute_face_normals(raw_model1, ring1);
+  et = build_edge_table(raw_model1, 1);
+  ring1 = (et != NULL) ? build_rings(raw_model1, et, 0) : NULL;
+  if (ring1 == NULL) {
+    fprintf(stderr, "Not enough memory to build the rings\n");
+    exit(1);
+  }
+  raw_model1->face_normals = compute_face_normals(raw_model1, et);
+  free_edge_table(et);
 
   info2 = (struct vertex_curvature*)
     malloc(raw_model2->num_vert*sizeof(struct vertex_curvature));
-  ring2 = (struct ring_info*)
-    malloc(raw_model2->num_vert*sizeof(struct ring_info));
-  build_star_global(raw_model2, ring2);
-  raw_model2->face_normals = compute_face_normals(raw_model2, ring2);
+  et = build_edge_table(raw_model2, 1);
+  ring2 = (et != NULL) ? build_rings(raw_model2, et, 0) : NULL;
+  if (ring2 == NULL) {
+    fprintf(stderr, "Not enough memory to build the rings\n");
+    exit(1);
+  }
+  raw_model2->face_normals = compute_face_normals(raw_model2, et);
+  free_edge_table(et);
 
   printf("Computing vertex normals...\n");
   raw_model1->area = (float*)malloc(raw_model1->num_faces*sizeof(float));
@@ -117,18 +126,10 @@ int main(int argc, char **argv) {
   printf("mean_dk2 = %f\n", mean_dk2);
   printf("mean_dkg = %f\n", mean_dkg);
 
-  for (i=0; i<raw_model1->num_vert; i++) {
-    free(ring1[i].ord_face);
-    free(ring1[i].ord_vert);
-  }
-  for (i=0; i<raw_model2->num_vert; i++) {
-    free(ring2[i].ord_face);
-    free(ring2[i].ord_vert);
-  }
   free(info1);
   free(info2);
-  free(ring1);
-  free(ring2);
+  free_rings(ring1);
+  free_rings(ring2);
   free(deltak1);
   free(deltak2);
   free(deltakg);
@@ -9,6 +9,7 @@ int main(int argc, char **argv) {
   struct model *raw_model=NULL;
   struct vertex_curvature *curv;
   struct ring_info *ring;
+  struct edge_table *et;
   int i;
   char *filename;
   double maxkm=-FLT_MAX, maxkg=-FLT_MAX;
@@ -34,10 +35,14 @@ int main(int argc, char **argv) {
   printf("Computing face normals...\n");
   curv = (struct vertex_curvature*)
     malloc(raw_model->num_vert*sizeof(struct vertex_curvature));
-  ring = (struct ring_info*)
-    malloc(raw_model->num_vert*sizeof(struct ring_info));
-  build_star_global(raw_model, ring);
-  raw_model->face_normals = compute_face_normals(raw_model, ring);
+  et = build_edge_table(raw_model, 1);
+  ring = (et != NULL) ? build_rings(raw_model, et, 0) : NULL;
+  if (ring == NULL) {
+    fprintf(stderr, "Not enough memory to build the rings\n");
+    exit(1);
+  }
+  raw_model->face_normals = compute_face_normals(raw_model, et);
+  free_edge_table(et);
 
   printf("Computing vertex normals...\n");
   raw_model->area = (float*)malloc(raw_model->num_faces*sizeof(float));
@@ -65,14 +70,9 @@ int main(int argc, char **argv) {
 
   printf("minkm = %f\tmaxkm = %f\n", minkm, maxkm);
   printf("minkg = %f\tmaxkg = %f\n", minkg, maxkg);
-  for (i=0; i<raw_model->num_vert; i++) {
-    free(ring[i].ord_face);
-    free(ring[i].ord_vert);
-  }
-
   free(curv);
 
-  free(ring);
+  free_rings(ring);
 
   __free_raw_model(raw_model);
 
@@ -2,6 +2,7 @@
 #include <3dutils.h>
 #include <ring.h>
 #include <curvature.h>
+#include <thread_pool.h>
 #ifdef CURV_DEBUG
 # include <debug_print.h>
 #endif
@@ -45,38 +46,95 @@ static double get_top_angle(const vertex_t *v0, const vertex_t *v1,
 /*     return M_PI - atan2(norm_v(&h), norm_v(&v)); */
 /* } */
 
-/* Test face f from raw_model to check if this is an obtuse triangle */
-static int obtuse_triangle(const vertex_t *v0, const vertex_t *v1, 
-                           const vertex_t *v2) 
-{
-  double th, sum=0.0;
+/* Number of faces or vertices processed in each parallel chunk */
+#define CURV_BLOCK 1024
 
-  th = get_top_angle(v0, v1, v2);
-  sum += th;
-  if (th > M_PI_2)
-    return 1;
-  th = get_top_angle(v2, v0, v1);
-  sum += th;
-  if (th > M_PI_2)
-    return 1;
-  if (M_PI-sum > M_PI_2)
+/* The quantities of a face needed at each of its corners (i.e. at f0, f1
+ * and f2) */
+struct face_curv {
+  double theta[3]; /* the angle at the corner */
+  double cot[3];   /* its cotangent */
+  double ma[3];    /* the contribution of the face to the mixed area of
+                    * the vertex of the corner */
+};
+
+/* The data shared by the parallel passes of
+ * compute_curvature_with_rings() */
+struct curv_data {
+  const struct model *raw_model;
+  const struct ring_info *rings;
+  struct vertex_curvature *curv;
+  struct face_curv *fc;
+};
+
+/* Returns the corner (0, 1 or 2) of vertex v in face f */
+static int face_corner(const face_t *f, int v) 
+{
+  if (f->f0 == v)
+    return 0;
+  else if (f->f1 == v)
     return 1;
-  
-  return 0;
+  return 2;
 }
 
+/* Computes the angles, cotangents and mixed area contributions of the faces
+ * start to end-1. The mixed area (Voronoi area, or a fraction of the face
+ * area for obtuse triangles) of a corner v0 uses the other two vertices in
+ * face order, v1 and v2, as the obtuse test and the cotangent formula
+ * always did. */
+static void face_curv_work(void *data, int start, int end, int tid) 
+{
+  struct curv_data *d = (struct curv_data*)data;
+  const vertex_t *vtcs = d->raw_model->vertices;
+  struct face_curv *fc;
+  const vertex_t *v[3];
+  int k, i, i1, i2, obtuse;
+  double sum, cs[3], sn[3];
+
+  (void)tid;
+  for (k=start; k<end; k++) {
+    fc = &(d->fc[k]);
+    v[0] = &(vtcs[d->raw_model->faces[k].f0]);
+    v[1] = &(vtcs[d->raw_model->faces[k].f1]);
+    v[2] = &(vtcs[d->raw_model->faces[k].f2]);
+    for (i=0; i<3; i++) {
+      fc->theta[i] = get_top_angle(v[i], v[(i+1)%3], v[(i+2)%3]);
+      cs[i] = cos(fc->theta[i]);
+      sn[i] = sin(fc->theta[i]);
+      fc->cot[i] = cs[i]/sn[i];
+    }
+    for (i=0; i<3; i++) {
+      i1 = (i == 0) ? 1 : 0;
+      i2 = (i == 2) ? 1 : 2;
+      sum = fc->theta[i] + fc->theta[i2];
+      obtuse = (fc->theta[i] > M_PI_2 || fc->theta[i2] > M_PI_2 || 
+                M_PI-sum > M_PI_2);
+      if (!obtuse)
+        fc->ma[i] = 0.125*(dist2_v(v[i], v[i1])*cs[i2]/sn[i2] +
+                           dist2_v(v[i], v[i2])*cs[i1]/sn[i1]);
+      else if (fc->theta[i] > M_PI_2)
+        fc->ma[i] = 0.5*d->raw_model->area[k];
+      else
+        fc->ma[i] = 0.25*d->raw_model->area[k];
+    }
+  }
+}
+
+/* Sums the face quantities around vertex v0 to get its mean curvature
+ * normal, mixed area, Gaussian curvature (from the angle defect) and mean
+ * curvature */
 static void
 compute_mean_curvature_normal(const struct model *raw_model,
                               int v0, const struct ring_info *rings, 
+                              const struct face_curv *fc,
                               vertex_t *sum_vert, double *mixed_area, 
                               double *gauss_curv, double *mean_curv) 
 {
 
-  int v1, v1_idx, v2f, v2b, v2b_idx, v2, i;
+  int v1, v1_idx, v2f, v2b, v2b_idx, f, i;
   int n=rings[v0].size;
   vertex_t tmp;
-  double alpha, beta, c, theta, kg, ma;
-  face_t *cur_face;
+  double c, kg, ma;
 
   ma = 0.0;
   sum_vert->x = 0.0;
@@ -84,6 +142,7 @@ compute_mean_curvature_normal(const struct model *raw_model,
   sum_vert->z = 0.0;
 
 
+  /* the face ord_face[i] lies between ord_vert[i] and ord_vert[i+1] */
   for (v1_idx=0; v1_idx<n; v1_idx++) {
     v1=rings[v0].ord_vert[v1_idx];
     v2f = rings[v0].ord_vert[(v1_idx + 1)%n];
@@ -91,13 +150,10 @@ compute_mean_curvature_normal(const struct model *raw_model,
     v2b = rings[v0].ord_vert[v2b_idx];
     
     substract_v(&(raw_model->vertices[v1]), &(raw_model->vertices[v0]), &tmp);
-    alpha = get_top_angle(&(raw_model->vertices[v2b]), 
-			   &(raw_model->vertices[v1]), 
-			   &(raw_model->vertices[v0]));
-    beta = get_top_angle(&(raw_model->vertices[v2f]), 
-			  &(raw_model->vertices[v1]), 
-			  &(raw_model->vertices[v0]));
-    c = (cos(alpha)/sin(alpha) + cos(beta)/sin(beta));
+    f = rings[v0].ord_face[v2b_idx];
+    c = fc[f].cot[face_corner(&(raw_model->faces[f]), v2b)];
+    f = rings[v0].ord_face[v1_idx];
+    c += fc[f].cot[face_corner(&(raw_model->faces[f]), v2f)];
 
     add_prod_v(c, &tmp, sum_vert, sum_vert); 
 
@@ -106,52 +162,10 @@ compute_mean_curvature_normal(const struct model *raw_model,
   kg = 2.0*M_PI;
 
   for (i=0; i<rings[v0].n_faces; i++) {
-    cur_face = &(raw_model->faces[rings[v0].ord_face[i]]);
-    if (cur_face->f0 == v0) {
-      v1 = cur_face->f1;
-      v2 = cur_face->f2;
-    } else if (cur_face->f1 == v0) {
-      v1 = cur_face->f0;
-      v2 = cur_face->f2;
-    } else { /* cur_face.f2 == v0 */
-      v1 = cur_face->f0;
-      v2 = cur_face->f1;
-    }
-    
-    theta = get_top_angle(&(raw_model->vertices[v0]), 
-			   &(raw_model->vertices[v1]),
-			   &(raw_model->vertices[v2]));
-    kg -= theta; 
-
-    if (!obtuse_triangle(&(raw_model->vertices[v0]), 
-			 &(raw_model->vertices[v1]), 
-			 &(raw_model->vertices[v2]))) {
-      
-      alpha = get_top_angle(&(raw_model->vertices[v1]), 
-			     &(raw_model->vertices[v0]),
-			     &(raw_model->vertices[v2]));
-      beta =  get_top_angle(&(raw_model->vertices[v2]), 
-			     &(raw_model->vertices[v1]),
-			     &(raw_model->vertices[v0]));
-      
-      ma += 0.125*(dist2_v(&(raw_model->vertices[v0]), 
-                           &(raw_model->vertices[v1]))*
-                   cos(beta)/sin(beta) +
-                   dist2_v(&(raw_model->vertices[v0]), 
-                           &(raw_model->vertices[v2]))*
-                   cos(alpha)/sin(alpha));
-
-      
-    }
-    else {
-      if (theta > M_PI_2) {
-	ma += 0.5*raw_model->area[rings[v0].ord_face[i]];
-      }
-      else {
-	ma += 0.25*raw_model->area[rings[v0].ord_face[i]];
-      }
-     
-    }
+    f = rings[v0].ord_face[i];
+    v1 = face_corner(&(raw_model->faces[f]), v0);
+    kg -= fc[f].theta[v1];
+    ma += fc[f].ma[v1];
   }
   
   prod_v(0.5/ma, sum_vert, sum_vert);
@@ -161,21 +175,23 @@ compute_mean_curvature_normal(const struct model *raw_model,
   
 }
 
-
-int compute_curvature_with_rings(const struct model *raw_model, 
-                                 struct vertex_curvature *curv, 
-                                 const struct ring_info *rings) 
+/* Computes the curvature of the vertices start to end-1 */
+static void vertex_curv_work(void *data, int start, int end, int tid) 
 {
+  struct curv_data *d = (struct curv_data*)data;
+  struct vertex_curvature *curv = d->curv;
+  const struct ring_info *rings = d->rings;
   int i;
   double k, k2, delta;
   
-  for (i=0; i<raw_model->num_vert; i++) {
+  (void)tid;
+  for (i=start; i<end; i++) {
     if (rings[i].type != 0) {
       curv[i].gauss_curv = 0.0;
       curv[i].mean_curv = 0.0;
       continue;
     }
-    compute_mean_curvature_normal(raw_model, i, rings, 
+    compute_mean_curvature_normal(d->raw_model, i, rings, d->fc,
 				  &(curv[i].mean_curv_normal), 
 				  &(curv[i].mixed_area), 
 				  &(curv[i].gauss_curv), 
@@ -198,13 +214,36 @@ int compute_curvature_with_rings(const struct model *raw_model,
     DEBUG_PRINT("Mean curv. normal = %f %f %f\n", curv[i].mean_curv_normal.x,
                 curv[i].mean_curv_normal.y, curv[i].mean_curv_normal.z);
     DEBUG_PRINT("Mixed area = %f\n", curv[i].mixed_area);
-    DEBUG_PRINT("Vertex normal = %f %f %f\n", raw_model->normals[i].x, 
-                raw_model->normals[i].y, raw_model->normals[i].z);
+    DEBUG_PRINT("Vertex normal = %f %f %f\n", d->raw_model->normals[i].x, 
+                d->raw_model->normals[i].y, d->raw_model->normals[i].z);
     DEBUG_PRINT("Gauss_k=%f k1=%f k2=%f\n\n", 
                 curv[i].gauss_curv,  
                 curv[i].k1, curv[i].k2); 
 #endif
   }
+}
+
+/* The angles, cotangents and mixed area contributions are computed once
+ * per face, in parallel, then summed around each vertex, in parallel too.
+ * Returns -1 if out of memory. */
+int compute_curvature_with_rings(const struct model *raw_model, 
+                                 struct vertex_curvature *curv, 
+                                 const struct ring_info *rings) 
+{
+  struct curv_data d;
+  int n_threads;
+
+  d.raw_model = raw_model;
+  d.rings = rings;
+  d.curv = curv;
+  d.fc = (struct face_curv*)malloc((raw_model->num_faces+1)*
+                                   sizeof(struct face_curv));
+  if (d.fc == NULL)
+    return -1;
+  n_threads = tp_num_cpus();
+  tp_par_for(n_threads, raw_model->num_faces, CURV_BLOCK, face_curv_work, &d);
+  tp_par_for(n_threads, raw_model->num_vert, CURV_BLOCK, vertex_curv_work, &d);
+  free(d.fc);
   return 0;
 }
 
@@ -214,20 +253,266 @@ int compute_curvature(const struct model *raw_model,
                       struct vertex_curvature *curv) 
 {
   struct ring_info* rings;
-  int i, ret;
+  int ret;
 
-  rings = 
-    (struct ring_info*)malloc(raw_model->num_vert*sizeof(struct ring_info));
-
-  build_star_global(raw_model, rings);
+  rings = build_star_global(raw_model);
   ret = compute_curvature_with_rings(raw_model, curv, rings);
-  for (i=0; i<raw_model->num_vert; i++) {
-    if (rings[i].ord_vert != NULL)
-      free(rings[i].ord_vert);
-    if (rings[i].ord_face != NULL)
-    free(rings[i].ord_face);
-  }
-  free(rings);
+  free_rings(rings);
 
   return ret;
 }
+
+/* Threshold on the difference of the principal curvatures, relative to
+ * the largest of their magnitudes, below which they are considered equal
+ * (and on the off-diagonal term of the second fundamental form below which
+ * it is considered diagonal). Being relative it does not depend on the
+ * scale of the model. */
+#define LSQ_UMBILIC 1e-4
+
+/* The data shared by the parallel fit of compute_curvature_lsq() */
+struct lsq_data {
+  const struct model *raw_model;
+  const struct ring_info *rings;
+  struct vertex_curvature *curv;
+  int use_2ring;
+  int **nbr;   /* neighbour buffer of each thread */
+  int *n_fail; /* number of vertices that could not be fitted, per
+                * thread */
+};
+
+/* Stores the neighbours of vertex v used by the fit in nbr (its 1-ring,
+ * and its 2-ring if use_2ring is set, without duplicates) and returns
+ * their number */
+static int lsq_neighbours(const struct ring_info *rings, int v, 
+                          int use_2ring, int *nbr)
+{
+  const struct ring_info *r;
+  int j, k, l, n, n1, w;
+
+  r = &(rings[v]);
+  for (n=0; n<r->size; n++)
+    nbr[n] = r->ord_vert[n];
+  if (!use_2ring)
+    return n;
+  n1 = n;
+  for (k=0; k<n1; k++) {
+    r = &(rings[nbr[k]]);
+    for (j=0; j<r->size; j++) {
+      w = r->ord_vert[j];
+      if (w == v)
+        continue;
+      for (l=0; l<n && nbr[l] != w; l++);
+      if (l == n)
+        nbr[n++] = w;
+    }
+  }
+  return n;
+}
+
+/* Solves the 3x3 symmetric system a*c = r, where a is given by its upper
+ * triangle (a00 a01 a02 a11 a12 a22), with an unrolled Cholesky
+ * factorization. Returns non-zero if a is not (numerically) positive
+ * definite. */
+static int lsq_solve3(const double *a, const double *r, double *c)
+{
+  double l00, l10, l20, l11, l21, l22, y0, y1, y2, p, eps;
+
+  eps = 1e-12*(a[0] + a[3] + a[5]);
+  if (a[0] <= eps)
+    return 1;
+  l00 = sqrt(a[0]);
+  l10 = a[1]/l00;
+  l20 = a[2]/l00;
+  p = a[3] - l10*l10;
+  if (p <= eps)
+    return 1;
+  l11 = sqrt(p);
+  l21 = (a[4] - l20*l10)/l11;
+  p = a[5] - l20*l20 - l21*l21;
+  if (p <= eps)
+    return 1;
+  l22 = sqrt(p);
+
+  y0 = r[0]/l00;
+  y1 = (r[1] - l10*y0)/l11;
+  y2 = (r[2] - l20*y0 - l21*y1)/l22;
+  c[2] = y2/l22;
+  c[1] = (y1 - l21*c[2])/l11;
+  c[0] = (y0 - l10*c[1] - l20*c[2])/l00;
+  return 0;
+}
+
+/* Fits the quadric z = c0*x^2/2 + c1*x*y + c2*y^2/2 to the n neighbours
+ * nbr of vertex i, in the frame (b0, b1, n) of its tangent plane, and
+ * derives the principal curvatures and directions. Returns non-zero if
+ * the fit is not possible (the curvatures are then set to zero). */
+static int lsq_fit_vertex(const struct model *raw_model, int i, 
+                          const int *nbr, int n, 
+                          struct vertex_curvature *curv)
+{
+  vertex_t vi_j, nvi, b0, b1, t1l, t2l;
+  double a[6], r[3], u0, u1, u2, x, y, z, k1, k2, delta;
+  int j;
+
+  nvi = raw_model->normals[i];
+  memset(curv, 0, sizeof(*curv));
+
+  /* The basis of the tangent plane is the projection of the first
+   * neighbour not lying on the normal, and its rotation by pi/2, so that
+   * (b0, b1, nvi) is direct. */
+  b0.x = b0.y = b0.z = 0.0;
+  for (j=0; j<n; j++) {
+    substract_v(&(raw_model->vertices[nbr[j]]), &(raw_model->vertices[i]),
+                &vi_j);
+    add_prod_v(-scalprod_v(&vi_j, &nvi), &nvi, &vi_j, &b0);
+    if (norm2_v(&b0) > 0.0) 
+      break;
+  }
+  if (n < 3 || j == n) 
+    return 1;
+  normalize_v(&b0);
+  crossprod_v(&nvi, &b0, &b1);
+
+  /* Normal equations of the least squares problem */
+  a[0] = a[1] = a[2] = a[3] = a[4] = a[5] = 0.0;
+  r[0] = r[1] = r[2] = 0.0;
+  for (j=0; j<n; j++) {
+    /* Vj - Vi, in the basis (b0, b1, nvi) */
+    substract_v(&(raw_model->vertices[nbr[j]]), &(raw_model->vertices[i]),
+                &vi_j);
+    x = scalprod_v(&vi_j, &b0);
+    y = scalprod_v(&vi_j, &b1);
+    z = scalprod_v(&vi_j, &nvi);
+    u0 = 0.5*x*x;
+    u1 = x*y;
+    u2 = 0.5*y*y;
+    a[0] += u0*u0;
+    a[1] += u0*u1;
+    a[2] += u0*u2;
+    a[3] += u1*u1;
+    a[4] += u1*u2;
+    a[5] += u2*u2;
+    r[0] += u0*z;
+    r[1] += u1*z;
+    r[2] += u2*z;
+  }
+  if (lsq_solve3(a, r, curv->c)) {
+    memset(curv, 0, sizeof(*curv));
+    return 1;
+  }
+
+  /* Compute the eigenvalues of the C matrix */
+  /* This gives the principal curvatures */
+  delta = (curv->c[0] - curv->c[2])*(curv->c[0] - curv->c[2]) +
+    4.0*curv->c[1]*curv->c[1];
+  k1 = 0.5*(curv->c[0] + curv->c[2] + sqrt(delta));
+  k2 = 0.5*(curv->c[0] + curv->c[2] - sqrt(delta));
+  if (fabs(k1) > fabs(k2)) {
+    curv->k1 = k1;
+    curv->k2 = k2;
+  } else {
+    curv->k1 = k2;
+    curv->k2 = k1;
+  }
+  curv->gauss_curv = k1*k2;
+  curv->mean_curv = 0.5*(k1 + k2);
+
+  /* Compute the principal directions (if any) */
+  /* They are in the plane (b0, b1) */
+  if (sqrt(delta) > LSQ_UMBILIC*fabs(curv->k1)) {/* if 2 != eigenvalues */
+    if (fabs(curv->c[1]) < LSQ_UMBILIC*fabs(curv->k1)) {/* II is diagonal */
+      /* k1 is the diagonal coefficient of largest magnitude, so it may
+       * be the one of b1 */
+      if (fabs(curv->k1 - curv->c[0]) <= fabs(curv->k1 - curv->c[2])) {
+        t1l.x = 1.0;
+        t1l.y = 0.0;
+        t2l.x = 0.0;
+        t2l.y = 1.0;
+      } else {
+        t1l.x = 0.0;
+        t1l.y = 1.0;
+        t2l.x = 1.0;
+        t2l.y = 0.0;
+      }
+    } else {
+      t1l.x = 1.0;
+      t1l.y = (curv->k1 - curv->c[0])/curv->c[1];
+      t2l.x = 1.0;
+      t2l.y = (curv->k2 - curv->c[0])/curv->c[1];
+    }
+    curv->t1.x = t1l.x*b0.x + t1l.y*b1.x;
+    curv->t1.y = t1l.x*b0.y + t1l.y*b1.y;
+    curv->t1.z = t1l.x*b0.z + t1l.y*b1.z;
+    curv->t2.x = t2l.x*b0.x + t2l.y*b1.x;
+    curv->t2.y = t2l.x*b0.y + t2l.y*b1.y;
+    curv->t2.z = t2l.x*b0.z + t2l.y*b1.z;
+    normalize_v(&(curv->t1));
+    normalize_v(&(curv->t2));
+  } /* else 1 double eigenvalue, no principal direction */
+  return 0;
+}
+
+/* Fits the vertices start to end-1 */
+static void lsq_work(void *data, int start, int end, int tid) 
+{
+  struct lsq_data *d;
+  int i, n;
+
+  d = (struct lsq_data*)data;
+  for (i=start; i<end; i++) {
+    n = lsq_neighbours(d->rings, i, d->use_2ring, d->nbr[tid]);
+    d->n_fail[tid] += lsq_fit_vertex(d->raw_model, i, d->nbr[tid], n,
+                                     &(d->curv[i]));
+  }
+}
+
+/* See curvature.h */
+int compute_curvature_lsq(const struct model *raw_model, 
+                          const struct ring_info *rings,
+                          struct vertex_curvature *curv, 
+                          int use_2ring, int n_threads) 
+{
+  struct lsq_data d;
+  int i, j, n, max_n, n_fail, ok;
+
+  if (n_threads < 1)
+    n_threads = 1;
+  /* Largest neighbourhood, to size the buffers */
+  for (max_n=0, i=0; i<raw_model->num_vert; i++) {
+    n = rings[i].size;
+    if (use_2ring) {
+      for (j=0; j<rings[i].size; j++)
+        n += rings[rings[i].ord_vert[j]].size;
+    }
+    if (n > max_n)
+      max_n = n;
+  }
+
+  d.raw_model = raw_model;
+  d.rings = rings;
+  d.curv = curv;
+  d.use_2ring = use_2ring;
+  d.n_fail = (int*)calloc(n_threads, sizeof(int));
+  d.nbr = (int**)calloc(n_threads, sizeof(int*));
+  if (d.n_fail == NULL || d.nbr == NULL) {
+    free(d.n_fail);
+    free(d.nbr);
+    return -1;
+  }
+  for (n=0; n<n_threads; n++) {
+    d.nbr[n] = (int*)malloc((max_n+1)*sizeof(int));
+    if (d.nbr[n] == NULL)
+      break;
+  }
+  ok = (n == n_threads);
+  if (ok) 
+    tp_par_for(n_threads, raw_model->num_vert, CURV_BLOCK, lsq_work, &d);
+
+  for (n_fail=0, i=0; i<n; i++) {
+    n_fail += d.n_fail[i];
+    free(d.nbr[i]);
+  }
+  free(d.n_fail);
+  free(d.nbr);
+  return ok ? n_fail : -1;
+}
@@ -0,0 +1,280 @@
+/* $Id$ */
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+/* Edge table construction, see edge_table.h. The half-edges are first
+ * bucketed on the smallest vertex of their edge with a counting sort (one
+ * bucket per vertex), and then each bucket is sorted on the largest vertex,
+ * which is an MSD radix sort of the edge keys. The buckets only hold a few
+ * half-edges each (about three for a regular mesh), so this is linear in
+ * the number of faces and vertices. The buckets are independent and are
+ * sorted and linked in parallel. The table is kept small, since on large
+ * models the first touch of the memory is a significant part of the
+ * cost. */
+
+#include <edge_table.h>
+#include <thread_pool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Number of vertices (i.e. buckets) processed in each parallel chunk */
+#define ET_BLOCK 1024
+
+/* Buckets larger than this are heap sorted instead of insertion sorted */
+#define ET_ISORT_MAX 16
+
+/* Order of half-edges a and b within a bucket: by the largest vertex of the
+ * edge, as stored in key, and then by half-edge index. */
+#define ET_HE_LESS(key,a,b) \
+  ((key)[a] < (key)[b] || ((key)[a] == (key)[b] && (a) < (b)))
+
+/* Shared data for the parallel steps of build_edge_table() */
+struct et_build_data {
+  struct edge_table *et; /* the table being built. Until the buckets are
+                          * linked he_edge holds the largest vertex of the
+                          * edge of each half-edge. */
+  int *bkt_he;           /* the half-edges, bucketed by the smallest vertex
+                          * of their edge */
+  int *bkt_idx;          /* start of each bucket in bkt_he (n_vert+1) */
+  int *bkt_edge;         /* number of edges in each bucket, and then index
+                          * of the first edge of each bucket (n_vert) */
+};
+
+/* Moves down he[root] to restore the heap property of he[0] to he[n-1] */
+static void et_sift_down(int *he, int root, int n, const int *key)
+{
+  int child,tmp;
+
+  while ((child = 2*root+1) < n) {
+    if (child+1 < n && ET_HE_LESS(key,he[child],he[child+1])) child++;
+    if (!ET_HE_LESS(key,he[root],he[child])) return;
+    tmp = he[root];
+    he[root] = he[child];
+    he[child] = tmp;
+    root = child;
+  }
+}
+
+/* Sorts the n half-edges in he, see ET_HE_LESS */
+static void et_sort_bucket(int *he, int n, const int *key)
+{
+  int i,j,h,tmp;
+
+  if (n <= ET_ISORT_MAX) {
+    for (i=1; i<n; i++) {
+      h = he[i];
+      for (j=i; j>0 && ET_HE_LESS(key,h,he[j-1]); j--) he[j] = he[j-1];
+      he[j] = h;
+    }
+  } else { /* vertex of very high valence */
+    for (i=n/2-1; i>=0; i--) et_sift_down(he,i,n,key);
+    for (i=n-1; i>0; i--) {
+      tmp = he[0];
+      he[0] = he[i];
+      he[i] = tmp;
+      et_sift_down(he,0,i,key);
+    }
+  }
+}
+
+/* Sorts the buckets of vertices start to end-1 and counts their edges */
+static void et_sort_work(void *data, int start, int end, int tid)
+{
+  struct et_build_data *d;
+  const int *key;
+  int *he;
+  int v,i,n,n_edges;
+
+  (void)tid;
+  d = (struct et_build_data*)data;
+  key = d->et->he_edge;
+  for (v=start; v<end; v++) {
+    he = d->bkt_he+d->bkt_idx[v];
+    n = d->bkt_idx[v+1]-d->bkt_idx[v];
+    et_sort_bucket(he,n,key);
+    for (n_edges=0, i=0; i<n; i++) {
+      if (i == 0 || key[he[i]] != key[he[i-1]]) n_edges++;
+    }
+    d->bkt_edge[v] = n_edges;
+  }
+}
+
+/* Numbers the edges of the buckets of vertices start to end-1 and links
+ * their half-edges */
+static void et_link_work(void *data, int start, int end, int tid)
+{
+  struct et_build_data *d;
+  struct edge_table *et;
+  int *he;
+  int v,e,i,j,k,n;
+
+  (void)tid;
+  d = (struct et_build_data*)data;
+  et = d->et;
+  for (v=start; v<end; v++) {
+    he = d->bkt_he+d->bkt_idx[v];
+    n = d->bkt_idx[v+1]-d->bkt_idx[v];
+    e = d->bkt_edge[v];
+    for (i=0; i<n; i=j, e++) {
+      /* the run he[i] to he[j-1] is the edge e */
+      for (j=i+1; j<n && et->he_edge[he[j]] == et->he_edge[he[i]]; j++);
+      et->edge_he[e] = he[i];
+      for (k=i; k<j; k++) {
+        et->he_radial[he[k]] = he[(k+1 < j) ? k+1 : i];
+        et->he_edge[he[k]] = e;
+      }
+    }
+  }
+}
+
+/* See edge_table.h */
+void free_edge_table(struct edge_table *et)
+{
+  if (et == NULL) return;
+  free(et->he_edge);
+  free(et->he_radial);
+  free(et->edge_he);
+  free(et->vtx_he);
+  free(et->vtx_n_faces);
+  free(et);
+}
+
+/* See edge_table.h */
+struct edge_table *build_edge_table(const struct model *m, int n_threads)
+{
+  struct edge_table *et;
+  struct et_build_data d;
+  const face_t *faces;
+  int n_vert,n_edges,c,s;
+  int k,h,i,v[3],lo,hi;
+
+  n_vert = m->num_vert;
+  faces = m->faces;
+  memset(&d,0,sizeof(d));
+  et = calloc(1,sizeof(*et));
+  if (et == NULL) return NULL;
+  et->n_faces = m->num_faces;
+  et->n_vert = n_vert;
+  et->he_edge = malloc(sizeof(*(et->he_edge))*(3*m->num_faces+1));
+  et->he_radial = malloc(sizeof(*(et->he_radial))*(3*m->num_faces+1));
+  et->vtx_he = malloc(sizeof(*(et->vtx_he))*(n_vert+1));
+  et->vtx_n_faces = calloc(n_vert+1,sizeof(*(et->vtx_n_faces)));
+  d.et = et;
+  d.bkt_idx = calloc(n_vert+2,sizeof(*(d.bkt_idx)));
+  d.bkt_edge = malloc(sizeof(*(d.bkt_edge))*(n_vert+1));
+  if (et->he_edge == NULL || et->he_radial == NULL || et->vtx_he == NULL ||
+      et->vtx_n_faces == NULL || d.bkt_idx == NULL || d.bkt_edge == NULL) {
+    goto no_mem;
+  }
+
+  /* Count the half-edges in each bucket, keeping the largest vertex as the
+   * sort key in he_edge, and find the faces of each vertex */
+  for (i=0; i<n_vert; i++) et->vtx_he[i] = -1;
+  for (k=0; k<m->num_faces; k++) {
+    v[0] = faces[k].f0;
+    v[1] = faces[k].f1;
+    v[2] = faces[k].f2;
+    h = 3*k;
+    if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) { /* degenerate */
+      for (i=0; i<3; i++) {
+        et->he_edge[h+i] = -1;
+        et->he_radial[h+i] = -1;
+      }
+      continue;
+    }
+    for (i=0; i<3; i++, h++) {
+      if (v[i] < v[(i+1)%3]) {
+        lo = v[i];
+        hi = v[(i+1)%3];
+      } else {
+        lo = v[(i+1)%3];
+        hi = v[i];
+      }
+      et->he_edge[h] = hi;
+      d.bkt_idx[lo+1]++;
+      et->vtx_n_faces[v[i]]++;
+      if (et->vtx_he[v[i]] < 0) et->vtx_he[v[i]] = h;
+    }
+  }
+  for (i=0; i<n_vert; i++) d.bkt_idx[i+1] += d.bkt_idx[i];
+
+  /* Distribute the half-edges in the buckets, in increasing order */
+  d.bkt_he = malloc(sizeof(*(d.bkt_he))*(d.bkt_idx[n_vert]+1));
+  if (d.bkt_he == NULL) goto no_mem;
+  memcpy(d.bkt_edge,d.bkt_idx,sizeof(*(d.bkt_edge))*n_vert);
+  for (k=0; k<m->num_faces; k++) {
+    h = 3*k;
+    if (et->he_edge[h] < 0) continue; /* degenerate */
+    v[0] = faces[k].f0;
+    v[1] = faces[k].f1;
+    v[2] = faces[k].f2;
+    d.bkt_he[d.bkt_edge[(v[0] < v[1]) ? v[0] : v[1]]++] = h;
+    d.bkt_he[d.bkt_edge[(v[1] < v[2]) ? v[1] : v[2]]++] = h+1;
+    d.bkt_he[d.bkt_edge[(v[2] < v[0]) ? v[2] : v[0]]++] = h+2;
+  }
+
+  /* Sort the buckets and number the edges */
+  tp_par_for(n_threads,n_vert,ET_BLOCK,et_sort_work,&d);
+  for (s=0, i=0; i<n_vert; i++) {
+    c = d.bkt_edge[i];
+    d.bkt_edge[i] = s;
+    s += c;
+  }
+  n_edges = s;
+  et->n_edges = n_edges;
+  et->edge_he = malloc(sizeof(*(et->edge_he))*(n_edges+1));
+  if (et->edge_he == NULL) goto no_mem;
+
+  /* Link the half-edges of each edge */
+  tp_par_for(n_threads,n_vert,ET_BLOCK,et_link_work,&d);
+
+  free(d.bkt_he);
+  free(d.bkt_idx);
+  free(d.bkt_edge);
+  return et;
+
+ no_mem:
+  free(d.bkt_he);
+  free(d.bkt_idx);
+  free(d.bkt_edge);
+  free_edge_table(et);
+  return NULL;
+}
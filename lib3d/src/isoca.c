@@ -24,7 +24,6 @@ int main(int argc, char **argv) {
   int n;
   char *filename;
   struct model *isoca;
-  struct model *or_mod, *sub_mod=NULL;
   int count_faces=0, use_binary=0;
   struct subdiv_functions iso_sub = { 0xff, midpoint_sph, NULL, NULL, NULL };
   if (argc != 3 && argc != 4) {
@@ -121,23 +120,13 @@ int main(int argc, char **argv) {
     j++;
   }
   
-  or_mod = isoca;
-  sub_mod = isoca;
- 
-  for (i=0; i<n; i++) {
-    printf("Level %d ... ", i+1);fflush(stdout);
-    sub_mod = subdiv(or_mod, &iso_sub);
-    free(or_mod->faces);
-    free(or_mod->vertices);
-    or_mod = sub_mod;
+  if (n > 0) {
+    printf("Subdividing %d levels ... ", n);fflush(stdout);
+    subdiv_levels_write(isoca, &iso_sub, n, 0, filename, use_binary);
     printf("done\n");
-  }
-
-  sub_mod->normals = NULL;
-  sub_mod->face_normals = NULL;
-  sub_mod->tree = NULL;
-  write_raw_model(sub_mod, filename, use_binary);
+  } else
+    write_raw_model(isoca, filename, use_binary);
 
-  __free_raw_model(sub_mod);
+  __free_raw_model(isoca);
   return 0;
 }
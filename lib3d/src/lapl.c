@@ -1,39 +1,68 @@
 /* $Id$ */
 #include <3dmodel.h>
 #include <geomutils.h>
-#include <ring.h>
+#include <edge_table.h>
+#include <smoothing.h>
+#include <thread_pool.h>
 #include <3dmodel_io.h>
 #include <model_in.h>
 
+/* Conjugate gradient settings of the implicit smoothing */
+#define LAPL_CG_MAX_ITER 1000
+#define LAPL_CG_TOL 1e-6
+
+static void usage(void)
+{
+  fprintf(stderr, "Usage: lapl [-bin] [-cot] [-l lambda] [-mu mu] "
+          "[-implicit] infile outfile [n_iter]\n");
+  fprintf(stderr, "\t-bin\t\twrite a binary raw file\n");
+  fprintf(stderr, "\t-cot\t\tuse cotangent weights instead of uniform "
+          "ones\n");
+  fprintf(stderr, "\t-l lambda\tsmoothing factor (default 1, i.e. each "
+          "vertex\n\t\t\tis moved to the barycenter of its neighbours)\n");
+  fprintf(stderr, "\t-mu mu\t\tTaubin smoothing, with a second step of "
+          "factor mu\n\t\t\t(e.g. -l 0.5 -mu -0.53)\n");
+  fprintf(stderr, "\t-implicit\timplicit smoothing steps, solved with a "
+          "conjugate\n\t\t\tgradient (not with -mu)\n");
+  exit(-1);
+}
+
 int main(int argc, char **argv) {
   char *in_fname, *out_fname;
   struct model *raw_model;
-  vertex_t *new_vert, tmp;
-  struct ring_info *ring;
-  int i, j, rcode, n_lev=1, lev;
-  int use_binary=0;
+  struct edge_table *et;
+  struct lapl_matrix *lm;
+  int i, rcode, n_lev=1, lev, n_threads;
+  int use_binary=0, type=LAPL_UNIFORM, implicit=0, use_mu=0;
+  double lambda=1.0, mu=0.0;
 
-  if (argc < 3 || argc > 5) {
-    fprintf(stderr, "Usage: lapl [-bin] infile outfile [n_lev]\n");
-    exit(-1);
-  }
-  
-  if (strcmp(argv[1],"-bin") == 0) {
-    use_binary=1;
-    in_fname = argv[2];
-    out_fname = argv[3];
-    if (argc == 5) {
-      i = atoi(argv[4]);
-      n_lev = (i < 1)?1:i;
-    }
-  } else {
-    in_fname = argv[1];
-    out_fname = argv[2];
-    if (argc == 4) {
-      i = atoi(argv[3]);
-      n_lev = (i < 1)?1:i;
+  for (i=1; i<argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i],"-bin") == 0) {
+      use_binary = 1;
+    } else if (strcmp(argv[i],"-cot") == 0) {
+      type = LAPL_COTANGENT;
+    } else if (strcmp(argv[i],"-implicit") == 0) {
+      implicit = 1;
+    } else if (strcmp(argv[i],"-l") == 0 && i+1 < argc) {
+      lambda = atof(argv[++i]);
+    } else if (strcmp(argv[i],"-mu") == 0 && i+1 < argc) {
+      mu = atof(argv[++i]);
+      use_mu = 1;
+    } else {
+      usage();
     }
   }
+  if (argc-i < 2 || argc-i > 3) usage();
+  if (implicit && use_mu) {
+    fprintf(stderr, "-mu can not be used with -implicit\n");
+    usage();
+  }
+  in_fname = argv[i];
+  out_fname = argv[i+1];
+  if (argc-i == 3) {
+    n_lev = atoi(argv[i+2]);
+    if (n_lev < 1) n_lev = 1;
+  }
 
   rcode = read_fmodel(&raw_model, in_fname, MESH_FF_AUTO, 0);
   if (rcode < 0) {
@@ -41,34 +70,40 @@ int main(int argc, char **argv) {
     exit(rcode);
   }
 
-  ring = 
-    (struct ring_info*)malloc(raw_model->num_vert*sizeof(struct ring_info));
-  new_vert =  (vertex_t*)malloc(raw_model->num_vert*sizeof(vertex_t));
-  
-  for (lev=0; lev<n_lev; lev++) {
-    build_star_global(raw_model, ring);
-
-    for (i=0; i<raw_model->num_vert; i++) {
-      tmp.x = tmp.y = tmp.z = 0.0;
-      for (j=0; j<ring[i].size; j++) 
-        __add_v(raw_model->vertices[ring[i].ord_vert[j]], tmp, tmp);
-      
-      __prod_v(1.0/(float)ring[i].size, tmp, tmp);
-      __add_v(raw_model->vertices[i], tmp, new_vert[i]);
-    }
-    
-    memcpy(raw_model->vertices, new_vert, 
-           raw_model->num_vert*sizeof(vertex_t));
+  /* the smoothing does not change the connectivity, so the matrix is
+   * built only once (the cotangent weights are those of the input) */
+  n_threads = tp_num_cpus();
+  et = build_edge_table(raw_model, n_threads);
+  lm = (et != NULL) ? 
+    build_lapl_matrix(raw_model, et, type, n_threads) : NULL;
+  free_edge_table(et);
+  if (lm == NULL) {
+    fprintf(stderr, "Not enough memory to build the Laplacian\n");
+    exit(1);
+  }
 
-    for (j=0; j<raw_model->num_vert; j++) {
-      free(ring[j].ord_vert);
-      free(ring[j].ord_face);
+  if (implicit) {
+    for (lev=0; lev<n_lev; lev++) {
+      rcode = lapl_smooth_implicit(lm, raw_model, lambda, LAPL_CG_MAX_ITER,
+                                   LAPL_CG_TOL, n_threads);
+      if (rcode == -2) {
+        fprintf(stderr, "Warning: the implicit step %d did not converge\n",
+                lev);
+        rcode = 0;
+      } else if (rcode < 0) {
+        break;
+      }
     }
+  } else {
+    rcode = lapl_smooth(lm, raw_model, n_lev, lambda, mu, n_threads);
+  }
+  if (rcode < 0) {
+    fprintf(stderr, "Not enough memory for the smoothing\n");
+    exit(1);
   }
   write_raw_model(raw_model, out_fname, use_binary);
-  free(new_vert);
  
-  free(ring);
+  free_lapl_matrix(lm);
   __free_raw_model(raw_model);
 
   return 0;
@@ -2,229 +2,168 @@
 #include <3dutils.h>
 #include <ring.h>
 #include <curvature.h>
-#include <gsl/gsl_multifit.h>
+#include <thread_pool.h>
 
 
+/* Size of the grids sampling the quadrics of the check */
+#define CHECK_N 20
+#define CHECK_STEP 0.05
+/* Tolerance of the check */
+#define CHECK_TOL 1e-3
 
 
+/* Computes the rings and the vertex normals of the model, and returns the
+ * rings */
+static struct ring_info* prepare_model(struct model *raw_model, 
+                                       int n_threads) {
+  struct ring_info *rings;
+  struct edge_table *et;
+  int i;
 
-/* Computes the principal curvatures for each vertex */
-/* using a least-squares fitting on the neighborhood */
-static void lsq_fit(struct model *raw_model, struct ring_info *rings, 
-  		    struct vertex_curvature *curv) {
-  int i, j;
-  vertex_t **t;
-  vertex_t vi_j; /* vi - vj */
-  vertex_t nvi;
-  vertex_t t1l, t2l, tmp;
-  vertex_t b0, b1; /* basis vectors of tangent plane*/ 
-  vertex_t **d;
-  double  *u,  k1, k2, delta;
-  gsl_matrix *X, *cov;
-  gsl_vector *y,  *c;
-  gsl_multifit_linear_workspace *wspace;
-  double chisq;
-
-  t = (vertex_t**)malloc(raw_model->num_vert*sizeof(vertex_t*));
-  d = (vertex_t**)malloc(raw_model->num_vert*sizeof(vertex_t*));
-
-  
-
-  for (i=0; i<raw_model->num_vert; i++) {
-    t[i] = (vertex_t*)malloc(rings[i].size*sizeof(vertex_t));
-    d[i] = (vertex_t*)malloc(rings[i].size*sizeof(vertex_t));
-
-
-    nvi = raw_model->normals[i];
-
-    for(j=0; j<rings[i].size; j++){
-
-      /* Vj - Vi*/
-      substract_v(&(raw_model->vertices[rings[i].ord_vert[j]]), 
-		  &(raw_model->vertices[i]), &vi_j);
-
-      /* signed distance */
-      d[i][j].z = scalprod_v(&vi_j, &nvi);
-      /* tangent vector */
-      add_prod_v(-d[i][j].z, &nvi, &vi_j, &(t[i][j]));
-    }/* End for j */
-
-     /* Find basis of tangent plane */
-    b0 = t[i][0];
-
-    normalize_v(&b0);
-    /* Gram-Schmidt */
-    /* triangulated surface, so t[i][1] and t[i][0] are not colinear */    
-    add_prod_v(-scalprod_v(&b0, &(t[i][1])), &b0, &(t[i][1]), &b1);
-    normalize_v(&b1);
-
-    /* Make the basis is direct */
-    crossprod_v(&b0, &b1, &t1l);
-    if (scalprod_v(&nvi, &t1l) < - 0.5) 
-      prod_v(-1.0, &b1, &b1);
-
-    crossprod_v(&b0, &b1, &t1l);
-    substract_v(&t1l, &nvi, &t1l);
-    printf("base = %f %f %f\n", t1l.x, t1l.y, t1l.z);
-    u = (double*)malloc(3*rings[i].size*sizeof(double));    
-    for (j=0; j<rings[i].size; j++) {      
-      /* Coordinates of the projection of vj on the tangent plane */
-      /* expressed in the basis (b0, b1, nvi) */
-      d[i][j].x = scalprod_v(&(t[i][j]), &b0);
-      d[i][j].y = scalprod_v(&(t[i][j]), &b1);
-      t1l.x = t[i][j].x - (d[i][j].x*b0.x + d[i][j].y*b1.x);
-      t1l.y = t[i][j].y - (d[i][j].x*b0.y + d[i][j].y*b1.y);
-/*       printf("t1l = %f %f \n", t1l.x, t1l.y); */
-
-      u[3*j] = 0.5*d[i][j].x * d[i][j].x;
-      u[3*j+1] = d[i][j].x * d[i][j].y;      
-      u[3*j+2] = 0.5*d[i][j].y * d[i][j].y;
-      
-    }
-
-    
-    X = gsl_matrix_alloc(rings[i].size, 3);
-    y = gsl_vector_alloc(rings[i].size);
-
-    c = gsl_vector_alloc(3);
-    cov = gsl_matrix_alloc(3, 3);
-
-    for (j=0; j<rings[i].size; j++) {
-      gsl_matrix_set(X, j, 0, u[3*j]);
-      gsl_matrix_set(X, j, 1, u[3*j+1]);
-      gsl_matrix_set(X, j, 2, u[3*j+2]);
-
-      gsl_vector_set(y, j, d[i][j].z);
-
-    }
-
-    wspace = gsl_multifit_linear_alloc(rings[i].size, 3);
-    gsl_multifit_linear(X, y, c, cov, &chisq, wspace);
-    gsl_multifit_linear_free(wspace);
-    printf("Residual = %f\n", chisq);
-    curv[i].c[0] = gsl_vector_get(c, 0);
-    curv[i].c[1] = gsl_vector_get(c, 1);
-    curv[i].c[2] = gsl_vector_get(c, 2);
-
-    gsl_matrix_free(X);
-    gsl_matrix_free(cov);
-    gsl_vector_free(y);
-    gsl_vector_free(c);
-    /* Find the solutions of the systems */
-
-
-    /* Compute the eigenvalues of the C matrix */
-    /* This gives the principal curvatures */
-    delta = (curv[i].c[0] - curv[i].c[2])*(curv[i].c[0] - curv[i].c[2]) +
-      4.0*curv[i].c[1]*curv[i].c[1];
-    k1 = 0.5*(curv[i].c[0] + curv[i].c[2] + sqrt(delta));
-    k2 = 0.5*(curv[i].c[0] + curv[i].c[2] - sqrt(delta));
-
-    if (fabs(k1)>fabs(k2)) {
-      printf("Vertex %d : k1=%f k2=%f kg=%f\n",i,k1,k2, k1*k2); 
-      curv[i].k1 = k1;
-      curv[i].k2 = k2;
-    }
-    else {
-      printf("Vertex %d : k1=%f k2=%f kg=%f\n",i,k2,k1, k1*k2); 
-      curv[i].k1 = k2;
-      curv[i].k2 = k1;
-    }
-
-
- 
-    /* Compute the principal directions (if any) */
-    /* They are in the plane (b0, b1) */
-    t1l.z = 0.0;
-    t2l.z = 0.0;
-    if (fabs(delta)>1e-6) {/* if 2 != eigenvalues */
-      if(fabs(curv[i].c[1])<1e-6) {/* II is diagonal */
-	t1l.x = 1.0;
-	t1l.y = 0.0;
-	t2l.x = 0.0;
-	t2l.y = 1.0;
-      } else {
-	t1l.x = 1.0;
-	t1l.y = (curv[i].k1 - curv[i].c[0])/curv[i].c[1];
-	t2l.x = 1.0;
-	t2l.y = (curv[i].k2 - curv[i].c[0])/curv[i].c[1];
-      }
-    } else { /* 1 double eigenvalue */
-      /* No principal direction */
-      t1l.x = 0.0;
-      t1l.y = 0.0;
-      t2l.x = 0.0;
-      t2l.y = 0.0;
-    }
-    
-    curv[i].t1.x = t1l.x*b0.x + t1l.y*b1.x;
-    curv[i].t1.y = t1l.y*b0.y + t1l.y*b1.y;
-    curv[i].t1.z = 0.0;
-    curv[i].t2.x = t2l.x*b0.x + t2l.y*b1.x;
-    curv[i].t2.y = t2l.y*b0.y + t2l.y*b1.y;
-    curv[i].t2.z = 0.0;
-    normalize_v(&(curv[i].t1));
-    normalize_v(&(curv[i].t2));
-    printf("T1 = (%f, %f, 0.0)\t T2 = (%f, %f, 0.0)\n", curv[i].t1.x, 
-	   curv[i].t1.y, curv[i].t2.x, curv[i].t2.y);
-    crossprod_v(&(curv[i].t1), &(curv[i].t2), &tmp);
-    printf("discr = %f\n",norm_v(&tmp));
-    free(u);
-  }/* End for i */
-
+  raw_model->area = (float*)malloc(raw_model->num_faces*sizeof(float));
+  et = build_edge_table(raw_model, n_threads);
+  rings = (et != NULL) ? build_rings(raw_model, et, n_threads) : NULL;
+  if (rings == NULL) {
+    fprintf(stderr, "Not enough memory to build the rings\n");
+    exit(1);
+  }
+  /* Compute normals of each face of the model */
+  raw_model->face_normals = compute_face_normals(raw_model, et);
+  free_edge_table(et);
+  if (raw_model->face_normals == NULL) {
+    fprintf(stderr, "Unable to build face normals (Non-manifold model ?)\n");
+    exit(1);
+  }
   
-
+  /*Compute normals for each vertex */
+  compute_vertex_normal(raw_model, rings, raw_model->face_normals);
   for (i=0; i<raw_model->num_vert; i++) {
-    free(t[i]);
-    free(d[i]);
+    prod_v(-1.0, &(raw_model->normals[i]), &(raw_model->normals[i]));
   }
-  free(t);
-  free(d);
+  return rings;
 }
 
-
-
-
-static void compute_curvature_lsq(struct model *raw_model) {
-  int i;
+/* Computes the principal curvatures for each vertex */
+/* using a least-squares fitting on the neighborhood */
+static void do_curvature_lsq(struct model *raw_model, int use_2ring) {
+  int i, n_fail, n_threads;
   struct vertex_curvature *curv;
   struct ring_info *rings;
 
-  
-
-  raw_model->area = (float*)malloc(raw_model->num_faces*sizeof(float));
+  n_threads = tp_num_cpus();
   curv = (struct vertex_curvature*)
     malloc(raw_model->num_vert*sizeof(struct vertex_curvature));
-  rings= (struct ring_info*)
-    malloc(raw_model->num_vert*sizeof(struct ring_info));
-  /* Compute normals of each face of the model */
-  raw_model->face_normals = compute_face_normals(raw_model, rings);
-
-  
-  /*Compute normals for each vertex */
   printf("Computing vertex normals ... ");fflush(stdout);
-  compute_vertex_normal(raw_model, rings, raw_model->face_normals);
+  rings = prepare_model(raw_model, n_threads);
   printf("done\n");
-  printf("Building 1-rings .... ");fflush(stdout);
+
+  n_fail = compute_curvature_lsq(raw_model, rings, curv, use_2ring, 
+                                 n_threads);
+  if (n_fail < 0) {
+    fprintf(stderr, "Not enough memory for the fitting\n");
+    exit(1);
+  }
+
   for (i=0; i<raw_model->num_vert; i++) {
-/*     build_star(raw_model, i, &(rings[i])); */
-    prod_v(-1.0, &(raw_model->normals[i]), &(raw_model->normals[i]));
+    printf("Vertex %d : k1=%f k2=%f kg=%f\n", i, curv[i].k1, curv[i].k2,
+           curv[i].gauss_curv);
+    printf("T1 = (%f, %f, %f)\t T2 = (%f, %f, %f)\n", curv[i].t1.x, 
+           curv[i].t1.y, curv[i].t1.z, curv[i].t2.x, curv[i].t2.y, 
+           curv[i].t2.z);
   }
-  printf("done\n");
- 
-  
+  if (n_fail > 0)
+    printf("%d vertices could not be fitted\n", n_fail);
 
-  
-  
-  lsq_fit(raw_model, rings, curv);
+  free(curv); 
+  free_rings(rings);
+}
 
-  for(i=0; i<raw_model->num_vert; i++) {
-     free(rings[i].ord_face); 
-     free(rings[i].ord_vert); 
+/* Fits the quadric z = (a*x^2 + 2*b*x*y + c*y^2)/2, sampled on a regular
+ * grid and scaled by s, at its apex and checks the principal curvatures
+ * and the first principal direction (t1x, t1y, 0) (the signs depend on the
+ * orientation of the normals). Returns non-zero if the check fails. */
+static int check_quadric(double a, double b, double c, 
+                         double t1x, double t1y, double s) {
+  struct model *raw_model;
+  struct ring_info *rings;
+  struct vertex_curvature *curv;
+  vertex_t t1;
+  double x, y, k1, k2, delta;
+  int i, j, k, ctr, err;
+
+  raw_model = (struct model*)calloc(1, sizeof(struct model));
+  raw_model->num_vert = (CHECK_N+1)*(CHECK_N+1);
+  raw_model->num_faces = 2*CHECK_N*CHECK_N;
+  raw_model->vertices = 
+    (vertex_t*)malloc(raw_model->num_vert*sizeof(vertex_t));
+  raw_model->faces = (face_t*)malloc(raw_model->num_faces*sizeof(face_t));
+  for (i=0; i<=CHECK_N; i++) {
+    for (j=0; j<=CHECK_N; j++) {
+      x = (i - CHECK_N/2)*CHECK_STEP;
+      y = (j - CHECK_N/2)*CHECK_STEP;
+      k = i*(CHECK_N+1) + j;
+      raw_model->vertices[k].x = (float)(s*x);
+      raw_model->vertices[k].y = (float)(s*y);
+      raw_model->vertices[k].z = (float)(0.5*s*(a*x*x + 2.0*b*x*y + c*y*y));
+    }
+  }
+  for (k=0, i=0; i<CHECK_N; i++) {
+    for (j=0; j<CHECK_N; j++) {
+      raw_model->faces[k].f0 = i*(CHECK_N+1) + j;
+      raw_model->faces[k].f1 = (i+1)*(CHECK_N+1) + j;
+      raw_model->faces[k++].f2 = i*(CHECK_N+1) + j + 1;
+      raw_model->faces[k].f0 = i*(CHECK_N+1) + j + 1;
+      raw_model->faces[k].f1 = (i+1)*(CHECK_N+1) + j;
+      raw_model->faces[k++].f2 = (i+1)*(CHECK_N+1) + j + 1;
+    }
   }
-  free(curv); 
-  free(rings);
 
+  curv = (struct vertex_curvature*)
+    malloc(raw_model->num_vert*sizeof(struct vertex_curvature));
+  rings = prepare_model(raw_model, 1);
+  compute_curvature_lsq(raw_model, rings, curv, 0, 1);
+
+  /* expected curvatures, k1 being the one of largest magnitude */
+  delta = sqrt((a - c)*(a - c) + 4.0*b*b);
+  k1 = 0.5*(a + c + delta);
+  k2 = 0.5*(a + c - delta);
+  if (fabs(k2) > fabs(k1)) {
+    x = k1;
+    k1 = k2;
+    k2 = x;
+  }
+  t1.x = (float)t1x;
+  t1.y = (float)t1y;
+  t1.z = 0.0;
+  ctr = (CHECK_N/2)*(CHECK_N+1) + CHECK_N/2;
+  err = fabs(fabs(s*curv[ctr].k1) - fabs(k1)) > CHECK_TOL ||
+    fabs(fabs(s*curv[ctr].k2) - fabs(k2)) > CHECK_TOL ||
+    fabs(s*s*curv[ctr].gauss_curv - k1*k2) > CHECK_TOL ||
+    fabs(fabs(scalprod_v(&(curv[ctr].t1), &t1)) - 1.0) > CHECK_TOL;
+  printf("z = (%g x^2 + 2*%g xy + %g y^2)/2, scale %g : k1=%f k2=%f "
+         "T1 = (%f, %f, %f) %s\n", a, b, c, s, curv[ctr].k1, curv[ctr].k2,
+         curv[ctr].t1.x, curv[ctr].t1.y, curv[ctr].t1.z, 
+         err ? "FAILED" : "ok");
+
+  free(curv);
+  free_rings(rings);
+  __free_raw_model(raw_model);
+  return err;
+}
+
+/* Checks the fitting on a few quadrics with known curvatures */
+static int check_lsq(void) {
+  int err=0;
+
+  err |= check_quadric(1.0, 0.0, 5.0, 0.0, 1.0, 1.0);
+  err |= check_quadric(5.0, 0.0, 1.0, 1.0, 0.0, 1.0);
+  /* eigenvector of k1=2.0811 is (1, 0.1623) */
+  err |= check_quadric(2.0, 0.5, -1.0, 0.987087, 0.160182, 1.0);
+  /* nearly umbilic, the principal directions must not depend on the
+   * scale */
+  err |= check_quadric(1.0, 0.0, 1.002, 0.0, 1.0, 1.0);
+  err |= check_quadric(1.0, 0.0, 1.002, 0.0, 1.0, 100.0);
+  return err;
 }
 
 
@@ -232,19 +171,26 @@ int main(int argc, char **argv) {
   
   char *basename;
   struct model *raw_model;
-  
-
-  if (argc != 2) {
-    printf("maps model.raw \n"); 
+  int use_2ring=0;
+
+  if (argc == 2 && strcmp(argv[1], "-check") == 0) {
+    return check_lsq();
+  } else if (argc == 3 && strcmp(argv[1], "-2ring") == 0) {
+    use_2ring = 1;
+    basename = argv[2];
+  } else if (argc == 2) {
+    basename = argv[1];
+  } else {
+    printf("maps [-2ring] model.raw \n"); 
+    printf("maps -check\n"); 
     exit(0);
   }
   
-  basename = argv[1];
   raw_model = read_raw_model(basename);
   printf("Model read\n");
 
 
-  compute_curvature_lsq(raw_model); 
+  do_curvature_lsq(raw_model, use_2ring); 
   
   
   __free_raw_model(raw_model);
@@ -768,7 +768,11 @@ int read_fmodel(struct model **models_ref, const char *fname,
   data->f = loc_fopen(fname, "rb");
   data->block = (unsigned char*)malloc(GZ_BUF_SZ*sizeof(unsigned char));
 
-  if (data->f == NULL) return MESH_BAD_FNAME;
+  if (data->f == NULL) {
+    free(data->block);
+    free(data);
+    return MESH_BAD_FNAME;
+  }
   /* initialize file_data structure */
   data->size = GZ_BUF_SZ;
   data->eof_reached = 0;
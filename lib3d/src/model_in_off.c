@@ -192,7 +192,8 @@ int read_off_tmesh(struct model **tmesh_ref,struct file_data *data)
     return MESH_CORRUPTED;
   if (int_scanf(data, &edge_num) != 1)
     return MESH_CORRUPTED;
-  if (vert_num < 3 || face_num <= 0)
+  /* Without faces it is a point set */
+  if (vert_num <= 0 || face_num < 0 || (face_num > 0 && vert_num < 3))
     return MESH_CORRUPTED;
   /* otherwise alloc needed buffers/structs */
   tmesh = calloc(1,sizeof(*tmesh));
@@ -200,8 +201,8 @@ int read_off_tmesh(struct model **tmesh_ref,struct file_data *data)
   tmesh->num_vert = vert_num;
   tmesh->vertices = malloc(sizeof(vertex_t)*tmesh->num_vert);
   tmesh->num_faces = face_num;
-  tmesh->faces = malloc(sizeof(face_t)*tmesh->num_faces);
-  if (tmesh->faces == NULL || tmesh->vertices == NULL)
+  if (face_num > 0) tmesh->faces = malloc(sizeof(face_t)*tmesh->num_faces);
+  if ((face_num > 0 && tmesh->faces == NULL) || tmesh->vertices == NULL)
     return MESH_NO_MEM;
   rcode = read_off_vertices(tmesh->vertices, data, tmesh->num_vert,
 			    &(tmesh->bBox[0]), &(tmesh->bBox[1]));
@@ -737,8 +737,19 @@ int read_ply_tmesh(struct model **tmesh_ref, struct file_data *data)
     rcode = MESH_CORRUPTED;
 
   if (rcode >= 0) {
+    /* Scan the header words up to 'end_header'. The face element is
+     * optional, a file with only vertices is read as a point set. */
     do {
-      if ((c = find_string(data, "element")) != EOF) {
+      if (skip_ws_str_scanf(data, stmp) != 1) {
+        rcode = MESH_CORRUPTED;
+      } else if (strcmp(stmp, "end_header") == 0) {
+        break;
+      } else if (strcmp(stmp, "comment") == 0 || 
+                 strcmp(stmp, "obj_info") == 0) {
+        do { /* skip the rest of the line */
+          c = getc(data);
+        } while (c != '\n' && c != '\r' && c != EOF);
+      } else if (strcmp(stmp, "element") == 0) {
         if (skip_ws_str_scanf(data, stmp) == 1) {
           if (strcmp(stmp, "vertex") == 0) {
             if ((c = int_scanf(data, &(tmesh->num_vert))) != 1)
@@ -772,20 +783,20 @@ int read_ply_tmesh(struct model **tmesh_ref, struct file_data *data)
           fprintf(stderr, "[Warning] Unrecognized 'element' field found."
                   " Skipping...\n");
         }
-      } else
-        rcode = MESH_CORRUPTED;
-    } while (rcode >= 0 && (tmesh->num_faces == 0 || tmesh->num_vert == 0));
+      }
+    } while (rcode >= 0);
     
-  /* Ignore everything else from the header */
-    if ((c = find_string(data, "end_header")) == EOF)
+    if (rcode >= 0 && (tmesh->num_vert <= 0 || tmesh->num_faces < 0))
       rcode = MESH_CORRUPTED;
     /* end_header read */
-    else {
+    if (rcode >= 0) {
 
       tmesh->vertices = (vertex_t*)malloc(tmesh->num_vert*sizeof(vertex_t));
-      tmesh->faces = (face_t*)malloc(tmesh->num_faces*sizeof(face_t));
+      if (tmesh->num_faces > 0)
+        tmesh->faces = (face_t*)malloc(tmesh->num_faces*sizeof(face_t));
       
-      if (tmesh->vertices == NULL || tmesh->faces == NULL)
+      if (tmesh->vertices == NULL || 
+          (tmesh->num_faces > 0 && tmesh->faces == NULL))
         rcode = MESH_NO_MEM;
       else {
         if (is_bin) { 
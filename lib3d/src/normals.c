@@ -3,7 +3,8 @@
 #include <geomutils.h>
 #include <normals.h>
 #include <ring.h>
-#include <block_list.h>
+#include <edge_table.h>
+#include <thread_pool.h>
 
 #if defined(DEBUG) || defined(NORM_DEBUG) || defined(NORM_DEBUG_BFS)
 # include <debug_print.h>
@@ -13,110 +14,63 @@
 # include <time.h>
 #endif
 
-/* Adds an edge in the dual graph and returns the last elt. in the graph */
-static int add_edge_dg(struct block_list **cur_edges,
-                       const int face_0, const int face_1, 
-                       const int v0, const int v1 ) {
-
-  if ((*cur_edges)->elem_filled == (*cur_edges)->nelem) {
-    *cur_edges = get_next_block(*cur_edges);
-    if (*cur_edges == NULL)
-      return -1;
-  }
-  
-  BLOCK_LIST_TAIL(*cur_edges, struct edge_dual).face0 = face_0;
-  BLOCK_LIST_TAIL(*cur_edges, struct edge_dual).face1 = face_1;
-  BLOCK_LIST_TAIL(*cur_edges, struct edge_dual).common.v0 = v0;
-  BLOCK_LIST_TAIL_INCR(*cur_edges, struct edge_dual).common.v1 = v1;
-
-  return 0;
-
-}
-
-/* Returns the number of edges from the dual graph or -1 if a non-manifold */
-/* edge is encoutered. The list of faces surrounding each vertex is done */
-/* at the same time */
+/* Number of faces or vertices processed in each parallel chunk */
+#define NORM_BLOCK 1024
+
+/* Shared data of the parallel normal computations */
+struct norm_data {
+  const struct model *m;
+  const struct edge_table *et;
+  const struct ring_info *rings;
+  const vertex_t *face_normals; /* the face normals (input) */
+  vertex_t *normals;            /* the face or vertex normals (output) */
+  int *not_oriented;            /* set per thread if a pair of adjacent
+                                 * faces is not consistently oriented or
+                                 * an edge is non-manifold */
+};
+
+/* Returns the number of edges from the dual graph or -1 if out of memory. */
+/* There is one dual edge for each edge shared by exactly two faces, */
+/* boundary and non-manifold edges are ignored. The list of dual edges */
+/* around each face is done at the same time */
 static int build_edge_list(const struct model *raw_model, 
                            struct dual_graph_info *dual_graph, 
-                           const struct ring_info *ring, 
+                           const struct edge_table *et, 
                            struct dual_graph_index *dg_idx){
 
-  int i, j, f=-1, num_edges_dual=0, rcode=-1;
-  struct block_list *head_edges, *cur_edges;
-  
-  head_edges = (struct block_list*)malloc(sizeof(struct block_list));
-  cur_edges = head_edges;
-  rcode = init_block_list(head_edges, sizeof(struct edge_dual));
-  if (rcode < 0)
-    return rcode;
-
-  for (i=0; i<raw_model->num_vert; i++) {
+  int e, h0, h1, f, num_edges_dual=0;
+  struct edge_dual *edge;
 
-    /* some models have isolated vertices -> continue */
-    /* continue also for non-manifold-vertices... */
-    if (ring[i].type == -1 || ring[i].type == 2)
+  dual_graph->edges = 
+    (struct edge_dual*)malloc((et->n_edges+1)*sizeof(struct edge_dual));
+  if (dual_graph->edges == NULL)
+    return -1;
+
+  for (e=0; e<et->n_edges; e++) {
+    h0 = et->edge_he[e];
+    h1 = ET_HE_TWIN(et, h0);
+    if (h1 < 0)
       continue;
 
-    for (j=0; j<ring[i].n_faces-1; j++) {
-
-      rcode = add_edge_dg(&cur_edges,
-                          ring[i].ord_face[j], ring[i].ord_face[j+1], 
-                          i, ring[i].ord_vert[j+1]);
-      if (rcode < 0)
-        return rcode;
-      /* update index */
-      f = ring[i].ord_face[j];
-      /* if the test below is true, the face is non-manifold, so bail
-         out */
-      if (dg_idx[f].face_info > 5)
-        return -1;
-
-      dg_idx[f].ring[dg_idx[f].face_info++] = num_edges_dual;
-
-      f = ring[i].ord_face[j+1];
-      if (dg_idx[f].face_info > 5) 
-        return -1;
-      dg_idx[f].ring[dg_idx[f].face_info++] = num_edges_dual++;
-
-
-    }
-    /* handle last face if the vertex is regular (i.e. not boundary)
-     * */
-    if (ring[i].type == 0) {
-
-      f = ring[i].ord_face[ring[i].n_faces-1];
-      
-      rcode =add_edge_dg(&cur_edges, f, 
-                         ring[i].ord_face[0], i, ring[i].ord_vert[0]);
-      if (rcode < 0)
-        return rcode;
-      if (dg_idx[f].face_info > 5)
-        return -1;
-
-      dg_idx[f].ring[dg_idx[f].face_info++] = num_edges_dual;
-
-      f = ring[i].ord_face[0];
-      if (dg_idx[f].face_info > 5)
-        return -1;
-
-      dg_idx[f].ring[dg_idx[f].face_info++] = num_edges_dual++;
-
-    }
+    /* the common edge is oriented as in face0 */
+    edge = &(dual_graph->edges[num_edges_dual]);
+    edge->face0 = ET_HE_FACE(h0);
+    edge->face1 = ET_HE_FACE(h1);
+    edge->common.v0 = ET_HE_ORG(raw_model->faces, h0);
+    edge->common.v1 = ET_HE_DST(raw_model->faces, h0);
+
+    f = edge->face0;
+    dg_idx[f].ring[dg_idx[f].face_info++] = num_edges_dual;
+    f = edge->face1;
+    dg_idx[f].ring[dg_idx[f].face_info++] = num_edges_dual++;
   }
   dual_graph->num_edges_dual = num_edges_dual;
-  dual_graph->edges = 
-    (struct edge_dual*)malloc(num_edges_dual*sizeof(struct edge_dual));
-  rcode = gather_block_list(head_edges, dual_graph->edges, 
-                            num_edges_dual*sizeof(struct edge_dual));
-  free_block_list(&head_edges);
-  if (rcode == 0)
-    rcode = num_edges_dual;
 #ifdef NORM_DEBUG
   DEBUG_PRINT("%d edges in dual graph\n", 
               dual_graph->num_edges_dual);
 #endif
 
-  return rcode;
+  return num_edges_dual;
 
 }
 
@@ -162,7 +116,7 @@ find_dual_edges(const int cur_face,  int *nfound,
 
 /* Builds the spanning tree of the dual graph */
 struct face_tree** bfs_build_spanning_tree(const struct model *raw_model, 
-					   struct ring_info *ring) {
+					   const struct edge_table *et) {
   int faces_traversed=0;
   int list_size=0, i;
   int ne_dual=0;
@@ -188,11 +142,11 @@ struct face_tree** bfs_build_spanning_tree(const struct model *raw_model,
 
 #ifdef TIME_BUILD_EDGE_LIST
   start = clock();
-  ne_dual = build_edge_list(raw_model, dual_graph, ring, dg_idx);
+  ne_dual = build_edge_list(raw_model, dual_graph, et, dg_idx);
   printf("Edge list built in %f sec.\n", 
          (double)(clock()-start)/CLOCKS_PER_SEC);
 #else 
-  ne_dual = build_edge_list(raw_model, dual_graph, ring, dg_idx);
+  ne_dual = build_edge_list(raw_model, dual_graph, et, dg_idx);
 #endif
 
   dual_graph->done = BITMAP_ALLOC(dual_graph->num_edges_dual);
@@ -523,20 +477,86 @@ static void build_normals(const struct model *raw_model,
   
   
 
+}
+
+/* Checks the orientation of faces start to end-1: each manifold edge
+ * should be traversed in opposite directions by its two faces */
+static void orient_check_work(void *data, int start, int end, int tid)
+{
+  struct norm_data *d;
+  const face_t *faces;
+  int h,r;
+
+  d = (struct norm_data*)data;
+  faces = d->m->faces;
+  for (h=3*start; h<3*end; h++) {
+    r = d->et->he_radial[h];
+    if (r < 0 || r == h) continue; /* degenerate face or boundary edge */
+    if (d->et->he_radial[r] != h ||
+        ET_HE_ORG(faces,h) != ET_HE_DST(faces,r)) {
+      d->not_oriented[tid] = 1;
+      return;
+    }
+  }
+}
+
+/* Computes the normals of faces start to end-1, from their orientation */
+static void face_normal_work(void *data, int start, int end, int tid)
+{
+  struct norm_data *d;
+  const face_t *f;
+  int i;
+
+  (void)tid;
+  d = (struct norm_data*)data;
+  for (i=start; i<end; i++) {
+    f = &(d->m->faces[i]);
+    ncrossp_v(&(d->m->vertices[f->f0]), &(d->m->vertices[f->f1]), 
+              &(d->m->vertices[f->f2]), &(d->normals[i]));
+  }
 }
 
 /* Compute consistent normals for each face of the model */
-/* "build_star_global" has to be called *before* entering this */
+/* "build_edge_table" has to be called *before* entering this */
+/* If the model is already consistently oriented (and its edges are
+ * manifold) the normals are directly computed from the faces, in
+ * parallel, and follow their orientation. Otherwise the spanning tree of
+ * the dual graph is used to orient them, starting from an arbitrary
+ * face. */
 vertex_t* compute_face_normals(const struct model* raw_model, 
-			       struct ring_info *ring) {
+			       const struct edge_table *et) {
   
   vertex_t *normals;
   struct face_tree **tree, *top;
-  int i;
+  struct norm_data d;
+  int i, n_threads, oriented;
 #ifdef TIME_BFS
   clock_t start;
 #endif
 
+  n_threads = tp_num_cpus();
+  d.m = raw_model;
+  d.et = et;
+  d.not_oriented = (int*)calloc(n_threads, sizeof(int));
+  if (d.not_oriented == NULL)
+    return NULL;
+  tp_par_for(n_threads, raw_model->num_faces, NORM_BLOCK, 
+             orient_check_work, &d);
+  for (oriented=1, i=0; i<n_threads; i++) {
+    if (d.not_oriented[i])
+      oriented = 0;
+  }
+  free(d.not_oriented);
+
+  if (oriented) {
+    normals = (vertex_t*)malloc(raw_model->num_faces*sizeof(vertex_t));
+    if (normals == NULL)
+      return NULL;
+    d.normals = normals;
+    tp_par_for(n_threads, raw_model->num_faces, NORM_BLOCK, 
+               face_normal_work, &d);
+    return normals;
+  }
 
   /* Compute spanning tree of the dual graph */
 
@@ -544,7 +564,7 @@ vertex_t* compute_face_normals(const struct model* raw_model,
   start = clock();
 #endif
 
-  tree = bfs_build_spanning_tree(raw_model, ring); 
+  tree = bfs_build_spanning_tree(raw_model, et); 
 #ifdef TIME_BFS
   printf("Tree computed in %f sec.\n", (clock()-start)/(float)CLOCKS_PER_SEC);
 #endif
@@ -573,62 +593,73 @@ vertex_t* compute_face_normals(const struct model* raw_model,
   return normals;
 }
 
+/* Computes the area of faces start to end-1 */
+static void face_area_work(void *data, int start, int end, int tid)
+{
+  const struct model *m;
+  int i;
 
-/* Compute a "normal" for each vertex */
-void compute_vertex_normal(struct model* raw_model, 
-                           const struct ring_info* ring,  
-			   const vertex_t *model_normals) {
-  int i,j;
-  vertex_t tmp, *p1, *p2, *p3;
-
-  raw_model->total_area = 0.0;
-
-  /* Compute area of each face */
-  for (i=0; i<raw_model->num_faces; i++) {
-    p1 = &(raw_model->vertices[raw_model->faces[i].f0]);
-    p2 = &(raw_model->vertices[raw_model->faces[i].f1]);
-    p3 = &(raw_model->vertices[raw_model->faces[i].f2]);
-    
-    raw_model->area[i] = tri_area_v(p1, p2, p3);
-    raw_model->total_area += raw_model->area[i];
+  (void)tid;
+  m = ((struct norm_data*)data)->m;
+  for (i=start; i<end; i++) {
+    m->area[i] = tri_area_v(&(m->vertices[m->faces[i].f0]), 
+                            &(m->vertices[m->faces[i].f1]), 
+                            &(m->vertices[m->faces[i].f2]));
   }
+}
 
-  /* Alloc array for normal of each vertex */
-  raw_model->normals = (vertex_t*)malloc(raw_model->num_vert*sizeof(vertex_t));
-  
+/* Computes the normals of vertices start to end-1, gathering the normals
+ * of the faces of their ring */
+static void vertex_normal_work(void *data, int start, int end, int tid)
+{
+  struct norm_data *d;
+  const struct ring_info *ring;
+  const float *area;
+  vertex_t tmp;
+  int i,j;
 
-  for (i=0; i<raw_model->num_vert; i++) {
+  (void)tid;
+  d = (struct norm_data*)data;
+  area = d->m->area;
+  for (i=start; i<end; i++) {
+    ring = &(d->rings[i]);
     tmp.x = 0.0;
     tmp.y = 0.0;
     tmp.z = 0.0;
-    for (j=0; j<ring[i].n_faces; j++) 
-      __add_prod_v(raw_model->area[ring[i].ord_face[j]], 
-                   model_normals[ring[i].ord_face[j]], tmp, tmp);
-    
-    
-
+    for (j=0; j<ring->n_faces; j++) 
+      __add_prod_v(area[ring->ord_face[j]], 
+                   d->face_normals[ring->ord_face[j]], tmp, tmp);
     __normalize_v(tmp);
-    raw_model->normals[i] = tmp;
-    
+    d->normals[i] = tmp;
   }
-
-  
 }
 
+/* Compute a "normal" for each vertex */
+/* The face areas and then the vertex normals are computed in parallel. The
+ * rings are built in a single block, so the faces of the vertices are read
+ * from one array, in order. */
+void compute_vertex_normal(struct model* raw_model, 
+                           const struct ring_info* ring,  
+			   const vertex_t *model_normals) {
+  struct norm_data d;
+  int i, n_threads;
 
+  n_threads = tp_num_cpus();
+  d.m = raw_model;
+  d.rings = ring;
+  d.face_normals = model_normals;
 
+  /* Compute area of each face */
+  tp_par_for(n_threads, raw_model->num_faces, NORM_BLOCK, 
+             face_area_work, &d);
+  /* summed in face order, as it does not depend on the thread count */
+  raw_model->total_area = 0.0;
+  for (i=0; i<raw_model->num_faces; i++)
+    raw_model->total_area += raw_model->area[i];
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+  /* Alloc array for normal of each vertex */
+  raw_model->normals = (vertex_t*)malloc(raw_model->num_vert*sizeof(vertex_t));
+  d.normals = raw_model->normals;
+  tp_par_for(n_threads, raw_model->num_vert, NORM_BLOCK, 
+             vertex_normal_work, &d);
+}
@@ -1,5 +1,7 @@
 /* $Id$ */
 #include <3dutils.h>
+#include <smoothing.h>
+#include <thread_pool.h>
 #include <rawview.h>
 #include <rawview_misc.h>
 #include <stdarg.h>
@@ -133,46 +135,46 @@ void set_light_off()
 int do_normals(struct model* raw_model, int verbose) 
 {
   struct ring_info *tmp;
-  int i,rcode=0;
+  struct edge_table *et;
+  int rcode=0;
 
   verbose_printf(verbose, "Computing normals...\n");
   if (raw_model->area == NULL)
     raw_model->area = (float*)malloc(raw_model->num_faces*sizeof(float));
 
-  tmp = (struct ring_info*)
-    malloc(raw_model->num_vert*sizeof(struct ring_info));
-  build_star_global(raw_model, tmp);
-  raw_model->face_normals = compute_face_normals(raw_model, tmp);
+  et = build_edge_table(raw_model, 1);
+  tmp = (et != NULL) ? build_rings(raw_model, et, 0) : NULL;
+  if (tmp == NULL) {
+    free_edge_table(et);
+    fprintf(stderr, "Error - Not enough memory to build the rings\n");
+    return 1;
+  }
+  raw_model->face_normals = compute_face_normals(raw_model, et);
+  free_edge_table(et);
   
   if (raw_model->face_normals != NULL){
     compute_vertex_normal(raw_model, tmp, raw_model->face_normals);
-    for (i=0; i<raw_model->num_vert; i++) {
-      free(tmp[i].ord_face);
-      free(tmp[i].ord_vert);
-    }
-    free(tmp);
     verbose_printf(verbose, "Face and vertex normals done !\n");
   } else {
     fprintf(stderr, 
             "Error - Unable to build face normals (Non-manifold model ?)\n");
     rcode = 1;
   }
+  free_rings(tmp);
     
   return rcode;
 }
 
 int do_spanning_tree(struct model *raw_model, int verbose) 
 {
-  struct ring_info* tmp;
-  int i, ret=0;
+  struct edge_table *et;
+  int ret=0;
 
-  tmp = (struct ring_info*)
-    malloc(raw_model->num_vert*sizeof(struct ring_info));
-  build_star_global(raw_model, tmp);
+  et = build_edge_table(raw_model, 1);
 
   verbose_printf(verbose, "Building spanning tree\n");
   /* Compute spanning tree of the dual graph */
-  raw_model->tree = bfs_build_spanning_tree(raw_model, tmp); 
+  raw_model->tree = bfs_build_spanning_tree(raw_model, et); 
   if (raw_model->tree == NULL) {
     fprintf(stderr, "Unable to build spanning tree\n");
     ret = 1;
@@ -181,11 +183,7 @@ int do_spanning_tree(struct model *raw_model, int verbose)
   if (ret == 0) 
     verbose_printf(verbose, "Spanning tree done\n");
   
-  for(i=0; i<raw_model->num_vert; i++) {
-    free(tmp[i].ord_face);
-    free(tmp[i].ord_vert);
-  } 
-  free(tmp);
+  free_edge_table(et);
   return ret;
 }
 
@@ -254,32 +252,21 @@ int do_curvature(struct gl_render_context *gl_ctx)
 
 int do_laplacian_smoothing(struct gl_render_context *gl_ctx) 
 {
-  struct ring_info *rings;
+  struct edge_table *et;
+  struct lapl_matrix *lm;
   struct model *raw_model = gl_ctx->raw_model;
-  vertex_t *new_vert, tmp;
-  int i, j;
-
-  rings = 
-    (struct ring_info*)malloc(raw_model->num_vert*sizeof(struct ring_info));
-  new_vert =  (vertex_t*)malloc(raw_model->num_vert*sizeof(vertex_t));
-
-  build_star_global(raw_model, rings);
-  for (i=0; i<raw_model->num_vert; i++) {
-    tmp.x = tmp.y = tmp.z = 0.0;
-    for (j=0; j<rings[i].size; j++) 
-      __add_v(raw_model->vertices[rings[i].ord_vert[j]], tmp, tmp);
-    
-    __prod_v(1.0/(float)rings[i].size, tmp, new_vert[i]);
+  int n_threads, rcode;
 
-  }
-  memcpy(raw_model->vertices, new_vert, 
-         raw_model->num_vert*sizeof(vertex_t));
-  
-  for (j=0; j<raw_model->num_vert; j++) {
-    free(rings[j].ord_vert);
-    free(rings[j].ord_face);
-  }
-  free(new_vert);
-  free(rings);
-  return 0;
+  n_threads = tp_num_cpus();
+  et = build_edge_table(raw_model, n_threads);
+  if (et == NULL)
+    return 1;
+  lm = build_lapl_matrix(raw_model, et, LAPL_UNIFORM, n_threads);
+  free_edge_table(et);
+  if (lm == NULL)
+    return 1;
+  /* one step moving each vertex to the barycenter of its neighbours */
+  rcode = lapl_smooth(lm, raw_model, 1, 1.0, 0.0, n_threads);
+  free_lapl_matrix(lm);
+  return (rcode < 0);
 }
@@ -26,415 +26,418 @@
 
 #include <3dmodel.h>
 #include <ring.h>
+#include <edge_table.h>
+#include <thread_pool.h>
 
 #if defined(DEBUG) || defined(RING_DEBUG) || defined(NORM_DEBUG)
 # include <debug_print.h>
 #endif
 
-#ifndef REMOVE_ELT_FROM_LIST
-#define REMOVE_ELT_FROM_LIST(elt,tmp)           \
-do {                                            \
-  tmp = (elt)->prev;                            \
-  elt = (elt)->next;                            \
-  if ((elt)->prev != NULL)                      \
-    free((elt)->prev);                          \
-                                                \
-  (elt)->prev = tmp;                            \
-  if (tmp != NULL)                              \
-    (tmp)->next = elt;                          \
-} while(0)
-#endif
-
-#ifndef ALLOC_NEXT_SLOT
-#define ALLOC_NEXT_SLOT(list_tail)                                        \
-do {                                                                      \
-    (list_tail)->next = (struct edge_v*)calloc(1, sizeof(struct edge_v)); \
-    (list_tail)->next->prev = list_tail;                                  \
-    list_tail = (list_tail)->next;                                        \
-} while(0)
-#endif
+/* Number of vertices processed in each parallel chunk by build_rings() */
+#define RING_BLOCK 1024
+
+/* The faces around a vertex, across which its ring is walked. They are
+ * either given by the edge table of the model or listed explicitly. */
+struct vertex_fan {
+  const struct edge_table *et; /* the edge table, NULL if 'faces' is used */
+  const int *faces;            /* the faces incident on the vertex, in
+                                * increasing order */
+  int n;                       /* the number of faces incident on the
+                                * vertex */
+};
+
+/* Returns the vertex of face f that is neither v nor w */
+static int third_vertex(const face_t *f, const int v, const int w) {
+  if (f->f0 != v && f->f0 != w)
+    return f->f0;
+  else if (f->f1 != v && f->f1 != w)
+    return f->f1;
+  return f->f2;
+}
 
-void build_star_global(const struct model *raw_model, 
-                       struct ring_info *ring) {
-  int i;
-  int *num_edges=NULL; /* number of edges in the 1-ring */
-  struct edge_v **edge_list_primal, **cur_list_tail, *list_tail=NULL, *tmp;
-  int *final_star;
-  int *face_star;
-  int vid;
-  int star_size, n_faces, edge_added;
+/* Returns the twin of the half-edge of face 'fidx' lying on the edge v-w
+ * (see edge_table.h) */
+static int twin_on_edge(const struct model *raw_model, 
+                        const struct edge_table *et, 
+                        const int fidx, const int v, const int w) {
+  const face_t *f = &(raw_model->faces[fidx]);
+  int h = 3*fidx;
   
-  edge_list_primal = (struct edge_v**)
-    malloc(raw_model->num_vert*sizeof(struct edge_v*));
-  cur_list_tail = (struct edge_v**)
-    malloc(raw_model->num_vert*sizeof(struct edge_v*));
-  for (i=0; i<raw_model->num_vert; i++) {
-    edge_list_primal[i] = (struct edge_v*)calloc(1, sizeof(struct edge_v));
-    cur_list_tail[i] = edge_list_primal[i];
-  }
-  memset(ring, 0, raw_model->num_vert*sizeof(struct ring_info));
+  if ((f->f1 == v && f->f2 == w) || (f->f1 == w && f->f2 == v))
+    h += 1;
+  else if ((f->f2 == v && f->f0 == w) || (f->f2 == w && f->f0 == v))
+    h += 2;
+  return ET_HE_TWIN(et, h);
+}
 
-  num_edges = (int*)calloc(raw_model->num_vert, sizeof(int));
-  
-  
-  /* List all the edges in the 1-rings */
-  for (i=0; i<raw_model->num_faces; i++) {
+/* Returns the other face of the fan of vertex v sharing the edge v-w with
+ * face 'fidx'. It is -1 if there is none (boundary edge) and -2 if there
+ * is more than one (non-manifold edge). */
+static int fan_twin(const struct model *raw_model, 
+                    const struct vertex_fan *fan, 
+                    const int fidx, const int v, const int w) {
+  const face_t *f;
+  int k, t;
+
+  if (fan->et != NULL) {
+    t = twin_on_edge(raw_model, fan->et, fidx, v, w);
+    return (t < 0) ? t : ET_HE_FACE(t);
+  }
+  t = -1;
+  for (k=0; k<fan->n; k++) {
+    if (fan->faces[k] == fidx)
+      continue;
+    f = &(raw_model->faces[fan->faces[k]]);
+    if (f->f0 == w || f->f1 == w || f->f2 == w) {
+      if (t >= 0)
+        return -2;
+      t = fan->faces[k];
+    }
+  }
+  return t;
+}
 
-    vid = raw_model->faces[i].f0; /* current vertex */
-    num_edges[vid]++;
-    cur_list_tail[vid]->v0 = raw_model->faces[i].f1;
-    cur_list_tail[vid]->v1 = raw_model->faces[i].f2;
-    cur_list_tail[vid]->face = i;
-    ALLOC_NEXT_SLOT(cur_list_tail[vid]);
+/* Reverses the entries a to b-1 of the ring lists */
+static void reverse_ring_part(struct ring_info *ring, int a, int b) {
+  int tmp;
+
+  for (b--; a<b; a++, b--) {
+    tmp = ring->ord_vert[a];
+    ring->ord_vert[a] = ring->ord_vert[b];
+    ring->ord_vert[b] = tmp;
+    tmp = ring->ord_face[a];
+    ring->ord_face[a] = ring->ord_face[b];
+    ring->ord_face[b] = tmp;
+  }
+}
 
-    
-    vid = raw_model->faces[i].f1;
-    num_edges[vid]++;
-    cur_list_tail[vid]->v0 = raw_model->faces[i].f0;
-    cur_list_tail[vid]->v1 = raw_model->faces[i].f2;
-    cur_list_tail[vid]->face = i;
-    ALLOC_NEXT_SLOT(cur_list_tail[vid]);
-    
-    vid = raw_model->faces[i].f2;
-    num_edges[vid]++;
-    cur_list_tail[vid]->v0 = raw_model->faces[i].f0;
-    cur_list_tail[vid]->v1 = raw_model->faces[i].f1;
-    cur_list_tail[vid]->face = i;
-    ALLOC_NEXT_SLOT(cur_list_tail[vid]);
+/* Rotates the closed ring to the start the rings have always had, which
+ * does not depend on the face the ring is walked from. It is the start of
+ * the ring grown from its lowest index face, adding at each step the
+ * lowest index face adjacent to either end of the ring, before the first
+ * vertex or after the last one (the last face is added before the first
+ * vertex). The ring thus starts after its k-th face before the lowest
+ * index face, k being the number of faces added before. */
+void order_closed_ring(struct ring_info *ring) {
+  int n = ring->n_faces;
+  int j, p, ti, bi, k;
+
+  p = 0;
+  for (j=1; j<n; j++) {
+    if (ring->ord_face[j] < ring->ord_face[p])
+      p = j;
   }
-  free(cur_list_tail);
+  ti = n-1;
+  bi = 1;
+  k = 0;
+  for (j=1; j<n; j++) {
+    if (ti == bi ||
+        ring->ord_face[(p+ti)%n] < ring->ord_face[(p+bi)%n]) {
+      k++;
+      ti--;
+    } else
+      bi++;
+  }
+  j = (p-k+n)%n;
+  if (j != 0) { /* rotate left by j */
+    reverse_ring_part(ring, 0, j);
+    reverse_ring_part(ring, j, n);
+    reverse_ring_part(ring, 0, n);
+  }
+  ring->ord_vert[n] = ring->ord_vert[0];
+}
 
-  for (i=0; i<raw_model->num_vert; i++) {
-    if(num_edges[i] == 0) {
-      ring[i].type = -1; 
-      list_tail = edge_list_primal[i];
-#ifdef DEBUG
-      DEBUG_PRINT("Vertex %d has no face...\n", i);
-#endif
-      goto singularity_encountered; 
+/* Shared data for the parallel build of the rings in build_rings() */
+struct ring_build_data {
+  const struct model *raw_model;
+  const struct edge_table *et;
+  struct ring_info *ring;
+};
+
+/* Builds the 1-ring of vertex i by walking across the edges shared by the
+ * faces of its fan, starting from face f_start. The storage for the
+ * ordered vertices (at least n+1) and faces (at least n) of the ring, n
+ * being the number of faces of the fan, must already be set in *ring. If i
+ * is non-manifold its type is set to 2 and the storage pointers to
+ * NULL. */
+static void walk_ring(const struct model *raw_model, 
+                      const struct vertex_fan *fan, int i, int f_start,
+                      struct ring_info *ring) {
+  int n, f, t;
+  int p, q, r, p0, q0;
+  int star_size, n_faces, closed;
+  const face_t *face;
+
+  n = fan->n;
+
+  /* Start from the first face, with the other two vertices in the face
+   * order */
+  face = &(raw_model->faces[f_start]);
+  if (face->f0 == i) {
+    p0 = face->f1;
+    q0 = face->f2;
+  } else if (face->f1 == i) {
+    p0 = face->f0;
+    q0 = face->f2;
+  } else {
+    p0 = face->f0;
+    q0 = face->f1;
+  }
+  
+  /* Walk backwards (across the i-p edges) to the boundary, if any */
+  f = f_start;
+  p = p0;
+  q = q0;
+  closed = 0;
+  t = -1;
+  for (n_faces=1; n_faces<=n; n_faces++) {
+    t = fan_twin(raw_model, fan, f, i, p);
+    if (t < 0)
+      break;
+    f = t;
+    if (f == f_start) {
+      closed = 1;
+      break;
     }
-
-    /* worst case allocation */
-    final_star = (int*)malloc(2*num_edges[i]*sizeof(int));
-    face_star = (int*)malloc(2*num_edges[i]*sizeof(int));
+    r = third_vertex(&(raw_model->faces[f]), i, p);
+    q = p;
+    p = r;
+  }
+  if (closed) {
+    f = f_start;
+    p = p0;
+    q = q0;
+  }
     
-    /* Put 1st elts in the star */
-    final_star[0] = edge_list_primal[i]->v0;
-    final_star[1] = edge_list_primal[i]->v1;
-    face_star[0] = edge_list_primal[i]->face;
-
-    /* de-queue 1st elt */
-    REMOVE_ELT_FROM_LIST(edge_list_primal[i], tmp);
-
-    list_tail = edge_list_primal[i];
+  star_size = 0;
+  if (t != -2) {
+    /* Walk forwards (across the i-q edges), filling the ring */
+    ring->ord_vert[0] = p;
+    ring->ord_vert[1] = q;
+    ring->ord_face[0] = f;
     star_size = 2;
     n_faces = 1;
-
-
-    
-    while (star_size <= num_edges[i]) {
-      edge_added = 0;
-      while (list_tail->prev != NULL)
-        list_tail = list_tail->prev;
-
-      while (list_tail != NULL && edge_added == 0) {
-        if (list_tail->v0 == final_star[0]) {
-          /* add v1 on top */
-          memmove(&(final_star[1]), final_star, star_size*sizeof(int));
-          memmove(&(face_star[1]), face_star, n_faces*sizeof(int));
-          
-          final_star[0] = list_tail->v1;
-          face_star[0] = list_tail->face;
-
-          star_size++;
-          n_faces++;
-          edge_added = 1;
-          REMOVE_ELT_FROM_LIST(list_tail, tmp);
-
-        }
-        else if (list_tail->v1 == final_star[0]) {
-          /* add v0 on top */
-          memmove(&(final_star[1]), final_star, star_size*sizeof(int));
-          memmove(&(face_star[1]), face_star, n_faces*sizeof(int));
-       
-          final_star[0] = list_tail->v0;
-          face_star[0] = list_tail->face;
-
-          star_size++;
-          n_faces++;
-          edge_added = 1;
-          REMOVE_ELT_FROM_LIST(list_tail, tmp);
-
-
-        }
-        else if (list_tail->v0 == final_star[star_size-1]) {
-          /* add v1 on bottom */
-          final_star[star_size] = list_tail->v1;
-          face_star[n_faces] = list_tail->face;
-
-          star_size++;
-          n_faces++;
-          edge_added = 1;
-          REMOVE_ELT_FROM_LIST(list_tail, tmp);
-
-        }
-        else if (list_tail->v1 == final_star[star_size-1]) {
-          /* add v0 on bottom */
-          final_star[star_size] = list_tail->v0;
-          face_star[n_faces] = list_tail->face;
-
-          star_size++;
-          n_faces++;
-          edge_added = 1;
-          REMOVE_ELT_FROM_LIST(list_tail, tmp);
-
-        } else
-          list_tail = list_tail->next;
-      }
-
-      if (edge_added == 0) {
-        printf("Vertex %d is non-manifold\n", i);
-        free(final_star);
-        free(face_star);
-        ring[i].type = 2;
-        /* 
-         *  What follows is implicitely done by memset-ing the
-         *  structure to 0 :
-         *
-         *  ring[i].size = 0;
-         *  ring[i].n_faces = 0;
-         *  ring[i].ord_face = NULL;
-         *  ring[i].ord_vert = NULL;
-         *
-         */
-        goto singularity_encountered;
+    while (n_faces <= n) {
+      t = fan_twin(raw_model, fan, f, i, q);
+      if (t < 0)
+        break;
+      f = t;
+      if (closed && f == f_start)
+        break;
+      if (n_faces == n) {
+        n_faces++; /* went past the start => not a single fan */
+        break;
       }
+      r = third_vertex(&(raw_model->faces[f]), i, q);
+      ring->ord_face[n_faces++] = f;
+      ring->ord_vert[star_size++] = r;
+      q = r;
     }
+  }
 
-    if (final_star[0] == final_star[star_size-1]) {    /* Regular vertex */
-      star_size--;
-      ring[i].type = 0;
-    } else     /* Boundary vertex */
-      ring[i].type = 1;
+  /* Non-manifold edge around i or more than one fan of faces */
+  if (t == -2 || n_faces != n) {
+    ring->type = 2;
+    ring->ord_vert = NULL;
+    ring->ord_face = NULL;
+    return;
+  }
+
+  if (closed) {    /* Regular vertex */
+    star_size--;
+    ring->type = 0;
+  } else     /* Boundary vertex */
+    ring->type = 1;
 
-    ring[i].size = star_size;
-    ring[i].ord_vert = (int*)malloc(star_size*sizeof(int));
-    memcpy(ring[i].ord_vert, final_star, star_size*sizeof(int));
+  ring->size = star_size;
 #ifdef DEBUG
-    DEBUG_PRINT("vertex %d: valence=%d\n", i, star_size);
+  DEBUG_PRINT("vertex %d: valence=%d\n", i, star_size);
 #endif
-    ring[i].n_faces = n_faces;
-    ring[i].ord_face = (int*)malloc(n_faces*sizeof(int));
-    memcpy(ring[i].ord_face, face_star, n_faces*sizeof(int));
+  ring->n_faces = n_faces;
+  if (closed)
+    order_closed_ring(ring);
 
 #ifdef RING_DEBUG
-    DEBUG_PRINT("vertex %d Tr: ", i);
-    for (j=0; j<ring[i].n_faces; j++) {
-      printf("%d ", ring[i].ord_face[j]);
-    }
-    printf("\n");
+  DEBUG_PRINT("vertex %d Tr: ", i);
+  for (t=0; t<ring->n_faces; t++) {
+    printf("%d ", ring->ord_face[t]);
+  }
+  printf("\n");
 #endif
+}
 
-    free(final_star);
-    free(face_star);
+/* Builds the 1-ring of vertex i by walking across the edges shared by its
+ * incident faces, using the edge table et. The storage for the ordered
+ * vertices (at least n+1) and faces (at least n) of the ring, n being the
+ * number of faces incident on i, must already be set in *ring. If i is
+ * non-manifold its type is set to 2 and the storage pointers to NULL. */
+void build_vertex_ring(const struct model *raw_model, 
+                       const struct edge_table *et, int i, 
+                       struct ring_info *ring) {
+  struct vertex_fan fan;
 
-  /* Make sure everything is correctly freed */
-  singularity_encountered:
-    while (list_tail != NULL) {
-      tmp = list_tail;
-      list_tail = list_tail->next;
-      free(tmp);
-    }
+  fan.et = et;
+  fan.faces = NULL;
+  fan.n = et->vtx_n_faces[i];
+  if (fan.n <= 0) {
+    ring->type = -1; 
+#ifdef DEBUG
+    DEBUG_PRINT("Vertex %d has no face...\n", i);
+#endif
+    return;
   }
-  free(edge_list_primal);
-  free(num_edges);
+  /* the first face is the one of the first half-edge from i */
+  walk_ring(raw_model, &fan, i, ET_HE_FACE(et->vtx_he[i]), ring);
 }
 
-/* find the 1-ring of vertex v */
-void build_star(const struct model *raw_model, int v, struct ring_info *ring) {
+/* Builds the rings of the vertices start to end-1 */
+static void build_rings_work(void *data, int start, int end, int tid) {
+  struct ring_build_data *d = (struct ring_build_data*)data;
+  int i;
 
-  int i, j;
-  int num_edges=0; /* number of edges in the 1-ring */
-  struct edge_v *edge_list_primal=NULL;
-  int *final_star;
-  int *face_star;
-  unsigned char *done;
-  int star_size;
-  int n_faces;
-  int edge_added;
+  (void)tid;
+  for (i=start; i<end; i++)
+    build_vertex_ring(d->raw_model, d->et, i, &(d->ring[i]));
+}
 
+/* Allocates the rings of the model in a single block, with the storage of
+ * the vertex and face lists of each ring sized from the number of faces of
+ * each vertex in et */
+struct ring_info* alloc_rings(const struct model *raw_model, 
+                              const struct edge_table *et) {
+  struct ring_info *ring;
+  int *arena;
+  int i, n;
+  size_t arena_sz;
+
+  arena_sz = 0;
+  for (i=0; i<raw_model->num_vert; i++) {
+    n = et->vtx_n_faces[i];
+    if (n > 0)
+      arena_sz += 2*n+1;
+  }
+  ring = (struct ring_info*)malloc(raw_model->num_vert*sizeof(struct ring_info)
+                                   + arena_sz*sizeof(int) + 1);
+  if (ring == NULL)
+    return NULL;
+  memset(ring, 0, raw_model->num_vert*sizeof(struct ring_info));
+  arena = (int*)(ring + raw_model->num_vert);
+  for (i=0; i<raw_model->num_vert; i++) {
+    n = et->vtx_n_faces[i];
+    if (n <= 0)
+      continue;
+    ring[i].ord_vert = arena;
+    ring[i].ord_face = arena + n + 1;
+    arena += 2*n+1;
+  }
+  return ring;
+}
 
-  /* list all edges in the 1-ring */
-  for (i=0; i<raw_model->num_faces; i++) {
-    if (raw_model->faces[i].f0 == v) {
-      num_edges ++;
-      edge_list_primal = (struct edge_v*)
-	realloc(edge_list_primal, num_edges*sizeof(struct edge_v));
-      
-#ifdef NORM_DEBUG
-      if (edge_list_primal == NULL) {
-	DEBUG_PRINT("realloc failed %d\n", i);
-	exit(-1);
-      }
-#endif
+/* Builds the 1-ring of each vertex, walking across the edges shared by
+ * the faces given by the edge table. The rings and their vertex and face
+ * lists are stored in a single block, sized from the number of faces of
+ * each vertex. */
+struct ring_info* build_rings(const struct model *raw_model, 
+                              const struct edge_table *et, int n_threads) {
+  struct ring_info *ring;
+  struct ring_build_data d;
+  int i;
 
-      edge_list_primal[num_edges-1].v0 = raw_model->faces[i].f1;
-      edge_list_primal[num_edges-1].v1 = raw_model->faces[i].f2;
-      edge_list_primal[num_edges-1].face = i;
-    } else if (raw_model->faces[i].f1 == v) {
-      num_edges ++;
-      edge_list_primal = (struct edge_v*)
-	realloc(edge_list_primal, num_edges*sizeof(struct edge_v));
-
-#ifdef NORM_DEBUG
-      if (edge_list_primal == NULL) {
-	DEBUG_PRINT("realloc failed %d\n", i);
-	exit(-1);
-      }
-#endif
+  ring = alloc_rings(raw_model, et);
+  if (ring == NULL)
+    return NULL;
 
-      edge_list_primal[num_edges-1].v0 = raw_model->faces[i].f0;
-      edge_list_primal[num_edges-1].v1 = raw_model->faces[i].f2;      
-      edge_list_primal[num_edges-1].face = i;
+  d.raw_model = raw_model;
+  d.et = et;
+  d.ring = ring;
+  if (n_threads <= 0)
+    n_threads = tp_num_cpus();
+  tp_par_for(n_threads, raw_model->num_vert, RING_BLOCK, build_rings_work, 
+             &d);
 
-    }  else if (raw_model->faces[i].f2 == v) {
-      num_edges ++;
-      edge_list_primal = (struct edge_v*)
-	realloc(edge_list_primal, num_edges*sizeof(struct edge_v));
+  for (i=0; i<raw_model->num_vert; i++) {
+    if (ring[i].type == 2)
+      printf("Vertex %d is non-manifold\n", i);
+  }
+  return ring;
+}
 
+/* Frees the rings returned by build_rings() or build_star_global() */
+void free_rings(struct ring_info *ring) {
+  free(ring);
+}
 
-      edge_list_primal[num_edges-1].v0 = raw_model->faces[i].f0;
-      edge_list_primal[num_edges-1].v1 = raw_model->faces[i].f1;      
-      edge_list_primal[num_edges-1].face = i;
-    }
+/* Builds the 1-ring of all the vertices of the model */
+struct ring_info* build_star_global(const struct model *raw_model) {
+  struct edge_table *et;
+  struct ring_info *ring;
+  int n_threads = tp_num_cpus();
+
+  et = build_edge_table(raw_model, n_threads);
+  if (et == NULL) {
+    fprintf(stderr, "Not enough memory to build the edge table\n");
+    exit(-1);
+  }
+  ring = build_rings(raw_model, et, n_threads);
+  free_edge_table(et);
+  if (ring == NULL) {
+    fprintf(stderr, "Not enough memory to build the rings\n");
+    exit(-1);
+  }
+  return ring;
+}
 
+/* Builds the 1-ring of vertex v, as build_rings() does but finding the
+ * faces incident on v by scanning all the faces of the model. The ordered
+ * vertex and face lists of the ring are malloc'ed and should be freed by
+ * the caller. */
+void build_star(const struct model *raw_model, int v, struct ring_info *ring) {
+  struct vertex_fan fan;
+  int *faces, *ord_vert, *ord_face;
+  int i, n, faces_sz;
+  const face_t *f;
+
+  /* list the faces incident on v, in increasing order, ignoring the
+   * degenerate ones as the edge table does */
+  n = 0;
+  faces_sz = 0;
+  faces = NULL;
+  for (i=0; i<raw_model->num_faces; i++) {
+    f = &(raw_model->faces[i]);
+    if ((f->f0 != v && f->f1 != v && f->f2 != v) ||
+        f->f0 == f->f1 || f->f1 == f->f2 || f->f2 == f->f0)
+      continue;
+    if (n == faces_sz) {
+      faces_sz = (faces_sz > 0) ? 2*faces_sz : 8;
+      faces = (int*)realloc(faces, faces_sz*sizeof(int));
+    }
+    faces[n++] = i;
   }
 
-  if (num_edges == 0) {
+  ring->size = 0;
+  ring->n_faces = 0;
+  ring->ord_vert = NULL;
+  ring->ord_face = NULL;
+  if (n == 0) {
+    ring->type = -1;
 #ifdef DEBUG
     DEBUG_PRINT("Vertex %d has no face...\n", v);
 #endif
-    ring->type = 0;
-    ring->size = 0;
-    ring->ord_vert = NULL;
     return;
   }
 
-  done = (unsigned char*)calloc(num_edges, sizeof(unsigned char));
-  /* worst case allocation */
-  final_star = (int*)malloc(2*num_edges*sizeof(int));
-  face_star = (int*)malloc(2*num_edges*sizeof(int));
-
-  /* Put 1st two elts in the star */
-  final_star[0] = edge_list_primal[0].v0;
-  final_star[1] = edge_list_primal[0].v1;
-  face_star[0] = edge_list_primal[0].face;
-
-  star_size = 2;
-  n_faces = 1;
-  done[0] = 1;
-  i = 1;
-
-
-  /* build the 1-ring */
-  while (i < num_edges) {
-    edge_added = 0;
-    for(j=0; j<num_edges; j++) {
-      if (done[j])
-	continue;
-      if (edge_list_primal[j].v0 == final_star[0]) {
-	/* add v1 on top */
-        memmove(&(final_star[1]), final_star, star_size*sizeof(int));
-        memmove(&(face_star[1]), face_star, n_faces*sizeof(int));
-	
-	final_star[0] = edge_list_primal[j].v1;
-	face_star[0] = edge_list_primal[j].face;
-	
-	done[j] = 1;
-	i++;
-	star_size++;
-	n_faces++;
-	edge_added = 1;
-	break;
-      }
-      else if (edge_list_primal[j].v1 == final_star[0]) {
-	/* add v0 on top */
-        memmove(&(final_star[1]), final_star, star_size*sizeof(int));
-        memmove(&(face_star[1]), face_star, n_faces*sizeof(int));
-       
-	final_star[0] = edge_list_primal[j].v0;
-	face_star[0] = edge_list_primal[j].face;
-	done[j] = 1;
-	i++;
-	star_size++;
-	n_faces++;
-	edge_added = 1;
-	break;
-      }
-      else if (edge_list_primal[j].v0 == final_star[star_size-1]) {
-	/* add v1 on bottom */
-	final_star[star_size] = edge_list_primal[j].v1;
-	face_star[n_faces] = edge_list_primal[j].face;
-	done[j] = 1;
-	i++;
-	star_size++;
-	n_faces++;
-	edge_added = 1;
-	break;
-      }
-      else if (edge_list_primal[j].v1 == final_star[star_size-1]) {
-	/* add v0 on bottom */
-	final_star[star_size] = edge_list_primal[j].v0;
-	face_star[n_faces] = edge_list_primal[j].face;
-	done[j] = 1;
-	i++;
-	star_size++;
-	n_faces++;
-	edge_added = 1;
-	break;
-      }
-    }
-    if (edge_added == 0) {
-      printf("Vertex %d is non-manifold\n", v);
-      free(done);
-      free(final_star);
-      free(face_star);
-      ring->type = 2;
-      ring->size = 0;
-      ring->n_faces = 0;
-      ring->ord_face = NULL;
-      ring->ord_vert = NULL;
-      return;
-    }
+  ord_vert = (int*)malloc((n+1)*sizeof(int));
+  ord_face = (int*)malloc(n*sizeof(int));
+  ring->ord_vert = ord_vert;
+  ring->ord_face = ord_face;
+  fan.et = NULL;
+  fan.faces = faces;
+  fan.n = n;
+  walk_ring(raw_model, &fan, v, faces[0], ring);
+  if (ring->type == 2) { /* walk_ring() drops the storage */
+    printf("Vertex %d is non-manifold\n", v);
+    free(ord_vert);
+    free(ord_face);
   }
-
-  if (final_star[0] == final_star[star_size-1]) {    /* Regular vertex */
-    star_size--;
-    ring->type = 0;
-  } else     /* Boundary vertex */
-    ring->type = 1;
-
-
-  ring->size = star_size;
-  ring->ord_vert = (int*)malloc(star_size*sizeof(int));
-  memcpy(ring->ord_vert, final_star, star_size*sizeof(int));
-  ring->n_faces = n_faces;
-  ring->ord_face = (int*)malloc(n_faces*sizeof(int));
-  memcpy(ring->ord_face, face_star, n_faces*sizeof(int));
-
-#ifdef RING_DEBUG
-  DEUBG_PRINT("Vertex %d : star_size=%d num_edges=%d n_faces=%d\n", v, 
-              star_size, num_edges, n_faces);
-  for (i=0; i<star_size; i++)
-    printf("vertex %d \n", final_star[i]);
-  for (i=0; i<n_faces; i++)
-    printf("face %d\n", face_star[i]);
-#endif
-
-  free(edge_list_primal);
-  free(final_star);
-  free(face_star);
-  free(done);
-
+  free(faces);
 }
-
@@ -0,0 +1,566 @@
+/* $Id$ */
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+/* Laplacian smoothing, see smoothing.h. The edges of the edge table are
+ * numbered by increasing smallest vertex and then by increasing largest
+ * vertex, so filling the rows in edge order gives the columns of each row
+ * already sorted. The weights are computed in parallel over the edges and
+ * the rows are then applied in parallel, in blocks of LS_BLOCK
+ * vertices. The dot products of the conjugate gradient are summed per
+ * block and then over the blocks in order, so that the result does not
+ * depend on the number of threads. */
+
+#include <smoothing.h>
+#include <thread_pool.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* Number of edges or vertices processed in each parallel chunk */
+#define LS_BLOCK 1024
+
+/* Shared data for the construction of the matrix */
+struct ls_build_data {
+  const struct model *m;
+  const struct edge_table *et;
+  struct lapl_matrix *lm;
+  double *edge_w; /* weight of each edge */
+};
+
+/* Shared data for the smoothing steps */
+struct ls_data {
+  const struct lapl_matrix *lm;
+  struct model *m;
+  double *x[3];     /* the coordinates */
+  double *y[3];     /* the new coordinates (explicit steps) or the
+                     * residual (conjugate gradient) */
+  double *p[3];     /* the search direction */
+  double *q[3];     /* the matrix times the search direction */
+  double *part;     /* 6 partial sums per block */
+  double lambda;    /* the smoothing factor */
+  double alpha[3];  /* conjugate gradient step */
+  double beta[3];   /* conjugate gradient direction update */
+  int done[3];      /* non-zero for the converged coordinates */
+};
+
+/* The cotangent of the angle opposite to half-edge h in its face */
+static double ls_he_cot(const struct model *m, int h)
+{
+  const vertex_t *a,*b,*o;
+  double u[3],v[3],c[3],n;
+
+  a = &m->vertices[ET_HE_ORG(m->faces,h)];
+  b = &m->vertices[ET_HE_DST(m->faces,h)];
+  o = &m->vertices[ET_HE_DST(m->faces,ET_HE_NEXT(h))];
+  u[0] = (double)a->x-o->x;
+  u[1] = (double)a->y-o->y;
+  u[2] = (double)a->z-o->z;
+  v[0] = (double)b->x-o->x;
+  v[1] = (double)b->y-o->y;
+  v[2] = (double)b->z-o->z;
+  c[0] = u[1]*v[2]-u[2]*v[1];
+  c[1] = u[2]*v[0]-u[0]*v[2];
+  c[2] = u[0]*v[1]-u[1]*v[0];
+  n = sqrt(c[0]*c[0]+c[1]*c[1]+c[2]*c[2]);
+  if (n == 0) return 0; /* zero area face, no contribution */
+  return (u[0]*v[0]+u[1]*v[1]+u[2]*v[2])/n;
+}
+
+/* Computes the cotangent weights of edges start to end-1 */
+static void ls_cot_work(void *data, int start, int end, int tid)
+{
+  struct ls_build_data *d;
+  int e,h,h0;
+  double s;
+
+  (void)tid;
+  d = (struct ls_build_data*)data;
+  for (e=start; e<end; e++) {
+    h = h0 = d->et->edge_he[e];
+    s = 0;
+    do {
+      s += ls_he_cot(d->m,h);
+      h = d->et->he_radial[h];
+    } while (h != h0);
+    /* clamped, so that the Laplacian stays positive semi-definite */
+    d->edge_w[e] = (s > 0) ? 0.5*s : 0;
+  }
+}
+
+/* Sums the weights of rows start to end-1 */
+static void ls_diag_work(void *data, int start, int end, int tid)
+{
+  struct lapl_matrix *lm;
+  int i,k;
+  double s;
+
+  (void)tid;
+  lm = ((struct ls_build_data*)data)->lm;
+  for (i=start; i<end; i++) {
+    for (s=0, k=lm->row_start[i]; k<lm->row_start[i+1]; k++) s += lm->w[k];
+    lm->diag[i] = s;
+  }
+}
+
+/* See smoothing.h */
+void free_lapl_matrix(struct lapl_matrix *lm)
+{
+  if (lm == NULL) return;
+  free(lm->row_start);
+  free(lm->col);
+  free(lm->w);
+  free(lm->diag);
+  free(lm);
+}
+
+/* See smoothing.h */
+struct lapl_matrix *build_lapl_matrix(const struct model *m,
+                                      const struct edge_table *et,
+                                      int type, int n_threads)
+{
+  struct ls_build_data d;
+  struct lapl_matrix *lm;
+  int *pos;
+  int e,i,a,b,h;
+
+  lm = (struct lapl_matrix*)calloc(1,sizeof(*lm));
+  if (lm == NULL) return NULL;
+  lm->n_rows = m->num_vert;
+  lm->row_start = (int*)calloc(m->num_vert+1,sizeof(int));
+  lm->col = (int*)malloc((2*et->n_edges+1)*sizeof(int));
+  lm->w = (double*)malloc((2*et->n_edges+1)*sizeof(double));
+  lm->diag = (double*)malloc((m->num_vert+1)*sizeof(double));
+  d.edge_w = (double*)malloc((et->n_edges+1)*sizeof(double));
+  pos = (int*)malloc((m->num_vert+1)*sizeof(int));
+  if (lm->row_start == NULL || lm->col == NULL || lm->w == NULL ||
+      lm->diag == NULL || d.edge_w == NULL || pos == NULL) {
+    free(d.edge_w);
+    free(pos);
+    free_lapl_matrix(lm);
+    return NULL;
+  }
+  d.m = m;
+  d.et = et;
+  d.lm = lm;
+
+  if (type == LAPL_COTANGENT) {
+    tp_par_for(n_threads,et->n_edges,LS_BLOCK,ls_cot_work,&d);
+  } else {
+    for (e=0; e<et->n_edges; e++) d.edge_w[e] = 1;
+  }
+
+  /* Row sizes, then fill in edge order (i.e. with sorted columns) */
+  for (e=0; e<et->n_edges; e++) {
+    h = et->edge_he[e];
+    lm->row_start[ET_HE_ORG(m->faces,h)+1]++;
+    lm->row_start[ET_HE_DST(m->faces,h)+1]++;
+  }
+  for (i=0; i<m->num_vert; i++) {
+    lm->row_start[i+1] += lm->row_start[i];
+    pos[i] = lm->row_start[i];
+  }
+  for (e=0; e<et->n_edges; e++) {
+    h = et->edge_he[e];
+    a = ET_HE_ORG(m->faces,h);
+    b = ET_HE_DST(m->faces,h);
+    lm->col[pos[a]] = b;
+    lm->w[pos[a]++] = d.edge_w[e];
+    lm->col[pos[b]] = a;
+    lm->w[pos[b]++] = d.edge_w[e];
+  }
+  free(pos);
+  free(d.edge_w);
+
+  tp_par_for(n_threads,m->num_vert,LS_BLOCK,ls_diag_work,&d);
+  return lm;
+}
+
+/* Copies the vertices start to end-1 of the model to the coordinate
+ * arrays */
+static void ls_load_work(void *data, int start, int end, int tid)
+{
+  struct ls_data *d;
+  const vertex_t *v;
+  int i;
+
+  (void)tid;
+  d = (struct ls_data*)data;
+  for (i=start; i<end; i++) {
+    v = &d->m->vertices[i];
+    d->x[0][i] = v->x;
+    d->x[1][i] = v->y;
+    d->x[2][i] = v->z;
+  }
+}
+
+/* Copies the coordinates of vertices start to end-1 back to the model */
+static void ls_store_work(void *data, int start, int end, int tid)
+{
+  struct ls_data *d;
+  vertex_t *v;
+  int i;
+
+  (void)tid;
+  d = (struct ls_data*)data;
+  for (i=start; i<end; i++) {
+    v = &d->m->vertices[i];
+    v->x = (float)d->x[0][i];
+    v->y = (float)d->x[1][i];
+    v->z = (float)d->x[2][i];
+  }
+}
+
+/* Explicit step on vertices start to end-1, from x to y */
+static void ls_explicit_work(void *data, int start, int end, int tid)
+{
+  struct ls_data *d;
+  const struct lapl_matrix *lm;
+  const double *x0,*x1,*x2;
+  int i,j,k;
+  double s0,s1,s2,l;
+
+  (void)tid;
+  d = (struct ls_data*)data;
+  lm = d->lm;
+  x0 = d->x[0];
+  x1 = d->x[1];
+  x2 = d->x[2];
+  for (i=start; i<end; i++) {
+    if (lm->diag[i] <= 0) {
+      d->y[0][i] = x0[i];
+      d->y[1][i] = x1[i];
+      d->y[2][i] = x2[i];
+      continue;
+    }
+    s0 = s1 = s2 = 0;
+    for (k=lm->row_start[i]; k<lm->row_start[i+1]; k++) {
+      j = lm->col[k];
+      s0 += lm->w[k]*x0[j];
+      s1 += lm->w[k]*x1[j];
+      s2 += lm->w[k]*x2[j];
+    }
+    l = d->lambda/lm->diag[i];
+    d->y[0][i] = x0[i]+(l*s0-d->lambda*x0[i]);
+    d->y[1][i] = x1[i]+(l*s1-d->lambda*x1[i]);
+    d->y[2][i] = x2[i]+(l*s2-d->lambda*x2[i]);
+  }
+}
+
+/* Allocates the n_arr first coordinate arrays of d (x, y, p and q, in
+ * that order) and the partial sums. Returns non-zero if out of memory, in
+ * which case everything is freed. */
+static int ls_alloc(struct ls_data *d, int n_arr)
+{
+  double **arr[4];
+  int a,c,n,n_blk,err;
+
+  arr[0] = d->x;
+  arr[1] = d->y;
+  arr[2] = d->p;
+  arr[3] = d->q;
+  n = d->lm->n_rows+1;
+  n_blk = (d->lm->n_rows+LS_BLOCK-1)/LS_BLOCK+1;
+  d->part = (double*)malloc(6*n_blk*sizeof(double));
+  err = (d->part == NULL);
+  for (a=0; a<4; a++) {
+    for (c=0; c<3; c++) {
+      arr[a][c] = NULL;
+      if (a < n_arr && !err) {
+        arr[a][c] = (double*)malloc(n*sizeof(double));
+        err = (arr[a][c] == NULL);
+      }
+    }
+  }
+  if (err) {
+    for (a=0; a<4; a++) {
+      for (c=0; c<3; c++) free(arr[a][c]);
+    }
+    free(d->part);
+  }
+  return err;
+}
+
+/* Frees the arrays of d */
+static void ls_free(struct ls_data *d)
+{
+  int c;
+
+  for (c=0; c<3; c++) {
+    free(d->x[c]);
+    free(d->y[c]);
+    free(d->p[c]);
+    free(d->q[c]);
+  }
+  free(d->part);
+}
+
+/* Applies one explicit step with factor lambda, swapping x and y */
+static void ls_explicit_step(struct ls_data *d, double lambda,
+                             int n_threads)
+{
+  double *tmp;
+  int c;
+
+  d->lambda = lambda;
+  tp_par_for(n_threads,d->lm->n_rows,LS_BLOCK,ls_explicit_work,d);
+  for (c=0; c<3; c++) {
+    tmp = d->x[c];
+    d->x[c] = d->y[c];
+    d->y[c] = tmp;
+  }
+}
+
+/* See smoothing.h */
+int lapl_smooth(const struct lapl_matrix *lm, struct model *m, int n_iter,
+                double lambda, double mu, int n_threads)
+{
+  struct ls_data d;
+  int it;
+
+  d.lm = lm;
+  d.m = m;
+  if (ls_alloc(&d,2)) return -1;
+  tp_par_for(n_threads,m->num_vert,LS_BLOCK,ls_load_work,&d);
+  for (it=0; it<n_iter; it++) {
+    ls_explicit_step(&d,lambda,n_threads);
+    if (mu != 0) ls_explicit_step(&d,mu,n_threads);
+  }
+  tp_par_for(n_threads,m->num_vert,LS_BLOCK,ls_store_work,&d);
+  ls_free(&d);
+  return 0;
+}
+
+/* The diagonal of the implicit system for row i, 1 for the rows of fixed
+ * vertices */
+#define LS_DIAG(lm,l,i) (((lm)->diag[i] > 0) ? (1+(l))*(lm)->diag[i] : 1.0)
+
+/* Computes the initial residual y (the initial guess being the current
+ * coordinates x) and search direction p of rows start to end-1. The
+ * squared norms of the right hand side and the residual dot products are
+ * summed per block in part. */
+static void ls_cg_init_work(void *data, int start, int end, int tid)
+{
+  struct ls_data *d;
+  const struct lapl_matrix *lm;
+  double s,b,r,a,bb[3],rz[3];
+  int blk,i,k,c,i_end;
+
+  (void)tid;
+  d = (struct ls_data*)data;
+  lm = d->lm;
+  for (blk=start; blk<end; blk+=LS_BLOCK) {
+    i_end = (blk+LS_BLOCK < end) ? blk+LS_BLOCK : end;
+    for (c=0; c<3; c++) bb[c] = rz[c] = 0;
+    for (i=blk; i<i_end; i++) {
+      a = LS_DIAG(lm,d->lambda,i);
+      for (c=0; c<3; c++) {
+        if (lm->diag[i] > 0) {
+          for (s=0, k=lm->row_start[i]; k<lm->row_start[i+1]; k++) {
+            s += lm->w[k]*d->x[c][lm->col[k]];
+          }
+          b = lm->diag[i]*d->x[c][i];
+          r = d->lambda*(s-b); /* b-(a*x-lambda*s) */
+        } else {
+          b = d->x[c][i];
+          r = 0;
+        }
+        d->y[c][i] = r;
+        d->p[c][i] = r/a;
+        bb[c] += b*b;
+        rz[c] += r*r/a;
+      }
+    }
+    for (c=0; c<3; c++) {
+      d->part[6*(blk/LS_BLOCK)+c] = bb[c];
+      d->part[6*(blk/LS_BLOCK)+3+c] = rz[c];
+    }
+  }
+}
+
+/* Computes q = A*p for rows start to end-1 and sums p.q per block */
+static void ls_cg_mul_work(void *data, int start, int end, int tid)
+{
+  struct ls_data *d;
+  const struct lapl_matrix *lm;
+  double s,v,pq[3];
+  int blk,i,k,c,i_end;
+
+  (void)tid;
+  d = (struct ls_data*)data;
+  lm = d->lm;
+  for (blk=start; blk<end; blk+=LS_BLOCK) {
+    i_end = (blk+LS_BLOCK < end) ? blk+LS_BLOCK : end;
+    for (c=0; c<3; c++) {
+      pq[c] = 0;
+      if (d->done[c]) continue;
+      for (i=blk; i<i_end; i++) {
+        v = LS_DIAG(lm,d->lambda,i)*d->p[c][i];
+        if (lm->diag[i] > 0) {
+          for (s=0, k=lm->row_start[i]; k<lm->row_start[i+1]; k++) {
+            s += lm->w[k]*d->p[c][lm->col[k]];
+          }
+          v -= d->lambda*s;
+        }
+        d->q[c][i] = v;
+        pq[c] += d->p[c][i]*v;
+      }
+    }
+    for (c=0; c<3; c++) d->part[6*(blk/LS_BLOCK)+c] = pq[c];
+  }
+}
+
+/* Updates the coordinates and residual of rows start to end-1 and sums
+ * the new residual dot products per block */
+static void ls_cg_update_work(void *data, int start, int end, int tid)
+{
+  struct ls_data *d;
+  double r,a,rr[3],rz[3];
+  int blk,i,c,i_end;
+
+  (void)tid;
+  d = (struct ls_data*)data;
+  for (blk=start; blk<end; blk+=LS_BLOCK) {
+    i_end = (blk+LS_BLOCK < end) ? blk+LS_BLOCK : end;
+    for (c=0; c<3; c++) {
+      rr[c] = rz[c] = 0;
+      if (d->done[c]) continue;
+      for (i=blk; i<i_end; i++) {
+        d->x[c][i] += d->alpha[c]*d->p[c][i];
+        r = d->y[c][i]-d->alpha[c]*d->q[c][i];
+        d->y[c][i] = r;
+        a = LS_DIAG(d->lm,d->lambda,i);
+        rr[c] += r*r;
+        rz[c] += r*r/a;
+      }
+    }
+    for (c=0; c<3; c++) {
+      d->part[6*(blk/LS_BLOCK)+c] = rr[c];
+      d->part[6*(blk/LS_BLOCK)+3+c] = rz[c];
+    }
+  }
+}
+
+/* Updates the search direction of rows start to end-1 */
+static void ls_cg_dir_work(void *data, int start, int end, int tid)
+{
+  struct ls_data *d;
+  int i,c;
+
+  (void)tid;
+  d = (struct ls_data*)data;
+  for (c=0; c<3; c++) {
+    if (d->done[c]) continue;
+    for (i=start; i<end; i++) {
+      d->p[c][i] = d->y[c][i]/LS_DIAG(d->lm,d->lambda,i)+
+        d->beta[c]*d->p[c][i];
+    }
+  }
+}
+
+/* Sums the partial sums of all blocks into s (6 values) */
+static void ls_sum_parts(const struct ls_data *d, double *s)
+{
+  int b,c,n_blk;
+
+  n_blk = (d->lm->n_rows+LS_BLOCK-1)/LS_BLOCK;
+  for (c=0; c<6; c++) s[c] = 0;
+  for (b=0; b<n_blk; b++) {
+    for (c=0; c<6; c++) s[c] += d->part[6*b+c];
+  }
+}
+
+/* See smoothing.h */
+int lapl_smooth_implicit(const struct lapl_matrix *lm, struct model *m,
+                         double lambda, int max_iter, double tol,
+                         int n_threads)
+{
+  struct ls_data d;
+  double s[6],bb[3],rz[3];
+  int it,c,n_done,failed=0;
+
+  d.lm = lm;
+  d.m = m;
+  d.lambda = lambda;
+  if (ls_alloc(&d,4)) return -1;
+  tp_par_for(n_threads,m->num_vert,LS_BLOCK,ls_load_work,&d);
+  tp_par_for(n_threads,m->num_vert,LS_BLOCK,ls_cg_init_work,&d);
+  ls_sum_parts(&d,s);
+  for (n_done=0, c=0; c<3; c++) {
+    bb[c] = s[c]*tol*tol;
+    rz[c] = s[3+c];
+    d.done[c] = (rz[c] <= 0);
+    n_done += d.done[c];
+  }
+
+  for (it=0; it<max_iter && n_done<3; it++) {
+    tp_par_for(n_threads,m->num_vert,LS_BLOCK,ls_cg_mul_work,&d);
+    ls_sum_parts(&d,s);
+    for (c=0; c<3; c++) {
+      if (d.done[c]) continue;
+      if (s[c] <= 0) { /* the matrix is not positive definite */
+        d.done[c] = 1;
+        n_done++;
+        failed = 1;
+        continue;
+      }
+      d.alpha[c] = rz[c]/s[c];
+    }
+    tp_par_for(n_threads,m->num_vert,LS_BLOCK,ls_cg_update_work,&d);
+    ls_sum_parts(&d,s);
+    for (c=0; c<3; c++) {
+      if (d.done[c]) continue;
+      if (s[c] <= bb[c] || s[3+c] <= 0) {
+        d.done[c] = 1;
+        n_done++;
+        continue;
+      }
+      d.beta[c] = s[3+c]/rz[c];
+      rz[c] = s[3+c];
+    }
+    if (n_done < 3) {
+      tp_par_for(n_threads,m->num_vert,LS_BLOCK,ls_cg_dir_work,&d);
+    }
+  }
+  if (n_done < 3) failed = 1;
+  tp_par_for(n_threads,m->num_vert,LS_BLOCK,ls_store_work,&d);
+  ls_free(&d);
+  return failed ? -2 : it;
+}
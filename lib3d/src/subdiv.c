@@ -2,8 +2,8 @@
 #include <3dutils.h>
 #include <subdiv_methods.h>
 #include <subdiv.h>
-#include <block_list.h>
-#include <assert.h>
+#include <edge_table.h>
+#include <thread_pool.h>
 #if defined(SUBDIV_DEBUG) || defined(DEBUG)
 # include <debug_print.h>
 #endif
@@ -11,230 +11,676 @@
 # include <time.h>
 #endif
 
-/* This is the function that performs the subdivision.
-   The argument 'midpoint_func' is the pointer to the 
-   function that performs the computation of the midpoint.
-   The 'update_func' stands for the function that updates 
-   the postion of 'old' vertices. This is only used for 
-   non-interpolating subd. (i.e. Loop). For interpolating subd. 
-   you just pass NULL as argument */
-struct model* subdiv(struct model *raw_model, 
-                     const struct subdiv_functions* sf) 
+/* Number of faces, edges or vertices processed in each parallel chunk */
+#define SUBDIV_BLOCK 1024
+/* Number of face blocks of the last level written at once by
+ * subdiv_levels_write() */
+#define SUBDIV_WINDOW 64
+
+/* The data shared by the parallel passes of a level of subdivision */
+struct subdiv_data {
+  const struct model *raw_model;
+  const struct subdiv_functions *sf;
+  const struct ring_info *rings;
+  const struct edge_table *et;
+  int *edge_slot;    /* for each edge, the position of its second vertex in
+                      * the ring of its first one (-1 if not in a ring) */
+  int *edge_vidx;    /* for each edge, the index of its midpoint vertex */
+  int *blk_edges;    /* for each face block, the number of edges first seen
+                      * in the block, then the index of the first midpoint */
+  int *blk_faces;    /* for each face block, the number of non-degenerate
+                      * faces, then the index of the first new face */
+  int *face_child;   /* for each face, the index of its first new face (-1
+                      * if degenerate) */
+  int n_new_vert;    /* number of vertices of the subdivided model */
+  int n_new_faces;   /* number of faces of the subdivided model */
+  int face_off;      /* the first face of the current pass, a multiple of
+                      * SUBDIV_BLOCK */
+  vertex_t *mid_out; /* where the midpoints are written ... */
+  int mid_base;      /* ... minus the index of the first one */
+  face_t *face_out;  /* where the new faces are written ... */
+  int face_base;     /* ... minus the index of the first one */
+  const struct model *sub_model;   /* the subdivided model */
+  struct edge_table *sub_et;       /* the derived edge table */
+  struct ring_info *sub_rings;     /* the derived rings */
+};
+
+/* For a half-edge 3*k+i going from f_i to f_i+1, the offsets (from the first
+ * half-edge of the new faces of k) of the new half-edges on the same edge,
+ * the one starting or ending at f_i and the one starting or ending at
+ * f_i+1, and of the first half-edge starting at the midpoint */
+static const int he_child_org[3] = {0, 5, 8};
+static const int he_child_dst[3] = {3, 6, 2};
+static const int he_child_mid[3] = {1, 5, 2};
+
+/* Finds the position of each edge in the ring of its first vertex (the
+ * origin of its first half-edge), for the vertices start to end-1 */
+static void edge_slot_work(void *data, int start, int end, int tid)
 {
+  struct subdiv_data *d = (struct subdiv_data*)data;
+  const struct ring_info *ring;
+  const face_t *faces = d->raw_model->faces;
+  const struct edge_table *et = d->et;
+  int v, j, k, f, h, e;
+  int fv[3];
+
+  (void)tid;
+  for (v=start; v<end; v++) {
+    ring = &(d->rings[v]);
+    if (ring->type != 0 && ring->type != 1)
+      continue;
+    for (j=0; j<ring->size; j++) {
+      /* face j lies between ord_vert[j] and ord_vert[j+1], the last vertex
+       * of an open ring only has the face before it */
+      f = ring->ord_face[(j < ring->n_faces) ? j : j-1];
+      fv[0] = faces[f].f0;
+      fv[1] = faces[f].f1;
+      fv[2] = faces[f].f2;
+      k = (fv[0] == v) ? 0 : ((fv[1] == v) ? 1 : 2);
+      /* the half-edge from v to ord_vert[j], or the one coming back */
+      h = (fv[(k+1)%3] == ring->ord_vert[j]) ? 3*f+k : 3*f+(k+2)%3;
+      e = et->he_edge[h];
+      if (ET_HE_ORG(faces, et->edge_he[e]) == v)
+        d->edge_slot[e] = j;
+    }
+  }
+}
 
-  struct model *subdiv_model;
-  int i, i0, i1, i2;
-  int v0, v1, v2;
-  int u0, u1, u2;
-  struct ring_info *rings;
-  vertex_t p;
-  int nedges = 0;
-  int face_idx = 0;
-  struct midpoint_info *mp_info;
-  int v_idx=raw_model->num_vert;
-  face_t *temp_face;
-  struct block_list *tmp_v=NULL, *cur;
-#ifdef SUBDIV_DEBUG
-  int vert_idx = raw_model->num_vert;
-#endif
-#ifdef SUBDIV_TIME
-  clock_t start;
-#endif
+/* Counts the edges first seen (i.e. whose first half-edge is) in each block
+ * of faces, and the non-degenerate faces */
+static void face_count_work(void *data, int start, int end, int tid)
+{
+  struct subdiv_data *d = (struct subdiv_data*)data;
+  const struct edge_table *et = d->et;
+  int k, h, b;
 
-  rings = (struct ring_info*)
-    malloc(raw_model->num_vert*sizeof(struct ring_info));
+  (void)tid;
+  for (k=start; k<end; k++) {
+    if (et->he_edge[3*k] < 0) /* degenerate */
+      continue;
+    b = k/SUBDIV_BLOCK;
+    d->blk_faces[b]++;
+    for (h=3*k; h<3*k+3; h++) {
+      if (et->edge_he[et->he_edge[h]] == h)
+        d->blk_edges[b]++;
+    }
+  }
+}
 
-  build_star_global(raw_model, rings);
+/* Numbers the midpoints in the order in which the edges are first seen in
+ * the faces, and the new faces */
+static void edge_index_work(void *data, int start, int end, int tid)
+{
+  struct subdiv_data *d = (struct subdiv_data*)data;
+  const struct edge_table *et = d->et;
+  int k, h, idx, c;
+
+  (void)tid;
+  idx = 0;
+  c = 0;
+  for (k=start; k<end; k++) {
+    if (k == start || k%SUBDIV_BLOCK == 0) {
+      idx = d->blk_edges[k/SUBDIV_BLOCK];
+      c = d->blk_faces[k/SUBDIV_BLOCK];
+    }
+    if (et->he_edge[3*k] < 0) { /* degenerate */
+      d->face_child[k] = -1;
+      continue;
+    }
+    d->face_child[k] = c;
+    c += 4;
+    for (h=3*k; h<3*k+3; h++) {
+      if (et->edge_he[et->he_edge[h]] == h)
+        d->edge_vidx[et->he_edge[h]] = idx++;
+    }
+  }
+}
 
-  /* Spherical subdivision needs to have normals computed */
-  if (raw_model->normals == NULL && 
-      (sf->id == SUBDIV_SPH_OR || sf->id == SUBDIV_SPH_ALT)) {
-      raw_model->area = (float*)malloc(raw_model->num_faces*sizeof(float));
-      raw_model->face_normals = compute_face_normals(raw_model, rings);
-      compute_vertex_normal(raw_model, rings, raw_model->face_normals);
+/* Computes the midpoints of the edges first seen in the faces face_off+start
+ * to face_off+end-1 */
+static void edge_midpoint_work(void *data, int start, int end, int tid)
+{
+  struct subdiv_data *d = (struct subdiv_data*)data;
+  const struct ring_info *rings = d->rings;
+  const struct edge_table *et = d->et;
+  const face_t *faces = d->raw_model->faces;
+  const vertex_t *vtcs = d->raw_model->vertices;
+  int k, h, e, v0, v1;
+  vertex_t *p;
+
+  (void)tid;
+  for (k=d->face_off+start; k<d->face_off+end; k++) {
+    for (h=3*k; h<3*k+3; h++) {
+      e = et->he_edge[h];
+      if (e < 0 || et->edge_he[e] != h)
+        continue;
+      v0 = ET_HE_ORG(faces, h);
+      v1 = ET_HE_DST(faces, h);
+      p = &(d->mid_out[d->edge_vidx[e]-d->mid_base]);
+      if (d->edge_slot[e] < 0 || 
+          (rings[v1].type != 0 && rings[v1].type != 1)) {
+        /* non-manifold, there is no ring to apply the scheme */
+        __prod_v(0.5, vtcs[v0], *p);
+        __add_prod_v(0.5, vtcs[v1], *p, *p);
+      } else if (rings[v0].type == 1 || rings[v1].type == 1) {
+        d->sf->midpoint_func_bound(rings, v0, d->edge_slot[e], d->raw_model,
+                                   d->sf->sph_h_func, p);
+      } else {
+        d->sf->midpoint_func(rings, v0, d->edge_slot[e], d->raw_model,
+                             d->sf->sph_h_func, p);
+      }
+    }
   }
-  
-  mp_info = (struct midpoint_info*)
-    malloc(raw_model->num_vert*sizeof(struct midpoint_info));
+}
 
-  temp_face = (face_t*)malloc(4*raw_model->num_faces*sizeof(face_t));
+/* Splits the faces face_off+start to face_off+end-1 in four */
+static void face_split_work(void *data, int start, int end, int tid)
+{
+  struct subdiv_data *d = (struct subdiv_data*)data;
+  const struct edge_table *et = d->et;
+  const face_t *faces = d->raw_model->faces;
+  face_t *out;
+  int k, m0, m1, m2;
+
+  (void)tid;
+  for (k=d->face_off+start; k<d->face_off+end; k++) {
+    if (d->face_child[k] < 0) /* degenerate */
+      continue;
+    out = &(d->face_out[d->face_child[k]-d->face_base]);
+    m0 = d->edge_vidx[et->he_edge[3*k]];   /* edge f0 f1 */
+    m1 = d->edge_vidx[et->he_edge[3*k+1]]; /* edge f1 f2 */
+    m2 = d->edge_vidx[et->he_edge[3*k+2]]; /* edge f2 f0 */
+
+    out->f0 = faces[k].f0;
+    out->f1 = m0;
+    (out++)->f2 = m2;
+
+    out->f0 = faces[k].f1;
+    out->f1 = m0;
+    (out++)->f2 = m1;
+
+    out->f0 = faces[k].f2;
+    out->f1 = m1;
+    (out++)->f2 = m2;
+
+    out->f0 = m0;
+    out->f1 = m1;
+    (out++)->f2 = m2;
+  }
+}
 
-  tmp_v = (struct block_list*)malloc(sizeof(struct block_list));
-  if (init_block_list(tmp_v, sizeof(vertex_t)) != 0)
-    abort();
-  cur = tmp_v;
+/* Returns the new half-edge, child of the half-edge h of the model, lying
+ * on the half of its edge that ends at vertex v */
+static int he_child(const struct subdiv_data *d, int h, int v)
+{
+  int b = 3*d->face_child[h/3];
 
-  for (i=0; i< raw_model->num_vert; i++) {
+  return (ET_HE_ORG(d->raw_model->faces, h) == v) ? 
+    b + he_child_org[h%3] : b + he_child_dst[h%3];
+}
 
-    /* This _should_ be kinda OK to ignore this vertex */
-    if (rings[i].type != 0 && rings[i].type != 1) 
+/* Derives the half-edges of the subdivided model from the faces start to
+ * end-1. The edge e of the model gives the edges 2*e (the half at the
+ * origin of its first half-edge) and 2*e+1, and each face k gives three
+ * inner edges, starting at 2*n_edges+3*face_child[k]/4. */
+static void et_face_work(void *data, int start, int end, int tid)
+{
+  struct subdiv_data *d = (struct subdiv_data*)data;
+  const struct edge_table *et = d->et;
+  const face_t *faces = d->raw_model->faces;
+  struct edge_table *sub_et = d->sub_et;
+  int k, i, h, r, e, a, b, ca, cb, ie;
+
+  (void)tid;
+  for (k=start; k<end; k++) {
+    if (d->face_child[k] < 0) /* degenerate */
       continue;
-    
-    mp_info[i].edge_subdiv_done = BITMAP_ALLOC(rings[i].size);
-    mp_info[i].size = rings[i].size;
-    mp_info[i].midpoint_idx = (int*)malloc(mp_info[i].size*sizeof(int));
-   
-      
-#ifdef SUBDIV_DEBUG
-    DEBUG_PRINT("Vertex %d : star_size = %d\n", i, rings[i].size);
-    for (j=0; j<rings[i].size; j++)
-      printf("number %d : %d\n", j, rings[i].ord_vert[j]);
-#endif
-  }
-
-#ifdef SUBDIV_TIME
-  start = clock();
-#endif
-  for (i=0; i<raw_model->num_faces; i++) {
-    v0 = raw_model->faces[i].f0;
-    v1 = raw_model->faces[i].f1;
-    v2 = raw_model->faces[i].f2;
-
-    i0 = 0;
-    while (rings[v0].ord_vert[i0] != v1)
-      i0++;
-    u0 = 0;
-    while (rings[v1].ord_vert[u0] != v0)
-      u0++;
-
-    i1 = 0;
-    while (rings[v1].ord_vert[i1] != v2)
-      i1++;
-    u1 = 0;
-    while (rings[v2].ord_vert[u1] != v1)
-      u1++;
-
-    i2 = 0;
-    while (rings[v2].ord_vert[i2] != v0)
-      i2++;
-    u2 = 0;
-    while (rings[v0].ord_vert[u2] != v2)
-      u2++;
-
-    /* edge v0v1 */
-    if (!BITMAP_TEST_BIT(mp_info[v0].edge_subdiv_done, i0)) {
-      if (rings[v0].type == 1 || rings[v1].type == 1) 
-        sf->midpoint_func_bound(rings, v0, i0, raw_model, sf->sph_h_func,  &p);
-      else
-        sf->midpoint_func(rings, v0, i0, raw_model, sf->sph_h_func, &p);
-      nedges++;
-      BITMAP_SET_BIT(mp_info[v0].edge_subdiv_done, i0);
-      BITMAP_SET_BIT(mp_info[v1].edge_subdiv_done, u0);
-      if (cur->elem_filled == cur->nelem)
-        cur = get_next_block(cur);
-      assert(cur != NULL);
-      BLOCK_LIST_TAIL_INCR(cur, vertex_t) = p;
-
-
-      mp_info[v0].midpoint_idx[i0] = v_idx;
-      mp_info[v1].midpoint_idx[u0] = v_idx++;
-
-      
+    for (i=0; i<3; i++) {
+      h = 3*k+i;
+      e = et->he_edge[h];
+      a = ET_HE_ORG(faces, et->edge_he[e]);
+      b = (ET_HE_ORG(faces, h) == a) ? ET_HE_DST(faces, h) : 
+        ET_HE_ORG(faces, h);
+      ca = he_child(d, h, a);
+      cb = he_child(d, h, b);
+      r = et->he_radial[h];
+      sub_et->he_edge[ca] = 2*e;
+      sub_et->he_edge[cb] = 2*e+1;
+      sub_et->he_radial[ca] = he_child(d, r, a);
+      sub_et->he_radial[cb] = he_child(d, r, b);
     }
-
-    /* edge v1v2 */
-    if (!BITMAP_TEST_BIT(mp_info[v1].edge_subdiv_done, i1)) {
-      if (rings[v1].type == 1 || rings[v2].type == 1)
-        sf->midpoint_func_bound(rings, v1, i1, raw_model, sf->sph_h_func, &p);
-      else
-        sf->midpoint_func(rings, v1, i1, raw_model, sf->sph_h_func, &p);
-      nedges++;
-      BITMAP_SET_BIT(mp_info[v1].edge_subdiv_done, i1);
-      BITMAP_SET_BIT(mp_info[v2].edge_subdiv_done, u1);
-      if (cur->elem_filled == cur->nelem)
-        cur = get_next_block(cur);
-      assert(cur != NULL);
-      BLOCK_LIST_TAIL_INCR(cur, vertex_t) = p;
-
-      mp_info[v1].midpoint_idx[i1] = v_idx;
-      mp_info[v2].midpoint_idx[u1] = v_idx++;
+    /* the inner edges are shared by a corner face and the middle one */
+    h = 3*d->face_child[k];
+    ie = 2*et->n_edges + d->face_child[k]/4*3;
+    for (i=0; i<3; i++) {
+      a = h + 3*i + 1;
+      b = h + 9 + (i+2)%3;
+      sub_et->he_edge[a] = ie+i;
+      sub_et->he_edge[b] = ie+i;
+      sub_et->he_radial[a] = b;
+      sub_et->he_radial[b] = a;
+      sub_et->edge_he[ie+i] = a;
     }
+  }
+}
+
+/* Derives the first half-edges of the halves of the edges start to end-1,
+ * and the first half-edge and number of faces of their midpoints */
+static void et_edge_work(void *data, int start, int end, int tid)
+{
+  struct subdiv_data *d = (struct subdiv_data*)data;
+  const struct edge_table *et = d->et;
+  const face_t *faces = d->raw_model->faces;
+  struct edge_table *sub_et = d->sub_et;
+  int e, h, r, n, m;
+
+  (void)tid;
+  for (e=start; e<end; e++) {
+    h = et->edge_he[e];
+    sub_et->edge_he[2*e] = he_child(d, h, ET_HE_ORG(faces, h));
+    sub_et->edge_he[2*e+1] = he_child(d, h, ET_HE_DST(faces, h));
+    m = d->edge_vidx[e];
+    sub_et->vtx_he[m] = 3*d->face_child[h/3] + he_child_mid[h%3];
+    n = 0;
+    r = h;
+    do {
+      n++;
+      r = et->he_radial[r];
+    } while (r != h);
+    sub_et->vtx_n_faces[m] = 3*n;
+  }
+}
 
-    /* edge v2v0 */
-    if (!BITMAP_TEST_BIT(mp_info[v2].edge_subdiv_done, i2)) {
-      if (rings[v2].type == 1 || rings[v0].type == 1)
-        sf->midpoint_func_bound(rings, v2, i2, raw_model, sf->sph_h_func, &p);
-      else
-        sf->midpoint_func(rings, v2, i2, raw_model, sf->sph_h_func, &p);
-      nedges++;
-      BITMAP_SET_BIT(mp_info[v2].edge_subdiv_done, i2);
-      BITMAP_SET_BIT(mp_info[v0].edge_subdiv_done, u2);
-      if (cur->elem_filled == cur->nelem)
-        cur = get_next_block(cur);
-      assert(cur != NULL);
-      BLOCK_LIST_TAIL_INCR(cur, vertex_t) = p;
-
-      mp_info[v2].midpoint_idx[i2] = v_idx;
-      mp_info[v0].midpoint_idx[u2] = v_idx++;
+/* Derives the first half-edge and number of faces of the vertices start to
+ * end-1 */
+static void et_vtx_work(void *data, int start, int end, int tid)
+{
+  struct subdiv_data *d = (struct subdiv_data*)data;
+  const struct edge_table *et = d->et;
+  struct edge_table *sub_et = d->sub_et;
+  int v, h;
+
+  (void)tid;
+  for (v=start; v<end; v++) {
+    h = et->vtx_he[v];
+    /* the vertex is the first one of its new corner faces */
+    sub_et->vtx_he[v] = (h < 0) ? -1 : 3*(d->face_child[h/3] + h%3);
+    sub_et->vtx_n_faces[v] = et->vtx_n_faces[v];
+  }
+}
 
+/* Derives the rings of the vertices start to end-1 of the subdivided
+ * model. The ring of a vertex of the model has the midpoints of its edges
+ * and its new corner faces, in the same order as the one built by
+ * build_vertex_ring() on the subdivided model. That one starts from the
+ * new corner face of the first face and goes the other way round when the
+ * vertex is the third one of that face (the corner face of f2 is f2, m12,
+ * m20). The rings of the midpoints are built from the derived edge
+ * table. */
+static void ring_derive_work(void *data, int start, int end, int tid)
+{
+  struct subdiv_data *d = (struct subdiv_data*)data;
+  const struct ring_info *ring;
+  const face_t *faces = d->raw_model->faces;
+  struct ring_info *sub;
+  int v, j, n, f, k, h, flip, c, m;
+  int fv[3];
+
+  (void)tid;
+  for (v=start; v<end; v++) {
+    sub = &(d->sub_rings[v]);
+    if (v >= d->raw_model->num_vert) {
+      build_vertex_ring(d->sub_model, d->sub_et, v, sub);
+      continue;
     }
+    ring = &(d->rings[v]);
+    if (ring->type != 0 && ring->type != 1) {
+      sub->type = ring->type;
+      sub->ord_vert = NULL;
+      sub->ord_face = NULL;
+      continue;
+    }
+    n = ring->n_faces;
+    sub->type = ring->type;
+    sub->size = ring->size;
+    sub->n_faces = n;
+    flip = (d->et->vtx_he[v]%3 == 2);
+    for (j=0; j<ring->size; j++) {
+      f = ring->ord_face[(j < n) ? j : j-1];
+      fv[0] = faces[f].f0;
+      fv[1] = faces[f].f1;
+      fv[2] = faces[f].f2;
+      k = (fv[0] == v) ? 0 : ((fv[1] == v) ? 1 : 2);
+      h = (fv[(k+1)%3] == ring->ord_vert[j]) ? 3*f+k : 3*f+(k+2)%3;
+      m = d->edge_vidx[d->et->he_edge[h]];
+      c = d->face_child[f] + k;
+      if (!flip) {
+        sub->ord_vert[j] = m;
+        if (j < n)
+          sub->ord_face[j] = c;
+      } else if (ring->type == 0) {
+        sub->ord_vert[(n+1-j)%n] = m;
+        sub->ord_face[(n-j)%n] = c;
+      } else {
+        sub->ord_vert[ring->size-1-j] = m;
+        if (j < n)
+          sub->ord_face[n-1-j] = c;
+      }
+    }
+    if (ring->type == 0)
+      order_closed_ring(sub);
+  }
+}
 
-    /* We have all the edges of the current tr. that are subdivided */
-    temp_face[face_idx].f0 = v0;
-    temp_face[face_idx].f1 = mp_info[v0].midpoint_idx[i0];
-    temp_face[face_idx++].f2 = mp_info[v2].midpoint_idx[i2];
-    
-    temp_face[face_idx].f0 = v1;
-    temp_face[face_idx].f1 = mp_info[v0].midpoint_idx[i0];
-    temp_face[face_idx++].f2 = mp_info[v1].midpoint_idx[i1];
+/* Gets the positions of the edges in the rings and numbers the midpoints
+ * and the new faces of a level of subdivision of raw_model */
+static void subdiv_prepare(struct subdiv_data *d, struct model *raw_model,
+                           const struct subdiv_functions *sf,
+                           struct edge_table *et, struct ring_info *rings,
+                           int n_threads)
+{
+  int i, n_blocks, nedges, nfaces, c;
 
-    temp_face[face_idx].f0 = v2;
-    temp_face[face_idx].f1 = mp_info[v1].midpoint_idx[i1];
-    temp_face[face_idx++].f2 = mp_info[v2].midpoint_idx[i2];
+  memset(d, 0, sizeof(*d));
 
-    temp_face[face_idx].f0 = mp_info[v0].midpoint_idx[i0];
-    temp_face[face_idx].f1 = mp_info[v1].midpoint_idx[i1];
-    temp_face[face_idx++].f2 = mp_info[v2].midpoint_idx[i2];
+  /* Spherical subdivision needs to have normals computed */
+  if (raw_model->normals == NULL && 
+      (sf->id == SUBDIV_SPH_OR || sf->id == SUBDIV_SPH_ALT)) {
+      raw_model->area = (float*)malloc(raw_model->num_faces*sizeof(float));
+      raw_model->face_normals = compute_face_normals(raw_model, et);
+      compute_vertex_normal(raw_model, rings, raw_model->face_normals);
   }
- 
-  
 
+  n_blocks = (raw_model->num_faces+SUBDIV_BLOCK-1)/SUBDIV_BLOCK;
+  d->raw_model = raw_model;
+  d->sf = sf;
+  d->rings = rings;
+  d->et = et;
+  d->edge_slot = (int*)malloc((et->n_edges+1)*sizeof(int));
+  d->edge_vidx = (int*)malloc((et->n_edges+1)*sizeof(int));
+  d->face_child = (int*)malloc((raw_model->num_faces+1)*sizeof(int));
+  d->blk_edges = (int*)calloc(n_blocks+1, sizeof(int));
+  d->blk_faces = (int*)calloc(n_blocks+1, sizeof(int));
+  if (d->edge_slot == NULL || d->edge_vidx == NULL || 
+      d->face_child == NULL || d->blk_edges == NULL || d->blk_faces == NULL) {
+    fprintf(stderr, "Not enough memory to subdivide\n");
+    exit(1);
+  }
+  for (i=0; i<et->n_edges; i++)
+    d->edge_slot[i] = -1;
+
+  tp_par_for(n_threads, raw_model->num_vert, SUBDIV_BLOCK, edge_slot_work, d);
+  tp_par_for(n_threads, raw_model->num_faces, SUBDIV_BLOCK, face_count_work,
+             d);
+  nedges = raw_model->num_vert;
+  nfaces = 0;
+  for (i=0; i<n_blocks; i++) {
+    c = d->blk_edges[i];
+    d->blk_edges[i] = nedges;
+    nedges += c;
+    c = d->blk_faces[i];
+    d->blk_faces[i] = nfaces;
+    nfaces += 4*c;
+  }
+  d->blk_edges[n_blocks] = nedges;
+  d->blk_faces[n_blocks] = nfaces;
+  tp_par_for(n_threads, raw_model->num_faces, SUBDIV_BLOCK, edge_index_work,
+             d);
+  d->n_new_vert = nedges;
+  d->n_new_faces = nfaces;
+#ifdef SUBDIV_DEBUG
+  DEBUG_PRINT("%d new vertices computed \n", nedges-raw_model->num_vert);
+  DEBUG_PRINT("subdiv_model->num_vert = %d\n", nedges);
+#endif
+}
 
+/* Frees the data of subdiv_prepare() */
+static void subdiv_release(struct subdiv_data *d)
+{
+  free(d->edge_slot);
+  free(d->edge_vidx);
+  free(d->face_child);
+  free(d->blk_edges);
+  free(d->blk_faces);
+}
 
+/* Computes the positions of the vertices of the model in the subdivided
+ * model v */
+static void subdiv_old_vertices(const struct subdiv_data *d, vertex_t *v)
+{
+  struct model tmp;
+
+  /* the vertices without a ring stay where they are */
+  memcpy(v, d->raw_model->vertices, 
+         d->raw_model->num_vert*sizeof(vertex_t));
+  if (d->sf->update_func != NULL) { /* Approx. subdivision */
+    tmp = *(d->raw_model);
+    tmp.vertices = v;
+    d->sf->update_func(d->raw_model, &tmp, d->rings);
+  }
+}
 
+/* Builds the subdivided model of subdiv_prepare() */
+static struct model* subdiv_build(struct subdiv_data *d, int n_threads)
+{
+  struct model *subdiv_model;
 
-#ifdef SUBDIV_DEBUG
-  DEBUG_PRINT("%d new vertices computed \n", nedges);
-  DEBUG_PRINT("subdiv_model->num_vert = %d\n", nedges+raw_model->num_vert);
-#endif
   subdiv_model = (struct model*)malloc(sizeof(struct model));
   memset(subdiv_model, 0, sizeof(struct model));
-  subdiv_model->num_vert = raw_model->num_vert + nedges;
-  subdiv_model->num_faces = 4*raw_model->num_faces;
-  subdiv_model->faces = temp_face;
+  subdiv_model->num_vert = d->n_new_vert;
+  subdiv_model->num_faces = d->n_new_faces;
+  subdiv_model->faces = (face_t*)malloc((d->n_new_faces+1)*sizeof(face_t));
   subdiv_model->vertices = 
     (vertex_t*)malloc(subdiv_model->num_vert*sizeof(vertex_t));
+  if (subdiv_model->faces == NULL || subdiv_model->vertices == NULL) {
+    fprintf(stderr, "Not enough memory to subdivide\n");
+    exit(1);
+  }
+
+  /* Compute the midpoints and split the faces */
+  d->face_off = 0;
+  d->mid_out = subdiv_model->vertices;
+  d->mid_base = 0;
+  d->face_out = subdiv_model->faces;
+  d->face_base = 0;
+  tp_par_for(n_threads, d->raw_model->num_faces, SUBDIV_BLOCK, 
+             edge_midpoint_work, d);
+  tp_par_for(n_threads, d->raw_model->num_faces, SUBDIV_BLOCK, 
+             face_split_work, d);
+  subdiv_old_vertices(d, subdiv_model->vertices);
+  return subdiv_model;
+}
+
+/* Derives the edge table and the rings of the subdivided model sub_model
+ * from the ones of the model, instead of building them from scratch */
+static void subdiv_derive(struct subdiv_data *d, 
+                          const struct model *sub_model, 
+                          struct edge_table **sub_et, 
+                          struct ring_info **sub_rings, int n_threads)
+{
+  struct edge_table *et;
+  int i;
+
+  et = (struct edge_table*)calloc(1, sizeof(*et));
+  if (et == NULL) {
+    fprintf(stderr, "Not enough memory to subdivide\n");
+    exit(1);
+  }
+  et->n_faces = sub_model->num_faces;
+  et->n_vert = sub_model->num_vert;
+  et->n_edges = 2*d->et->n_edges + 3*(sub_model->num_faces/4);
+  et->he_edge = (int*)malloc((3*et->n_faces+1)*sizeof(int));
+  et->he_radial = (int*)malloc((3*et->n_faces+1)*sizeof(int));
+  et->edge_he = (int*)malloc((et->n_edges+1)*sizeof(int));
+  et->vtx_he = (int*)malloc((et->n_vert+1)*sizeof(int));
+  et->vtx_n_faces = (int*)malloc((et->n_vert+1)*sizeof(int));
+  if (et->he_edge == NULL || et->he_radial == NULL || et->edge_he == NULL ||
+      et->vtx_he == NULL || et->vtx_n_faces == NULL) {
+    fprintf(stderr, "Not enough memory to subdivide\n");
+    exit(1);
+  }
+  d->sub_model = sub_model;
+  d->sub_et = et;
+  tp_par_for(n_threads, d->raw_model->num_faces, SUBDIV_BLOCK, 
+             et_face_work, d);
+  tp_par_for(n_threads, d->et->n_edges, SUBDIV_BLOCK, et_edge_work, d);
+  tp_par_for(n_threads, d->raw_model->num_vert, SUBDIV_BLOCK, et_vtx_work, d);
+
+  d->sub_rings = alloc_rings(sub_model, et);
+  if (d->sub_rings == NULL) {
+    fprintf(stderr, "Not enough memory to subdivide\n");
+    exit(1);
+  }
+  tp_par_for(n_threads, sub_model->num_vert, SUBDIV_BLOCK, ring_derive_work, 
+             d);
+  for (i=0; i<sub_model->num_vert; i++) {
+    if (d->sub_rings[i].type == 2)
+      printf("Vertex %d is non-manifold\n", i);
+  }
+  *sub_et = et;
+  *sub_rings = d->sub_rings;
+}
 
-  if (sf->update_func == NULL) /* Interpolating subdivision */
-    memcpy(subdiv_model->vertices, raw_model->vertices, 
-	   raw_model->num_vert*sizeof(vertex_t));
-  else /* Approx. subdivision */
-    sf->update_func(raw_model, subdiv_model, rings);
-  
-  if (gather_block_list(tmp_v, &(subdiv_model->vertices[raw_model->num_vert]), 
-                        nedges*sizeof(vertex_t)) != 0)
-    abort();
-  free_block_list(&tmp_v);
-  
+/* Writes the subdivided model of subdiv_prepare() to the raw file pf, a
+ * window of face blocks at a time */
+static void subdiv_stream(struct subdiv_data *d, FILE *pf, int use_binary,
+                          int n_threads)
+{
+  vertex_t *v;
+  face_t *f;
+  int k, n, nf, b0, b1;
+
+  nf = d->raw_model->num_faces;
+  n = (d->raw_model->num_vert > 3*SUBDIV_WINDOW*SUBDIV_BLOCK) ?
+    d->raw_model->num_vert : 3*SUBDIV_WINDOW*SUBDIV_BLOCK;
+  v = (vertex_t*)malloc(n*sizeof(vertex_t));
+  f = (face_t*)malloc(4*SUBDIV_WINDOW*SUBDIV_BLOCK*sizeof(face_t));
+  if (v == NULL || f == NULL) {
+    fprintf(stderr, "Not enough memory to subdivide\n");
+    exit(1);
+  }
+
+  subdiv_old_vertices(d, v);
+  write_raw_vertices(pf, v, d->raw_model->num_vert, use_binary);
+  d->mid_out = v;
+  for (k=0; k<nf; k+=SUBDIV_WINDOW*SUBDIV_BLOCK) {
+    n = (nf-k < SUBDIV_WINDOW*SUBDIV_BLOCK) ? nf-k : SUBDIV_WINDOW*SUBDIV_BLOCK;
+    b0 = k/SUBDIV_BLOCK;
+    b1 = (k+n+SUBDIV_BLOCK-1)/SUBDIV_BLOCK;
+    d->face_off = k;
+    d->mid_base = d->blk_edges[b0];
+    tp_par_for(n_threads, n, SUBDIV_BLOCK, edge_midpoint_work, d);
+    write_raw_vertices(pf, v, d->blk_edges[b1]-d->blk_edges[b0], use_binary);
+  }
+  d->face_out = f;
+  for (k=0; k<nf; k+=SUBDIV_WINDOW*SUBDIV_BLOCK) {
+    n = (nf-k < SUBDIV_WINDOW*SUBDIV_BLOCK) ? nf-k : SUBDIV_WINDOW*SUBDIV_BLOCK;
+    b0 = k/SUBDIV_BLOCK;
+    b1 = (k+n+SUBDIV_BLOCK-1)/SUBDIV_BLOCK;
+    d->face_off = k;
+    d->face_base = d->blk_faces[b0];
+    tp_par_for(n_threads, n, SUBDIV_BLOCK, face_split_work, d);
+    write_raw_faces(pf, f, d->blk_faces[b1]-d->blk_faces[b0], use_binary);
+  }
+  free(v);
+  free(f);
+}
+
+/* Performs the n_lev levels of subdivision of raw_model. If pf is not NULL
+ * the last level is written to it and NULL is returned, otherwise the last
+ * level is returned. */
+static struct model* subdiv_run(struct model *raw_model, 
+                                const struct subdiv_functions *sf,
+                                int n_lev, int n_threads, char *filename, 
+                                int use_binary)
+{
+  struct subdiv_data d;
+  struct model *cur, *sub;
+  struct edge_table *et, *sub_et;
+  struct ring_info *rings, *sub_rings;
+  FILE *pf;
+  int lev;
 #ifdef SUBDIV_TIME
-  printf("subdiv time = %f sec.\n", (clock()-start)/(float)CLOCKS_PER_SEC);
-#endif
-#ifdef SUBDIV_DEBUG
-  DEBUG_PRINT("face_idx = %d vert_idx = %d\n", face_idx, vert_idx);
+  clock_t start;
 #endif
 
-  for (i=0; i<raw_model->num_vert; i++) {
-    if (rings[i].type == 0 || rings[i].type == 1) {
-      free(mp_info[i].midpoint_idx);
-      free(mp_info[i].edge_subdiv_done);
+  if (n_lev < 1)
+    n_lev = 1;
+  if (n_threads <= 0)
+    n_threads = tp_num_cpus();
+  et = build_edge_table(raw_model, n_threads);
+  rings = (et != NULL) ? build_rings(raw_model, et, n_threads) : NULL;
+  if (rings == NULL) {
+    fprintf(stderr, "Not enough memory to subdivide\n");
+    exit(1);
+  }
+
+  cur = raw_model;
+  sub = NULL;
+  for (lev=0; lev<n_lev; lev++) {
+#ifdef SUBDIV_TIME
+    start = clock();
+#endif
+    subdiv_prepare(&d, cur, sf, et, rings, n_threads);
+    sub_et = NULL;
+    sub_rings = NULL;
+    if (lev < n_lev-1 || filename == NULL) {
+      sub = subdiv_build(&d, n_threads);
+      if (lev < n_lev-1)
+        subdiv_derive(&d, sub, &sub_et, &sub_rings, n_threads);
+    } else {
+      sub = NULL;
+      pf = write_raw_header(filename, d.n_new_vert, d.n_new_faces, 0, 
+                            use_binary);
+      subdiv_stream(&d, pf, use_binary, n_threads);
+      fclose(pf);
     }
-    free(rings[i].ord_vert);
-    free(rings[i].ord_face);
- 
+#ifdef SUBDIV_TIME
+    printf("subdiv time = %f sec.\n", (clock()-start)/(float)CLOCKS_PER_SEC);
+#endif
+    subdiv_release(&d);
+    free_edge_table(et);
+    free_rings(rings);
+    if (cur != raw_model)
+      __free_raw_model(cur);
+    cur = sub;
+    et = sub_et;
+    rings = sub_rings;
   }
-  free(rings);
-  free(mp_info);
-  return subdiv_model;
+  return sub;
+}
+
+/* This is the function that performs the subdivision.
+   The argument 'midpoint_func' is the pointer to the 
+   function that performs the computation of the midpoint.
+   The 'update_func' stands for the function that updates 
+   the postion of 'old' vertices. This is only used for 
+   non-interpolating subd. (i.e. Loop). For interpolating subd. 
+   you just pass NULL as argument.
+   Each edge of the edge table gets its midpoint index before any
+   midpoint is computed, so that the midpoints are computed in parallel
+   over the edges and the faces are split in parallel, without any
+   search in the rings. Degenerate faces are dropped and the edges of
+   non-manifold vertices are split at their middle. */
+struct model* subdiv(struct model *raw_model, 
+                     const struct subdiv_functions* sf) 
+{
+  return subdiv_run(raw_model, sf, 1, 0, NULL, 0);
 }
 
+/* See subdiv.h */
+struct model* subdiv_levels(struct model *raw_model, 
+                            const struct subdiv_functions *sf, 
+                            int n_lev, int n_threads)
+{
+  return subdiv_run(raw_model, sf, n_lev, n_threads, NULL, 0);
+}
 
+/* See subdiv.h */
+void subdiv_levels_write(struct model *raw_model, 
+                         const struct subdiv_functions *sf, 
+                         int n_lev, int n_threads, char *filename,
+                         int use_binary)
+{
+  subdiv_run(raw_model, sf, n_lev, n_threads, filename, use_binary);
+}
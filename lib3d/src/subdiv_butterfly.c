@@ -22,6 +22,10 @@ static const float reg_sten[6] = {0.25 - _2W_,
 static const float sten_4[4] = {0.375, 0.0, -0.125, 0.0};
 static const float sten_3[3] = {_5_12, _M1_12, _M1_12};
 
+/* Largest mask kept on the stack, the midpoints are computed in parallel
+ * and larger ones are malloc'ed */
+#define BUT_MASK_SZ 32
+
 /* 
  * Builds a Butterfly subd. mask of size n for irregular vertices.
  * The array must be pre-malloc'ed !
@@ -52,7 +56,8 @@ void compute_midpoint_butterfly(const struct ring_info *rings,
 				float (*sph_h_func)(const float),
                                 vertex_t *vout) 
 {
-  float *s=NULL, *t=NULL;
+  float s_buf[BUT_MASK_SZ], t_buf[BUT_MASK_SZ];
+  float *s=s_buf, *t=t_buf;
   int j;
   vertex_t p={0.0, 0.0, 0.0}, r={0.0, 0.0, 0.0};
   int n = rings[center].size;
@@ -86,8 +91,10 @@ void compute_midpoint_butterfly(const struct ring_info *rings,
     while (ring_op.ord_vert[v2] != center)
       v2++;
     
-    s = (float*)malloc(n*sizeof(float));
-    t = (float*)malloc(m*sizeof(float));
+    if (n > BUT_MASK_SZ)
+      s = (float*)malloc(n*sizeof(float));
+    if (m > BUT_MASK_SZ)
+      t = (float*)malloc(m*sizeof(float));
 
     /* Compute values of stencil for end-vertex */
     make_sub_mask(t, m);
@@ -131,8 +138,10 @@ void compute_midpoint_butterfly(const struct ring_info *rings,
     __add_v(p, r, p);
     __prod_v(0.5, p, p);
     
-    free(s);
-    free(t);
+    if (s != s_buf)
+      free(s);
+    if (t != t_buf)
+      free(t);
   }
   else if (n == 6 && m == 6) {/* regular */
     /* apply the 10 point stencil */
@@ -163,7 +172,8 @@ void compute_midpoint_butterfly(const struct ring_info *rings,
 
   }
   else if (n!=6 && m==6){ /* only one irreg. vertex_t */
-    s = (float*)malloc(n*sizeof(float));
+    if (n > BUT_MASK_SZ)
+      s = (float*)malloc(n*sizeof(float));
     make_sub_mask(s, n);
 
     for (j=0; j<n; j++) {
@@ -173,9 +183,11 @@ void compute_midpoint_butterfly(const struct ring_info *rings,
 
     __add_prod_v(0.75, raw_model->vertices[center], p, p);
 
-    free(s);
+    if (s != s_buf)
+      free(s);
   } else if (n==6 && m!=6) {
-    t = (float*)malloc(m*sizeof(float));
+    if (m > BUT_MASK_SZ)
+      t = (float*)malloc(m*sizeof(float));
     make_sub_mask(t, m);
 
     while (ring_op.ord_vert[v2] != center)
@@ -188,7 +200,8 @@ void compute_midpoint_butterfly(const struct ring_info *rings,
 
     __add_prod_v(0.75, raw_model->vertices[center2], p, p);
 
-    free(t);
+    if (t != t_buf)
+      free(t);
   } 
   
   *vout = p;
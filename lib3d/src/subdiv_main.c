@@ -78,25 +78,20 @@ int main(int argc, char **argv) {
   }  
 
 
-  for (lev=0; lev<nlev; lev++) {
-
-    /* performs the subdivision */
-    switch (sub_method) {
-    case SUBDIV_KOB_SQRT3: /* handle sqrt3 stuff separately */
+  switch (sub_method) {
+  case SUBDIV_KOB_SQRT3: /* handle sqrt3 stuff separately */
+    for (lev=0; lev<nlev; lev++) {
       sub_model = subdiv_sqrt3(or_model, &(sm.kob_sqrt3));
-      break;
-    default: /* 4-to-1 split */
-      sub_model = subdiv(or_model, tmp_func);     
-      break;
+      __free_raw_model(or_model);
+      or_model = sub_model;
     }
-
-    
+    write_raw_model(sub_model, outfile, use_binary);
+    __free_raw_model(sub_model);
+    break;
+  default: /* 4-to-1 split, the last level goes directly to the file */
+    subdiv_levels_write(or_model, tmp_func, nlev, 0, outfile, use_binary);
     __free_raw_model(or_model);
-    
-    or_model = sub_model;
+    break;
   }
-  write_raw_model(sub_model, outfile, use_binary);
-
-  __free_raw_model(sub_model);
   return 0;
 }
@@ -2,8 +2,8 @@
 #include <3dutils.h>
 #include <subdiv_methods.h>
 #include <subdiv.h>
-#include <block_list.h>
-#include <assert.h>
+#include <edge_table.h>
+#include <thread_pool.h>
 #if defined(SUBDIV_DEBUG) || defined(DEBUG)
 # include <debug_print.h>
 #endif
@@ -11,150 +11,132 @@
 # include <time.h>
 #endif
 
+/* Number of faces or vertices processed in each parallel chunk */
+#define SQRT3_BLOCK 1024
+
+/* The data shared by the parallel passes of subdiv_sqrt3() */
+struct sqrt3_data {
+  const struct model *raw_model;
+  const struct subdiv_sqrt3_functions *sf;
+  const struct ring_info *rings;
+  int *blk_faces;    /* for each vertex block, the index of its first new
+                      * face */
+  struct model *subdiv_model;
+};
+
+/* Computes the midpoints of the faces start to end-1 */
+static void face_midpoint_work(void *data, int start, int end, int tid)
+{
+  struct sqrt3_data *d = (struct sqrt3_data*)data;
+  int f;
+
+  (void)tid;
+  for (f=start; f<end; f++)
+    d->sf->face_midpoint_func(d->rings, f, d->raw_model, 
+                              &(d->subdiv_model->vertices[f + 
+                                d->raw_model->num_vert]));
+}
+
+/* Builds the new faces around the vertices start to end-1 */
+static void vertex_faces_work(void *data, int start, int end, int tid)
+{
+  struct sqrt3_data *d = (struct sqrt3_data*)data;
+  const struct ring_info *ring;
+  int nv = d->raw_model->num_vert;
+  face_t *out;
+  int i, j, nedges;
+
+  (void)tid;
+  out = NULL;
+  for (i=start; i<end; i++) {
+    if (i == start || i%SQRT3_BLOCK == 0)
+      out = &(d->subdiv_model->faces[d->blk_faces[i/SQRT3_BLOCK]]);
+    ring = &(d->rings[i]);
+    nedges = ring->size;
+    if (ring->type == 0) {
+      for (j=0; j<nedges-1; j++) {
+        out->f0 = i;
+        out->f1 = ring->ord_face[j] + nv;
+        (out++)->f2 = ring->ord_face[j+1] + nv;
+      }
+      
+      /* handle last face : closed ring*/
+      out->f0 = i;
+      out->f1 = ring->ord_face[nedges-1] + nv;
+      (out++)->f2 = ring->ord_face[0] + nv;
+
+    } else if (ring->type == 1) {
+      for (j=0; j<nedges-2; j++) {
+        out->f0 = i;
+        out->f1 = ring->ord_face[j] + nv;
+        (out++)->f2 = ring->ord_face[j+1] + nv;
+      }
+      
+      /* handle last and first faces : open ring */
+      /* FIXME: replace this by the MP of the edge every even
+       * subdivision level. Anyway, this generates duplicates in
+       * triangles so it _sucks_. It *must* die !! */
+      out->f0 = i;
+      out->f1 = ring->ord_face[nedges-2] + nv;
+      (out++)->f2 = ring->ord_vert[nedges-1];
+
+      out->f0 = i;
+      out->f1 = ring->ord_face[0] + nv;
+      (out++)->f2 = ring->ord_vert[0];
+    }
+  }
+}
+
 /* This is the function that performs the subdivision.
    The argument 'face_midpoint_func' is the pointer to the 
    function that performs the computation of the midpoint.
    The 'update_func' stands for the function that updates 
    the postion of 'old' vertices. This is only used for 
    non-interpolating subd. (i.e. Kobbelt). For interpolating subd. 
-   you just pass NULL as argument */
+   you just pass NULL as argument.
+   The number of new faces around each vertex is known from its ring, so
+   the face midpoints and the new faces are computed in parallel,
+   directly in the subdivided model. */
 struct model* subdiv_sqrt3(struct model *raw_model, 
                            const struct subdiv_sqrt3_functions *sf) 
 {
 
   struct model *subdiv_model;
+  struct sqrt3_data d;
   struct ring_info *rings;
-  int nedges;
+  struct edge_table *et;
   int face_idx = 0;
-  int i,j;
-  bitmap_t *face_mp_done;
-  struct block_list *temp_face=NULL, *cur;
-  vertex_t *tmp_v=NULL;
-#ifdef SUBDIV_DEBUG
-  int vert_idx = raw_model->num_vert;
-#endif
+  int i, n_blocks, n_threads;
 #ifdef SUBDIV_TIME
   clock_t start;
 #endif
 
-  rings = (struct ring_info*)
-    malloc(raw_model->num_vert*sizeof(struct ring_info));
-    
-  build_star_global(raw_model, rings);
-
-  temp_face = (struct block_list*)malloc(sizeof(struct block_list));
-  if (init_block_list(temp_face, sizeof(face_t)) != 0)
-    abort();
-  cur = temp_face;
-
-  tmp_v = (vertex_t*)malloc(raw_model->num_faces*sizeof(vertex_t));
-  face_mp_done = BITMAP_ALLOC(raw_model->num_faces);
+  n_threads = tp_num_cpus();
+  et = build_edge_table(raw_model, n_threads);
+  rings = (et != NULL) ? build_rings(raw_model, et, n_threads) : NULL;
+  free_edge_table(et);
+  if (rings == NULL) {
+    fprintf(stderr, "Not enough memory to subdivide\n");
+    exit(1);
+  }
 
 #ifdef SUBDIV_TIME
   start = clock();
 #endif
+  n_blocks = (raw_model->num_vert+SQRT3_BLOCK-1)/SQRT3_BLOCK;
+  d.blk_faces = (int*)malloc((n_blocks+1)*sizeof(int));
   for (i=0; i< raw_model->num_vert; i++) {
-    nedges = rings[i].size;
-    if (rings[i].type == 0) {
-      for (j=0; j<nedges-1; j++) {
-        /* compute face midpoint if needed */
-        if (!BITMAP_TEST_BIT(face_mp_done, rings[i].ord_face[j])) {
-          sf->face_midpoint_func(rings, rings[i].ord_face[j], raw_model, 
-                                 &(tmp_v[rings[i].ord_face[j]]));
-          BITMAP_SET_BIT(face_mp_done, rings[i].ord_face[j]);
-        }
-        if (cur->elem_filled == cur->nelem)
-          cur = get_next_block(cur);
-        assert(cur != NULL);
-
-        BLOCK_LIST_TAIL(cur, face_t).f0 = i;
-        BLOCK_LIST_TAIL(cur, face_t).f1 = rings[i].ord_face[j] + 
-          raw_model->num_vert;
-        BLOCK_LIST_TAIL_INCR(cur, face_t).f2 = rings[i].ord_face[j+1] + 
-          raw_model->num_vert;
-
-        face_idx++;
-        
-      }
-      
-      /* handle last face : closed ring*/
-      if (!BITMAP_TEST_BIT(face_mp_done, rings[i].ord_face[nedges-1])) {
-        sf->face_midpoint_func(rings, rings[i].ord_face[nedges-1], raw_model, 
-                               &(tmp_v[rings[i].ord_face[nedges-1]]));
-        BITMAP_SET_BIT(face_mp_done, rings[i].ord_face[nedges-1]);
-      }
-        if (cur->elem_filled == cur->nelem)
-          cur = get_next_block(cur);
-        assert(cur != NULL);
-
-        BLOCK_LIST_TAIL(cur, face_t).f0 = i;
-        BLOCK_LIST_TAIL(cur, face_t).f1 = 
-          rings[i].ord_face[nedges-1] + raw_model->num_vert;
-        BLOCK_LIST_TAIL_INCR(cur, face_t).f2 = rings[i].ord_face[0] + 
-          raw_model->num_vert;
-
-        face_idx++;
-
-    } else if (rings[i].type == 1) {
-      for (j=0; j<nedges-2; j++) {
-        /* compute face midpoint if needed */
-        if (!BITMAP_TEST_BIT(face_mp_done, rings[i].ord_face[j])) {
-          sf->face_midpoint_func(rings, rings[i].ord_face[j], raw_model, 
-                                 &(tmp_v[rings[i].ord_face[j]]));
-          BITMAP_SET_BIT(face_mp_done, rings[i].ord_face[j]);
-        }
-        if (cur->elem_filled == cur->nelem)
-          cur = get_next_block(cur);
-        assert(cur != NULL);
-
-        BLOCK_LIST_TAIL(cur, face_t).f0 = i;
-        BLOCK_LIST_TAIL(cur, face_t).f1 = rings[i].ord_face[j] + 
-          raw_model->num_vert;
-        BLOCK_LIST_TAIL_INCR(cur, face_t).f2 = rings[i].ord_face[j+1] + 
-          raw_model->num_vert;
-
-        face_idx++;
-        
-      }
-      
-      /* handle last and first faces : open ring */
-      if (!BITMAP_TEST_BIT(face_mp_done, rings[i].ord_face[nedges-2])) {
-        sf->face_midpoint_func(rings, rings[i].ord_face[nedges-2], raw_model, 
-                               &(tmp_v[rings[i].ord_face[nedges-2]]));
-        BITMAP_SET_BIT(face_mp_done, rings[i].ord_face[nedges-2]);
-      }
-      if (cur->elem_filled == cur->nelem)
-        cur = get_next_block(cur);
-      assert(cur != NULL);
-      
-      /* FIXME: replace this by the MP of the edge every even
-       * subdivision level. Anyway, this generates duplicates in
-       * triangles so it _sucks_. It *must* die !! */
-      BLOCK_LIST_TAIL(cur, face_t).f0 = i;
-      BLOCK_LIST_TAIL(cur, face_t).f1 = rings[i].ord_face[nedges-2] + 
-        raw_model->num_vert;
-      BLOCK_LIST_TAIL_INCR(cur, face_t).f2 = rings[i].ord_vert[nedges-1];
-
-      face_idx++;
-
-      if (cur->elem_filled == cur->nelem)
-        cur = get_next_block(cur);
-      assert(cur != NULL);
-      BLOCK_LIST_TAIL(cur, face_t).f0 = i;
-      BLOCK_LIST_TAIL(cur, face_t).f1 = rings[i].ord_face[0] + 
-        raw_model->num_vert;
-      BLOCK_LIST_TAIL_INCR(cur, face_t).f2 = rings[i].ord_vert[0];
-
-      face_idx++;
-
-    } else { /* Non-manifold vertex */
+    if (i%SQRT3_BLOCK == 0)
+      d.blk_faces[i/SQRT3_BLOCK] = face_idx;
+    if (rings[i].type == 0 || rings[i].type == 1) {
+      face_idx += rings[i].size;
+    } else if (rings[i].type == 2) { /* Non-manifold vertex */
       fprintf(stderr, "Vertex %d is non-manifold -> bail out\n", i);
+      free(d.blk_faces);
+      free_rings(rings);
       return NULL;
     }
   }
-#ifdef SUBDIV_TIME
-  printf("subdiv time = %f sec.\n", (clock()-start)/(float)CLOCKS_PER_SEC);
-#endif
 
 #ifdef SUBDIV_DEBUG
   DEBUG_PRINT("%d new vertices computed \n", raw_model->num_faces);
@@ -166,39 +148,29 @@ struct model* subdiv_sqrt3(struct model *raw_model,
   subdiv_model->num_vert = raw_model->num_vert + raw_model->num_faces;
   subdiv_model->num_faces = face_idx;
   subdiv_model->faces = 
-    (face_t*)malloc(subdiv_model->num_faces*sizeof(face_t));
+    (face_t*)malloc((subdiv_model->num_faces+1)*sizeof(face_t));
   subdiv_model->vertices = 
     (vertex_t*)malloc(subdiv_model->num_vert*sizeof(vertex_t));
 
+  d.raw_model = raw_model;
+  d.sf = sf;
+  d.rings = rings;
+  d.subdiv_model = subdiv_model;
+  tp_par_for(n_threads, raw_model->num_faces, SQRT3_BLOCK, face_midpoint_work,
+             &d);
+  tp_par_for(n_threads, raw_model->num_vert, SQRT3_BLOCK, vertex_faces_work,
+             &d);
+
   if (sf->update_func == NULL) /* Interpolating subdivision */
     memcpy(subdiv_model->vertices, raw_model->vertices, 
 	   raw_model->num_vert*sizeof(vertex_t));
   else /* Approx. subdivision */
     sf->update_func(raw_model, subdiv_model, rings);
-  
-  /* copy faces midpoints */
-  memcpy(&(subdiv_model->vertices[raw_model->num_vert]), tmp_v, 
-         raw_model->num_faces*sizeof(vertex_t));
-
-  if (gather_block_list(temp_face, subdiv_model->faces, 
-                        subdiv_model->num_faces*sizeof(face_t)) != 0)
-    abort();
-  free_block_list(&temp_face);
-  
-
-#ifdef SUBDIV_DEBUG
-  DEBUG_PRINT("face_idx = %d vert_idx = %d\n", face_idx, vert_idx);
+#ifdef SUBDIV_TIME
+  printf("subdiv time = %f sec.\n", (clock()-start)/(float)CLOCKS_PER_SEC);
 #endif
 
-  free(face_mp_done);
-  free(tmp_v);
-  for (i=0; i<raw_model->num_vert; i++) {
-    free(rings[i].ord_vert);
-    free(rings[i].ord_face);
-
-  }
-  free(rings);
+  free(d.blk_faces);
+  free_rings(rings);
   return subdiv_model;
 }
-
-
@@ -0,0 +1,535 @@
+/* $Id$ */
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+/* Worker pool for parallel loops, see thread_pool.h. The pool is created for
+ * each tp_par_for() call and the workers are joined before returning. The
+ * loops we parallelize are coarse enough for the thread creation cost to be
+ * negligible, and it keeps things simple (no idle threads lying around).
+ *
+ * Each thread accumulates the CPU time of the workers it started and
+ * joined, so that tp_cpu_time() can add it to its own. The accumulator is
+ * found through thread local storage: it is in the tp_thread_arg of the
+ * workers and malloc'ed for the other threads. */
+
+/* For clock_gettime() and the thread CPU clock */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+# define _POSIX_C_SOURCE 199506L
+#endif
+
+#include <thread_pool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(MESH_NO_THREADS)
+/* serial only */
+#elif defined(_WIN32)
+# include <windows.h>
+# include <process.h>
+#else
+# include <pthread.h>
+# include <unistd.h>
+# include <errno.h>
+#endif
+
+/* Returns the CPU time used by the calling thread, in seconds, or a
+ * negative value if it is not available */
+static double tp_thread_cpu_time(void)
+{
+#if defined(MESH_NO_THREADS)
+  return (double)clock()/CLOCKS_PER_SEC;
+#elif defined(_WIN32)
+  FILETIME t_creat,t_exit,t_kern,t_user;
+  if (GetThreadTimes(GetCurrentThread(),&t_creat,&t_exit,&t_kern,&t_user)) {
+    /* FILETIME is in units of 100 ns */
+    return ((t_kern.dwHighDateTime+(double)t_user.dwHighDateTime)*
+            4294967296.0+t_kern.dwLowDateTime+
+            (double)t_user.dwLowDateTime)*1e-7;
+  }
+  return -1.0;
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts) == 0) {
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+  }
+  return -1.0;
+#else
+  return -1.0;
+#endif
+}
+
+/* Returns a time in seconds, from an arbitrary origin, to pace the polls */
+static double tp_now(void)
+{
+#if defined(_WIN32) && !defined(MESH_NO_THREADS)
+  return GetTickCount()*1e-3;
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC,&ts) == 0) {
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+  }
+  return (double)clock()/CLOCKS_PER_SEC;
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/* Processes the indices 0 to n-1 in the calling thread, as thread 0. If
+ * poll is not NULL they are processed in chunks of 'chunk' indices and
+ * poll is called between the chunks, when 'interval' seconds have passed
+ * since the previous call. The loop stops if it returns non-zero. */
+static void tp_serial(int n, int chunk, tp_work_func_t *work, void *data,
+                      tp_poll_func_t *poll, void *poll_data, double interval)
+{
+  double next_poll;
+  int start,end;
+
+  if (poll == NULL) {
+    work(data,0,n,0);
+    return;
+  }
+  next_poll = tp_now()+interval;
+  for (start=0; start<n; start=end) {
+    end = (n-start > chunk) ? start+chunk : n;
+    work(data,start,end,0);
+    if (end < n && tp_now() >= next_poll) {
+      if (poll(poll_data,end,n)) break;
+      next_poll = tp_now()+interval;
+    }
+  }
+}
+
+#ifndef MESH_NO_THREADS
+
+/* Maximum number of threads ever used */
+#define TP_MAX_THREADS 256
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION tp_lock_t;
+# define TP_LOCK_INIT(l) InitializeCriticalSection(l)
+# define TP_LOCK_DESTROY(l) DeleteCriticalSection(l)
+# define TP_LOCK(l) EnterCriticalSection(l)
+# define TP_UNLOCK(l) LeaveCriticalSection(l)
+typedef HANDLE tp_cond_t; /* a manual reset event */
+# define TP_COND_INIT(c) (*(c) = CreateEvent(NULL,TRUE,FALSE,NULL))
+# define TP_COND_DESTROY(c) CloseHandle(*(c))
+# define TP_COND_SIGNAL(c) SetEvent(*(c))
+#else
+typedef pthread_mutex_t tp_lock_t;
+# define TP_LOCK_INIT(l) pthread_mutex_init(l,NULL)
+# define TP_LOCK_DESTROY(l) pthread_mutex_destroy(l)
+# define TP_LOCK(l) pthread_mutex_lock(l)
+# define TP_UNLOCK(l) pthread_mutex_unlock(l)
+typedef pthread_cond_t tp_cond_t;
+# define TP_COND_INIT(c) pthread_cond_init(c,NULL)
+# define TP_COND_DESTROY(c) pthread_cond_destroy(c)
+# define TP_COND_SIGNAL(c) pthread_cond_signal(c)
+#endif
+
+/* Shared state of a parallel loop */
+struct tp_loop {
+  tp_work_func_t *work; /* the function to call */
+  void *data;           /* its data argument */
+  int n;                /* the number of indices */
+  int chunk;            /* the number of indices in each chunk */
+  int next;             /* first index not yet handed out */
+  int n_done;           /* the number of indices processed */
+  int n_active;         /* the number of started threads not yet done */
+  int stop;             /* non-zero once no more chunks are handed out */
+  tp_lock_t lock;       /* protects all the above but 'work' to 'chunk' */
+  tp_cond_t idle;       /* signaled when n_active drops to zero */
+};
+
+/* Per thread argument */
+struct tp_thread_arg {
+  struct tp_loop *loop; /* the shared loop state */
+  int tid;              /* the thread index */
+  double cpu;           /* the CPU time of the workers started by the
+                         * thread, to which the thread's own is added when
+                         * it is done */
+};
+
+#ifdef _WIN32
+/* The thread local storage of the CPU time accumulators */
+static DWORD tp_cpu_key = TLS_OUT_OF_INDEXES;
+/* 0 until tp_cpu_key is being created, 1 while, 2 after */
+static volatile LONG tp_cpu_key_state = 0;
+
+/* Creates tp_cpu_key, once */
+static void tp_cpu_key_init(void)
+{
+  if (InterlockedCompareExchange(&tp_cpu_key_state,1,0) == 0) {
+    tp_cpu_key = TlsAlloc();
+    InterlockedExchange(&tp_cpu_key_state,2);
+  } else {
+    while (tp_cpu_key_state != 2) Sleep(0);
+  }
+}
+
+/* Returns the CPU time accumulator of the calling thread, NULL if none */
+static double *tp_get_cpu_acc(void)
+{
+  tp_cpu_key_init();
+  if (tp_cpu_key == TLS_OUT_OF_INDEXES) return NULL;
+  return (double*)TlsGetValue(tp_cpu_key);
+}
+
+/* Sets the CPU time accumulator of the calling thread */
+static void tp_set_cpu_acc(double *acc)
+{
+  if (tp_cpu_key != TLS_OUT_OF_INDEXES) TlsSetValue(tp_cpu_key,acc);
+}
+#else
+/* The thread local storage of the CPU time accumulators. Those that are
+ * malloc'ed are freed when the thread exits. */
+static pthread_key_t tp_cpu_key;
+static pthread_once_t tp_cpu_once = PTHREAD_ONCE_INIT;
+static int tp_cpu_key_ok = 0;
+
+/* Creates tp_cpu_key, called once */
+static void tp_cpu_key_init(void)
+{
+  tp_cpu_key_ok = (pthread_key_create(&tp_cpu_key,free) == 0);
+}
+
+/* Returns the CPU time accumulator of the calling thread, NULL if none */
+static double *tp_get_cpu_acc(void)
+{
+  pthread_once(&tp_cpu_once,tp_cpu_key_init);
+  if (!tp_cpu_key_ok) return NULL;
+  return (double*)pthread_getspecific(tp_cpu_key);
+}
+
+/* Sets the CPU time accumulator of the calling thread */
+static void tp_set_cpu_acc(double *acc)
+{
+  if (tp_cpu_key_ok) pthread_setspecific(tp_cpu_key,acc);
+}
+#endif
+
+/* Returns the CPU time accumulator of the calling thread, allocating it if
+ * the thread has none yet (i.e. it is not a worker). Returns NULL if it
+ * can not be allocated. */
+static double *tp_cpu_acc(void)
+{
+  double *acc;
+
+  acc = tp_get_cpu_acc();
+  if (acc == NULL) {
+    acc = malloc(sizeof(*acc));
+    if (acc == NULL) return NULL;
+    *acc = 0.0;
+    tp_set_cpu_acc(acc);
+    if (tp_get_cpu_acc() != acc) { /* no thread local storage */
+      free(acc);
+      return NULL;
+    }
+  }
+  return acc;
+}
+
+/* Counts the n_prev indices of the previous chunk as processed and takes
+ * the next chunk of the loop. Returns zero if no indices are left or the
+ * loop is stopped, otherwise the chunk is returned in *start and *end. */
+static int tp_next_chunk(struct tp_loop *loop, int n_prev, 
+                         int *start, int *end)
+{
+  int s;
+
+  TP_LOCK(&loop->lock);
+  loop->n_done += n_prev;
+  s = loop->stop ? loop->n : loop->next;
+  if (s < loop->n) {
+    loop->next = (loop->n-s > loop->chunk) ? s+loop->chunk : loop->n;
+  }
+  *end = loop->stop ? s : loop->next;
+  TP_UNLOCK(&loop->lock);
+  *start = s;
+  return s < *end;
+}
+
+/* Worker loop: processes chunks until none is left */
+static void tp_worker(struct tp_thread_arg *arg)
+{
+  int start,end;
+
+  end = start = 0;
+  while (tp_next_chunk(arg->loop,end-start,&start,&end)) {
+    arg->loop->work(arg->loop->data,start,end,arg->tid);
+  }
+}
+
+/* Runs the worker loop in a started thread, recording in arg->cpu the
+ * CPU time of the thread and of the workers it starts */
+static void tp_started_worker(struct tp_thread_arg *arg)
+{
+  double t;
+
+  arg->cpu = 0.0;
+  tp_set_cpu_acc(&(arg->cpu));
+  tp_worker(arg);
+  tp_set_cpu_acc(NULL);
+  t = tp_thread_cpu_time();
+  arg->cpu = (t >= 0.0) ? arg->cpu+t : -1.0;
+  TP_LOCK(&arg->loop->lock);
+  if (--arg->loop->n_active == 0) TP_COND_SIGNAL(&arg->loop->idle);
+  TP_UNLOCK(&arg->loop->lock);
+}
+
+/* Waits for the started threads of the loop to be done, calling 'poll'
+ * every 'interval' seconds meanwhile. Once 'poll' returns non-zero no
+ * more chunks are handed out. */
+static void tp_wait_poll(struct tp_loop *loop, tp_poll_func_t *poll, 
+                         void *poll_data, double interval)
+{
+  int done,stop;
+# ifdef _WIN32
+  int active;
+
+  for (;;) {
+    TP_LOCK(&loop->lock);
+    active = loop->n_active;
+    done = loop->n_done;
+    if (active > 0) ResetEvent(loop->idle);
+    TP_UNLOCK(&loop->lock);
+    if (active == 0) break;
+    if (WaitForSingleObject(loop->idle,(DWORD)(interval*1000)) != 
+        WAIT_TIMEOUT) {
+      continue;
+    }
+    stop = poll(poll_data,done,loop->n);
+    TP_LOCK(&loop->lock);
+    if (stop) loop->stop = 1;
+    TP_UNLOCK(&loop->lock);
+  }
+# else
+  struct timespec ts;
+  long ns;
+
+  TP_LOCK(&loop->lock);
+  while (loop->n_active > 0) {
+    clock_gettime(CLOCK_REALTIME,&ts);
+    ns = ts.tv_nsec+(long)(interval*1e9);
+    ts.tv_sec += ns/1000000000L;
+    ts.tv_nsec = ns%1000000000L;
+    if (pthread_cond_timedwait(&loop->idle,&loop->lock,&ts) != ETIMEDOUT ||
+        loop->n_active == 0) {
+      continue;
+    }
+    done = loop->n_done;
+    TP_UNLOCK(&loop->lock);
+    stop = poll(poll_data,done,loop->n);
+    TP_LOCK(&loop->lock);
+    if (stop) loop->stop = 1;
+  }
+  TP_UNLOCK(&loop->lock);
+# endif
+}
+
+/* Thread entry point */
+#ifdef _WIN32
+static unsigned __stdcall tp_thread_main(void *arg)
+{
+  tp_started_worker((struct tp_thread_arg*)arg);
+  return 0;
+}
+#else
+static void *tp_thread_main(void *arg)
+{
+  tp_started_worker((struct tp_thread_arg*)arg);
+  return NULL;
+}
+#endif
+
+#endif /* MESH_NO_THREADS */
+
+/* See thread_pool.h */
+int tp_num_cpus(void)
+{
+  int n;
+#if defined(MESH_NO_THREADS)
+  n = 1;
+#elif defined(_WIN32)
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  n = (int)si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#else
+  n = 1;
+#endif
+  return (n > 0) ? n : 1;
+}
+
+/* See thread_pool.h */
+double tp_cpu_time(void)
+{
+  double t;
+#ifndef MESH_NO_THREADS
+  double *acc;
+#endif
+
+  t = tp_thread_cpu_time();
+#ifndef MESH_NO_THREADS
+  if (t >= 0.0) {
+    acc = tp_cpu_acc();
+    t = (acc != NULL) ? t+*acc : -1.0;
+  }
+#endif
+  return t;
+}
+
+/* Runs tp_par_for() or tp_par_for_poll(), if poll is not NULL */
+static int tp_run(int n_threads, int n, int chunk, tp_work_func_t *work, 
+                  void *data, tp_poll_func_t *poll, void *poll_data,
+                  double interval)
+{
+#ifdef MESH_NO_THREADS
+  if (n <= 0) return 0;
+  (void)n_threads;
+  if (chunk <= 0) chunk = (n/8 > 0) ? n/8 : 1;
+  tp_serial(n,chunk,work,data,poll,poll_data,interval);
+  return 1;
+#else
+  struct tp_loop loop;
+  struct tp_thread_arg args[TP_MAX_THREADS];
+# ifdef _WIN32
+  HANDLE th[TP_MAX_THREADS];
+# else
+  pthread_t th[TP_MAX_THREADS];
+# endif
+  int i,first,n_started,ok;
+  double *acc;
+
+  if (n <= 0) return 0;
+  if (n_threads > TP_MAX_THREADS) n_threads = TP_MAX_THREADS;
+  if (chunk <= 0) { /* about 8 chunks per thread, for load balancing */
+    chunk = (n_threads > 0) ? n/(8*n_threads) : n;
+    if (chunk <= 0) chunk = 1;
+  }
+  if (n_threads > (n+chunk-1)/chunk) n_threads = (n+chunk-1)/chunk;
+  if (n_threads <= 1) { /* serial, avoid any overhead */
+    tp_serial(n,chunk,work,data,poll,poll_data,interval);
+    return 1;
+  }
+
+  /* Start the workers. The calling thread is worker 0, unless it polls. */
+  loop.work = work;
+  loop.data = data;
+  loop.n = n;
+  loop.chunk = chunk;
+  loop.next = 0;
+  loop.n_done = 0;
+  loop.n_active = 0;
+  loop.stop = 0;
+  TP_LOCK_INIT(&loop.lock);
+  TP_COND_INIT(&loop.idle);
+  first = (poll != NULL) ? 0 : 1;
+  for (n_started=0, i=first; i<n_threads; i++) {
+    args[i].loop = &loop;
+    args[i].tid = i;
+    TP_LOCK(&loop.lock);
+    loop.n_active++;
+    TP_UNLOCK(&loop.lock);
+# ifdef _WIN32
+    th[n_started] = (HANDLE)_beginthreadex(NULL,0,tp_thread_main,&args[i],0,
+                                           NULL);
+    ok = (th[n_started] != 0);
+# else
+    ok = (pthread_create(&th[n_started],NULL,tp_thread_main,&args[i]) == 0);
+# endif
+    if (!ok) {
+      TP_LOCK(&loop.lock);
+      loop.n_active--;
+      TP_UNLOCK(&loop.lock);
+      break;
+    }
+    n_started++;
+  }
+  if (poll == NULL) {
+    args[0].loop = &loop;
+    args[0].tid = 0;
+    tp_worker(&args[0]);
+  } else if (n_started > 0) {
+    tp_wait_poll(&loop,poll,poll_data,interval);
+  }
+
+  /* Wait for the others */
+  for (i=0; i<n_started; i++) {
+# ifdef _WIN32
+    WaitForSingleObject(th[i],INFINITE);
+    CloseHandle(th[i]);
+# else
+    pthread_join(th[i],NULL);
+# endif
+  }
+  TP_COND_DESTROY(&loop.idle);
+  TP_LOCK_DESTROY(&loop.lock);
+
+  /* Account for the CPU time of the workers */
+  acc = tp_cpu_acc();
+  for (i=first; acc != NULL && i<first+n_started; i++) {
+    if (args[i].cpu >= 0.0) *acc += args[i].cpu;
+  }
+
+  if (poll == NULL) return n_started+1;
+  if (n_started == 0) { /* no thread could be started, do it all here */
+    tp_serial(n,chunk,work,data,poll,poll_data,interval);
+    return 1;
+  }
+  return n_started;
+#endif
+}
+
+/* See thread_pool.h */
+int tp_par_for(int n_threads, int n, int chunk, tp_work_func_t *work, 
+               void *data)
+{
+  return tp_run(n_threads,n,chunk,work,data,NULL,NULL,0.0);
+}
+
+/* See thread_pool.h */
+int tp_par_for_poll(int n_threads, int n, int chunk, tp_work_func_t *work, 
+                    void *data, tp_poll_func_t *poll, void *poll_data,
+                    double interval)
+{
+  return tp_run(n_threads,n,chunk,work,data,poll,poll_data,interval);
+}
@@ -56,6 +56,7 @@
 #include <ScreenWidget.h>
 #include <InitWidget.h>
 #include <mesh_run.h>
+#include <mesh_batch.h>
 #include <3dmodel.h>
 
 #ifndef _MESHICON_XPM
@@ -90,6 +91,7 @@ static void print_usage(FILE *out)
 {
   print_version(out);
   fprintf(out,"Usage: mesh [[options] file1 file2]\n");
+  fprintf(out,"       mesh [options] -batch manifest\n");
   fprintf(out,"\n");
   fprintf(out,"The program measures the distance from the 3D model in\n");
   fprintf(out,"file1 to the one in file2. The models must be given as\n");
@@ -100,6 +102,10 @@ static void print_usage(FILE *out)
   fprintf(out,"ignoring all transformations, and does not support USE tags\n");
   fprintf(out,"(DEF tags are ignored). Likewise the Inventor 2.x reader is\n");
   fprintf(out,"somewhat limited. The file type is autodetected.\n");
+  fprintf(out,"In text mode (-t) file1 can also be a point cloud (a PLY\n");
+  fprintf(out,"or OFF file without faces), in which case the distance is\n");
+  fprintf(out,"measured from each point (see -vertices-only), and the\n");
+  fprintf(out,"symmetric distance (-s) is not available.\n");
   fprintf(out,"After the distance is calculated the result is displayed\n");
   fprintf(out,"as overall measures in text form and as a detailed distance\n");
   fprintf(out,"map in graphical form.\n");
@@ -198,6 +204,68 @@ static void print_usage(FILE *out)
   fprintf(out,"      \twill probably crash your computer with a\n");
   fprintf(out,"      \tswap storm. Not compatible with the -t option.\n");
   fprintf(out,"\n");
+  fprintf(out,"  -batch f\tRun all the distance measurements listed in\n");
+  fprintf(out,"          \tthe manifest file f, and print a table with\n");
+  fprintf(out,"          \tthe results. The GUI is not used. Each line\n");
+  fprintf(out,"          \tof f gives either a pair of model files (the\n");
+  fprintf(out,"          \tdistance is measured from the first to the\n");
+  fprintf(out,"          \tsecond), or a single model file which is\n");
+  fprintf(out,"          \tcompared to the reference model set by the\n");
+  fprintf(out,"          \tlast \"-ref file\" line. Empty lines and lines\n");
+  fprintf(out,"          \tstarting with '#' are ignored. File names\n");
+  fprintf(out,"          \twith spaces must be in double quotes. Files\n");
+  fprintf(out,"          \tused several times are read only once.\n");
+  fprintf(out,"          \tErrors in one measurement do not stop the\n");
+  fprintf(out,"          \tothers. The other options apply to each\n");
+  fprintf(out,"          \tmeasurement.\n");
+  fprintf(out,"\n");
+  fprintf(out,"  -j n\tUse n threads. By default as many as processors.\n");
+  fprintf(out,"\n");
+  fprintf(out,"  -o fmt\tPrint the results in the machine readable\n");
+  fprintf(out,"        \tformat fmt (json or csv) on standard output,\n");
+  fprintf(out,"        \tincluding the model information and the time\n");
+  fprintf(out,"        \tused by each processing stage. The human\n");
+  fprintf(out,"        \treadable output and progress go to standard\n");
+  fprintf(out,"        \terror. Not compatible with the -wlog option.\n");
+  fprintf(out,"\n");
+  fprintf(out,"  -stats\tCollect and print statistics on the distance\n");
+  fprintf(out,"        \tqueries (cells and triangles scanned per\n");
+  fprintf(out,"        \tsample, histograms of the grid cell lengths,\n");
+  fprintf(out,"        \tetc.), useful to tune the partitioning grid.\n");
+  fprintf(out,"        \tIn batch mode they are only output with -o.\n");
+  fprintf(out,"\n");
+  fprintf(out,"  -autogrid\tAuto-tune the size of the partitioning grid\n");
+  fprintf(out,"           \tcells by timing probe distance queries with\n");
+  fprintf(out,"           \tseveral candidate sizes, and use the fastest.\n");
+  fprintf(out,"           \tIn batch mode the grid of each model is tuned\n");
+  fprintf(out,"           \twith samples of the first model measured\n");
+  fprintf(out,"           \tagainst it.\n");
+  fprintf(out,"\n");
+  fprintf(out,"  -signed\tCalculate the signed distance from model 1 to\n");
+  fprintf(out,"         \tmodel 2, positive on the side of model 2 its\n");
+  fprintf(out,"         \tnormals point to (outside for a closed model\n");
+  fprintf(out,"         \toriented outwards), and print its min, max,\n");
+  fprintf(out,"         \tmean and histogram. Model 2 is oriented if\n");
+  fprintf(out,"         \tpossible. The error displayed by the GUI is\n");
+  fprintf(out,"         \tthen signed, with a two-sided colormap. The\n");
+  fprintf(out,"         \tdistance from model 2 to 1 (-s) is unsigned.\n");
+  fprintf(out,"         \tIn batch mode it is only output with -o.\n");
+  fprintf(out,"\n");
+  fprintf(out,"  -vertices-only\tCalculate the distance only from each\n");
+  fprintf(out,"                \tvertex of model 1, instead of from\n");
+  fprintf(out,"                \tsamples of its triangles, using the\n");
+  fprintf(out,"                \tthreads given by -j. Much faster, but\n");
+  fprintf(out,"                \tthe statistics are per vertex, not\n");
+  fprintf(out,"                \tweighted by area, and the -l, -mf and\n");
+  fprintf(out,"                \t-autogrid options are ignored. The GUI is\n");
+  fprintf(out,"                \tnot used.\n");
+  fprintf(out,"\n");
+  fprintf(out,"  -skip-m1-analysis\tDo not analyze the topology and\n");
+  fprintf(out,"                   \torientation of model 1, which is not\n");
+  fprintf(out,"                   \tneeded to measure the distance. Its\n");
+  fprintf(out,"                   \tmodel information is then not\n");
+  fprintf(out,"                   \treported. Only with -t or -batch.\n");
+  fprintf(out,"\n");
 }
 
 /* Initializes *pargs to default values and parses the command line arguments
@@ -253,6 +321,44 @@ static void parse_args(int argc, char **argv, struct args *pargs)
 	pargs->do_wlog = 1;
       } else if (strcmp(argv[i], "-tex") == 0) { /* enable textures */
         pargs->do_texture = 1;
+      } else if (strcmp(argv[i], "-batch") == 0) { /* batch manifest */
+        if (argc <= i+1) {
+          fprintf(stderr,"ERROR: missing argument for -batch option\n");
+          exit(1);
+        }
+        pargs->batch_fname = argv[++i];
+        pargs->no_gui = 1;
+      } else if (strcmp(argv[i], "-j") == 0) { /* number of threads */
+        if (argc <= i+1) {
+          fprintf(stderr,"ERROR: missing argument for -j option\n");
+          exit(1);
+        }
+        pargs->n_threads = strtol(argv[++i],&endptr,10);
+        if (argv[i][0] == '\0' || *endptr != '\0' || pargs->n_threads <= 0) {
+          fprintf(stderr,"ERROR: invalid number for -j option\n");
+          exit(1);
+        }
+      } else if (strcmp(argv[i], "-o") == 0) { /* output format */
+        if (argc <= i+1) {
+          fprintf(stderr,"ERROR: missing argument for -o option\n");
+          exit(1);
+        }
+        pargs->out_format = parse_out_format(argv[++i]);
+        if (pargs->out_format < 0) {
+          fprintf(stderr,"ERROR: invalid format for -o option\n");
+          exit(1);
+        }
+      } else if (strcmp(argv[i], "-stats") == 0) { /* query statistics */
+        pargs->do_qstats = 1;
+      } else if (strcmp(argv[i], "-autogrid") == 0) { /* tune grid */
+        pargs->do_autogrid = 1;
+      } else if (strcmp(argv[i], "-signed") == 0) { /* signed distance */
+        pargs->do_signed = 1;
+      } else if (strcmp(argv[i], "-vertices-only") == 0) { /* vertices */
+        pargs->do_vertices_only = 1;
+        pargs->no_gui = 1;
+      } else if (strcmp(argv[i], "-skip-m1-analysis") == 0) { /* no m1 info */
+        pargs->skip_m1_analysis = 1;
       } 
       else { /* unrecognized option */
         fprintf(stderr,
@@ -272,10 +378,23 @@ static void parse_args(int argc, char **argv, struct args *pargs)
     }
     i++; /* next argument */
   }
+  if (pargs->batch_fname != NULL &&
+      (pargs->m1_fname != NULL || pargs->m2_fname != NULL)) {
+    fprintf(stderr, "ERROR: no file names allowed with -batch option\n");
+    exit(1);
+  }
   if (pargs->no_gui && pargs->do_wlog) {
     fprintf(stderr, "ERROR: incompatible options -t and -wlog\n");
     exit(1);
   }
+  if (pargs->out_format != MESH_OUT_TEXT && pargs->do_wlog) {
+    fprintf(stderr, "ERROR: incompatible options -o and -wlog\n");
+    exit(1);
+  }
+  if (!pargs->no_gui && pargs->skip_m1_analysis) {
+    fprintf(stderr, "ERROR: option -skip-m1-analysis requires -t\n");
+    exit(1);
+  }
   if (pargs->no_gui && pargs->do_texture) {
     fprintf(stderr, "ERROR: incompatible options -t and -tex\n");
     exit(1);
@@ -304,6 +423,7 @@ int main( int argc, char **argv )
   QPixmap *qpxMeshIcon=NULL;
   struct model_error model1,model2;
   int rcode;
+  int cancelled;
   struct outbuf *log;
   struct prog_reporter pr;
 
@@ -316,12 +436,17 @@ int main( int argc, char **argv )
   memset(&model2,0,sizeof(model2));
   memset(&pr,0,sizeof(pr));
   log = NULL;
+  cancelled = 0;
   i = 0;
   while (i<argc) {
     if (strcmp(argv[i],"-t") == 0) /* text version requested */
       break; 
     if (strcmp(argv[i],"-h") == 0) /* just asked for command line help */
       break; 
+    if (strcmp(argv[i],"-batch") == 0) /* batch mode, text only */
+      break; 
+    if (strcmp(argv[i],"-vertices-only") == 0) /* text only */
+      break; 
     i++;
   }
   if (i == argc) { /* no text version requested, initialize QT */
@@ -337,6 +462,15 @@ int main( int argc, char **argv )
   /* Parse arguments */
   parse_args(argc,argv,&pargs);
 
+  /* Batch mode runs without GUI and exits */
+  if (pargs.batch_fname != NULL) {
+    log = outbuf_new(stdio_puts,stdout);
+    rcode = mesh_run_batch(&pargs,log);
+    outbuf_delete(log);
+    delete qpxMeshIcon;
+    return (rcode != 0) ? 1 : 0;
+  }
+
   /* Display starting dialog if insufficient arguments */
   if (pargs.m1_fname != NULL || pargs.m2_fname != NULL) {
     if (pargs.m1_fname == NULL || pargs.m2_fname == NULL) {
@@ -354,22 +488,25 @@ int main( int argc, char **argv )
     }
     if (pargs.no_gui) {
       pr.prog = stdio_prog;
-      pr.cb_out = stdout;
+      /* Keep standard output clean for machine readable results */
+      pr.cb_out = (pargs.out_format != MESH_OUT_TEXT) ? stderr : stdout;
     } else {
-      qProg = new QProgressDialog("Calculating distance",0,100);
+      qProg = new QProgressDialog("Calculating distance","Cancel",100);
       qProg->setIcon(*qpxMeshIcon);
       qProg->setMinimumDuration(1500);
       pr.prog = QT_prog;
       pr.cb_out = qProg;
     }
 
-    mesh_run(&pargs, &model1, &model2, log, &pr);
+    cancelled = mesh_run(&pargs, &model1, &model2, log, &pr);
   } else {
     b = new InitWidget(pargs, &model1, &model2);
     b->setIcon(*qpxMeshIcon);
     b->show(); 
   }
-  if (a != NULL) {
+  if (cancelled) {
+    rcode = 1;
+  } else if (a != NULL) {
     if (pargs.m1_fname != NULL || pargs.m2_fname != NULL) {
       c = new ScreenWidget(&model1, &model2, &pargs);
       c->setIcon(*qpxMeshIcon);
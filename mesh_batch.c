@@ -0,0 +1,644 @@
+/* $Id$ */
+
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+
+
+
+
+
+
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <xalloc.h>
+#include <model_analysis.h>
+#include <compute_error.h>
+#include <geomutils.h>
+#include <thread_pool.h>
+#include <timing.h>
+
+#include <mesh_batch.h>
+
+/* Maximum length of a line in the manifest */
+#define BATCH_LINE_MAX 4096
+
+/* Number of buckets in the file name hash table (must be a power of 2) */
+#define BATCH_HASH_SZ 4096
+
+/* --------------------------------------------------------------------------*
+ *                       Local data types                                    *
+ * --------------------------------------------------------------------------*/
+
+/* A model file used in the batch */
+struct batch_file {
+  char *fname;            /* The file name */
+  int n_uses;             /* The number of measurements that use the file. If
+                           * more than one, the model is read before starting
+                           * the measurements and shared by them, otherwise
+                           * it is read by the measurement itself. */
+  int as_model2;          /* Non-zero if the model is used as model 2 in some
+                           * measurement, so that it needs a spatial index */
+  int probe_job;          /* The measurement whose other model is sampled to
+                           * auto-tune the grid of the index: the first one
+                           * using the file as model 2, or as model 1 if
+                           * none */
+  struct model *mesh;     /* The model, NULL if not loaded or on error */
+  struct model_info info; /* The model analysis information */
+  int analyzed;           /* Non-zero if the model has been analyzed (not a
+                           * point cloud nor skipped) */
+  int n_vert;             /* The number of vertices of the model */
+  int n_faces;            /* The number of faces of the model */
+  double bbox_diag;       /* The bounding box diagonal of the model */
+  struct stage_time t_read;    /* The time used to read the model */
+  struct stage_time t_analyze; /* The time used to analyze the model */
+  struct surf_index *si;  /* The spatial index on the model surface, NULL if
+                           * not needed or not yet built */
+  const char *errstr;     /* The reason for which the model could not be
+                           * loaded. NULL if no error. */
+  int next;               /* Next file in the same hash bucket, -1 if none */
+};
+
+/* A distance measurement in the batch */
+struct batch_job {
+  int f1;                 /* The index of the model 1 file */
+  int f2;                 /* The index of the model 2 file */
+  int line;               /* The line of the manifest defining it */
+  const char *errstr;     /* Error message if the measurement failed, NULL
+                           * otherwise */
+  const char *err_fname;  /* The file that caused the error, if any */
+  double bbox2_diag;      /* The bounding box diagonal of model 2 */
+  struct dist_surf_surf_stats stats;     /* Statistics from model 1 to 2 */
+  struct dist_surf_surf_stats stats_rev; /* Statistics from model 2 to 1,
+                                          * only if symmetric */
+};
+
+/* The complete batch */
+struct batch {
+  const struct args *args;  /* The program arguments */
+  struct batch_file *files; /* The model files, without repetitions */
+  int n_files;              /* The number of elements in files */
+  int files_sz;             /* The allocated size of files */
+  int hash[BATCH_HASH_SZ];  /* The first file in each hash bucket, -1 if
+                             * empty */
+  struct batch_job *jobs;   /* The measurements, in manifest order */
+  int n_jobs;               /* The number of elements in jobs */
+  int jobs_sz;              /* The allocated size of jobs */
+  int *shared;              /* The indices of the files that are shared */
+  int n_shared;             /* The number of elements in shared */
+};
+
+/* --------------------------------------------------------------------------*
+ *                            Local functions                                *
+ * --------------------------------------------------------------------------*/
+
+/* Prints the error message msg for line lineno of the manifest fname and
+ * exits. */
+static void manifest_error(const char *fname, int lineno, const char *msg)
+{
+  fprintf(stderr,"ERROR: %s:%d: %s\n",fname,lineno,msg);
+  exit(1);
+}
+
+/* Returns the index of the file fname in b->files, adding it if not yet
+ * present. */
+static int get_batch_file(struct batch *b, const char *fname)
+{
+  unsigned int h;
+  const char *c;
+  int i;
+  struct batch_file *bf;
+
+  for (h=0, c=fname; *c != '\0'; c++) {
+    h = h*31+(unsigned char)*c;
+  }
+  h &= BATCH_HASH_SZ-1;
+  for (i=b->hash[h]; i>=0; i=b->files[i].next) {
+    if (strcmp(b->files[i].fname,fname) == 0) return i;
+  }
+  if (b->n_files == b->files_sz) {
+    b->files_sz += (b->files_sz+16)/2;
+    b->files = xa_realloc(b->files,b->files_sz*sizeof(*(b->files)));
+  }
+  i = b->n_files++;
+  bf = &(b->files[i]);
+  memset(bf,0,sizeof(*bf));
+  bf->fname = xa_malloc(strlen(fname)+1);
+  strcpy(bf->fname,fname);
+  bf->next = b->hash[h];
+  b->hash[h] = i;
+  return i;
+}
+
+/* Adds a measurement from file f1 to file f2 (indices in b->files),
+ * defined at line lineno of the manifest. */
+static void add_batch_job(struct batch *b, int f1, int f2, int lineno)
+{
+  struct batch_job *job;
+
+  if (b->n_jobs == b->jobs_sz) {
+    b->jobs_sz += (b->jobs_sz+16)/2;
+    b->jobs = xa_realloc(b->jobs,b->jobs_sz*sizeof(*(b->jobs)));
+  }
+  job = &(b->jobs[b->n_jobs++]);
+  memset(job,0,sizeof(*job));
+  job->f1 = f1;
+  job->f2 = f2;
+  job->line = lineno;
+  if (b->files[f1].n_uses == 0) b->files[f1].probe_job = b->n_jobs-1;
+  if (!b->files[f2].as_model2) b->files[f2].probe_job = b->n_jobs-1;
+  b->files[f1].n_uses++;
+  b->files[f2].n_uses++;
+  b->files[f2].as_model2 = 1;
+}
+
+/* Splits the string str in whitespace separated tokens, storing a pointer
+ * to each in tok. A token can be enclosed in double quotes, in which case
+ * it can contain whitespace (but not double quotes). At most max_tok tokens
+ * are stored. The string is modified to terminate each token. Returns the
+ * number of tokens found (which can be larger than max_tok), or -1 if a
+ * quote is not closed or is not followed by whitespace. */
+static int split_line(char *str, char **tok, int max_tok)
+{
+  int n;
+
+  n = 0;
+  for (;;) {
+    while (isspace((unsigned char)*str)) str++;
+    if (*str == '\0') break;
+    if (*str == '"') {
+      str++;
+      if (n < max_tok) tok[n] = str;
+      n++;
+      while (*str != '\0' && *str != '"') str++;
+      if (*str == '\0') return -1;
+      *(str++) = '\0';
+      if (*str == '\0') break;
+      if (!isspace((unsigned char)*str)) return -1;
+      str++;
+      continue;
+    }
+    if (n < max_tok) tok[n] = str;
+    n++;
+    while (*str != '\0' && !isspace((unsigned char)*str)) str++;
+    if (*str == '\0') break;
+    *(str++) = '\0';
+  }
+  return n;
+}
+
+/* Reads the manifest file fname and fills the file and measurement lists of
+ * b. If the manifest can not be read or has syntax errors the program
+ * exits. */
+static void read_manifest(struct batch *b, const char *fname)
+{
+  FILE *f;
+  char line[BATCH_LINE_MAX];
+  char *tok[2];
+  char *c;
+  int n_tok,lineno,ref;
+
+  f = fopen(fname,"r");
+  if (f == NULL) {
+    fprintf(stderr,"ERROR: %s: %s\n",fname,strerror(errno));
+    exit(1);
+  }
+  ref = -1;
+  lineno = 0;
+  while (fgets(line,sizeof(line),f) != NULL) {
+    lineno++;
+    if (strchr(line,'\n') == NULL && !feof(f)) {
+      manifest_error(fname,lineno,"line too long");
+    }
+    for (c=line; isspace((unsigned char)*c); c++);
+    if (*c == '#') continue; /* comment */
+    n_tok = split_line(line,tok,2);
+    if (n_tok < 0) {
+      manifest_error(fname,lineno,"unbalanced quotes");
+    }
+    if (n_tok == 0) continue; /* empty */
+    if (strcmp(tok[0],"-ref") == 0) { /* reference model */
+      if (n_tok != 2) {
+        manifest_error(fname,lineno,"-ref requires exactly one file name");
+      }
+      ref = get_batch_file(b,tok[1]);
+    } else if (n_tok == 1) { /* candidate for the reference model */
+      if (ref < 0) {
+        manifest_error(fname,lineno,"no reference model (missing -ref line)");
+      }
+      add_batch_job(b,get_batch_file(b,tok[0]),ref,lineno);
+    } else if (n_tok == 2) { /* model pair */
+      add_batch_job(b,get_batch_file(b,tok[0]),get_batch_file(b,tok[1]),
+                    lineno);
+    } else {
+      manifest_error(fname,lineno,"too many file names");
+    }
+  }
+  if (ferror(f)) {
+    fprintf(stderr,"ERROR: %s: I/O error\n",fname);
+    exit(1);
+  }
+  fclose(f);
+}
+
+/* Frees the model and spatial index of bf */
+static void unload_batch_file(struct batch_file *bf)
+{
+  if (bf->mesh != NULL) __free_raw_model(bf->mesh);
+  free_surf_index(bf->si);
+  bf->mesh = NULL;
+  bf->si = NULL;
+}
+
+/* Reads and analyzes the model of bf. If needs_index is non-zero the model
+ * will be indexed (see index_batch_file()): for the signed distance it is
+ * then oriented, if possible. Otherwise the model can be a point cloud,
+ * which is not analyzed. On error bf->mesh is NULL and bf->errstr is
+ * set. */
+static void load_batch_file(struct batch_file *bf, int needs_index,
+                            const struct args *args)
+{
+  int rcode;
+
+  stage_begin(&(bf->t_read));
+  bf->mesh = read_model_file(bf->fname,!needs_index,&(bf->errstr));
+  stage_end(&(bf->t_read));
+  if (bf->mesh == NULL) return;
+  bf->n_vert = bf->mesh->num_vert;
+  bf->n_faces = bf->mesh->num_faces;
+  bf->bbox_diag = dist_v(&(bf->mesh->bBox[0]),&(bf->mesh->bBox[1]));
+  stage_begin(&(bf->t_analyze));
+  bf->analyzed = (bf->n_faces > 0 && (needs_index || !args->skip_m1_analysis));
+  rcode = 0;
+  if (bf->analyzed) {
+    /* files are loaded in parallel, so analyze each with one thread */
+    rcode = analyze_model(bf->mesh,&(bf->info),
+                          (needs_index && args->do_signed),1,0,NULL,NULL);
+  } else { /* point cloud, no topology, or not requested */
+    memset(&(bf->info),0,sizeof(bf->info));
+  }
+  stage_end(&(bf->t_analyze));
+  if (rcode != 0) {
+    bf->errstr = dist_error_str(rcode);
+    unload_batch_file(bf);
+  }
+}
+
+/* Builds the spatial index on the surface of the model of bf, already
+ * loaded. For the signed distance the index includes the
+ * pseudo-normals. If probe is not NULL the grid is auto-tuned with samples
+ * of probe, the model measured against bf, taken with the sampling density
+ * of the measurements whose model 2 has the bounding box diagonal
+ * diag2. Otherwise, or if probe is a point cloud, the grid is not tuned. On
+ * error bf is unloaded and bf->errstr is set. */
+static void index_batch_file(struct batch_file *bf, const struct model *probe,
+                             double diag2, const struct args *args)
+{
+  double abs_sampling_step;
+  int sflags;                   /* DIST_SIGNED if requested */
+  int rcode;
+
+  sflags = (args->do_signed ? DIST_SIGNED : 0);
+  if (probe != NULL && probe->num_faces > 0) {
+    abs_sampling_step = args->sampling_step*diag2;
+    rcode = build_surf_index(&(bf->si),bf->mesh,NULL,NULL,probe,
+                             1/(abs_sampling_step*abs_sampling_step),sflags);
+  } else {
+    rcode = build_surf_index(&(bf->si),bf->mesh,NULL,NULL,NULL,0,sflags);
+  }
+  if (rcode != 0) {
+    bf->errstr = dist_error_str(rcode);
+    unload_batch_file(bf);
+  }
+}
+
+/* Worker function to load the shared files b->shared[start] to
+ * b->shared[end-1]. */
+static void load_shared_work(void *data, int start, int end, int tid)
+{
+  struct batch *b;
+  struct batch_file *bf;
+  int i;
+
+  b = (struct batch*)data;
+  (void)tid;
+  for (i=start; i<end; i++) {
+    bf = &(b->files[b->shared[i]]);
+    load_batch_file(bf,bf->as_model2 || b->args->do_symmetric,b->args);
+  }
+}
+
+/* Worker function to build the index of the shared files b->shared[start]
+ * to b->shared[end-1] that need one, once all of them are loaded. If the
+ * grid is auto-tuned, the probe model is the other model of the file's
+ * probe_job. It is read just for the probe queries if it is not shared. */
+static void index_shared_work(void *data, int start, int end, int tid)
+{
+  struct batch *b;
+  struct batch_file *bf,*pf;
+  const struct batch_job *job;
+  struct model *probe;
+  const char *errstr;
+  double diag2;
+  int i,f;
+
+  b = (struct batch*)data;
+  (void)tid;
+  for (i=start; i<end; i++) {
+    f = b->shared[i];
+    bf = &(b->files[f]);
+    if (bf->mesh == NULL || !(bf->as_model2 || b->args->do_symmetric)) {
+      continue;
+    }
+    job = &(b->jobs[bf->probe_job]);
+    pf = &(b->files[(job->f2 == f) ? job->f1 : job->f2]);
+    probe = NULL;
+    if (b->args->do_autogrid && !b->args->do_vertices_only) {
+      probe = (pf->n_uses > 1) ? pf->mesh :
+        read_model_file(pf->fname,1,&errstr);
+    }
+    /* the sampling density is relative to model 2, as in run_batch_job() */
+    if (job->f2 == f || probe == NULL) {
+      diag2 = bf->bbox_diag;
+    } else {
+      diag2 = dist_v(&(probe->bBox[0]),&(probe->bBox[1]));
+    }
+    index_batch_file(bf,probe,diag2,b->args);
+    if (probe != NULL && pf->n_uses == 1) __free_raw_model(probe);
+  }
+}
+
+/* Runs the measurement job of batch b. */
+static void run_batch_job(struct batch *b, struct batch_job *job)
+{
+  struct batch_file *bf1,*bf2;
+  struct model_error me;
+  double abs_sampling_step,abs_sampling_dens;
+  int qflags;                   /* DIST_QUERY_STATS if requested */
+  int sflags;                   /* DIST_SIGNED if requested */
+  int tune;                     /* auto-tune the grid of the indices */
+  int rcode;
+
+  bf1 = &(b->files[job->f1]);
+  bf2 = &(b->files[job->f2]);
+  /* Read and index the files that are not shared (used by this job only),
+   * each grid being tuned with samples of the other model */
+  if (bf1->n_uses == 1) load_batch_file(bf1,b->args->do_symmetric,b->args);
+  if (bf2->n_uses == 1) load_batch_file(bf2,1,b->args);
+  tune = b->args->do_autogrid && !b->args->do_vertices_only;
+  if (bf1->mesh != NULL && bf2->mesh != NULL) {
+    if (bf2->n_uses == 1) {
+      index_batch_file(bf2,(tune ? bf1->mesh : NULL),bf2->bbox_diag,b->args);
+    }
+    if (bf1->n_uses == 1 && b->args->do_symmetric && bf2->mesh != NULL) {
+      index_batch_file(bf1,(tune ? bf2->mesh : NULL),bf2->bbox_diag,b->args);
+    }
+  }
+
+  if (bf1->mesh == NULL) {
+    job->errstr = bf1->errstr;
+    job->err_fname = bf1->fname;
+  } else if (bf2->mesh == NULL) {
+    job->errstr = bf2->errstr;
+    job->err_fname = bf2->fname;
+  } else {
+    /* Sampling step is relative to model 2, as in mesh_run() */
+    job->bbox2_diag = dist_v(&(bf2->mesh->bBox[0]),&(bf2->mesh->bBox[1]));
+    abs_sampling_step = b->args->sampling_step*job->bbox2_diag;
+    abs_sampling_dens = 1/(abs_sampling_step*abs_sampling_step);
+    qflags = (b->args->do_qstats ? DIST_QUERY_STATS : 0);
+    sflags = (b->args->do_signed ? DIST_SIGNED : 0);
+    /* The jobs already run in parallel, so one thread per job */
+    memset(&me,0,sizeof(me));
+    me.mesh = bf1->mesh;
+    if (b->args->do_vertices_only || bf1->n_faces == 0) {
+      rcode = dist_verts_idx(&me,bf2->si,&(job->stats),qflags|sflags,1,NULL);
+    } else {
+      rcode = dist_surf_idx(&me,bf2->si,abs_sampling_dens,
+                            b->args->min_sample_freq,&(job->stats),
+                            qflags|sflags,1,NULL);
+    }
+    free_face_error(me.fe);
+    free(me.verror);
+    if (rcode != 0) {
+      job->errstr = dist_error_str(rcode);
+      job->err_fname = bf1->fname;
+    } else if (b->args->do_symmetric) {
+      memset(&me,0,sizeof(me));
+      me.mesh = bf2->mesh;
+      if (b->args->do_vertices_only) {
+        rcode = dist_verts_idx(&me,bf1->si,&(job->stats_rev),qflags,1,NULL);
+      } else {
+        rcode = dist_surf_idx(&me,bf1->si,abs_sampling_dens,
+                              b->args->min_sample_freq,&(job->stats_rev),
+                              qflags,1,NULL);
+      }
+      free_face_error(me.fe);
+      free(me.verror);
+      if (rcode != 0) {
+        job->errstr = dist_error_str(rcode);
+        job->err_fname = bf2->fname;
+      }
+    }
+  }
+
+  if (bf1->n_uses == 1) unload_batch_file(bf1);
+  if (bf2->n_uses == 1) unload_batch_file(bf2);
+}
+
+/* Worker function to run the jobs start to end-1 of the batch data */
+static void run_jobs_work(void *data, int start, int end, int tid)
+{
+  struct batch *b;
+  int i;
+
+  b = (struct batch*)data;
+  (void)tid;
+  for (i=start; i<end; i++) {
+    run_batch_job(b,&(b->jobs[i]));
+  }
+}
+
+/* Prints the results of the batch b to out */
+static void print_batch_results(const struct batch *b, struct outbuf *out)
+{
+  const struct batch_job *job;
+  double dmin,dmax,dmean,drms;
+  int i,n_samples;
+
+  if (b->args->do_symmetric) {
+    outbuf_printf(out,"\n       Symmetric distance between model 1 and "
+                  "model 2\n\n");
+  } else {
+    outbuf_printf(out,"\n       Distance from model 1 to model 2\n\n");
+  }
+  outbuf_printf(out,"Line\t        Min\t        Max\t       Mean\t"
+                "        RMS\t Max %%diag\t  Samples\tModel 1\tModel 2\n");
+  for (i=0; i<b->n_jobs; i++) {
+    job = &(b->jobs[i]);
+    if (job->errstr != NULL) {
+      outbuf_printf(out,"%4d\tERROR: %.100s: %.100s\n",job->line,
+                    job->err_fname,job->errstr);
+      continue;
+    }
+    dmin = job->stats.min_dist;
+    dmax = job->stats.max_dist;
+    dmean = job->stats.mean_dist;
+    drms = job->stats.rms_dist;
+    n_samples = job->stats.m1_samples;
+    if (b->args->do_symmetric) {
+      dmin = max(dmin,job->stats_rev.min_dist);
+      dmax = max(dmax,job->stats_rev.max_dist);
+      dmean = max(dmean,job->stats_rev.mean_dist);
+      drms = max(drms,job->stats_rev.rms_dist);
+      n_samples += job->stats_rev.m1_samples;
+    }
+    outbuf_printf(out,"%4d\t%11g\t%11g\t%11g\t%11g\t%10g\t%9d\t",
+                  job->line,dmin,dmax,dmean,drms,dmax/job->bbox2_diag*100,
+                  n_samples);
+    outbuf_printf(out,"%.240s\t",b->files[job->f1].fname);
+    outbuf_printf(out,"%.240s\n",b->files[job->f2].fname);
+  }
+  outbuf_printf(out,"\n");
+  outbuf_flush(out);
+}
+
+/* Fills the model result mr for output from the file bf */
+static void get_model_result(struct model_result *mr,
+                             const struct batch_file *bf)
+{
+  mr->fname = bf->fname;
+  mr->n_vert = bf->n_vert;
+  mr->n_faces = bf->n_faces;
+  mr->bbox_diag = bf->bbox_diag;
+  mr->info = bf->analyzed ? &(bf->info) : NULL;
+  mr->t_read = bf->t_read;
+  mr->t_analyze = bf->t_analyze;
+}
+
+/* Prints the results of the batch b to out in the machine readable format
+ * b->args->out_format. */
+static void output_batch_results(const struct batch *b, struct outbuf *out)
+{
+  const struct batch_job *job;
+  struct mesh_result res;
+  int i;
+
+  output_results_begin(out,b->args->out_format);
+  for (i=0; i<b->n_jobs; i++) {
+    job = &(b->jobs[i]);
+    memset(&res,0,sizeof(res));
+    res.line = job->line;
+    res.errstr = job->errstr;
+    res.err_fname = job->err_fname;
+    get_model_result(&res.m1,&(b->files[job->f1]));
+    get_model_result(&res.m2,&(b->files[job->f2]));
+    if (job->errstr == NULL) {
+      res.abs_sampling_step = b->args->sampling_step*job->bbox2_diag;
+      res.stats = &(job->stats);
+      res.stats_rev = (b->args->do_symmetric) ? &(job->stats_rev) : NULL;
+    }
+    output_result(out,b->args->out_format,&res,i);
+  }
+  output_results_end(out,b->args->out_format);
+}
+
+/* --------------------------------------------------------------------------*
+ *                          External functions                               *
+ * --------------------------------------------------------------------------*/
+
+/* See mesh_batch.h */
+int mesh_run_batch(const struct args *args, struct outbuf *out)
+{
+  struct batch b;
+  int i,n_threads,n_failed;
+  struct outbuf *log;
+
+  /* With machine readable output, out only gets the results */
+  log = (args->out_format != MESH_OUT_TEXT) ?
+    outbuf_new(stdio_puts,stderr) : out;
+  memset(&b,0,sizeof(b));
+  b.args = args;
+  for (i=0; i<BATCH_HASH_SZ; i++) b.hash[i] = -1;
+  n_threads = (args->n_threads > 0) ? args->n_threads : tp_num_cpus();
+
+  read_manifest(&b,args->batch_fname);
+  outbuf_printf(log,"Batch of %d measurements on %d model files, "
+                "using %d threads\n",b.n_jobs,b.n_files,n_threads);
+  outbuf_flush(log);
+
+  /* Read, analyze and index the models used more than once */
+  b.shared = xa_malloc((b.n_files+1)*sizeof(*(b.shared)));
+  for (i=0; i<b.n_files; i++) {
+    if (b.files[i].n_uses > 1) b.shared[b.n_shared++] = i;
+  }
+  tp_par_for(n_threads,b.n_shared,1,load_shared_work,&b);
+  tp_par_for(n_threads,b.n_shared,1,index_shared_work,&b);
+
+  /* Run the measurements, one per thread at a time */
+  tp_par_for(n_threads,b.n_jobs,1,run_jobs_work,&b);
+
+  if (args->out_format != MESH_OUT_TEXT) {
+    output_batch_results(&b,out);
+  } else {
+    print_batch_results(&b,out);
+  }
+  for (n_failed=0, i=0; i<b.n_jobs; i++) {
+    if (b.jobs[i].errstr != NULL) n_failed++;
+  }
+  if (n_failed != 0) {
+    outbuf_printf(log,"WARNING: %d of %d measurements failed\n",n_failed,
+                  b.n_jobs);
+    outbuf_flush(log);
+  }
+  if (log != out) outbuf_delete(log);
+
+  /* Free all storage */
+  for (i=0; i<b.n_files; i++) {
+    unload_batch_file(&(b.files[i]));
+    free(b.files[i].fname);
+  }
+  free(b.files);
+  free(b.jobs);
+  free(b.shared);
+  return n_failed;
+}
@@ -0,0 +1,89 @@
+/* $Id$ */
+
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+
+
+
+
+
+
+#ifndef _MESH_BATCH_PROTO
+#define _MESH_BATCH_PROTO
+
+#include <mesh_run.h>
+#include <reporting.h>
+
+#ifdef __cplusplus
+#define BEGIN_DECL extern "C" {
+#define END_DECL }
+#else
+#define BEGIN_DECL
+#define END_DECL
+#endif
+
+BEGIN_DECL
+#undef BEGIN_DECL
+
+/* Runs the distance measurements listed in the batch manifest file
+ * args->batch_fname, using args->n_threads worker threads. The other fields
+ * of args are applied to each measurement as in mesh_run(), except that no
+ * GUI is used. The manifest is a text file with one entry per line. Empty
+ * lines and lines starting with '#' are ignored. A line with two file names
+ * requests the distance from the model in the first file to the one in the
+ * second. A line of the form "-ref file" sets the reference model, and the
+ * following lines with a single file name request the distance from the
+ * model in that file to the reference model. File names containing
+ * whitespace must be enclosed in double quotes (and can then not contain
+ * double quotes). Each file is read only once, even if it appears in several
+ * entries, and the data derived from a reference model is shared by all the
+ * measurements using it. A measurement that fails (e.g., unreadable file)
+ * is reported as such in the results but does not stop the others. If the
+ * manifest can not be read or has syntax errors, an error message is
+ * printed and the program exits. The results table is printed through the
+ * output buffer out. Returns the number of failed measurements. */
+int mesh_run_batch(const struct args *args, struct outbuf *out);
+
+END_DECL
+#undef END_DECL
+
+#endif /* _MESH_BATCH_PROTO */
@@ -0,0 +1,482 @@
+/* $Id$ */
+
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+
+
+
+
+
+#include <mesh_output.h>
+
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+/* Maximum depth of nested objects */
+#define EMIT_MAX_DEPTH 8
+
+/* Maximum length of the CSV column name prefix */
+#define EMIT_PREFIX_MAX 64
+
+/* --------------------------------------------------------------------------*
+ *                       Local data types                                    *
+ * --------------------------------------------------------------------------*/
+
+/* State of the output of named fields, common to JSON and CSV. JSON objects
+ * map to CSV column names prefixed with the names of the enclosing objects,
+ * so that the same code outputs both formats. */
+struct emitter {
+  struct outbuf *out;     /* The output buffer */
+  int format;             /* MESH_OUT_JSON or MESH_OUT_CSV */
+  int header;             /* If non-zero only the CSV column names are
+                           * output, not the values */
+  int missing;            /* If non-zero the values are output as missing
+                           * (null in JSON, empty in CSV) */
+  int depth;              /* The current object nesting depth */
+  int n_fields[EMIT_MAX_DEPTH]; /* The number of fields already output at
+                                 * each depth, for the JSON separators */
+  int n_cols;             /* The number of CSV columns already output */
+  char prefix[EMIT_PREFIX_MAX]; /* The CSV column name prefix */
+  int prefix_len[EMIT_MAX_DEPTH]; /* The length of the CSV column name
+                                   * prefix before entering each depth,
+                                   * since names can contain '_' */
+};
+
+/* --------------------------------------------------------------------------*
+ *                            Local functions                                *
+ * --------------------------------------------------------------------------*/
+
+/* Outputs the separator and the name of a new field (JSON) or column
+ * (CSV). */
+static void emit_key(struct emitter *e, const char *name)
+{
+  if (e->format == MESH_OUT_JSON) {
+    if (e->n_fields[e->depth]++ > 0) outbuf_printf(e->out,",");
+    outbuf_printf(e->out,"\"%s\":",name);
+  } else {
+    if (e->n_cols++ > 0) outbuf_printf(e->out,",");
+    if (e->header) outbuf_printf(e->out,"%s%s",e->prefix,name);
+  }
+}
+
+/* Returns non-zero if the field value should not be output */
+static int emit_no_value(struct emitter *e)
+{
+  if (e->format == MESH_OUT_JSON) {
+    if (e->missing) outbuf_printf(e->out,"null");
+    return e->missing;
+  } else {
+    return e->header || e->missing;
+  }
+}
+
+/* Outputs the floating point field name with value v. Non-finite values
+ * (NaN or infinite) are output as missing, since JSON can not represent
+ * them. */
+static void emit_num(struct emitter *e, const char *name, double v)
+{
+  emit_key(e,name);
+  if (emit_no_value(e)) return;
+  if (v != v || fabs(v) > DBL_MAX) { /* NaN or infinite */
+    if (e->format == MESH_OUT_JSON) outbuf_printf(e->out,"null");
+  } else {
+    outbuf_printf(e->out,"%.10g",v);
+  }
+}
+
+/* Outputs the integer field name with value v */
+static void emit_int(struct emitter *e, const char *name, long v)
+{
+  emit_key(e,name);
+  if (emit_no_value(e)) return;
+  outbuf_printf(e->out,"%ld",v);
+}
+
+/* Outputs the boolean field name with value v */
+static void emit_bool(struct emitter *e, const char *name, int v)
+{
+  emit_key(e,name);
+  if (emit_no_value(e)) return;
+  if (e->format == MESH_OUT_JSON) {
+    outbuf_printf(e->out,"%s",v ? "true" : "false");
+  } else {
+    outbuf_printf(e->out,"%d",v ? 1 : 0);
+  }
+}
+
+/* Outputs the string field name with value str, quoted and escaped as
+ * required by the format. If str is NULL it is output as missing. */
+static void emit_str(struct emitter *e, const char *name, const char *str)
+{
+  char buf[OUTBUF_MAX_SZ/2];
+  int n;
+  unsigned char c;
+
+  emit_key(e,name);
+  if (str == NULL) {
+    if (e->format == MESH_OUT_JSON) outbuf_printf(e->out,"null");
+    return;
+  }
+  if (emit_no_value(e)) return;
+  /* Output in chunks, since outbuf_printf() has a limited length */
+  n = 0;
+  buf[n++] = '"';
+  for (; *str != '\0'; str++) {
+    if (n > (int)sizeof(buf)-8) {
+      buf[n] = '\0';
+      outbuf_printf(e->out,"%s",buf);
+      n = 0;
+    }
+    c = (unsigned char)*str;
+    if (e->format == MESH_OUT_CSV) {
+      if (c == '"') buf[n++] = '"'; /* quotes are doubled in CSV */
+      buf[n++] = c;
+    } else if (c == '"' || c == '\\') {
+      buf[n++] = '\\';
+      buf[n++] = c;
+    } else if (c < 0x20) {
+      sprintf(buf+n,"\\u%04x",c);
+      n += 6;
+    } else {
+      buf[n++] = c;
+    }
+  }
+  buf[n++] = '"';
+  buf[n] = '\0';
+  outbuf_printf(e->out,"%s",buf);
+}
+
+/* Starts the object field name. Its fields are output until the matching
+ * emit_end(). */
+static void emit_begin(struct emitter *e, const char *name)
+{
+  if (e->format == MESH_OUT_JSON) {
+    assert(e->depth+1 < EMIT_MAX_DEPTH);
+    emit_key(e,name);
+    outbuf_printf(e->out,"{");
+    e->n_fields[++(e->depth)] = 0;
+  } else {
+    assert(e->depth+1 < EMIT_MAX_DEPTH);
+    assert(strlen(e->prefix)+strlen(name)+2 <= EMIT_PREFIX_MAX);
+    e->prefix_len[e->depth++] = strlen(e->prefix);
+    strcat(e->prefix,name);
+    strcat(e->prefix,"_");
+  }
+}
+
+/* Ends the current object */
+static void emit_end(struct emitter *e)
+{
+  if (e->format == MESH_OUT_JSON) {
+    outbuf_printf(e->out,"}");
+    e->depth--;
+  } else { /* remove last component from prefix */
+    e->prefix[e->prefix_len[--(e->depth)]] = '\0';
+  }
+}
+
+/* Outputs the stage time field name */
+static void emit_time(struct emitter *e, const char *name,
+                      const struct stage_time *t)
+{
+  emit_begin(e,name);
+  emit_num(e,"wall",t->wall);
+  emit_num(e,"cpu",t->cpu);
+  emit_end(e);
+}
+
+/* Outputs the histogram field name with the n_bins values in hist, as an
+ * array in JSON and as the columns name_0, name_1, etc. in CSV. */
+static void emit_hist(struct emitter *e, const char *name,
+                      const double *hist, int n_bins)
+{
+  char col[EMIT_PREFIX_MAX];
+  int i;
+
+  if (e->format == MESH_OUT_JSON) {
+    emit_key(e,name);
+    if (emit_no_value(e)) return;
+    outbuf_printf(e->out,"[");
+    for (i=0; i<n_bins; i++) {
+      outbuf_printf(e->out,"%s%.0f",(i > 0 ? "," : ""),hist[i]);
+    }
+    outbuf_printf(e->out,"]");
+  } else {
+    assert(strlen(name)+12 <= EMIT_PREFIX_MAX);
+    for (i=0; i<n_bins; i++) {
+      sprintf(col,"%s_%d",name,i);
+      emit_num(e,col,hist[i]);
+    }
+  }
+}
+
+/* Outputs the distance query statistics field name, with the values in
+ * st. They are output as missing if they were not collected. */
+static void emit_qstats(struct emitter *e, const char *name,
+                        const struct dist_surf_surf_stats *st)
+{
+  const struct dist_query_stats *qs;
+  int missing;
+
+  missing = e->missing;
+  if (!st->has_qstats) {
+    if (e->format == MESH_OUT_JSON) { /* the whole object is null */
+      emit_key(e,name);
+      outbuf_printf(e->out,"null");
+      return;
+    }
+    e->missing = 1;
+  }
+  qs = &(st->qstats);
+  emit_begin(e,name);
+  emit_num(e,"queries",qs->n_queries);
+  emit_num(e,"cell_checks",qs->n_cell_scans);
+  emit_num(e,"cell_scans",qs->n_cell_t_scans);
+  emit_num(e,"triangle_scans",qs->n_triag_scans);
+  emit_num(e,"sum_first_ring",qs->sum_kstart);
+  emit_num(e,"sum_last_ring",qs->sum_kmax);
+  emit_num(e,"warm_starts",qs->n_warm_starts);
+  emit_hist(e,"hist_triangles",qs->hist_triags,DQS_HIST_BINS);
+  emit_hist(e,"hist_last_ring",qs->hist_kmax,DQS_HIST_BINS);
+  emit_hist(e,"hist_cell_length",qs->hist_cell_len,DQS_HIST_BINS);
+  emit_end(e);
+  e->missing = missing;
+}
+
+/* Outputs the signed distance statistics field name, with the values in
+ * st. They are output as missing if the signed distance was not
+ * calculated. */
+static void emit_signed(struct emitter *e, const char *name,
+                        const struct dist_surf_surf_stats *st)
+{
+  int missing;
+
+  missing = e->missing;
+  if (!st->is_signed) {
+    if (e->format == MESH_OUT_JSON) { /* the whole object is null */
+      emit_key(e,name);
+      outbuf_printf(e->out,"null");
+      return;
+    }
+    e->missing = 1;
+  }
+  emit_begin(e,name);
+  emit_num(e,"min",st->min_sdist);
+  emit_num(e,"max",st->max_sdist);
+  emit_num(e,"mean",st->mean_sdist);
+  emit_num(e,"hist_range",st->sdist_range);
+  emit_hist(e,"hist",st->sdist_hist,SDIST_HIST_BINS);
+  emit_end(e);
+  e->missing = missing;
+}
+
+/* Outputs the model field name, with the information in mr */
+static void emit_model(struct emitter *e, const char *name,
+                       const struct model_result *mr)
+{
+  static const struct model_info no_info;
+  const struct model_info *info;
+  int missing;
+
+  missing = e->missing;
+  info = mr->info;
+  if (mr->n_vert == 0) e->missing = 1; /* not read */
+  emit_begin(e,name);
+  emit_str(e,"file",mr->fname);
+  emit_int(e,"vertices",mr->n_vert);
+  emit_int(e,"faces",mr->n_faces);
+  emit_num(e,"bbox_diag",mr->bbox_diag);
+  if (info == NULL) { /* not read or point cloud */
+    info = &no_info;
+    e->missing = 1;
+  }
+  emit_int(e,"degenerate_faces",info->n_degenerate);
+  emit_int(e,"disjoint_parts",info->n_disjoint_parts);
+  emit_bool(e,"manifold",info->manifold);
+  emit_bool(e,"orig_oriented",info->orig_oriented);
+  emit_bool(e,"oriented",info->oriented);
+  emit_bool(e,"orientable",info->orientable);
+  emit_bool(e,"closed",info->closed);
+  e->missing = missing || mr->n_vert == 0;
+  emit_begin(e,"time");
+  emit_time(e,"read",&(mr->t_read));
+  emit_time(e,"analyze",&(mr->t_analyze));
+  emit_end(e);
+  emit_end(e);
+  e->missing = missing;
+}
+
+/* Outputs the distance statistics field name, with the values in st */
+static void emit_stats(struct emitter *e, const char *name,
+                       const struct dist_surf_surf_stats *st)
+{
+  static struct dist_surf_surf_stats no_stats;
+  int missing;
+
+  missing = e->missing;
+  if (st == NULL) {
+    if (e->format == MESH_OUT_JSON) { /* the whole object is null */
+      emit_key(e,name);
+      outbuf_printf(e->out,"null");
+      return;
+    }
+    st = &no_stats;
+    e->missing = 1;
+  }
+  emit_begin(e,name);
+  emit_num(e,"min",st->min_dist);
+  emit_num(e,"max",st->max_dist);
+  emit_num(e,"mean",st->mean_dist);
+  emit_num(e,"rms",st->rms_dist);
+  emit_num(e,"m1_area",st->m1_area);
+  emit_num(e,"m2_area",st->m2_area);
+  emit_num(e,"sampled_m1_area",st->st_m1_area);
+  emit_int(e,"m1_samples",st->m1_samples);
+  emit_bool(e,"vertices_only",st->vertices_only);
+  emit_num(e,"cell_size",st->cell_sz);
+  emit_num(e,"cell_ratio",st->cell_ratio);
+  emit_num(e,"probe_cost",st->probe_cost);
+  emit_begin(e,"grid");
+  emit_int(e,"x",st->grid_sz.x);
+  emit_int(e,"y",st->grid_sz.y);
+  emit_int(e,"z",st->grid_sz.z);
+  emit_end(e);
+  emit_int(e,"non_empty_cells",st->n_ne_cells);
+  emit_num(e,"triangles_per_non_empty_cell",st->n_t_p_nec);
+  emit_begin(e,"time");
+  emit_time(e,"triangle_list",&(st->t_tlist));
+  emit_time(e,"tune",&(st->t_tune));
+  emit_time(e,"grid",&(st->t_grid));
+  emit_time(e,"sampling",&(st->t_sampling));
+  emit_time(e,"stats",&(st->t_stats));
+  emit_end(e);
+  emit_qstats(e,"query_stats",st);
+  emit_signed(e,"signed",st);
+  emit_end(e);
+  e->missing = missing;
+}
+
+/* Outputs all the fields of res (or the CSV header if e->header is
+ * set). */
+static void emit_result(struct emitter *e, const struct mesh_result *res)
+{
+  emit_int(e,"line",res->line);
+  emit_str(e,"error",res->errstr);
+  emit_str(e,"error_file",res->err_fname);
+  emit_model(e,"model1",&(res->m1));
+  emit_model(e,"model2",&(res->m2));
+  emit_num(e,"sampling_step",res->abs_sampling_step);
+  emit_stats(e,"dist_1_2",res->stats);
+  emit_stats(e,"dist_2_1",res->stats_rev);
+  if (e->format == MESH_OUT_CSV) emit_int(e,"peak_rss_kb",peak_rss_kb());
+}
+
+/* --------------------------------------------------------------------------*
+ *                          External functions                               *
+ * --------------------------------------------------------------------------*/
+
+/* see mesh_output.h */
+int parse_out_format(const char *str)
+{
+  if (strcmp(str,"text") == 0) {
+    return MESH_OUT_TEXT;
+  } else if (strcmp(str,"json") == 0) {
+    return MESH_OUT_JSON;
+  } else if (strcmp(str,"csv") == 0) {
+    return MESH_OUT_CSV;
+  } else {
+    return -1;
+  }
+}
+
+/* see mesh_output.h */
+void output_results_begin(struct outbuf *out, int format)
+{
+  struct emitter e;
+  struct mesh_result res;
+
+  if (format == MESH_OUT_JSON) {
+    outbuf_printf(out,"{\"results\":[");
+  } else if (format == MESH_OUT_CSV) {
+    memset(&e,0,sizeof(e));
+    memset(&res,0,sizeof(res));
+    e.out = out;
+    e.format = format;
+    e.header = 1;
+    emit_result(&e,&res);
+    outbuf_printf(out,"\n");
+  }
+  outbuf_flush(out);
+}
+
+/* see mesh_output.h */
+void output_result(struct outbuf *out, int format,
+                   const struct mesh_result *res, int index)
+{
+  struct emitter e;
+
+  if (format != MESH_OUT_JSON && format != MESH_OUT_CSV) return;
+  memset(&e,0,sizeof(e));
+  e.out = out;
+  e.format = format;
+  if (format == MESH_OUT_JSON) {
+    outbuf_printf(out,"%s\n{",(index > 0) ? "," : "");
+    e.depth = 1;
+    emit_result(&e,res);
+    outbuf_printf(out,"}");
+  } else {
+    emit_result(&e,res);
+    outbuf_printf(out,"\n");
+  }
+  outbuf_flush(out);
+}
+
+/* see mesh_output.h */
+void output_results_end(struct outbuf *out, int format)
+{
+  if (format == MESH_OUT_JSON) {
+    outbuf_printf(out,"\n],\"peak_rss_kb\":%ld}\n",peak_rss_kb());
+  }
+  outbuf_flush(out);
+}
@@ -0,0 +1,141 @@
+/* $Id$ */
+
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+
+
+
+
+
+
+/*
+ * mesh_output: machine readable (JSON or CSV) output of the results
+ */
+
+#ifndef _MESH_OUTPUT_PROTO
+#define _MESH_OUTPUT_PROTO
+
+#include <compute_error.h>
+#include <reporting.h>
+#include <timing.h>
+
+#ifdef __cplusplus
+#define BEGIN_DECL extern "C" {
+#define END_DECL }
+#else
+#define BEGIN_DECL
+#define END_DECL
+#endif
+
+BEGIN_DECL
+#undef BEGIN_DECL
+
+/* --------------------------------------------------------------------------*
+ *                       Exported data types                                 *
+ * --------------------------------------------------------------------------*/
+
+/* The output formats */
+#define MESH_OUT_TEXT 0 /* Human readable text (default) */
+#define MESH_OUT_JSON 1 /* One JSON object, with an array of results */
+#define MESH_OUT_CSV  2 /* One CSV line per result, after a header line */
+
+/* A model of a measurement, as needed for output */
+struct model_result {
+  const char *fname;              /* The model file name */
+  int n_vert;                     /* The number of vertices. Zero if the
+                                   * model could not be read, in which case
+                                   * n_faces and bbox_diag are not used. */
+  int n_faces;                    /* The number of faces */
+  double bbox_diag;               /* The bounding box diagonal length */
+  const struct model_info *info;  /* The model analysis information. NULL
+                                   * if not available (i.e. the model could
+                                   * not be read or is a point cloud) */
+  struct stage_time t_read;       /* The time to read the model */
+  struct stage_time t_analyze;    /* The time to analyze the model */
+};
+
+/* The results of a distance measurement, as needed for output */
+struct mesh_result {
+  int line;                       /* The batch manifest line, zero if not in
+                                   * batch mode */
+  const char *errstr;             /* The error message if the measurement
+                                   * failed, NULL otherwise */
+  const char *err_fname;          /* The file that caused the error, if
+                                   * any */
+  struct model_result m1;         /* Model 1 */
+  struct model_result m2;         /* Model 2 */
+  double abs_sampling_step;       /* The absolute sampling step */
+  const struct dist_surf_surf_stats *stats; /* The statistics of the distance
+                                   * from model 1 to 2. NULL if not
+                                   * available. */
+  const struct dist_surf_surf_stats *stats_rev; /* The statistics of the
+                                   * distance from model 2 to 1. NULL if not
+                                   * available (i.e. not symmetric). */
+};
+
+/* --------------------------------------------------------------------------*
+ *                       Exported functions                                  *
+ * --------------------------------------------------------------------------*/
+
+/* Parses the output format name str ("text", "json" or "csv") and returns
+ * the corresponding MESH_OUT_... constant, or -1 if str is not valid. */
+int parse_out_format(const char *str);
+
+/* Outputs to out what precedes all results in the given format (the opening
+ * of the JSON object or the CSV header line). Nothing is output for
+ * MESH_OUT_TEXT, as for the following functions. */
+void output_results_begin(struct outbuf *out, int format);
+
+/* Outputs the result res to out in the given format. The argument index is
+ * the number of results already output since output_results_begin(). */
+void output_result(struct outbuf *out, int format,
+                   const struct mesh_result *res, int index);
+
+/* Outputs to out what follows all results in the given format, which
+ * includes the peak memory usage of the process (for JSON, in CSV it is in
+ * each line), and flushes out. */
+void output_results_end(struct outbuf *out, int format);
+
+END_DECL
+#undef END_DECL
+
+#endif /* _MESH_OUTPUT_PROTO */
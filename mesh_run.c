@@ -49,63 +49,297 @@
 
 #include <time.h>
 #include <string.h>
+#include <errno.h>
 #include <xalloc.h>
 #include <model_analysis.h>
 #include <compute_error.h>
 #include <model_in.h>
 #include <geomutils.h>
+#include <timing.h>
 
 #include <mesh_run.h>
 
-/* Reads a model from file 'fname' and returns the model read. If an error
- * occurs a message is printed and the program exists. 
- */
-static struct model *read_model_file(const char *fname)
+/* Returns a message describing the error err (an errno value) from opening
+ * a file. Unlike strerror() the message is a constant string, so that it
+ * can be used from several threads at the same time. */
+static const char *open_error_str(int err)
+{
+  switch (err) {
+#ifdef ENOENT
+  case ENOENT:
+    return "no such file or directory";
+#endif
+#ifdef EACCES
+  case EACCES:
+    return "permission denied";
+#endif
+#ifdef EISDIR
+  case EISDIR:
+    return "is a directory";
+#endif
+#ifdef ENAMETOOLONG
+  case ENAMETOOLONG:
+    return "file name too long";
+#endif
+#ifdef EMFILE
+  case EMFILE:
+    return "too many open files";
+#endif
+  default:
+    return "could not open file";
+  }
+}
+
+/* see mesh_run.h */
+struct model *read_model_file(const char *fname, int allow_points,
+                              const char **errstr)
 {
   int rcode;
+  int i;
   struct model *m;
-  const char *errstr;
   
   rcode = read_fmodel(&m,fname,MESH_FF_AUTO,1);
   if (rcode <= 0) {
     switch (rcode) {
     case 0:
-      errstr = "no models in file";
+      *errstr = "no models in file";
       break;
     case MESH_NO_MEM:
-      errstr = "no memory";
+      *errstr = "no memory";
       break;
     case MESH_CORRUPTED:
-      errstr = "corrupted file or I/O error";
+      *errstr = "corrupted file or I/O error";
       break;
     case MESH_MODEL_ERR:
-      errstr = "model error";
+      *errstr = "model error";
       break;
     case MESH_NOT_TRIAG:
-      errstr = "not a triangular mesh model";
+      *errstr = "not a triangular mesh model";
       break;
     case MESH_BAD_FF:
-      errstr = "unrecognized file format";
+      *errstr = "unrecognized file format";
       break;
     case MESH_BAD_FNAME:
-      errstr = strerror(errno);
+      *errstr = open_error_str(errno);
       break;
     default:
-      errstr = "unknown error";
+      *errstr = "unknown error";
+    }
+    return NULL;
+  } else if (m->num_faces == 0 && !allow_points) {
+    *errstr = "no faces (point clouds can only be model 1,"
+      " in text mode and without -s)";
+    __free_raw_model(m);
+    return NULL;
+  }
+  /* The x != x test is for NaNs */
+  for (i=0; i<m->num_vert; i++) {
+    if (m->vertices[i].x != m->vertices[i].x || 
+        m->vertices[i].y != m->vertices[i].y || 
+        m->vertices[i].z != m->vertices[i].z ||
+        fabs(m->vertices[i].x) > FLT_MAX || fabs(m->vertices[i].y) > FLT_MAX ||
+        fabs(m->vertices[i].z) > FLT_MAX) {
+      *errstr = "NaN or infinite vertex coordinates";
+      __free_raw_model(m);
+      return NULL;
     }
+  }
+  return m;
+}
+
+/* Reads a model from file 'fname' and returns the model read. If
+ * allow_points is non-zero the model can be a point cloud (no faces). If an
+ * error occurs a message is printed and the program exists. 
+ */
+static struct model *read_model_file_or_exit(const char *fname,
+                                             int allow_points)
+{
+  struct model *m;
+  const char *errstr;
+
+  m = read_model_file(fname,allow_points,&errstr);
+  if (m == NULL) {
     fprintf(stderr,"ERROR: %s: %s\n",fname,errstr);
     exit(1);
-  } else if (m->num_faces == 0) {
-    fprintf(stderr,"ERROR: %s: empty model (no faces)\n",fname);
-    exit(1);
   }
   return m;
 }
 
+/* Prints a histogram of a dist_query_stats structure to out, on a single
+ * line, with the given label. */
+static void print_hist(struct outbuf *out, const char *label,
+                       const double *hist)
+{
+  int i;
+
+  outbuf_printf(out,"%s",label);
+  for (i=0; i<DQS_HIST_BINS; i++) {
+    outbuf_printf(out," %.0f",hist[i]);
+  }
+  outbuf_printf(out,"\n");
+}
+
+/* Prints the distance query statistics in stats to out. The suffix is
+ * appended to the title. */
+static void print_query_stats(struct outbuf *out,
+                              const struct dist_surf_surf_stats *stats,
+                              const char *suffix)
+{
+  const struct dist_query_stats *qs;
+  double nq;
+
+  qs = &(stats->qstats);
+  nq = (qs->n_queries > 0) ? qs->n_queries : 1;
+  outbuf_printf(out,"       Distance query statistics%s\n\n",suffix);
+  outbuf_printf(out,"Queries:                          \t%.0f\n",
+                qs->n_queries);
+  outbuf_printf(out,"Avg. cells checked per query:     \t%.2f\n",
+                qs->n_cell_scans/nq);
+  outbuf_printf(out,"Avg. cells scanned per query:     \t%.2f\n",
+                qs->n_cell_t_scans/nq);
+  outbuf_printf(out,"Avg. triangles scanned per query: \t%.2f\n",
+                qs->n_triag_scans/nq);
+  outbuf_printf(out,"Avg. first / last cell ring:      \t%.2f / %.2f\n",
+                qs->sum_kstart/nq,qs->sum_kmax/nq);
+  outbuf_printf(out,"Warm started queries:             \t%.2f%%\n",
+                qs->n_warm_starts/nq*100.0);
+  outbuf_printf(out,"Histograms (bin 0 to %d, bins i>0 of log scales are "
+                "[2^(i-1),2^i)):\n",DQS_HIST_BINS-1);
+  print_hist(out,"Triangles scanned per query (log): ",qs->hist_triags);
+  print_hist(out,"Last cell ring per query:          ",qs->hist_kmax);
+  print_hist(out,"Triangles per non-empty cell (log):",qs->hist_cell_len);
+  outbuf_printf(out,"\n");
+}
+
+/* Prints the outcome of the grid cell size auto-tuning in stats to
+ * out. The suffix is appended to the labels. */
+static void print_autogrid(struct outbuf *out,
+                           const struct dist_surf_surf_stats *stats,
+                           const char *suffix)
+{
+  if (stats->probe_cost > 0) {
+    outbuf_printf(out,"Auto-tuned cell size ratio%s:\t%.3g (%.3g usecs/sample,"
+                  " %.2f secs)\n",suffix,stats->cell_ratio,
+                  stats->probe_cost*1e6,stats->t_tune.wall);
+  } else {
+    outbuf_printf(out,"Auto-tuned cell size ratio%s:\t%.3g (not tuned, "
+                  "too few samples)\n",suffix,stats->cell_ratio);
+  }
+}
+
+/* Prints the signed distance statistics in stats to out, with the
+ * percentages relative to bbox2_diag. */
+static void print_signed_stats(struct outbuf *out,
+                               const struct dist_surf_surf_stats *stats,
+                               double bbox2_diag)
+{
+  int i;
+
+  outbuf_printf(out,"    Signed distance from model 1 to model 2\n");
+  outbuf_printf(out,"(positive on the side model 2 normals point to)\n\n");
+  outbuf_printf(out,"        \t   Absolute\t%% BBox diag\n");
+  outbuf_printf(out,"        \t           \t  (Model 2)\n");
+  outbuf_printf(out,"Min:    \t%11g\t%11g\n",
+                stats->min_sdist,stats->min_sdist/bbox2_diag*100);
+  outbuf_printf(out,"Max:    \t%11g\t%11g\n",
+                stats->max_sdist,stats->max_sdist/bbox2_diag*100);
+  outbuf_printf(out,"Mean:   \t%11g\t%11g\n",
+                stats->mean_sdist,stats->mean_sdist/bbox2_diag*100);
+  outbuf_printf(out,"Histogram (%d bins from %g to %g):\n",SDIST_HIST_BINS,
+                -stats->sdist_range,stats->sdist_range);
+  for (i=0; i<SDIST_HIST_BINS; i++) {
+    outbuf_printf(out," %.0f",stats->sdist_hist[i]);
+  }
+  outbuf_printf(out,"\n\n");
+}
+
+/* Prints the sampling step and the number of samples of the distance from
+ * model 1 (m1) to model 2 (m2) in stats, and of the distance from model 2 to
+ * model 1 in stats_rev if it is not NULL. */
+static void print_sampling(struct outbuf *out,
+                           const struct dist_surf_surf_stats *stats,
+                           const struct dist_surf_surf_stats *stats_rev,
+                           const struct model *m1, const struct model *m2,
+                           double abs_sampling_step, double abs_sampling_dens,
+                           double bbox2_diag)
+{
+  outbuf_printf(out,"                 \tAbsolute\t   %% BBox diag\t     "
+                "Expected samples\n"
+                "                 \t        \t   model 2     \t   "
+                "model 1\tmodel 2\n");
+  if (stats_rev == NULL) {
+    outbuf_printf(out,"Sampling step:   \t%8g\t   %7g     \t   %7d\t%7d\n",
+                  abs_sampling_step,abs_sampling_step/bbox2_diag*100,
+                  (int)(stats->m1_area*abs_sampling_dens),0);
+    outbuf_printf(out,"\n");
+    outbuf_printf(out,"        \t    Total\t    Avg. / triangle\t\t"
+                  "Tot (%%) area of\n"
+                  "        \t          \tmodel 1\tmodel 2 \t\t"
+                  "sampled triang.\n");
+    outbuf_printf(out,"Samples:\t%9d\t%7.2g\t%7.2g\t\t%15.2f\n",
+                  stats->m1_samples,
+                  ((double)stats->m1_samples)/m1->num_faces,
+                  ((double)stats->m1_samples)/m2->num_faces,
+                  stats->st_m1_area/stats->m1_area*100.0);
+  } else {
+    outbuf_printf(out,"Sampling step:   \t%8g\t   %7g     \t   %7d\t%7d\n",
+                  abs_sampling_step,abs_sampling_step/bbox2_diag*100,
+                  (int)(stats->m1_area*abs_sampling_dens),
+                  (int)(stats->m2_area*abs_sampling_dens));
+    outbuf_printf(out,"\n");
+    outbuf_printf(out,"        \t    Total\t    Avg. / triangle\t\t"
+                  "Tot (%%) area of\n"
+                  "        \t         \tmodel 1 \tmodel 2 \t"
+                  "sampled triang.\n");
+    outbuf_printf(out,"Samples (1->2):\t%9d\t%7.2g\t%15.2g\t%18.2f\n",
+                  stats->m1_samples,
+                  ((double)stats->m1_samples)/m1->num_faces,
+                  ((double)stats->m1_samples)/m2->num_faces,
+                  stats->st_m1_area/stats->m1_area*100.0);
+    outbuf_printf(out,"Samples (2->1):\t%9d\t%7.2g\t%15.2g\t%18.2f\n",
+                  stats_rev->m1_samples,
+                  ((double)stats_rev->m1_samples)/m1->num_faces,
+                  ((double)stats_rev->m1_samples)/m2->num_faces,
+                  stats_rev->st_m1_area/stats_rev->m1_area*100.0);
+  }
+}
+
+/* Frees the model and the error data of me, and clears it. */
+static void free_model_error(struct model_error *me)
+{
+  if (me->mesh != NULL) __free_raw_model(me->mesh);
+  free_face_error(me->fe);
+  free(me->verror);
+  free(me->info);
+  memset(me,0,sizeof(*me));
+}
+
+/* Terminates mesh_run() after a cancelled or failed calculation, freeing
+ * model1 and model2 and the human readable output out if it is not the
+ * caller's one (i.e. if mout is not NULL). If errmsg is not NULL the
+ * calculation failed and errmsg is printed as an error to stderr, otherwise
+ * it has been cancelled. Returns the value that mesh_run() then returns. */
+static int run_abort(struct outbuf *out, struct outbuf *mout,
+                         struct model_error *model1,
+                         struct model_error *model2, const char *errmsg)
+{
+  if (errmsg != NULL) {
+    outbuf_flush(out);
+    fprintf(stderr,"ERROR: %s\n",errmsg);
+  } else {
+    outbuf_printf(out,"\nCalculation cancelled\n");
+  }
+  outbuf_flush(out);
+  free_model_error(model1);
+  free_model_error(model2);
+  if (mout != NULL) outbuf_delete(out);
+  return 1;
+}
+
 /* see mesh_run.h */
-void mesh_run(const struct args *args, struct model_error *model1,
-              struct model_error *model2, struct outbuf *out,
-              struct prog_reporter *progress)
+int mesh_run(const struct args *args, struct model_error *model1,
+             struct model_error *model2, struct outbuf *out,
+             struct prog_reporter *progress)
 {
   clock_t start_time;
   struct dist_surf_surf_stats stats;
@@ -114,24 +348,46 @@ void mesh_run(const struct args *args, struct model_error *model1,
   struct model_info *m1info,*m2info;
   double abs_sampling_step,abs_sampling_dens;
   int nv_empty,nf_empty;
+  struct outbuf *mout;    /* machine readable output, NULL if text only */
+  struct mesh_result res; /* the results for machine readable output */
+  int qflags;             /* DIST_QUERY_STATS and DIST_AUTO_GRID flags, if
+                           * requested */
+  int sflags;             /* DIST_SIGNED flag, if requested */
+  int vonly;              /* only the distance from the vertices */
+  int is_cloud;           /* model 1 is a point cloud (no faces) */
+  int rcode;              /* return code of the analysis and distance */
+
+  /* With machine readable output the rest goes to stderr */
+  memset(&res,0,sizeof(res));
+  if (args->out_format != MESH_OUT_TEXT) {
+    mout = out;
+    out = outbuf_new(stdio_puts,stderr);
+  } else {
+    mout = NULL;
+  }
 
   /* Read models from input files */
   memset(model1,0,sizeof(*model1));
   memset(model2,0,sizeof(*model2));
   m1info = (struct model_info*) xa_malloc(sizeof(*m1info));
   m2info = (struct model_info*) xa_malloc(sizeof(*m2info));
+  model1->info = m1info;
+  model2->info = m2info;
   outbuf_printf(out,"Reading %s ... ",args->m1_fname);
   outbuf_flush(out);
-  start_time = clock();
-  model1->mesh = read_model_file(args->m1_fname);
-  outbuf_printf(out,"Done (%.2f secs)\n",
-                (double)(clock()-start_time)/CLOCKS_PER_SEC);
+  stage_begin(&(res.m1.t_read));
+  /* Model 1 can be a point cloud, if only the distance from it is
+   * measured and it is not displayed */
+  model1->mesh = read_model_file_or_exit(args->m1_fname,
+                                         args->no_gui && !args->do_symmetric);
+  stage_end(&(res.m1.t_read));
+  outbuf_printf(out,"Done (%.2f secs)\n",res.m1.t_read.cpu);
   outbuf_printf(out,"Reading %s ... ",args->m2_fname);
   outbuf_flush(out);
-  start_time = clock();
-  model2->mesh = read_model_file(args->m2_fname);
-  outbuf_printf(out,"Done (%.2f secs)\n",
-                (double)(clock()-start_time)/CLOCKS_PER_SEC);
+  stage_begin(&(res.m2.t_read));
+  model2->mesh = read_model_file_or_exit(args->m2_fname,0);
+  stage_end(&(res.m2.t_read));
+  outbuf_printf(out,"Done (%.2f secs)\n",res.m2.t_read.cpu);
   outbuf_flush(out);
 
   /* Analyze models (we don't need normals for model 1, so we don't request
@@ -139,10 +395,26 @@ void mesh_run(const struct args *args, struct model_error *model1,
   start_time = clock();
   bbox1_diag = dist_v(&model1->mesh->bBox[0], &model1->mesh->bBox[1]);
   bbox2_diag = dist_v(&model2->mesh->bBox[0], &model2->mesh->bBox[1]);
-  analyze_model(model1->mesh,m1info,0,args->verb_analysis,out,"model 1");
-  model1->info = m1info;
-  analyze_model(model2->mesh,m2info,1,args->verb_analysis,out,"model 2");
-  model2->info = m2info;
+  is_cloud = (model1->mesh->num_faces == 0);
+  stage_begin(&(res.m1.t_analyze));
+  rcode = 0;
+  if (!is_cloud && !args->skip_m1_analysis) {
+    rcode = analyze_model(model1->mesh,m1info,0,args->n_threads,
+                          args->verb_analysis,out,"model 1");
+  } else { /* no topology to analyze, or not requested */
+    memset(m1info,0,sizeof(*m1info));
+  }
+  stage_end(&(res.m1.t_analyze));
+  stage_begin(&(res.m2.t_analyze));
+  if (rcode == 0) {
+    rcode = analyze_model(model2->mesh,m2info,1,args->n_threads,
+                          args->verb_analysis,out,"model 2");
+  }
+  stage_end(&(res.m2.t_analyze));
+  if (rcode != 0) {
+    return run_abort(out,mout,model1,model2,
+                         "not enough memory to analyze the models");
+  }
   /* Adjust sampling step size */
   abs_sampling_step = args->sampling_step*bbox2_diag;
   abs_sampling_dens = 1/(abs_sampling_step*abs_sampling_step);
@@ -172,16 +444,51 @@ void mesh_run(const struct args *args, struct model_error *model1,
   outbuf_printf(out,"Closed:                  \t%11s\t%11s\n",
                 (m1info->closed ? "yes" : "no"),
                 (m2info->closed ? "yes" : "no"));
+  if (is_cloud) {
+    outbuf_printf(out,"Model 1 is a point cloud, the distance is measured "
+                  "from each point\n");
+  } else if (args->skip_m1_analysis) {
+    outbuf_printf(out,"Model 1 was not analyzed, its topology information "
+                  "is not available\n");
+  }
   outbuf_flush(out);
+  if (args->do_signed && !m2info->orientable) {
+    outbuf_printf(out,"WARNING: model 2 is not orientable, the sign of the "
+                  "distance is not consistent\n");
+  }
 
   /* Compute the distance from one model to the other */
-  dist_surf_surf(model1,model2->mesh,abs_sampling_dens,args->min_sample_freq,
-                 &stats,!args->no_gui,(args->quiet ? NULL : progress));
+  vonly = args->do_vertices_only || is_cloud;
+  qflags = (args->do_qstats ? DIST_QUERY_STATS : 0) |
+    (args->do_autogrid ? DIST_AUTO_GRID : 0);
+  sflags = (args->do_signed ? DIST_SIGNED : 0);
+  if (vonly) {
+    rcode = dist_verts_surf(model1,model2->mesh,&stats,qflags|sflags,
+                            args->n_threads,(args->quiet ? NULL : progress));
+  } else {
+    rcode = dist_surf_surf(model1,model2->mesh,abs_sampling_dens,
+                           args->min_sample_freq,&stats,
+                           (args->no_gui ? 0 : DIST_CALC_NORMALS) |
+                           qflags | sflags,
+                           args->n_threads,(args->quiet ? NULL : progress));
+  }
+  if (rcode != 0) {
+    return run_abort(out,mout,model1,model2,dist_error_str(rcode));
+  }
+  if (prog_cancelled(progress)) {
+    return run_abort(out,mout,model1,model2,NULL);
+  }
 
   /* Print results */
-  outbuf_printf(out,"Surface area:            \t%11g\t%11g\n",
-                stats.m1_area,stats.m2_area);
-  outbuf_printf(out,"\n       Distance from model 1 to model 2\n\n");
+  if (is_cloud) {
+    outbuf_printf(out,"\n    Distance from model 1 points to model 2\n\n");
+  } else if (vonly) {
+    outbuf_printf(out,"\n   Distance from model 1 vertices to model 2\n\n");
+  } else {
+    outbuf_printf(out,"Surface area:            \t%11g\t%11g\n",
+                  stats.m1_area,stats.m2_area);
+    outbuf_printf(out,"\n       Distance from model 1 to model 2\n\n");
+  }
   outbuf_printf(out,"        \t   Absolute\t%% BBox diag\n");
   outbuf_printf(out,"        \t           \t  (Model 2)\n");
   outbuf_printf(out,"Min:    \t%11g\t%11g\n",
@@ -193,16 +500,33 @@ void mesh_run(const struct args *args, struct model_error *model1,
   outbuf_printf(out,"RMS:    \t%11g\t%11g\n",
                 stats.rms_dist,stats.rms_dist/bbox2_diag*100);
   outbuf_printf(out,"\n");
+  if (stats.is_signed) print_signed_stats(out,&stats,bbox2_diag);
   outbuf_flush(out);
   
  
 
   if (args->do_symmetric) { /* Invert models and recompute distance */
-    outbuf_printf(out,"       Distance from model 2 to model 1\n\n");
-    dist_surf_surf(model2,model1->mesh,abs_sampling_dens,args->min_sample_freq,
-                   &stats_rev,0,(args->quiet ? NULL : progress));
-    free_face_error(model2->fe);
-    model2->fe = NULL;
+    if (vonly) {
+      outbuf_printf(out,"   Distance from model 2 vertices to model 1\n\n");
+      rcode = dist_verts_surf(model2,model1->mesh,&stats_rev,qflags,
+                              args->n_threads,
+                              (args->quiet ? NULL : progress));
+      free(model2->verror);
+      model2->verror = NULL;
+    } else {
+      outbuf_printf(out,"       Distance from model 2 to model 1\n\n");
+      rcode = dist_surf_surf(model2,model1->mesh,abs_sampling_dens,
+                             args->min_sample_freq,&stats_rev,qflags,
+                             args->n_threads,(args->quiet ? NULL : progress));
+      free_face_error(model2->fe);
+      model2->fe = NULL;
+    }
+    if (rcode != 0) {
+      return run_abort(out,mout,model1,model2,dist_error_str(rcode));
+    }
+    if (prog_cancelled(progress)) {
+      return run_abort(out,mout,model1,model2,NULL);
+    }
     outbuf_printf(out,"        \t   Absolute\t%% BBox diag\n");
     outbuf_printf(out,"        \t           \t  (Model 2)\n");
     outbuf_printf(out,"Min:    \t%11g\t%11g\n",
@@ -236,43 +560,20 @@ void mesh_run(const struct args *args, struct model_error *model1,
   }
 
 
-  outbuf_printf(out,"                 \tAbsolute\t   %% BBox diag\t     "
-                "Expected samples\n"
-                "                 \t        \t   model 2     \t   "
-                "model 1\tmodel 2\n");
-  if (!args->do_symmetric) {
-    outbuf_printf(out,"Sampling step:   \t%8g\t   %7g     \t   %7d\t%7d\n",
-                  abs_sampling_step,abs_sampling_step/bbox2_diag*100,
-                  (int)(stats.m1_area*abs_sampling_dens),0);
-    outbuf_printf(out,"\n");
-    outbuf_printf(out,"        \t    Total\t    Avg. / triangle\t\t"
-                  "Tot (%%) area of\n"
-                  "        \t          \tmodel 1\tmodel 2 \t\t"
-                  "sampled triang.\n");
-    outbuf_printf(out,"Samples:\t%9d\t%7.2g\t%7.2g\t\t%15.2f\n",stats.m1_samples,
-                  ((double)stats.m1_samples)/model1->mesh->num_faces,
-                  ((double)stats.m1_samples)/model2->mesh->num_faces,
-                  stats.st_m1_area/stats.m1_area*100.0);
+  if (vonly) {
+    if (is_cloud) {
+      outbuf_printf(out,"Points queried:  \t%9d\n",stats.m1_samples);
+    } else {
+      outbuf_printf(out,"Vertices queried (1->2):\t%9d\n",stats.m1_samples);
+    }
+    if (args->do_symmetric) {
+      outbuf_printf(out,"Vertices queried (2->1):\t%9d\n",
+                    stats_rev.m1_samples);
+    }
   } else {
-    outbuf_printf(out,"Sampling step:   \t%8g\t   %7g     \t   %7d\t%7d\n",
-                  abs_sampling_step,abs_sampling_step/bbox2_diag*100,
-                  (int)(stats.m1_area*abs_sampling_dens),
-                  (int)(stats.m2_area*abs_sampling_dens));
-    outbuf_printf(out,"\n");
-    outbuf_printf(out,"        \t    Total\t    Avg. / triangle\t\t"
-                  "Tot (%%) area of\n"
-                  "        \t         \tmodel 1 \tmodel 2 \t"
-                  "sampled triang.\n");
-    outbuf_printf(out,"Samples (1->2):\t%9d\t%7.2g\t%15.2g\t%18.2f\n",
-                  stats.m1_samples,
-                  ((double)stats.m1_samples)/model1->mesh->num_faces,
-                  ((double)stats.m1_samples)/model2->mesh->num_faces,
-                  stats.st_m1_area/stats.m1_area*100.0);
-    outbuf_printf(out,"Samples (2->1):\t%9d\t%7.2g\t%15.2g\t%18.2f\n",
-                  stats_rev.m1_samples,
-                  ((double)stats_rev.m1_samples)/model1->mesh->num_faces,
-                  ((double)stats_rev.m1_samples)/model2->mesh->num_faces,
-                  stats_rev.st_m1_area/stats_rev.m1_area*100.0);
+    print_sampling(out,&stats,(args->do_symmetric ? &stats_rev : NULL),
+                   model1->mesh,model2->mesh,abs_sampling_step,
+                   abs_sampling_dens,bbox2_diag);
   }
   outbuf_printf(out,"\n");
   if (!args->do_symmetric) {
@@ -309,15 +610,45 @@ void mesh_run(const struct args *args, struct model_error *model1,
                   (stats_rev.grid_sz.x*stats_rev.grid_sz.y*
                    stats_rev.grid_sz.z)*100.0);
   }
+  if (args->do_autogrid && !vonly) {
+    print_autogrid(out,&stats,(args->do_symmetric ? " (1 to 2)" : ""));
+    if (args->do_symmetric) print_autogrid(out,&stats_rev," (2 to 1)");
+  }
   outbuf_printf(out,"\n");
+  if (args->do_qstats) {
+    print_query_stats(out,&stats,(args->do_symmetric ? " (1 to 2)" : ""));
+    if (args->do_symmetric) print_query_stats(out,&stats_rev," (2 to 1)");
+  }
   outbuf_printf(out,"Analysis and measuring time (secs.):\t%.2f\n",
                 (double)(clock()-start_time)/CLOCKS_PER_SEC);
   outbuf_flush(out);
 
-  if(!args->no_gui){
+  if (mout != NULL) { /* machine readable results */
+    res.m1.fname = args->m1_fname;
+    res.m1.n_vert = model1->mesh->num_vert;
+    res.m1.n_faces = model1->mesh->num_faces;
+    res.m1.bbox_diag = bbox1_diag;
+    res.m1.info = (is_cloud || args->skip_m1_analysis) ? NULL : m1info;
+    res.m2.fname = args->m2_fname;
+    res.m2.n_vert = model2->mesh->num_vert;
+    res.m2.n_faces = model2->mesh->num_faces;
+    res.m2.bbox_diag = bbox2_diag;
+    res.m2.info = m2info;
+    res.abs_sampling_step = abs_sampling_step;
+    res.stats = &stats;
+    res.stats_rev = (args->do_symmetric) ? &stats_rev : NULL;
+    output_results_begin(mout,args->out_format);
+    output_result(mout,args->out_format,&res,0);
+    output_results_end(mout,args->out_format);
+  }
+
+  if(!args->no_gui && !vonly){
     /* Get the per vertex error metric */
     nv_empty = nf_empty = 0; /* keep compiler happy */
-    calc_vertex_error(model1,&nv_empty,&nf_empty);
+    rcode = calc_vertex_error(model1,&nv_empty,&nf_empty);
+    if (rcode != 0) {
+      return run_abort(out,mout,model1,model2,dist_error_str(rcode));
+    }
     if (nv_empty>0) {
       outbuf_printf(out,
                     "WARNING: %.2f%% of vertices (%i out of %i) have no error "
@@ -332,4 +663,6 @@ void mesh_run(const struct args *args, struct model_error *model1,
     }
     outbuf_flush(out);
   }
+  if (mout != NULL) outbuf_delete(out);
+  return 0;
 }
@@ -52,6 +52,7 @@
 
 #include <compute_error.h>
 #include <reporting.h>
+#include <mesh_output.h>
 
 #ifdef __cplusplus
 #define BEGIN_DECL extern "C" {
@@ -79,16 +80,43 @@ struct args {
   int do_wlog; /* log the output into an external window */
   int do_texture; /* enables the display of error as a texture mapped
                    * on the model */
+  char *batch_fname; /* filename of the batch manifest, NULL if not in
+                      * batch mode */
+  int n_threads;  /* number of threads to use, if zero or negative the
+                   * number of processors */
+  int out_format; /* the output format of the results (MESH_OUT_TEXT,
+                   * MESH_OUT_JSON or MESH_OUT_CSV) */
+  int do_qstats;  /* collect and report the distance query statistics */
+  int do_autogrid; /* auto-tune the partitioning grid cell size */
+  int do_signed;  /* calculate the signed distance from model 1 to 2 */
+  int do_vertices_only; /* calculate the distance only from the vertices of
+                         * model 1, with n_threads threads */
+  int skip_m1_analysis; /* do not analyze model 1 (topology and
+                         * orientation), text only */
 };
 
+/* Reads a model from file fname and returns the model read. If an error
+ * occurs NULL is returned and a string describing the error is returned in
+ * *errstr. Models with non-finite vertex coordinates are considered errors,
+ * and so are models without faces (i.e. point clouds) unless allow_points
+ * is non-zero. It can be called from several threads at the same time. */
+struct model *read_model_file(const char *fname, int allow_points,
+                              const char **errstr);
+
 /* Runs the mesh program, given the parsed arguments in *args. The models and
  * their respective errors are returned in *model1 and *model2. If
  * args->no_gui is zero a QT window is opened to display the visual
  * results. All normal (non error) output is printed through the output buffer
- * out. If not NULL the progress object is used to report the progress. */
-void mesh_run(const struct args *args, struct model_error *model1,
-              struct model_error *model2, struct outbuf *out,
-              struct prog_reporter *progress);
+ * out. If args->out_format is not MESH_OUT_TEXT, only the machine readable
+ * results are printed to out, and the human readable output goes to
+ * stderr. If not NULL the progress object is used to report the progress,
+ * and the calculation can be cancelled through it. In that case, or if the
+ * analysis or distance calculation fails (e.g. for lack of memory, the error
+ * being printed to stderr), the models are freed, *model1 and *model2 are
+ * cleared and non-zero is returned. Otherwise zero is returned. */
+int mesh_run(const struct args *args, struct model_error *model1,
+             struct model_error *model2, struct outbuf *out,
+             struct prog_reporter *progress);
 
 END_DECL
 #undef END_DECL
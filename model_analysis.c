@@ -50,7 +50,9 @@
 #include <model_analysis.h>
 
 #include <assert.h>
-#include <xalloc.h>
+#include <edge_table.h>
+#include <model_in.h>
+#include <thread_pool.h>
 
 #ifdef INLINE
 # error Name clash with INLINE macro
@@ -78,14 +80,6 @@
 /* Type for bitmaps */
 typedef unsigned int bmap_t;
 
-/* A stack for arbitrary objects */
-struct stack {
-  char *data;       /* the buffer to store the data */
-  char *end;        /* the position just past the end of the data buffer */
-  char *next;       /* the position where to store the next element */
-  size_t elem_sz;   /* the element size, in bytes */
-};
-
 /* A list of vertices */
 struct vtx_list {
   int *vtcs;    /* The list of vertex indices */
@@ -98,20 +92,56 @@ struct topology {
   int closed;   /* is closed */
 };
 
-/* Structure to hold the list of extra faces adjacent to a face */
-struct adj_faces_x {
-  int *faces_on_edge[3];  /* list of adjacent faces for each edge */
-  int n_faces_on_edge[3]; /* number of elements in above lists. */
+/* Analysis results of a block of vertices or faces */
+struct an_block {
+  int manifold;   /* all vertices of the block are manifold */
+  int closed;     /* all vertices of the block are closed */
+  int oriented;   /* all faces of the block are oriented as their neighbors */
+  int orientable; /* no inconsistent orientation found within the block */
+  int no_mem;     /* the block could not be analyzed for lack of memory */
+};
+
+/* Shared data for the parallel steps of the model analysis. The vertices
+ * and faces are processed in blocks of vblock and fblock elements, each
+ * block joining in the union-find forests only its own elements. The
+ * forests are then completed serially with the edges between blocks. */
+struct an_data {
+  const face_t *mfaces;        /* the model faces */
+  struct face_lists *flist;    /* the faces incident on each vertex */
+  struct edge_table *et;       /* the edge table of the model */
+  int n_vtcs;                  /* the number of vertices */
+  int n_faces;                 /* the number of faces */
+  int n_threads;               /* the number of threads to use */
+  int vblock;                  /* the number of vertices in each block */
+  int fblock;                  /* the number of faces in each block */
+  struct an_block *blk;        /* the results of each block */
+  int *vtx_parent;             /* union-find forest of the vertices */
+  int *face_parent;            /* union-find forest of the faces */
+  unsigned char *face_par;     /* for each face: if its orientation is the
+                                * reverse of its parent's in face_parent */
+  bmap_t *manifold_vtcs;       /* flag for each vertex: is manifold */
+  bmap_t *face_revo;           /* flag for each face: orient. should be
+                                * reversed */
 };
 
-/* Structure to hold the list of faces adjacent to a face */
-struct adj_faces {
-  int face_on_edge[3];       /* index of the face adjacent on the f0-f1, f1-f2
-                              * and f2-f0 edges. -1 if none. */
-  struct adj_faces_x *extra; /* The additional adjacent faces for each of the
-                              * above edges, if any. NULL if none. Only
-                              * non-manifold models have more than one
-                              * adjacent face at any edge. */
+/* Shared data for the parallel build of the face lists in
+ * faces_of_vertex(). The corners of the faces are first distributed, by
+ * blocks of faces, into n_parts ranges of vertices, and then the lists of
+ * each range are filled independently. */
+struct fl_build_data {
+  const face_t *mfaces;  /* the model faces */
+  struct face_lists *fl; /* the face lists being built */
+  int fblock;            /* the number of faces in each block */
+  int n_parts;           /* the number of vertex ranges */
+  int vpart;             /* the number of vertices in each range */
+  int *blk_pos;          /* for each block and range (at
+                          * block*n_parts+range), the number of corners
+                          * and then their position in corner */
+  int *part_start;       /* start of each range in corner, plus the end of
+                          * the last one (n_parts+1) */
+  int *corner;           /* the corners (3*face+i) of the non-degenerate
+                          * faces, by range and then by block */
+  int *n_degenerate;     /* the number of degenerate faces in each block */
 };
 
 /* --------------------------------------------------------------------------*
@@ -132,78 +162,130 @@ struct adj_faces {
 /* Sets (to 1) the nth bit in the bmap bitmap */
 #define BMAP_SET(bmap,n) ((bmap)[n/BMAP_T_BITS] |= 1 << ((n)&BMAP_T_MASK))
 
+/* Minimum number of vertices or faces in each block processed in parallel */
+#define AN_MIN_BLOCK 4096
+
 /* --------------------------------------------------------------------------*
  *                            Utility functions                              *
  * --------------------------------------------------------------------------*/
 
 /* Allocates a bitmap of size sz bits, initialized to zero (i.e. all bits
  * cleared). The storage can be freed by calling free on the returned
- * pointer. */
+ * pointer. NULL is returned if out of memory. */
 static bmap_t * bmap_calloc(size_t sz) BMAP_CALLOC_ATTR;
 static bmap_t * bmap_calloc(size_t sz)
 {
-  return xa_calloc((sz+BMAP_T_BITS-1)/BMAP_T_BITS,sizeof(bmap_t));
+  return calloc((sz+BMAP_T_BITS-1)/BMAP_T_BITS,sizeof(bmap_t));
+}
+
+/* Returns the number of elements in each block when processing n elements
+ * with n_threads threads. It is a multiple of BMAP_T_BITS, so that blocks do
+ * not share bitmap words, and is as large as possible while leaving a few
+ * blocks per thread to balance the load. */
+static int an_block_size(int n, int n_threads)
+{
+  int b;
+
+  b = (n_threads > 1) ? n/(4*n_threads) : n;
+  if (b < AN_MIN_BLOCK) b = AN_MIN_BLOCK;
+  return (b+(int)BMAP_T_MASK)&~(int)BMAP_T_MASK;
+}
+
+/* Allocates an array of n_blocks block results, with all flags set (except
+ * no_mem). NULL is returned if out of memory. */
+static struct an_block *an_blocks_alloc(int n_blocks)
+{
+  struct an_block *blk;
+  int i;
+
+  blk = malloc(sizeof(*blk)*(n_blocks > 0 ? n_blocks : 1));
+  if (blk == NULL) return NULL;
+  for (i=0; i<n_blocks; i++) {
+    blk[i].manifold = 1;
+    blk[i].closed = 1;
+    blk[i].oriented = 1;
+    blk[i].orientable = 1;
+    blk[i].no_mem = 0;
+  }
+  return blk;
 }
 
-/* Initializes the stack s for storing elements of elem_sz bytes. */
-static void stack_init(struct stack *s, size_t elem_sz)
+/* Allocates a union-find forest of n elements, each in its own tree. NULL
+ * is returned if out of memory. */
+static int *uf_alloc(int n)
 {
-  size_t buf_sz;
-  assert(elem_sz > 0);
-  s->elem_sz = elem_sz;
-  buf_sz = 16350*elem_sz;
-  s->data = xa_malloc(buf_sz);
-  s->end = s->data+buf_sz;
-  s->next = s->data;
+  int *parent;
+  int i;
+
+  parent = malloc(sizeof(*parent)*(n > 0 ? n : 1));
+  if (parent == NULL) return NULL;
+  for (i=0; i<n; i++) parent[i] = i;
+  return parent;
 }
 
-/* Frees allocated storage for stack s */
-static void stack_fini(struct stack *s)
+/* Returns the root of the tree of x in the union-find forest parent,
+ * halving the path on the way. */
+static INLINE int uf_find(int *parent, int x)
 {
-  free(s->data);
-  s->data = NULL;
-  s->end = NULL;
-  s->next = NULL;
+  while (parent[x] != x) {
+    parent[x] = parent[parent[x]];
+    x = parent[x];
+  }
+  return x;
 }
 
-/* Grows the stack buffer. Currently grows by 16384 elements. */
-static void stack_grow_buf(struct stack *s)
+/* Joins the trees of x and y in the union-find forest parent. The smallest
+ * root becomes the root of the union. */
+static INLINE void uf_union(int *parent, int x, int y)
 {
-  size_t buf_sz;
-  ptrdiff_t next_off;
-
-  buf_sz = (s->end-s->data)+16384*s->elem_sz;
-  next_off = s->next-s->data;
-  s->data = xa_realloc(s->data,buf_sz);
-  s->end = s->data+buf_sz;
-  s->next = s->data+next_off;
+  x = uf_find(parent,x);
+  y = uf_find(parent,y);
+  if (x < y) {
+    parent[y] = x;
+  } else if (y < x) {
+    parent[x] = y;
+  }
 }
 
-/* Pushes the element pointed by *e and of the size specifed at stack
- * initialization into the stack s. */
-static INLINE void stack_push(struct stack *s, void *e)
+/* Same as uf_find(), for a forest where par gives, for each element, if its
+ * orientation is the reverse of that of its parent. The orientation of x
+ * relative to the root is returned in *rev. */
+static INLINE int uf_find_par(int *parent, unsigned char *par, int x,
+                              int *rev)
 {
-  assert(s->next <= s->end);
-  if (s->next == s->end) stack_grow_buf(s);
-  memcpy(s->next,e,s->elem_sz);
-  s->next += s->elem_sz;
-  assert(s->next <= s->end);
+  int p,r;
+
+  r = 0;
+  while ((p = parent[x]) != x) {
+    parent[x] = parent[p];
+    par[x] ^= par[p];
+    r ^= par[x];
+    x = parent[x];
+  }
+  *rev = r;
+  return x;
 }
 
-/* If the stack is not empty, it pops the last element of the stack and stores
- * it the location pointed by e and of the size specified at stack
- * initialization, and returns one. If the stack is empty it returns zero. */
-static INLINE int stack_pop(struct stack *s, void *e)
+/* Joins the trees of x and y, as in uf_union(), where the orientation of y
+ * is the reverse of that of x if rev is non-zero. Returns zero if x and y
+ * were already in the same tree with the other relative orientation, and
+ * non-zero otherwise. */
+static INLINE int uf_union_par(int *parent, unsigned char *par, int x, int y,
+                               int rev)
 {
-  assert(s->next <= s->end);
-  if (s->next == s->data) {
-    return 0; /* stack empty */
+  int rx,ry,px,py;
+
+  rx = uf_find_par(parent,par,x,&px);
+  ry = uf_find_par(parent,par,y,&py);
+  if (rx == ry) return (px^py) == rev;
+  if (rx < ry) {
+    parent[ry] = rx;
+    par[ry] = (unsigned char)(px^py^rev);
   } else {
-    s->next -= s->elem_sz;
-    assert(s->next <= s->end);
-    memcpy(e,s->next,s->elem_sz);
-    return 1;
+    parent[rx] = ry;
+    par[rx] = (unsigned char)(px^py^rev);
   }
+  return 1;
 }
 
 /* --------------------------------------------------------------------------*
@@ -227,18 +309,10 @@ static void orient_model(struct model *m, const bmap_t *face_rev_orientation)
   }
 }
 
-/* Grows the storage space for list->vtcs and adjusts *sz accordingly. */
-static void vtx_list_grow(struct vtx_list *list, int *sz)
-{
-  *sz += 2;
-  list->vtcs = xa_realloc(list->vtcs,*sz*sizeof(*(list->vtcs)));
-}
-
 /* Searches for vertex index v in list. If not found v is added to
  * list. Returns zero if not-found and non-zero otherwise. list->vtcs storage
- * must be large enough for v to be added. The current size of the list buffer
- * is given in *sz and adjusted if necessary. */
-static INLINE int vtx_in_list_or_add(struct vtx_list *list, int v, int *sz)
+ * must be large enough for v to be added. */
+static INLINE int vtx_in_list_or_add(struct vtx_list *list, int v)
 {
   int i;
   i = 0;
@@ -246,7 +320,6 @@ static INLINE int vtx_in_list_or_add(struct vtx_list *list, int v, int *sz)
     if (list->vtcs[i++] == v) return 1; /* already in list */
   }
   /* not in list */
-  if (*sz == list->n_elems) vtx_list_grow(list,sz);
   list->vtcs[list->n_elems++] = v;
   return 0;
 }
@@ -326,21 +399,22 @@ static INLINE void reverse_list(int *list, int len)
 }
 
 /* Performs local analysis of the faces incident on vertex vidx. The faces of
- * the model are given in the mfaces array. The list of faces incident on vidx
- * is given by *flist. The local topology information is returned in
- * *ltop. The list of incident faces in *flist is reordered, so that for
+ * the model are given in the mfaces array. The list of the nf faces incident
+ * on vidx is given by vface, and vfaces_buf is a buffer of at least nf-1
+ * elements to work with. The local topology information is returned in
+ * *ltop. The list of incident faces in vface is reordered, so that for
  * manfifold vertices two consecutive entries are adjacent faces (in addition
  * the last anf first ones are adjacent if the vertex is closed). For
  * non-manifold vertices no special guarantees can be made on the resulting
  * order. In addition it constructs the list of vertices, different from vidx
  * and without repetition, that belong to the faces incident on vidx in
- * *vlist. */
+ * *vlist, whose storage must have room for 2*nf vertices (each face adds at
+ * most two). */
 static void get_vertex_topology(const face_t *mfaces, int vidx,
-                                const struct face_list *flist,
+                                int *vface, int nf, int *vfaces_buf,
                                 struct topology *ltop,
                                 struct vtx_list *vlist)
 {
-  int nf;          /* number of faces incident on current vertex */
   int fidx;        /* current face index */
   int v2;          /* vertex on which next face should be incident */
   int vstart;      /* starting vertex, to check for closed surface */
@@ -349,37 +423,29 @@ static void get_vertex_topology(const face_t *mfaces, int vidx,
   int n_vfaces;    /* number of faces in vfaces */
   int v2_was_in_list; /* flag: v2 already visited when last encountered */
   int vstart_was_in_list; /* same as above but for vstart */
-  int vtx_buf_sz;  /* size of the vertex list buffer */
 
   /* Initialize */
   ltop->manifold = 1;
   ltop->closed = 1;
   vlist->n_elems = 0;
-  nf = flist->n_faces;
-  if (nf == 0) { /* isolated vertex => nothing to be done */
-    vlist->vtcs = NULL;
-    return;
-  }
+  if (nf == 0) return; /* isolated vertex => nothing to be done */
   n_vfaces = nf-1;
-  fidx = flist->face[n_vfaces];
-  vfaces = xa_malloc(sizeof(*(vfaces))*n_vfaces);
-  memcpy(vfaces,flist->face,sizeof(*(vfaces))*n_vfaces);
-  /* do typical size allocation */
-  vtx_buf_sz = nf;
-  vlist->vtcs = xa_realloc(vlist->vtcs,sizeof(*(vlist->vtcs))*vtx_buf_sz);
+  fidx = vface[n_vfaces];
+  vfaces = vfaces_buf;
+  memcpy(vfaces,vface,sizeof(*(vfaces))*n_vfaces);
   /* Get first face vertices */
   assert(fidx>=0);
   get_ordered_vtcs(&mfaces[fidx],vidx,&vstart,&v2);
   /* Check the other faces in order */
   rev_orient = 0;
   vstart_was_in_list = 0; /* list empty, so vstart always added */
-  vtx_in_list_or_add(vlist,vstart,&vtx_buf_sz);
-  v2_was_in_list = vtx_in_list_or_add(vlist,v2,&vtx_buf_sz);
+  vtx_in_list_or_add(vlist,vstart);
+  v2_was_in_list = vtx_in_list_or_add(vlist,v2);
   while (n_vfaces > 0) { /* process the remaining faces */
     fidx = find_face_with_edge(mfaces,vfaces,&n_vfaces,vidx,&v2);
     if (fidx >= 0) { /* found an adjacent face */
-      flist->face[n_vfaces] = fidx;
-      v2_was_in_list = vtx_in_list_or_add(vlist,v2,&vtx_buf_sz);
+      vface[n_vfaces] = fidx;
+      v2_was_in_list = vtx_in_list_or_add(vlist,v2);
       if (v2_was_in_list) {
         if (v2 == vstart) vstart_was_in_list = 1; /* handle duplicate */
         /* v2 appearing twice is only addmissible in a manifold if it is the
@@ -400,19 +466,19 @@ static void get_vertex_topology(const face_t *mfaces, int vidx,
         /* Restart with first not yet counted triangle (always one) */
         assert(n_vfaces > 0);
         fidx = vfaces[--n_vfaces];
-        flist->face[n_vfaces] = fidx;
+        vface[n_vfaces] = fidx;
         assert(fidx >= 0);
         rev_orient = 0; /* restore original orientation */
         /* Get new first face vertices */
         get_ordered_vtcs(&mfaces[fidx],vidx,&vstart,&v2);
-        vstart_was_in_list = vtx_in_list_or_add(vlist,vstart,&vtx_buf_sz);
-        v2_was_in_list = vtx_in_list_or_add(vlist,v2,&vtx_buf_sz);
+        vstart_was_in_list = vtx_in_list_or_add(vlist,vstart);
+        v2_was_in_list = vtx_in_list_or_add(vlist,v2);
       } else {
         /* we reverse scanning orientation and continue from the other side */
         int tmpi;
         rev_orient = 1;
         if (ltop->manifold) { /* if non-manifold order becomes useless */
-          reverse_list(flist->face+n_vfaces,flist->n_faces-n_vfaces);
+          reverse_list(vface+n_vfaces,nf-n_vfaces);
         }
         tmpi = v2;
         v2 = vstart;
@@ -428,486 +494,345 @@ static void get_vertex_topology(const face_t *mfaces, int vidx,
   if (!(v2 == vstart || (vstart_was_in_list && v2_was_in_list))) {
     ltop->closed = 0;
   }
-  free(vfaces);
 }
 
-/* Adds the face_idx to the list of extra adjacent faces *af, as adjacent on
- * the edge edge_idx. */
-static void add_adj_face_extra(struct adj_faces *af, int edge_idx, int face_idx)
+/* Returns the half-edge adjacent to half-edge h with which h is to be
+ * checked, using the radial links he_radial of the edge table, or -1 if
+ * none. Each adjacent pair is returned once: on edges with two half-edges
+ * only from the first one, and on non-manifold edges each half-edge is
+ * paired with the next one around the edge. */
+static INLINE int adj_half_edge(const int *he_radial, int h)
 {
-  int j;
+  int g;
 
-  if (af->extra == NULL) { /* no extra lists for no edge yet */
-    af->extra = xa_calloc(1,sizeof(*(af->extra)));
-  }
-  j = (af->extra->n_faces_on_edge[edge_idx])++;
-  af->extra->faces_on_edge[edge_idx] =
-    xa_realloc(af->extra->faces_on_edge[edge_idx],
-               sizeof(*(af->extra->faces_on_edge[0]))*(j+1));
-  af->extra->faces_on_edge[edge_idx][j] = face_idx;
-  
+  g = he_radial[h];
+  if (g < 0 || g == h) return -1; /* degenerate face or boundary edge */
+  if (g < h && he_radial[g] == h) return -1; /* already paired from g */
+  return g;
 }
 
-/* Adds the face_idx to the list of adjacent faces *af, as adjacent on the
- * edge edge_idx. */
-static INLINE void add_adj_face(struct adj_faces *af, int edge_idx,
-                                int face_idx)
+/* Analyzes the topology of the vertices start to end-1 and joins in the
+ * vertex forest those sharing an edge within the block. If out of memory
+ * the no_mem flag of the block is set. */
+static void vtx_block_work(void *data, int start, int end, int tid)
 {
-  if (af->face_on_edge[edge_idx] < 0) {
-    af->face_on_edge[edge_idx] = face_idx;
-  } else {
-    add_adj_face_extra(af,edge_idx,face_idx);
+  struct an_data *d;
+  struct an_block *blk;
+  struct vtx_list vlist;   /* the vertices sharing an edge with the current */
+  struct topology vtx_top; /* local vertex topology */
+  int *vfaces_buf;         /* work buffer for get_vertex_topology() */
+  int buf_sz;              /* size of vfaces_buf and vlist.vtcs */
+  int v,w,i,nf;
+
+  (void)tid;
+  d = (struct an_data*)data;
+  blk = &(d->blk[start/d->vblock]);
+  vlist.vtcs = NULL;
+  vlist.n_elems = 0;
+  vfaces_buf = NULL;
+  buf_sz = 0;
+  for (v=start; v<end; v++) {
+    nf = d->flist->start[v+1]-d->flist->start[v];
+    if (nf > buf_sz) {
+      buf_sz = 2*nf;
+      free(vfaces_buf);
+      free(vlist.vtcs);
+      vfaces_buf = malloc(sizeof(*vfaces_buf)*buf_sz);
+      vlist.vtcs = malloc(sizeof(*(vlist.vtcs))*buf_sz);
+      if (vfaces_buf == NULL || vlist.vtcs == NULL) {
+        blk->no_mem = 1;
+        break;
+      }
+    }
+    get_vertex_topology(d->mfaces,v,d->flist->face+d->flist->start[v],nf,
+                        vfaces_buf,&vtx_top,&vlist);
+    if (vtx_top.manifold) {
+      BMAP_SET(d->manifold_vtcs,v);
+    } else {
+      blk->manifold = 0;
+    }
+    if (!vtx_top.closed) blk->closed = 0;
+    for (i=0; i<vlist.n_elems; i++) {
+      w = vlist.vtcs[i];
+      if (w > v && w < end) uf_union(d->vtx_parent,v,w);
+    }
   }
+  free(vlist.vtcs);
+  free(vfaces_buf);
 }
 
-/* Frees all the storage array of lists of adjacent faces, of length n_faces. */
-static void free_adj_face_list(struct adj_faces *aflist, int n_faces)
+/* Checks the orientation of the faces start to end-1 against their adjacent
+ * faces and joins in the face forest the adjacent faces within the
+ * block. */
+static void face_block_work(void *data, int start, int end, int tid)
 {
-  int i;
-
-  for (i=0; i<n_faces; i++) {
-    if (aflist[i].extra != NULL) {
-      free(aflist[i].extra->faces_on_edge[0]);
-      free(aflist[i].extra->faces_on_edge[1]);
-      free(aflist[i].extra->faces_on_edge[2]);
-      free(aflist[i].extra);
+  struct an_data *d;
+  struct an_block *blk;
+  int h,g,fidx,rev;
+
+  (void)tid;
+  d = (struct an_data*)data;
+  blk = &(d->blk[start/d->fblock]);
+  for (h=3*start; h<3*end; h++) {
+    if ((g = adj_half_edge(d->et->he_radial,h)) < 0) continue;
+    /* consistently oriented faces traverse the shared edge in opposite
+     * directions */
+    rev = (ET_HE_ORG(d->mfaces,g) == ET_HE_ORG(d->mfaces,h));
+    if (rev) blk->oriented = 0;
+    if (d->et->he_radial[g] != h) {
+      /* three or more faces on the edge: two of them traverse it in the same
+       * direction and each has the opposite orientation of the other */
+      blk->oriented = 0;
+      blk->orientable = 0;
+    }
+    fidx = ET_HE_FACE(g);
+    if (fidx >= start && fidx < end &&
+        !uf_union_par(d->face_parent,d->face_par,ET_HE_FACE(h),fidx,rev)) {
+      blk->orientable = 0;
     }
   }
-  free(aflist);
 }
 
-/* Builds and returns the list of adjacent faces for each face in the
- * model. n_faces is the number of faces, mfaces the array of faces of the
- * model, and flist the list of faces incident on each vertex. manifold_vtcs
- * flags, for each vertex, if it is manifold or not. Degenerate faces are
- * skipped. The returned array is of length n_faces. */
-static struct adj_faces * find_adjacent_faces(const face_t *mfaces, int n_faces,
-                                              const struct face_list *flist,
-                                              const bmap_t *manifold_vtcs)
+/* Sets the orientation flag of the faces start to end-1 from their
+ * orientation relative to the root of their tree in the face forest. */
+static void face_revo_work(void *data, int start, int end, int tid)
 {
-  struct adj_faces *aflist;
-  int k,i,imax;
-  int f0,f1,f2;
-  int adj_fidx;
-  const struct face_list *faces_at_vtx;
-
-  aflist = xa_malloc(n_faces*sizeof(*aflist));
-  for (k=0; k<n_faces; k++) {
-    aflist[k].face_on_edge[0] = -1;
-    aflist[k].face_on_edge[1] = -1;
-    aflist[k].face_on_edge[2] = -1;
-    aflist[k].extra = NULL;
-
-    f0 = mfaces[k].f0;
-    f1 = mfaces[k].f1;
-    f2 = mfaces[k].f2;
-
-    if (f0 == f1 || f1 == f2 || f2 == f0) continue; /* ignore degenerates */
-
-    /* Find faces adjacent on the f0-f1 edge */
-    faces_at_vtx = &flist[f0];
-    if (BMAP_ISSET(manifold_vtcs,f0)) {
-      /* manifold => faces_at_vtx is ordered (i.e. adjacent faces are either
-       * just before or just after in faces_at_vtx) and there is at most one
-       * adjacent face on the edge f0-f1. */
-      i = imax = faces_at_vtx->n_faces-1;
-      if (imax > 0) { /* k is not the only face on this vertex */
-        while (faces_at_vtx->face[i] != k) {
-          i--;
-          assert(i>=0); /* there is always a match */
-        }
-        adj_fidx = faces_at_vtx->face[(i > 0) ? i-1 : imax];
-        assert(k != adj_fidx);
-        if (mfaces[adj_fidx].f0 == f1 || mfaces[adj_fidx].f1 == f1 ||
-            mfaces[adj_fidx].f2 == f1) { /* adjacent on f0-f1 */
-          add_adj_face(&aflist[k],0,adj_fidx);
-        } else { /* there can only be one adjacent */
-          adj_fidx = faces_at_vtx->face[(i < imax) ? i+1 : 0];
-          assert(k != adj_fidx);
-          if (mfaces[adj_fidx].f0 == f1 || mfaces[adj_fidx].f1 == f1 ||
-              mfaces[adj_fidx].f2 == f1) { /* adjacent on f0-f1 */
-            add_adj_face(&aflist[k],0,adj_fidx);
-          }
-        }
-      }
-    } else { /* unordered faces_at_vtx => full scan */
-      for (i=faces_at_vtx->n_faces-1; i>=0; i--) {
-        adj_fidx = faces_at_vtx->face[i];
-        if (adj_fidx == k) continue; /* don't include ourselves */
-        if (mfaces[adj_fidx].f0 == f1 || mfaces[adj_fidx].f1 == f1 ||
-            mfaces[adj_fidx].f2 == f1) { /* adjacent on f0-f1 */
-          add_adj_face(&aflist[k],0,adj_fidx);
-        }
-      }
+  struct an_data *d;
+  int fidx,f,rev;
+
+  (void)tid;
+  d = (struct an_data*)data;
+  for (fidx=start; fidx<end; fidx++) {
+    for (rev=0, f=fidx; d->face_parent[f] != f; f=d->face_parent[f]) {
+      rev ^= d->face_par[f];
     }
+    if (rev) BMAP_SET(d->face_revo,fidx);
+  }
+}
 
-    /* Find faces adjacent on the f1-f2 edge */
-    faces_at_vtx = &flist[f1];
-    if (BMAP_ISSET(manifold_vtcs,f1)) {
-      /* manifold => faces_at_vtx is ordered (i.e. adjacent faces are either
-       * just before or just after in faces_at_vtx) and there is at most one
-       * adjacent face on the edge f1-f2. */
-      i = imax = faces_at_vtx->n_faces-1;
-      if (imax > 0) { /* k is not the only face on this vertex */
-        while (faces_at_vtx->face[i] != k) {
-          i--;
-          assert(i>=0); /* there is always a match */
-        }
-        adj_fidx = faces_at_vtx->face[(i > 0) ? i-1 : imax];
-        assert(k != adj_fidx);
-        if (mfaces[adj_fidx].f0 == f2 || mfaces[adj_fidx].f1 == f2 ||
-            mfaces[adj_fidx].f2 == f2) { /* adjacent on f1-f2 */
-          add_adj_face(&aflist[k],1,adj_fidx);
-        } else { /* there can only be one adjacent */
-          adj_fidx = faces_at_vtx->face[(i < imax) ? i+1 : 0];
-          assert(k != adj_fidx);
-          if (mfaces[adj_fidx].f0 == f2 || mfaces[adj_fidx].f1 == f2 ||
-              mfaces[adj_fidx].f2 == f2) { /* adjacent on f1-f2 */
-            add_adj_face(&aflist[k],1,adj_fidx);
-          }
-        }
-      }
-    } else { /* unordered faces_at_vtx => full scan */
-      for (i=faces_at_vtx->n_faces-1; i>=0; i--) {
-        adj_fidx = faces_at_vtx->face[i];
-        if (adj_fidx == k) continue; /* don't include ourselves */
-        if (mfaces[adj_fidx].f0 == f2 || mfaces[adj_fidx].f1 == f2 ||
-            mfaces[adj_fidx].f2 == f2) { /* adjacent on f1-f2 */
-          add_adj_face(&aflist[k],1,adj_fidx);
-        }
-      }
-    }
+/* Evaluates the orientation of the model given by the faces and edge table
+ * in *d, using d->n_threads threads. The results is returned in the
+ * following fields of minfo: oriented and orientable. The orientation of
+ * each face is returned as a malloc'ed bitmap array of length d->n_faces (in
+ * bits). If the corresponding bit is set the orientation of the
+ * corresponding face needs to be reversed to obtain an oriented model (if
+ * orientable). The first face of each part keeps its orientation. If the
+ * model is not orientable, the model would be mostly oriented if the
+ * returned orientation map is applied. NULL is returned if out of memory. */
+static bmap_t * model_orientation(struct an_data *d, struct model_info *minfo)
+{
+  int n_blocks;             /* number of face blocks */
+  int h,g,rev,i;
 
-    /* Find faces adjacent on the f2-f0 edge */
-    faces_at_vtx = &flist[f2];
-    if (BMAP_ISSET(manifold_vtcs,f2)) {
-      /* manifold => faces_at_vtx is ordered (i.e. adjacent faces are either
-       * just before or just after in faces_at_vtx) and there is at most one
-       * adjacent face on the edge f2-f0. */
-      i = imax = faces_at_vtx->n_faces-1;
-      if (imax > 0) { /* k is not the only face on this vertex */
-        while (faces_at_vtx->face[i] != k) {
-          i--;
-          assert(i>=0); /* there is always a match */
-        }
-        adj_fidx = faces_at_vtx->face[(i > 0) ? i-1 : imax];
-        assert(k != adj_fidx);
-        if (mfaces[adj_fidx].f0 == f0 || mfaces[adj_fidx].f1 == f0 ||
-            mfaces[adj_fidx].f2 == f0) { /* adjacent on f2-f0 */
-          add_adj_face(&aflist[k],2,adj_fidx);
-        } else { /* there can only be one adjacent */
-          adj_fidx = faces_at_vtx->face[(i < imax) ? i+1 : 0];
-          assert(k != adj_fidx);
-          if (mfaces[adj_fidx].f0 == f0 || mfaces[adj_fidx].f1 == f0 ||
-              mfaces[adj_fidx].f2 == f0) { /* adjacent on f2-f0 */
-            add_adj_face(&aflist[k],2,adj_fidx);
-          }
-        }
-      }
-    } else { /* unordered faces_at_vtx => full scan */
-      for (i=faces_at_vtx->n_faces-1; i>=0; i--) {
-        adj_fidx = faces_at_vtx->face[i];
-        if (adj_fidx == k) continue; /* don't include ourselves */
-        if (mfaces[adj_fidx].f0 == f0 || mfaces[adj_fidx].f1 == f0 ||
-            mfaces[adj_fidx].f2 == f0) { /* adjacent on f2-f0 */
-          add_adj_face(&aflist[k],2,adj_fidx);
-        }
+  /* Initialize */
+  d->fblock = an_block_size(d->n_faces,d->n_threads);
+  n_blocks = (d->n_faces+d->fblock-1)/d->fblock;
+  d->blk = an_blocks_alloc(n_blocks);
+  d->face_parent = uf_alloc(d->n_faces);
+  d->face_par = calloc(d->n_faces > 0 ? d->n_faces : 1,
+                       sizeof(*(d->face_par)));
+  d->face_revo = bmap_calloc(d->n_faces);
+  if (d->blk == NULL || d->face_parent == NULL || d->face_par == NULL ||
+      d->face_revo == NULL) {
+    free(d->face_revo);
+    d->face_revo = NULL;
+    goto end;
+  }
+
+  /* Join the adjacent faces within each block, then between blocks */
+  tp_par_for(d->n_threads,d->n_faces,d->fblock,face_block_work,d);
+  minfo->orientable = 1;
+  minfo->oriented = 1;
+  for (i=0; i<n_blocks; i++) {
+    minfo->orientable = minfo->orientable && d->blk[i].orientable;
+    minfo->oriented = minfo->oriented && d->blk[i].oriented;
+  }
+  if (n_blocks > 1) {
+    for (h=0; h<3*d->n_faces; h++) {
+      if ((g = adj_half_edge(d->et->he_radial,h)) < 0 ||
+          ET_HE_FACE(g)/d->fblock == ET_HE_FACE(h)/d->fblock) continue;
+      rev = (ET_HE_ORG(d->mfaces,g) == ET_HE_ORG(d->mfaces,h));
+      if (!uf_union_par(d->face_parent,d->face_par,ET_HE_FACE(h),
+                        ET_HE_FACE(g),rev)) {
+        minfo->orientable = 0;
       }
     }
   }
-  return aflist;
+
+  /* Get the orientation of each face relative to its part's first face */
+  tp_par_for(d->n_threads,d->n_faces,d->fblock,face_revo_work,d);
+
+ end:
+  free(d->blk);
+  free(d->face_parent);
+  free(d->face_par);
+  d->blk = NULL;
+  d->face_parent = NULL;
+  d->face_par = NULL;
+  return d->face_revo;
 }
 
-/* Returns the next face in the list of adjacent faces aflist[fidx]. The
- * search starts at edge *edge_idx and at position *edge_pos within that
- * edge. The values edge and position for the next search are returned in
- * *edge_idx and *edge_pos. The index of the edge of fidx on which the
- * adjacent face is found is returned in *join_eidx. If there are no more
- * adjacent faces -1 is returned. Otherwise fidx is removed from
- * aflist[next_fidx], where next_fidx is the returned value (i.e. the
- * symmetric face adjacency is removed). */
-static INLINE int get_next_adj_face_rm(struct adj_faces *aflist, int fidx,
-                                       int *edge_idx, int *edge_pos,
-                                       int *join_eidx)
+/* Evaluates the topology of the model given by the faces, the list of
+ * incident faces for each vertex and the edge table in *d, using
+ * d->n_threads threads. The result is returned in the following fields of
+ * minfo: manifold, closed and n_disjoint_parts. It returns a malloc'ed
+ * bitmap array (of length d->n_vtcs bits) indicating which vertices are
+ * manifold. The entries for each vertex in d->flist are reordered (as
+ * explained in get_vertex_topology()), but the contents are the same. NULL
+ * is returned if out of memory. */
+static bmap_t * model_topology(struct an_data *d, struct model_info *minfo)
 {
-  int next_fidx;
-  int eidx,epos,jeidx;
-  struct adj_faces *af;
-
-  eidx = *edge_idx;
-  epos = *edge_pos;
-
-  assert(eidx >= 0 && eidx < 3);
-  af = &aflist[fidx];
-  do {
-    if (epos == 0) { /* take from main adjacent faces */
-      next_fidx = af->face_on_edge[eidx];
-      jeidx = eidx;
-      if (af->extra != NULL && epos < af->extra->n_faces_on_edge[eidx]) {
-        epos++;
-      } else {
-        eidx++;
-      }
-    } else { /* take from extra adjacent faces */
-      next_fidx = af->extra->faces_on_edge[eidx][epos-1];
-      jeidx = eidx;
-      if (epos < af->extra->n_faces_on_edge[eidx]) {
-        epos++;
-      } else {
-        eidx++;
-        epos = 0;
-      }
-    }
-    /* get indices of next adjacent face */
-  } while (next_fidx < 0 && eidx < 3);
-  if (next_fidx < 0) return -1; /* none found */
-  /* return values */
-  *edge_idx = eidx;
-  *edge_pos = epos;
-  *join_eidx = jeidx;
-  /* remove symmetric adjacency from next_fidx */
-  af = &aflist[next_fidx];
-  for (eidx=0; eidx<3; eidx++) { /* remove from main adjacent faces */
-    if (af->face_on_edge[eidx] == fidx) {
-      af->face_on_edge[eidx] = -1;
-      return next_fidx; /* done */
+  int n_blocks;             /* number of vertex blocks */
+  int e,h,v0,v1,i;
+
+  /* Initialize */
+  d->vblock = an_block_size(d->n_vtcs,d->n_threads);
+  n_blocks = (d->n_vtcs+d->vblock-1)/d->vblock;
+  d->blk = an_blocks_alloc(n_blocks);
+  d->vtx_parent = uf_alloc(d->n_vtcs);
+  d->manifold_vtcs = bmap_calloc(d->n_vtcs);
+  if (d->blk == NULL || d->vtx_parent == NULL || d->manifold_vtcs == NULL) {
+    goto no_mem;
+  }
+
+  /* Analyze each vertex and join the connected vertices within each block,
+   * then between blocks */
+  tp_par_for(d->n_threads,d->n_vtcs,d->vblock,vtx_block_work,d);
+  for (i=0; i<n_blocks; i++) {
+    if (d->blk[i].no_mem) goto no_mem;
+  }
+  minfo->manifold = 1;
+  minfo->closed = 1;
+  for (i=0; i<n_blocks; i++) {
+    minfo->manifold = minfo->manifold && d->blk[i].manifold;
+    minfo->closed = minfo->closed && d->blk[i].closed;
+  }
+  if (n_blocks > 1) {
+    for (e=0; e<d->et->n_edges; e++) {
+      h = d->et->edge_he[e];
+      v0 = ET_HE_ORG(d->mfaces,h);
+      v1 = ET_HE_DST(d->mfaces,h);
+      if (v0/d->vblock != v1/d->vblock) uf_union(d->vtx_parent,v0,v1);
     }
   }
-  if (af->extra != NULL) { /* not in main adjacent faces => remove from extra */
-    for (eidx=0; eidx<3; eidx++) {
-      for (epos=0; epos < af->extra->n_faces_on_edge[eidx]; epos++) {
-        if (af->extra->faces_on_edge[eidx][epos] == fidx) {
-          af->extra->faces_on_edge[eidx][epos] = -1;
-          return next_fidx; /* done */
-        }
-      }
+
+  /* Count the parts: the roots of the trees, except isolated vertices */
+  minfo->n_disjoint_parts = 0;
+  for (i=0; i<d->n_vtcs; i++) {
+    if (d->vtx_parent[i] == i && d->et->vtx_n_faces[i] != 0) {
+      minfo->n_disjoint_parts++;
     }
   }
-  return next_fidx;
+
+ end:
+  free(d->blk);
+  free(d->vtx_parent);
+  d->blk = NULL;
+  d->vtx_parent = NULL;
+  return d->manifold_vtcs;
+
+ no_mem:
+  free(d->manifold_vtcs);
+  d->manifold_vtcs = NULL;
+  goto end;
 }
 
-/* Compare the orientation of *face1 and *face2, where f2_join_eidx is the
- * index of *face2 that is shared with *face1. Returns zero if both faces have
- * the same orientation and one otherwise. */
-static INLINE int get_orientation(const face_t *face1, const face_t *face2,
-                                  int f2_join_eidx)
+/* Returns the vertex of corner c (3*face+i) of the faces mfaces */
+static INLINE int corner_vtx(const face_t *mfaces, int c)
 {
-  int v0,v1; /* ordered vertices of the joining edge */
-
-  switch (f2_join_eidx) {
+  switch (c%3) {
   case 0:
-    v0 = face2->f0;
-    v1 = face2->f1;
-    break;
+    return mfaces[c/3].f0;
   case 1:
-    v0 = face2->f1;
-    v1 = face2->f2;
-    break;
-  default: /* must always be 2 */
-    assert(f2_join_eidx == 2);
-    v0 = face2->f2;
-    v1 = face2->f0;
+    return mfaces[c/3].f1;
+  default:
+    return mfaces[c/3].f2;
   }
+}
 
-  if (face1->f0 == v0) {
-    return (face1->f2 != v1);
-  } else if (face1->f1 == v0) {
-    return (face1->f0 != v1);
-  } else { /* face1->f2 == v0 */
-    assert(face1->f2 == v0);
-    return (face1->f1 != v1);
+/* Counts the corners of the faces start to end-1 in each vertex range, and
+ * their degenerate faces */
+static void fl_count_work(void *data, int start, int end, int tid)
+{
+  struct fl_build_data *d;
+  const face_t *face;
+  int *cnt;
+  int fidx,b;
+
+  (void)tid;
+  d = (struct fl_build_data*)data;
+  b = start/d->fblock;
+  cnt = d->blk_pos+b*d->n_parts;
+  for (fidx=start; fidx<end; fidx++) {
+    face = &(d->mfaces[fidx]);
+    /* degenerate faces not included */
+    if (face->f0 == face->f1 || face->f0 == face->f2 || face->f1 == face->f2) {
+      d->n_degenerate[b]++;
+      continue;
+    }
+    cnt[face->f0/d->vpart]++;
+    cnt[face->f1/d->vpart]++;
+    cnt[face->f2/d->vpart]++;
   }
 }
 
-/* Evaluates the orientation of the model given by the faces in mfaces, the
- * number of faces n_faces and the list of incident faces for each vertex
- * flist. manifold_vtcs flags, for each vertex, if it is manifold or not. The
- * results is returned in the following fields of minfo: oriented and
- * orientable. The orientation of each face is returned as a malloc'ed bitmap
- * array of length n_faces (in bits). If the corresponding bit is set the
- * orientation of the corresponding face needs to be reversed to obtain an
- * oriented model (if orientable). If the model is not orientable, the model
- * would be mostly oriented if the returned orientation map is applied. */
-static bmap_t * model_orientation(const face_t *mfaces, int n_faces,
-                                  const struct face_list *flist,
-                                  const bmap_t *manifold_vtcs,
-                                  struct model_info *minfo)
+/* Distributes the corners of the faces start to end-1 in the vertex
+ * ranges */
+static void fl_scatter_work(void *data, int start, int end, int tid)
 {
-  struct adj_faces *aflist; /* for each face, the list of adjacent faces */
-  bmap_t *face_oriented;    /* flag for each face: already tested orient. */
-  bmap_t *face_revo;        /* flag for each face: orient. should be reversed */
-  int n_oriented_faces;     /* number of faces whose orient. has been tested */
-  int next_fidx;            /* index of next face to test for orientation */
-  unsigned int next_rev_of_fidx; /* flag: orientation of next_rev_of_fidx is
-                                  * the reverse of that of fidx. */
-  int join_eidx;            /* shared edge index between adjacent faces */
-  struct stack stack;       /* stack to walk face tree */
-  struct {
-    int fidx;  /* current face index in aflist */
-    int eidx;  /* current edge index in within face */
-    int epos;  /* current position index within edge */
-  } cur;                    /* the indices to the current entry in aflist */
-
-  /* Initialize */
-  aflist = find_adjacent_faces(mfaces,n_faces,flist,manifold_vtcs);
-  face_oriented = bmap_calloc(n_faces);
-  face_revo = bmap_calloc(n_faces);
-  stack_init(&stack,sizeof(cur));
-  minfo->orientable = 1;
-  minfo->oriented = 1;
-  n_oriented_faces = 0;
-  cur.fidx = 0;
-  while (n_oriented_faces < n_faces) {
-    /* find next not yet oriented face. Use fast skip by testing BMAP_T_BITS
-     * entries in the bitmap at once, and then find the individual entry. */
-    for (cur.fidx &= (~BMAP_T_MASK); cur.fidx<n_faces; cur.fidx+=BMAP_T_BITS) {
-      if (face_oriented[cur.fidx/BMAP_T_BITS] != ~0U) break;
-    }
-    for (; cur.fidx<n_faces; cur.fidx++) {
-      if (!BMAP_ISSET(face_oriented,cur.fidx)) break;
+  struct fl_build_data *d;
+  const face_t *face;
+  int *pos;
+  int fidx;
+
+  (void)tid;
+  d = (struct fl_build_data*)data;
+  pos = d->blk_pos+(start/d->fblock)*d->n_parts;
+  for (fidx=start; fidx<end; fidx++) {
+    face = &(d->mfaces[fidx]);
+    if (face->f0 == face->f1 || face->f0 == face->f2 || face->f1 == face->f2) {
+      continue;
     }
-    assert(cur.fidx < n_faces);
-    assert(!BMAP_ISSET(face_revo,cur.fidx));
-    BMAP_SET(face_oriented,cur.fidx);
-    n_oriented_faces++;
-    cur.eidx = 0;
-    cur.epos = 0;
-    /* do a walk on all connected faces, checking orientation */
-    do {
-      /* get next face that is adjacent to current one */
-      if (cur.eidx < 3 &&
-          (next_fidx = get_next_adj_face_rm(aflist,cur.fidx,&cur.eidx,
-                                            &cur.epos,&join_eidx)) >= 0) {
-        /* still an adjacent face */
-        assert(BMAP_ISSET(face_oriented,cur.fidx));
-        assert(next_fidx != cur.fidx);
-        next_rev_of_fidx = get_orientation(&mfaces[next_fidx],
-                                           &mfaces[cur.fidx],join_eidx);
-        if (next_rev_of_fidx) minfo->oriented = 0;
-        if (!BMAP_ISSET(face_oriented,next_fidx)) {
-          /* not yet oriented face => orient and continue from new */
-          if ((next_rev_of_fidx^BMAP_ISSET(face_revo,cur.fidx)) != 0) {
-            BMAP_SET(face_revo,next_fidx);
-          }
-          BMAP_SET(face_oriented,next_fidx);
-          n_oriented_faces++;
-          stack_push(&stack,&cur);
-          cur.fidx = next_fidx;
-          cur.eidx = 0;
-          cur.epos = 0;
-        } else { /* face already oriented, check consistency */
-          if ((next_rev_of_fidx^BMAP_ISSET(face_revo,cur.fidx)) !=
-              BMAP_ISSET(face_revo,next_fidx)) {
-            minfo->orientable = 0;
-          }
-        }
-      } else { /* no more adjacent faces for cur.fidx => walk back */
-        if (!stack_pop(&stack,&cur)) {
-          break; /* stack is empty => we are done */
-        }
-      }
-    } while (1);
+    d->corner[pos[face->f0/d->vpart]++] = 3*fidx;
+    d->corner[pos[face->f1/d->vpart]++] = 3*fidx+1;
+    d->corner[pos[face->f2/d->vpart]++] = 3*fidx+2;
   }
-  free_adj_face_list(aflist,n_faces);
-  free(face_oriented);
-  stack_fini(&stack);
-  return face_revo;
 }
 
-/* Evaluates the topology of the model given by the faces in mfaces, the list
- * of incident faces for each vertex flist and the number of vertices
- * n_vtcs. The result is returned in the following fields of minfo: manifold,
- * closed and n_disjoint_parts. It returns a malloc'ed bitmap array (of length
- * n_vtcs bits) indicating which vertices are manifold. The entries for each
- * vertex in flist are reordered (as explained in get_vertex_topology()), but
- * the contents are the same. */
-static bmap_t * model_topology(int n_vtcs, const face_t *mfaces,
-                               const struct face_list *flist,
-                               struct model_info *minfo)
+/* Fills the face lists of the vertices in ranges start to end-1, from the
+ * corners distributed in each range */
+static void fl_fill_work(void *data, int start, int end, int tid)
 {
-  struct vtx_list *vlist; /* for each vertex, the list of vertices sharing an
-                           * edge with them. */
-  struct stack stack;     /* stack to walk vertex tree */
-  bmap_t *visited_vtcs;   /* array to mark visited vertices */
-  bmap_t *manifold_vtcs;  /* array flagging manifold vertices */
-  int n_visited_vertices; /* number of already visited vertices */
-  int next_vidx;          /* the index of the next vertex to visit */
-  struct topology vtx_top;/* local vertex toppology */
-  struct {
-    int vidx; /* index of entry in vlist */
-    int lpos; /* current position in the list at entry vidx in vlist */
-  } cur;                  /* the indices to the current vertex entry in vlist */
-
-  /* Initialize */
-  minfo->manifold = 1;
-  minfo->closed = 1;
-  minfo->n_disjoint_parts = 0;
-  stack_init(&stack,sizeof(cur));
-  vlist = xa_calloc(n_vtcs,sizeof(*vlist));
-  visited_vtcs = bmap_calloc(n_vtcs);
-  manifold_vtcs = bmap_calloc(n_vtcs);
-  next_vidx = 0; /* keep compiler happy */
-
-  n_visited_vertices = 0;
-  cur.vidx = 0;
-  while (n_visited_vertices < n_vtcs) {
-    /* Find next unvisited vertex (always one). Use fast skip by testing
-     * BMAP_T_BITS entries in the bitmap at once, and then find the individual
-     * entry. */
-    for (cur.vidx &= (~BMAP_T_MASK); cur.vidx<n_vtcs; cur.vidx+=BMAP_T_BITS) {
-      if (visited_vtcs[cur.vidx/BMAP_T_BITS] != ~0U) break;
+  struct fl_build_data *d;
+  struct face_lists *fl;
+  int p,i,v,vmin,vmax,pos,n;
+
+  (void)tid;
+  d = (struct fl_build_data*)data;
+  fl = d->fl;
+  for (p=start; p<end; p++) {
+    vmin = p*d->vpart;
+    vmax = (vmin+d->vpart < fl->n_vtcs) ? vmin+d->vpart : fl->n_vtcs;
+    if (vmin >= vmax) continue;
+    /* count the faces of each vertex and get the start of its list */
+    for (v=vmin; v<vmax; v++) fl->start[v] = 0;
+    for (i=d->part_start[p]; i<d->part_start[p+1]; i++) {
+      fl->start[corner_vtx(d->mfaces,d->corner[i])]++;
     }
-    for (; cur.vidx<n_vtcs; cur.vidx++) {
-      if (!BMAP_ISSET(visited_vtcs,cur.vidx)) break;
+    for (pos=d->part_start[p], v=vmin; v<vmax; v++) {
+      n = fl->start[v];
+      fl->start[v] = pos;
+      pos += n;
     }
-    assert(cur.vidx<n_vtcs);
-    /* mark all the connected vertices as visited and count one part */
-    assert(!BMAP_ISSET(visited_vtcs,cur.vidx));
-    BMAP_SET(visited_vtcs,cur.vidx);
-    n_visited_vertices++;
-    get_vertex_topology(mfaces,cur.vidx,&flist[cur.vidx],
-                        &vtx_top,&vlist[cur.vidx]);
-    minfo->manifold = minfo->manifold && vtx_top.manifold;
-    minfo->closed = minfo->closed && vtx_top.closed;
-    if (vtx_top.manifold) BMAP_SET(manifold_vtcs,cur.vidx);
-    if (vlist[cur.vidx].n_elems != 0) { /* vertex is not alone */
-      minfo->n_disjoint_parts++;
-      cur.lpos = 0;
-      do {
-        for (; cur.lpos < vlist[cur.vidx].n_elems; cur.lpos++) {
-          next_vidx = vlist[cur.vidx].vtcs[cur.lpos];
-          if (!BMAP_ISSET(visited_vtcs,next_vidx)) break;
-        }
-        if (cur.lpos < vlist[cur.vidx].n_elems) {
-          /* found connected and not yet visited vertex => continue from new */
-          assert(!BMAP_ISSET(visited_vtcs,next_vidx));
-          BMAP_SET(visited_vtcs,next_vidx);
-          n_visited_vertices++;
-          get_vertex_topology(mfaces,next_vidx,&flist[next_vidx],
-                              &vtx_top,&vlist[next_vidx]);
-          minfo->manifold = minfo->manifold && vtx_top.manifold;
-          minfo->closed = minfo->closed && vtx_top.closed;
-          if (vtx_top.manifold) BMAP_SET(manifold_vtcs,next_vidx);
-          cur.lpos++;
-          stack_push(&stack,&cur);
-          cur.vidx = next_vidx;
-          cur.lpos = 0;
-        } else {
-          /* no connected and not yet visited vertices => walk back */
-          free(vlist[cur.vidx].vtcs);
-          vlist[cur.vidx].vtcs = NULL;
-          if (!stack_pop(&stack,&cur)) {
-            break; /* stack is empty => we are done */
-          }
-        }
-      } while (1);
+    /* fill the lists, using the start of each as the fill position, and
+     * restore the starts */
+    for (i=d->part_start[p]; i<d->part_start[p+1]; i++) {
+      v = corner_vtx(d->mfaces,d->corner[i]);
+      fl->face[fl->start[v]++] = d->corner[i]/3;
     }
+    for (v=vmax-1; v>vmin; v--) fl->start[v] = fl->start[v-1];
+    fl->start[vmin] = d->part_start[p];
   }
-
-  stack_fini(&stack);
-  free(visited_vtcs);
-  free(vlist);
-  return manifold_vtcs;
 }
 
 /* Prints a list of non-manifold vertices to out. manifold_vtcs flags, for
@@ -954,21 +879,37 @@ static void print_manifold_vertices(struct outbuf *out, const char *name,
  * --------------------------------------------------------------------------*/
 
 /* See model_analysis.h */
-void analyze_model(struct model *m, struct model_info *info, int do_orient,
-                   int verbose, struct outbuf *out, const char *name)
+int analyze_model(struct model *m, struct model_info *info, int do_orient,
+                  int n_threads, int verbose, struct outbuf *out,
+                  const char *name)
 {
-  struct face_list *flist;       /* list of faces incident on each vertex */
+  struct an_data d;              /* the model and analysis state */
   bmap_t *face_revo;             /* flag for each face: if its orientation
                                   * should be reversed. */
   bmap_t *manifold_vtcs;         /* array flagging manifold vertices */
+  int rcode;
 
   /* Initialize */
+  rcode = MESH_NO_MEM;
+  face_revo = NULL;
+  manifold_vtcs = NULL;
   memset(info,0,sizeof(*info));
-  flist = faces_of_vertex(m,&(info->n_degenerate));
+  memset(&d,0,sizeof(d));
+  d.mfaces = m->faces;
+  d.n_vtcs = m->num_vert;
+  d.n_faces = m->num_faces;
+  d.n_threads = (n_threads > 0) ? n_threads : tp_num_cpus();
+  d.flist = faces_of_vertex(m,d.n_threads,&(info->n_degenerate));
+  if (d.flist == NULL) goto end;
+  d.et = build_edge_table(m,d.n_threads);
+  if (d.et == NULL) goto end;
 
   /* Make topology and orientation analysis */
-  manifold_vtcs = model_topology(m->num_vert,m->faces,flist,info);
-  face_revo = model_orientation(m->faces,m->num_faces,flist,manifold_vtcs,info);
+  manifold_vtcs = model_topology(&d,info);
+  if (manifold_vtcs == NULL) goto end;
+  face_revo = model_orientation(&d,info);
+  if (face_revo == NULL) goto end;
+  rcode = 0;
 
   /* Save original oriented state */
   info->orig_oriented = info->oriented;
@@ -984,64 +925,125 @@ void analyze_model(struct model *m, struct model_info *info, int do_orient,
   }
 
   /* Free memory */
+ end:
+  free_edge_table(d.et);
   free(face_revo);
   free(manifold_vtcs);
-  free_face_lists(flist,m->num_vert);
+  free_face_lists(d.flist);
+  return rcode;
 }
 
 /* See model_analysis.h */
-struct face_list *faces_of_vertex(const struct model *m, int *n_degenerate)
+struct face_lists *faces_of_vertex(const struct model *m, int n_threads,
+                                   int *n_degenerate)
 {
-  int j,jmax;           /* indices and loop limits */
-  int v0,v1,v2;         /* current triangle's vertex indices */
-  struct face_list *fl; /* the face list to return */
+  int j,jmax;            /* indices and loop limits */
+  int v0,v1,v2;          /* current triangle's vertex indices */
+  int n_blocks,p,b,pos;
+  int rcode;
+  struct face_lists *fl; /* the face lists to return */
+  struct fl_build_data d;
 
   /* NOTE: we do a two scan allocation, first gather the required sizes and
-   * then allocate storage. It is much faster than a single scan, since the
-   * number of calls to memory allocation routines is greatly reduced. In
-   * addition the obtained memory arrangement is more compact. */
-
-  fl = xa_calloc(m->num_vert,sizeof(*fl));
-  /* First scan: count number of incident faces per vertex */
-  for (*n_degenerate=0, j=0, jmax=m->num_faces; j<jmax; j++) {
-    v0 = m->faces[j].f0;
-    v1 = m->faces[j].f1;
-    v2 = m->faces[j].f2;
-    /* degenerate faces not included */
-    if (v0 == v1 || v0 == v2 || v1 == v2) {
-      (*n_degenerate)++;
-      continue;
+   * then fill the lists, all stored in a single array. It is much faster
+   * than allocating each list, and the memory arrangement is compact. */
+
+  if (n_threads <= 0) n_threads = tp_num_cpus();
+  fl = malloc(sizeof(*fl));
+  if (fl == NULL) return NULL;
+  fl->n_vtcs = m->num_vert;
+  fl->face = NULL;
+  fl->start = calloc(m->num_vert+1,sizeof(*(fl->start)));
+  if (fl->start == NULL) goto no_mem;
+  if (n_threads == 1 || m->num_faces < 2*AN_MIN_BLOCK) {
+    /* First scan: count number of incident faces per vertex */
+    for (*n_degenerate=0, j=0, jmax=m->num_faces; j<jmax; j++) {
+      v0 = m->faces[j].f0;
+      v1 = m->faces[j].f1;
+      v2 = m->faces[j].f2;
+      /* degenerate faces not included */
+      if (v0 == v1 || v0 == v2 || v1 == v2) {
+        (*n_degenerate)++;
+        continue;
+      }
+      fl->start[v0+1]++;
+      fl->start[v1+1]++;
+      fl->start[v2+1]++;
     }
-    fl[v0].n_faces++;
-    fl[v1].n_faces++;
-    fl[v2].n_faces++;
+    for (j=0, jmax=m->num_vert; j<jmax; j++) fl->start[j+1] += fl->start[j];
+    fl->face = malloc(sizeof(*(fl->face))*(fl->start[m->num_vert]+1));
+    if (fl->face == NULL) goto no_mem;
+    /* Second scan: fill list of incident faces, using the start of each
+     * list as the fill position, and then restore the starts */
+    for (j=0, jmax=m->num_faces; j<jmax; j++) {
+      v0 = m->faces[j].f0;
+      v1 = m->faces[j].f1;
+      v2 = m->faces[j].f2;
+      /* degenerate faces not included */
+      if (v0 == v1 || v0 == v2 || v1 == v2) continue;
+      fl->face[fl->start[v0]++] = j;
+      fl->face[fl->start[v1]++] = j;
+      fl->face[fl->start[v2]++] = j;
+    }
+    for (j=m->num_vert; j>0; j--) fl->start[j] = fl->start[j-1];
+    fl->start[0] = 0;
+    return fl;
   }
-  /* Allocate storage for each vertex */
-  for (j=0, jmax=m->num_vert; j<jmax; j++) {
-    fl[j].face = xa_malloc(fl[j].n_faces*sizeof(*(fl->face)));
-    fl[j].n_faces = 0;
+
+  /* Parallel build: distribute the face corners in vertex ranges, then fill
+   * the lists of each range */
+  rcode = MESH_NO_MEM;
+  memset(&d,0,sizeof(d));
+  d.mfaces = m->faces;
+  d.fl = fl;
+  d.fblock = an_block_size(m->num_faces,n_threads);
+  n_blocks = (m->num_faces+d.fblock-1)/d.fblock;
+  d.n_parts = 4*n_threads;
+  d.vpart = (m->num_vert+d.n_parts-1)/d.n_parts;
+  d.blk_pos = calloc(n_blocks*d.n_parts,sizeof(*(d.blk_pos)));
+  d.part_start = malloc(sizeof(*(d.part_start))*(d.n_parts+1));
+  d.n_degenerate = calloc(n_blocks,sizeof(*(d.n_degenerate)));
+  if (d.blk_pos == NULL || d.part_start == NULL || d.n_degenerate == NULL) {
+    goto end;
   }
-  /* Second scan: fill list of incident faces */
-  for (j=0, jmax=m->num_faces; j<jmax; j++) {
-    v0 = m->faces[j].f0;
-    v1 = m->faces[j].f1;
-    v2 = m->faces[j].f2;
-    /* degenerate faces not included */
-    if (v0 == v1 || v0 == v2 || v1 == v2) continue;
-    fl[v0].face[fl[v0].n_faces++] = j;
-    fl[v1].face[fl[v1].n_faces++] = j;
-    fl[v2].face[fl[v2].n_faces++] = j;
+  tp_par_for(n_threads,m->num_faces,d.fblock,fl_count_work,&d);
+  for (*n_degenerate=0, b=0; b<n_blocks; b++) {
+    *n_degenerate += d.n_degenerate[b];
   }
-  return fl;
+  for (pos=0, p=0; p<d.n_parts; p++) {
+    d.part_start[p] = pos;
+    for (b=0; b<n_blocks; b++) {
+      j = d.blk_pos[b*d.n_parts+p];
+      d.blk_pos[b*d.n_parts+p] = pos;
+      pos += j;
+    }
+  }
+  d.part_start[d.n_parts] = pos;
+  d.corner = malloc(sizeof(*(d.corner))*(pos+1));
+  fl->face = malloc(sizeof(*(fl->face))*(pos+1));
+  if (d.corner == NULL || fl->face == NULL) goto end;
+  tp_par_for(n_threads,m->num_faces,d.fblock,fl_scatter_work,&d);
+  tp_par_for(n_threads,d.n_parts,1,fl_fill_work,&d);
+  fl->start[m->num_vert] = pos;
+  rcode = 0;
+
+ end:
+  free(d.blk_pos);
+  free(d.part_start);
+  free(d.corner);
+  free(d.n_degenerate);
+  if (rcode == 0) return fl;
+
+ no_mem:
+  free_face_lists(fl);
+  return NULL;
 }
 
 /* See model_analysis.h */
-void free_face_lists(struct face_list *fl, int n)
+void free_face_lists(struct face_lists *fl)
 {
-  int i;
   if (fl == NULL) return;
-  for (i=0; i<n; i++) {
-    free(fl[i].face);
-  }
+  free(fl->face);
+  free(fl->start);
   free(fl);
 }
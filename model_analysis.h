@@ -74,10 +74,14 @@ BEGIN_DECL
  *                       Exported data types                                 *
  * --------------------------------------------------------------------------*/
 
-/* A list of model faces */
-struct face_list {
-  int *face;   /* Array of indices of the faces in the list */
-  int n_faces; /* Number of faces in the array */
+/* The lists of faces incident on each vertex of a model, stored one after
+ * the other in a single array. The faces of vertex v are face[start[v]] to
+ * face[start[v+1]-1], in increasing order. */
+struct face_lists {
+  int *face;   /* Array of indices of the faces of all the lists */
+  int *start;  /* Start of the list of each vertex in face, plus the end of
+                * the last list (n_vtcs+1 entries) */
+  int n_vtcs;  /* Number of vertices (i.e. lists) */
 };
 
 /* Model analysis information */
@@ -106,19 +110,25 @@ struct model_info {
  * are ignored in the analysis. If do_orient is non-zero and the model is
  * orientable, the model m will be modified so as to be oriented. If the model
  * is not orientable, the model will be oriented as much as possible if
- * do_orient is 2 or more. If verbose is non-zero any problems with the model
- * are reported to out, preceded by the model name name. */
-void analyze_model(struct model *m, struct model_info *info, int do_orient,
-                   int verbose, struct outbuf *out, const char *name);
-
-/* Returns an array of length m->num_vert with the list of faces incident on
- * each vertex. The number of degenerate faces is returned in
- * *n_degenerate. Degenerate faces are ignored (i.e. not included as incident
- * on any vertex). */
-struct face_list *faces_of_vertex(const struct model *m, int *n_degenerate);
-
-/* Frees the storage for the array of face lists fl, of length n */
-void free_face_lists(struct face_list *fl, int n);
+ * do_orient is 2 or more. The analysis uses n_threads threads (if zero or
+ * negative, as many as processors). If verbose is non-zero any problems with
+ * the model are reported to out, preceded by the model name name. Zero is
+ * returned on success, and MESH_NO_MEM if out of memory, in which case m is
+ * not modified and *info is not valid. */
+int analyze_model(struct model *m, struct model_info *info, int do_orient,
+                  int n_threads, int verbose, struct outbuf *out,
+                  const char *name);
+
+/* Returns the lists of faces incident on each vertex of m, built with
+ * n_threads threads (if zero or negative, as many as processors). The
+ * number of degenerate faces is returned in *n_degenerate. Degenerate faces
+ * are ignored (i.e. not included as incident on any vertex). NULL is
+ * returned if out of memory. */
+struct face_lists *faces_of_vertex(const struct model *m, int n_threads,
+                                   int *n_degenerate);
+
+/* Frees the face lists fl and their storage */
+void free_face_lists(struct face_lists *fl);
 
 END_DECL
 #undef END_DECL
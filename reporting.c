@@ -133,9 +133,41 @@ void outbuf_printf(struct outbuf *ob, const char *format, ...)
 }
 
 /* see reporting.h */
-void prog_report(struct prog_reporter *pr, int p)
+int prog_report(struct prog_reporter *pr, int p)
 {
-  pr->prog(pr->cb_out,p);
+  if (pr->prog(pr->cb_out,p)) pr->cancel = 1;
+  return pr->cancel;
+}
+
+/* see reporting.h */
+int prog_cancelled(const struct prog_reporter *pr)
+{
+  return pr != NULL && pr->cancel;
+}
+
+/* Reports the progress of a loop of prog_par_for() to the progress reporter
+ * data, with done of the n indices processed. Returns non-zero to stop the
+ * loop if the cancellation has been requested. */
+static int prog_poll(void *data, int done, int n)
+{
+  return prog_report((struct prog_reporter*)data,
+                     (n > 0) ? (int)(100.0*done/n) : 100);
+}
+
+/* see reporting.h */
+int prog_par_for(struct prog_reporter *pr, int n_threads, int n, int chunk,
+                 tp_work_func_t *work, void *data)
+{
+  if (pr == NULL) {
+    tp_par_for(n_threads,n,chunk,work,data);
+    return 0;
+  }
+  if (!prog_report(pr,0)) {
+    tp_par_for_poll(n_threads,n,chunk,work,data,prog_poll,pr,
+                    PROG_REPORT_INTERVAL);
+  }
+  prog_report(pr,-1);
+  return pr->cancel;
 }
 
 /* see reporting.h */
@@ -146,7 +178,7 @@ void stdio_puts(void *out, const char *str)
 }
 
 /* see reporting.h */
-void stdio_prog(void *out, int p)
+int stdio_prog(void *out, int p)
 {
   FILE *fout;
   fout = (FILE*)out;
@@ -156,4 +188,5 @@ void stdio_prog(void *out, int p)
     fprintf(fout,"\rProgress %3d %%",p);
   }
   fflush(fout);
+  return 0;
 }
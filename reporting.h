@@ -55,6 +55,7 @@
  * --------------------------------------------------------------------------*
  */
 
+#include <thread_pool.h>
 
 #ifdef __cplusplus
 #define BEGIN_DECL extern "C" {
@@ -99,15 +100,26 @@ struct outbuf {
  * to callback private data, while p is the current progress as a percentage
  * value. If p is negative the progress indicator should be removed (if
  * applicable). The progress must start with a call with p as zero, and end
- * with a call with p as negative (after calls with values 0..100). */
-typedef void prog_func_cb_t(void *out, int p);
-
-/* The progress reporter */
+ * with a call with p as negative (after calls with values 0..100). It
+ * returns non-zero if the user asked to cancel the computation. */
+typedef int prog_func_cb_t(void *out, int p);
+
+/* The progress reporter. It should be initialized to all zero before
+ * setting the callback. It is only used by the thread running the
+ * computation (the one that calls the callback), the worker threads never
+ * access it, so it needs no locking. */
 struct prog_reporter {
   prog_func_cb_t *prog; /* The function used to report the progress */
   void *cb_out;         /* Data private to the callback function */
+  int cancel;           /* Non-zero once the callback has requested the
+                         * cancellation of the computation. It is never
+                         * reset. */
 };
 
+/* The interval between two progress reports of prog_par_for(), in
+ * seconds */
+#define PROG_REPORT_INTERVAL 0.1
+
 /* --------------------------------------------------------------------------*
  *                       Exported functions                                  *
  * --------------------------------------------------------------------------*/
@@ -129,16 +141,31 @@ void outbuf_flush(struct outbuf *ob);
 void outbuf_printf(struct outbuf *ob, const char *format, ...)
   REPORTING_PRINTF_ATTR(2,3); /* allow GCC to check format string */
 
-/* Reports the progress p to pr. */
-void prog_report(struct prog_reporter *pr, int p);
+/* Reports the progress p to pr. Returns non-zero if the cancellation has
+ * been requested (see struct prog_reporter). */
+int prog_report(struct prog_reporter *pr, int p);
+
+/* Returns non-zero if pr is not NULL and the cancellation of the
+ * computation reporting to it has been requested. */
+int prog_cancelled(const struct prog_reporter *pr);
+
+/* Runs the parallel loop tp_par_for(n_threads,n,chunk,work,data),
+ * reporting its progress to pr (which can be NULL) every
+ * PROG_REPORT_INTERVAL seconds from the calling thread, while the worker
+ * threads process the chunks (see tp_par_for_poll()). The zero progress is
+ * reported first and the progress indicator is removed at the end. Once
+ * the cancellation is requested the chunks not yet started are skipped.
+ * Returns non-zero if the computation has been cancelled. */
+int prog_par_for(struct prog_reporter *pr, int n_threads, int n, int chunk,
+                 tp_work_func_t *work, void *data);
 
 /* Writes the string to stdio stream out (really a FILE *). To use with
  * outbuf. */
 void stdio_puts(void *out, const char *str);
 
 /* Prints progress percentage to stdout. If negative it erases a previous
- * progress message. */
-void stdio_prog(void *out, int p);
+ * progress message. Never requests cancellation. */
+int stdio_prog(void *out, int p);
 
 END_DECL
 #undef END_DECL
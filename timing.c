@@ -0,0 +1,144 @@
+/* $Id$ */
+
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+
+
+
+
+
+#include <timing.h>
+#include <thread_pool.h>
+
+#include <time.h>
+#if defined(_WIN32)
+# include <windows.h>
+# include <psapi.h>
+# ifdef _MSC_VER
+#  pragma comment(lib,"psapi.lib")
+# endif
+#else
+# include <sys/time.h>
+# include <sys/resource.h>
+#endif
+
+/* --------------------------------------------------------------------------*
+ *                          External functions                               *
+ * --------------------------------------------------------------------------*/
+
+/* see timing.h */
+double wall_time(void)
+{
+#if defined(_WIN32)
+  LARGE_INTEGER cnt,freq;
+  if (QueryPerformanceFrequency(&freq) && QueryPerformanceCounter(&cnt)) {
+    return (double)cnt.QuadPart/(double)freq.QuadPart;
+  }
+  return GetTickCount()*1e-3;
+#else
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec+tv.tv_usec*1e-6;
+#endif
+}
+
+/* see timing.h */
+double cpu_time(void)
+{
+  double t;
+#if defined(_WIN32)
+  FILETIME t_creat,t_exit,t_kern,t_user;
+#else
+  struct rusage ru;
+#endif
+
+  t = tp_cpu_time();
+  if (t >= 0.0) return t;
+#if defined(_WIN32)
+  if (GetProcessTimes(GetCurrentProcess(),&t_creat,&t_exit,&t_kern,&t_user)) {
+    /* FILETIME is in units of 100 ns */
+    return ((t_kern.dwHighDateTime+(double)t_user.dwHighDateTime)*
+            4294967296.0+t_kern.dwLowDateTime+
+            (double)t_user.dwLowDateTime)*1e-7;
+  }
+#else
+  if (getrusage(RUSAGE_SELF,&ru) == 0) {
+    return ru.ru_utime.tv_sec+ru.ru_stime.tv_sec+
+      (ru.ru_utime.tv_usec+ru.ru_stime.tv_usec)*1e-6;
+  }
+#endif
+  return (double)clock()/CLOCKS_PER_SEC;
+}
+
+/* see timing.h */
+void stage_begin(struct stage_time *t)
+{
+  t->wall -= wall_time();
+  t->cpu -= cpu_time();
+}
+
+/* see timing.h */
+void stage_end(struct stage_time *t)
+{
+  t->cpu += cpu_time();
+  t->wall += wall_time();
+}
+
+/* see timing.h */
+long peak_rss_kb(void)
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (GetProcessMemoryInfo(GetCurrentProcess(),&pmc,sizeof(pmc))) {
+    return (long)(pmc.PeakWorkingSetSize/1024);
+  }
+  return -1;
+#else
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF,&ru) != 0) return -1;
+# if defined(__APPLE__)
+  return (long)(ru.ru_maxrss/1024); /* in bytes on Mac OS X */
+# else
+  return (long)ru.ru_maxrss; /* in kilobytes on Linux and BSD */
+# endif
+#endif
+}
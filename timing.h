@@ -0,0 +1,107 @@
+/* $Id$ */
+
+
+/*
+ *
+ *  Copyright (C) 2001-2004 EPFL (Swiss Federal Institute of Technology,
+ *  Lausanne) This program is free software; you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ *  USA.
+ *
+ *  In addition, as a special exception, EPFL gives permission to link
+ *  the code of this program with the Qt non-commercial edition library
+ *  (or with modified versions of Qt non-commercial edition that use the
+ *  same license as Qt non-commercial edition), and distribute linked
+ *  combinations including the two.  You must obey the GNU General
+ *  Public License in all respects for all of the code used other than
+ *  Qt non-commercial edition.  If you modify this file, you may extend
+ *  this exception to your version of the file, but you are not
+ *  obligated to do so.  If you do not wish to do so, delete this
+ *  exception statement from your version.
+ *
+ *  Authors : Nicolas Aspert, Diego Santa-Cruz and Davy Jacquet
+ *
+ *  Web site : http://mesh.epfl.ch
+ *
+ *  Reference :
+ *   "MESH : Measuring Errors between Surfaces using the Hausdorff distance"
+ *   in Proceedings of IEEE Intl. Conf. on Multimedia and Expo (ICME) 2002, 
+ *   vol. I, pp. 705-708, available on http://mesh.epfl.ch
+ *
+ */
+
+
+
+
+
+
+
+#ifndef _TIMING_PROTO
+#define _TIMING_PROTO
+
+#ifdef __cplusplus
+#define BEGIN_DECL extern "C" {
+#define END_DECL }
+#else
+#define BEGIN_DECL
+#define END_DECL
+#endif
+
+BEGIN_DECL
+#undef BEGIN_DECL
+
+/* --------------------------------------------------------------------------*
+ *                       Exported data types                                 *
+ * --------------------------------------------------------------------------*/
+
+/* Time spent in a processing stage. It is accumulated by pairs of calls to
+ * stage_begin() and stage_end(), starting from all zero, made by the
+ * thread running the stage. */
+struct stage_time {
+  double wall; /* Elapsed wall clock time, in seconds */
+  double cpu;  /* CPU time (user and system) used by the thread running the
+                * stage and by the worker threads it started, in seconds.
+                * With several workers it can be larger than wall. If the
+                * CPU time of the threads is not available it is the one of
+                * the whole process. */
+};
+
+/* --------------------------------------------------------------------------*
+ *                       Exported functions                                  *
+ * --------------------------------------------------------------------------*/
+
+/* Returns the wall clock time, in seconds, from an arbitrary origin */
+double wall_time(void);
+
+/* Returns the CPU time used so far by the calling thread and the worker
+ * threads it started (see tp_cpu_time()), in seconds. If not available it
+ * is the CPU time used by the process. */
+double cpu_time(void);
+
+/* Marks the beginning of an interval to be accumulated in *t */
+void stage_begin(struct stage_time *t);
+
+/* Marks the end of an interval started with stage_begin() on t, adding its
+ * duration to *t. */
+void stage_end(struct stage_time *t);
+
+/* Returns the peak resident set size (i.e. maximum physical memory used) of
+ * the process so far, in kilobytes. Returns -1 if not available on this
+ * platform. */
+long peak_rss_kb(void);
+
+END_DECL
+#undef END_DECL
+
+#endif /* _TIMING_PROTO */